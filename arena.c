@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "retvals.h"
+#include "arena.h"
+
+#define ALIGN_UP(x)                    (((x) + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define BLOCK_HEADER_SIZE              ALIGN_UP(sizeof(ARENA_BLOCK))
+
+static uint8_t* get_block_data(ARENA_BLOCK *block) {
+	return (uint8_t*)block + BLOCK_HEADER_SIZE;
+}
+
+static ARENA_BLOCK* add_block(ARENA *arena, size_t min_size) {
+	size_t size = (min_size > arena->block_size) ? min_size : arena->block_size;
+	ARENA_BLOCK *block = malloc(BLOCK_HEADER_SIZE + size);
+	if (!block)
+		return NULL;
+
+	block->size = size;
+	block->used = 0;
+	block->next = arena->blocks;
+	arena->blocks = block;
+	return block;
+}
+
+int arena_init(ARENA *arena, size_t block_size) {
+	if (!arena)
+		return ERROR_INVALID_PARAMS;
+
+	memset(arena, 0, sizeof(ARENA));
+	arena->block_size = block_size ? ALIGN_UP(block_size) : ARENA_DEFAULT_BLOCK_SIZE;
+	return SUCCESS;
+}
+
+void arena_destroy(ARENA *arena) {
+	if (!arena)
+		return;
+
+	ARENA_BLOCK *block = arena->blocks;
+	while (block) {
+		ARENA_BLOCK *next = block->next;
+		free(block);
+		block = next;
+	}
+	memset(arena, 0, sizeof(ARENA));
+}
+
+void arena_reset(ARENA *arena) {
+	if (!arena)
+		return;
+
+	if (arena->total_allocated > arena->peak_allocated)
+		arena->peak_allocated = arena->total_allocated;
+
+	// if the last round of allocations needed more than one block, replace them all with a single block big enough
+	// for everything, so the next round (probably a similar sized quest) fits without any more calls to malloc()
+	if (arena->blocks && arena->blocks->next) {
+		size_t needed = 0;
+		for (ARENA_BLOCK *block = arena->blocks; block; block = block->next)
+			needed += block->used;
+
+		ARENA_BLOCK *block = arena->blocks;
+		while (block) {
+			ARENA_BLOCK *next = block->next;
+			free(block);
+			block = next;
+		}
+		arena->blocks = NULL;
+		add_block(arena, needed);
+	} else if (arena->blocks) {
+		arena->blocks->used = 0;
+	}
+
+	arena->last_alloc = NULL;
+	arena->total_allocated = 0;
+}
+
+void* arena_alloc(ARENA *arena, size_t size) {
+	if (!arena)
+		return malloc(size);
+
+	size = ALIGN_UP(size ? size : 1);
+	ARENA_BLOCK *block = arena->blocks;
+	if (!block || (block->size - block->used) < size) {
+		block = add_block(arena, size);
+		if (!block)
+			return NULL;
+	}
+
+	uint8_t *ptr = get_block_data(block) + block->used;
+	block->used += size;
+	arena->last_alloc = ptr;
+	arena->total_allocated += size;
+	return ptr;
+}
+
+/*
+ * Unlike realloc(), the old size must be given. If ptr was the most recent allocation it is grown or shrunk in place
+ * when possible (which is the common case, e.g. shrinking a worst-case sized compression output buffer), otherwise a
+ * new allocation is made and the data copied over.
+ */
+void* arena_realloc(ARENA *arena, void *ptr, size_t old_size, size_t new_size) {
+	if (!arena)
+		return realloc(ptr, new_size);
+
+	if (!ptr)
+		return arena_alloc(arena, new_size);
+
+	ARENA_BLOCK *block = arena->blocks;
+	if ((uint8_t*)ptr == arena->last_alloc && block) {
+		size_t offset = (uint8_t*)ptr - get_block_data(block);
+		size_t old_aligned = block->used - offset;
+		size_t new_aligned = ALIGN_UP(new_size ? new_size : 1);
+		if ((offset + new_aligned) <= block->size) {
+			block->used = offset + new_aligned;
+			arena->total_allocated = arena->total_allocated - old_aligned + new_aligned;
+			return ptr;
+		}
+	}
+
+	void *new_ptr = arena_alloc(arena, new_size);
+	if (new_ptr)
+		memcpy(new_ptr, ptr, (old_size < new_size) ? old_size : new_size);
+	return new_ptr;
+}
+
+void arena_free(ARENA *arena, void *ptr) {
+	// arena allocations are only ever released all at once by arena_reset()
+	if (!arena)
+		free(ptr);
+}
@@ -0,0 +1,44 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A simple bump allocator for short-lived, per-quest allocations. Memory is handed out from large blocks, individual
+ * allocations are never freed, and everything is released at once with arena_reset(). The memory is kept around
+ * after a reset, so a worker thread that reuses the same arena for every quest will stop calling malloc() entirely
+ * once the arena has grown large enough for the biggest quest it has seen.
+ *
+ * Every function that takes an ARENA also accepts NULL, in which case plain malloc() / realloc() / free() are used
+ * instead. This lets the "_ex" versions of functions (e.g. fuzziqer_prs_compress_ex) be used either way.
+ *
+ * An arena must only be used by one thread at a time.
+ */
+
+#define ARENA_DEFAULT_BLOCK_SIZE       (1024 * 1024)
+#define ARENA_ALIGNMENT                16
+
+typedef struct ARENA_BLOCK {
+	struct ARENA_BLOCK *next;
+	size_t size;
+	size_t used;
+} ARENA_BLOCK;
+
+typedef struct {
+	ARENA_BLOCK *blocks;           // the block currently being allocated from is first
+	size_t block_size;
+	uint8_t *last_alloc;           // most recent allocation, which can still be grown / shrunk in place
+	size_t total_allocated;        // bytes handed out since the last reset
+	size_t peak_allocated;
+} ARENA;
+
+int arena_init(ARENA *arena, size_t block_size);
+void arena_destroy(ARENA *arena);
+void arena_reset(ARENA *arena);
+
+void* arena_alloc(ARENA *arena, size_t size);
+void* arena_realloc(ARENA *arena, void *ptr, size_t old_size, size_t new_size);
+void arena_free(ARENA *arena, void *ptr);
+
+#endif
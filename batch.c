@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "retvals.h"
+#include "trace.h"
+#include "batch.h"
+
+typedef struct {
+	int num_jobs;
+	int next_job;
+	BATCH_JOB_FUNC job_func;
+	void *context;
+} BATCH;
+
+typedef struct {
+	BATCH *batch;
+	int worker_index;
+	pthread_t thread;
+} BATCH_WORKER;
+
+static void* worker_thread(void *arg) {
+	BATCH_WORKER *worker = (BATCH_WORKER*)arg;
+	BATCH *batch = worker->batch;
+	char name[TRACE_THREAD_NAME_LENGTH];
+
+	snprintf(name, sizeof(name), "worker %d", worker->worker_index);
+	trace_set_thread_name(name);
+
+	for (;;) {
+		int job_index = __atomic_fetch_add(&batch->next_job, 1, __ATOMIC_RELAXED);
+		if (job_index >= batch->num_jobs)
+			break;
+
+		batch->job_func(job_index, worker->worker_index, batch->context);
+	}
+
+	return NULL;
+}
+
+int batch_get_default_num_workers(void) {
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return (num_cpus > 0) ? (int)num_cpus : 1;
+}
+
+/*
+ * Runs job_func for every job index from 0 to num_jobs-1 using num_workers threads, returning once all jobs are done.
+ */
+int batch_run(int num_workers, int num_jobs, BATCH_JOB_FUNC job_func, void *context) {
+	if (num_workers < 1 || num_jobs < 0 || !job_func)
+		return ERROR_INVALID_PARAMS;
+
+	if (num_workers > num_jobs)
+		num_workers = num_jobs;
+	if (num_workers == 0)
+		return SUCCESS;
+
+	BATCH batch;
+	batch.num_jobs = num_jobs;
+	batch.next_job = 0;
+	batch.job_func = job_func;
+	batch.context = context;
+
+	BATCH_WORKER *workers = calloc(num_workers, sizeof(BATCH_WORKER));
+	if (!workers)
+		return ERROR_IO;
+
+	int num_started = 0;
+	for (int i = 0; i < num_workers; ++i) {
+		workers[i].batch = &batch;
+		workers[i].worker_index = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]))
+			break;
+		++num_started;
+	}
+
+	// if no threads could be started at all, just run everything on this thread instead
+	if (!num_started)
+		worker_thread(&workers[0]);
+
+	for (int i = 0; i < num_started; ++i)
+		pthread_join(workers[i].thread, NULL);
+
+	free(workers);
+	return SUCCESS;
+}
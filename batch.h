@@ -0,0 +1,14 @@
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+/*
+ * A simple worker pool for running a batch of independent jobs across multiple threads. Jobs are handed out to the
+ * worker threads one at a time, in order, as each worker becomes free.
+ */
+
+typedef void (*BATCH_JOB_FUNC)(int job_index, int worker_index, void *context);
+
+int batch_get_default_num_workers(void);
+int batch_run(int num_workers, int num_jobs, BATCH_JOB_FUNC job_func, void *context);
+
+#endif
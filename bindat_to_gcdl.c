@@ -16,16 +16,43 @@
 #include <time.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdbool.h>
 #include <malloc.h>
 
-#include <sylverant/encryption.h>
-#include <sylverant/prs.h>
-#include "fuzziqer_prs.h"
-
 #include "defs.h"
 
+#include "retvals.h"
 #include "quests.h"
+#include "gcdl.h"
+#include "decode_cache.h"
 #include "utils.h"
+#include "stats.h"
+#include "fuzziqer_prs.h"
+
+/*
+ * Loads the .bin data out of a download .qst file written out before, both as it is in the file (PRS-compressed) and
+ * decompressed, for re-using with prepare_download_quest_bin_incremental.
+ */
+static int load_previous_download_bin(const char *filename, uint8_t **out_compressed_bin, size_t *out_compressed_bin_size, uint8_t **out_bin, size_t *out_bin_size) {
+	int returncode, qst_type;
+	uint8_t *dat = NULL;
+	size_t dat_size;
+
+	returncode = decode_cache_load_quest_from_qst_ex(filename, out_bin, out_bin_size, &dat, &dat_size, &qst_type, NULL, NULL, out_compressed_bin, out_compressed_bin_size);
+	if (returncode)
+		return returncode;
+	free(dat);
+
+	if (qst_type != QST_TYPE_DOWNLOAD) {
+		free(*out_bin);
+		free(*out_compressed_bin);
+		*out_bin = NULL;
+		*out_compressed_bin = NULL;
+		return ERROR_BAD_DATA;
+	}
+
+	return SUCCESS;
+}
 
 int main(int argc, char *argv[]) {
 	int returncode, validation_result;
@@ -35,16 +62,27 @@ int main(int argc, char *argv[]) {
 	uint8_t *decompressed_dat = NULL;
 	uint8_t *final_bin = NULL;
 	uint8_t *final_dat = NULL;
+	uint8_t *previous_compressed_bin = NULL;
+	uint8_t *previous_bin = NULL;
+	bool incremental = false;
+
+	stats_parse_args(&argc, argv);
 
-	if (argc != 4) {
-		printf("Usage: bindat_to_gcdl quest.bin quest.dat output.qst\n");
+	int argi = 1;
+	if (argi < argc && !strcmp(argv[argi], "--incremental")) {
+		incremental = true;
+		argi += 1;
+	}
+
+	if ((argc - argi) != 3) {
+		printf("Usage: bindat_to_gcdl [--stats] [--incremental] quest.bin quest.dat output.qst\n");
 		return 1;
 	}
 
 	int result;
-	const char *bin_filename = argv[1];
-	const char *dat_filename = argv[2];
-	const char *output_qst_filename = argv[3];
+	const char *bin_filename = argv[argi];
+	const char *dat_filename = argv[argi + 1];
+	const char *output_qst_filename = argv[argi + 2];
 
 
 	/** validate lengths of the given quest .bin and .dat files, to make sure they fit into the packet structs **/
@@ -85,7 +123,7 @@ int main(int argc, char *argv[]) {
 	printf("Decompressing and validating .bin file ...\n");
 
 	size_t decompressed_bin_size;
-	result = fuzziqer_prs_decompress_buf(compressed_bin, &decompressed_bin, compressed_bin_size);
+	result = decode_cache_decompress_buf(compressed_bin, &decompressed_bin, compressed_bin_size);
 	if (result < 0) {
 		printf("Error code %d decompressing .dat data.\n", result);
 		goto error;
@@ -93,8 +131,13 @@ int main(int argc, char *argv[]) {
 	decompressed_bin_size = result;
 
 	QUEST_BIN_HEADER *bin_header = (QUEST_BIN_HEADER*)decompressed_bin;
-	validation_result = validate_quest_bin(bin_header, decompressed_bin_size, true);
+	// a previously cached failed validation is re-run anyway, so the same issues will still be displayed
+	if (!decode_cache_get_validation(compressed_bin, compressed_bin_size, &validation_result) || validation_result) {
+		validation_result = validate_quest_bin(bin_header, decompressed_bin_size, true);
+		decode_cache_set_validation(compressed_bin, compressed_bin_size, validation_result);
+	}
 	validation_result = handle_quest_bin_validation_issues(validation_result, bin_header, &decompressed_bin, &decompressed_bin_size);
+	bin_header = (QUEST_BIN_HEADER*)decompressed_bin;  // the data may have been moved by the above
 	if (validation_result) {
 		printf("Aborting due to invalid quest .bin data.\n");
 		goto error;
@@ -105,14 +148,17 @@ int main(int argc, char *argv[]) {
 	printf("Decompressing and validating .dat file ...\n");
 
 	size_t decompressed_dat_size;
-	result = fuzziqer_prs_decompress_buf(compressed_dat, &decompressed_dat, compressed_dat_size);
+	result = decode_cache_decompress_buf(compressed_dat, &decompressed_dat, compressed_dat_size);
 	if (result < 0) {
 		printf("Error code %d decompressing .dat data.\n", result);
 		goto error;
 	}
 	decompressed_dat_size = result;
 
-	validation_result = validate_quest_dat(decompressed_dat, decompressed_dat_size, true);
+	if (!decode_cache_get_validation(compressed_dat, compressed_dat_size, &validation_result) || validation_result) {
+		validation_result = validate_quest_dat(decompressed_dat, decompressed_dat_size, true);
+		decode_cache_set_validation(compressed_dat, compressed_dat_size, validation_result);
+	}
 	validation_result = handle_quest_dat_validation_issues(validation_result, &decompressed_dat, &decompressed_dat_size);
 	if (validation_result) {
 		printf("Aborting due to invalid quest .dat data.\n");
@@ -123,123 +169,104 @@ int main(int argc, char *argv[]) {
 	print_quick_quest_info(bin_header, compressed_bin_size, compressed_dat_size);
 
 
+	/** with --incremental, the .bin data in the existing output .qst file (if any) is re-used as much as possible **/
+
+	size_t previous_compressed_bin_size, previous_bin_size;
+	if (incremental) {
+		printf("Reading previous .bin file data from %s ...\n", output_qst_filename);
+		returncode = load_previous_download_bin(output_qst_filename,
+		                                        &previous_compressed_bin,
+		                                        &previous_compressed_bin_size,
+		                                        &previous_bin,
+		                                        &previous_bin_size);
+		if (returncode == ERROR_FILE_NOT_FOUND) {
+			printf("No previous .qst file, so the .bin file data will all be compressed.\n");
+			incremental = false;
+		} else if (returncode) {
+			printf("Error code %d (%s) reading previous .bin file data, it will all be compressed again.\n", returncode, get_error_message(returncode));
+			incremental = false;
+		}
+	}
+
+
 	/** set the "download" flag in the .bin header and then re-compress the .bin data **/
 	printf("Setting .bin header 'download' flag and re-compressing .bin file data ...\n");
 
-	bin_header->download = 1;  // gamecube pso client will not find quests on a memory card if this is not set!
-
 	uint8_t *recompressed_bin;
-	result = fuzziqer_prs_compress(decompressed_bin, &recompressed_bin, decompressed_bin_size);
-	if (result < 0) {
-		printf("Error code %d re-compressing .bin file data.\n", result);
+	size_t recompressed_bin_size;
+	if (incremental) {
+		size_t reused_size;
+		returncode = prepare_download_quest_bin_incremental(bin_header,
+		                                                    decompressed_bin_size,
+		                                                    previous_bin,
+		                                                    previous_bin_size,
+		                                                    previous_compressed_bin,
+		                                                    previous_compressed_bin_size,
+		                                                    &recompressed_bin,
+		                                                    &recompressed_bin_size,
+		                                                    &reused_size,
+		                                                    NULL);
+		if (!returncode)
+			printf("Re-used previous compressed data for %zu of %zu bytes.\n", reused_size, decompressed_bin_size);
+	} else {
+		returncode = prepare_download_quest_bin(bin_header, decompressed_bin_size, &recompressed_bin, &recompressed_bin_size, NULL);
+	}
+	if (returncode) {
+		printf("Error code %d (%s) re-compressing .bin file data.\n", returncode, get_error_message(returncode));
 		goto error;
 	}
 
 	// overwrite old compressed bin data, since we don't need it anymore
 	free(compressed_bin);
 	compressed_bin = recompressed_bin;
-	compressed_bin_size = (uint32_t)result;
+	compressed_bin_size = (uint32_t)recompressed_bin_size;
 
 
 	/** encrypt compressed .bin and .dat file data, using PC crypt method with randomly generated crypt key.
 	    prefix unencrypted download quest chunks header to prs compressed + encrypted .bin and .dat file data. **/
 	printf("Preparing final .qst file data ... \n");
 
-	srand(time(NULL));
-
-	uint32_t final_bin_size = compressed_bin_size + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	final_bin = malloc(final_bin_size);
-	memset(final_bin, 0, final_bin_size);
-	uint8_t *crypt_compressed_bin = final_bin + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	DOWNLOAD_QUEST_CHUNKS_HEADER *bin_dlchunks_header = (DOWNLOAD_QUEST_CHUNKS_HEADER*)final_bin;
-	bin_dlchunks_header->decompressed_size = decompressed_bin_size + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	bin_dlchunks_header->crypt_key = rand();
-	memcpy(crypt_compressed_bin, compressed_bin, compressed_bin_size);
-
-	uint32_t final_dat_size = compressed_dat_size + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	final_dat = malloc(final_dat_size);
-	memset(final_dat, 0, final_dat_size);
-	uint8_t *crypt_compressed_dat = final_dat + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	DOWNLOAD_QUEST_CHUNKS_HEADER *dat_dlchunks_header = (DOWNLOAD_QUEST_CHUNKS_HEADER*)final_dat;
-	dat_dlchunks_header->decompressed_size = decompressed_dat_size + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	dat_dlchunks_header->crypt_key = rand();
-	memcpy(crypt_compressed_dat, compressed_dat, compressed_dat_size);
-
-	CRYPT_SETUP bin_cs, dat_cs;
+	unsigned int seed = time(NULL);
+	size_t final_bin_size, final_dat_size;
 
-	// yes, we need to use PC encryption even for gamecube download quests
-	CRYPT_CreateKeys(&bin_cs, &bin_dlchunks_header->crypt_key, CRYPT_PC);
-	CRYPT_CreateKeys(&dat_cs, &dat_dlchunks_header->crypt_key, CRYPT_PC);
-
-	// NOTE: encrypts the compressed bin/dat data in-place
-	CRYPT_CryptData(&bin_cs, crypt_compressed_bin, final_bin_size - sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER), 1);
-	CRYPT_CryptData(&dat_cs, crypt_compressed_dat, final_dat_size - sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER), 1);
-
-
-	/** generate .qst file header for both the encrypted+compressed .bin and .dat file data, using the .bin header data **/
-
-	QST_HEADER qst_bin_header, qst_dat_header;
-
-	generate_qst_header(bin_base_filename, final_bin_size, bin_header, &qst_bin_header);
-	generate_qst_header(dat_base_filename, final_dat_size, bin_header, &qst_dat_header);
-
-
-	/** write out the .qst file. chunk data is written out as interleaved 0xA7 packets containing 1024 bytes each */
-	printf("Writing out %s ...\n", output_qst_filename);
-
-	FILE *fp = fopen(output_qst_filename, "wb");
-	if (!fp) {
-		printf("Error creating output .qst file: %s\n", output_qst_filename);
+	returncode = encrypt_download_quest_data(compressed_bin, compressed_bin_size, decompressed_bin_size, rand_r(&seed), &final_bin, &final_bin_size, NULL);
+	if (returncode) {
+		printf("Error code %d (%s) encrypting .bin file data.\n", returncode, get_error_message(returncode));
 		goto error;
 	}
 
-	fwrite(&qst_bin_header, sizeof(qst_bin_header), 1, fp);
-	fwrite(&qst_dat_header, sizeof(qst_dat_header), 1, fp);
-
-	uint32_t bin_pos = 0, bin_done = 0;
-	uint32_t dat_pos = 0, dat_done = 0;
-	uint8_t bin_counter = 0, dat_counter = 0;
-	QST_DATA_CHUNK chunk;
-
-	// note: .qst files actually do NOT need to be interleaved like this to work with the gamecube pso client. the
-	// khyller server did not do this. it is possible that some .qst file tools (qedit?) expect it though? so, meh,
-	// we'll just do it here because it's easy enough. also worth mentioning that khyller also put the .dat file data
-	// first. so the order seems unimportant too ... ?
-
-	while (!bin_done || !dat_done) {
-		if (!bin_done) {
-			uint32_t size = (final_bin_size - bin_pos >= 1024) ? 1024 : (final_bin_size - bin_pos);
-
-			generate_qst_data_chunk(bin_base_filename, bin_counter, final_bin + bin_pos, size, &chunk);
-			fwrite(&chunk, sizeof(QST_DATA_CHUNK), 1, fp);
-
-			bin_pos += size;
-			++bin_counter;
-			if (bin_pos >= final_bin_size)
-				bin_done = 1;
-		}
+	returncode = encrypt_download_quest_data(compressed_dat, compressed_dat_size, decompressed_dat_size, rand_r(&seed), &final_dat, &final_dat_size, NULL);
+	if (returncode) {
+		printf("Error code %d (%s) encrypting .dat file data.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
 
-		if (!dat_done) {
-			uint32_t size = (final_dat_size - dat_pos >= 1024) ? 1024 : (final_dat_size - dat_pos);
 
-			generate_qst_data_chunk(dat_base_filename, dat_counter, final_dat + dat_pos, size, &chunk);
-			fwrite(&chunk, sizeof(QST_DATA_CHUNK), 1, fp);
+	/** write out the .qst file **/
+	printf("Writing out %s ...\n", output_qst_filename);
 
-			dat_pos += size;
-			++dat_counter;
-			if (dat_pos >= final_dat_size)
-				dat_done = 1;
-		}
+	returncode = write_download_quest_qst(output_qst_filename,
+	                                      bin_base_filename,
+	                                      dat_base_filename,
+	                                      bin_header,
+	                                      final_bin,
+	                                      final_bin_size,
+	                                      final_dat,
+	                                      final_dat_size);
+	if (returncode) {
+		printf("Error code %d (%s) writing output .qst file: %s\n", returncode, get_error_message(returncode), output_qst_filename);
+		goto error;
 	}
 
-	fclose(fp);
-
 	returncode = 0;
 	goto quit;
 error:
 	returncode = 1;
 quit:
+	free(previous_compressed_bin);
+	free(previous_bin);
 	free(decompressed_bin);
+	free(decompressed_dat);
 	free(final_bin);
 	free(final_dat);
 	free(compressed_bin);
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "retvals.h"
+#include "utils.h"
+#include "hash.h"
+#include "content_store.h"
+
+#define OBJECTS_DIR                    "objects"
+#define COMPRESSED_DIR                 "compressed"
+#define REFS_FILE                      "refs"
+
+// builds "<store>/<area>/xx/<hash>" into out_path, optionally creating the "xx" directory along the way
+static int get_entry_path(const CONTENT_STORE *store, const char *area, uint64_t hash, bool create_dirs, char *out_path, size_t out_path_size) {
+	char hash_string[HASH_STRING_LENGTH + 1];
+	hash_to_string(hash, hash_string);
+
+	snprintf(out_path, out_path_size, "%s/%s/%.2s", store->path, area, hash_string);
+	if (create_dirs && create_directory(out_path))
+		return ERROR_CREATING_FILE;
+
+	snprintf(out_path, out_path_size, "%s/%s/%.2s/%s", store->path, area, hash_string, hash_string);
+	return SUCCESS;
+}
+
+// writes to a temporary file first, so that concurrent readers (or a crash part-way through) never see partial data
+static int write_entry(const char *path, const void *data, size_t size) {
+	char temp_path[FILENAME_MAX];
+	snprintf(temp_path, sizeof(temp_path), "%s.tmp%d", path, (int)getpid());
+
+	FILE *fp = fopen(temp_path, "wb");
+	if (!fp)
+		return ERROR_CREATING_FILE;
+
+	if (size && fwrite(data, 1, size, fp) != size) {
+		fclose(fp);
+		remove(temp_path);
+		return ERROR_IO;
+	}
+	fclose(fp);
+
+	if (rename(temp_path, path)) {
+		remove(temp_path);
+		return ERROR_IO;
+	}
+
+	return SUCCESS;
+}
+
+int content_store_open(const char *path, CONTENT_STORE *out_store) {
+	if (!path || !out_store)
+		return ERROR_INVALID_PARAMS;
+
+	char dir[FILENAME_MAX];
+
+	if (create_directory(path))
+		return ERROR_CREATING_FILE;
+	snprintf(dir, sizeof(dir), "%s/%s", path, OBJECTS_DIR);
+	if (create_directory(dir))
+		return ERROR_CREATING_FILE;
+	snprintf(dir, sizeof(dir), "%s/%s", path, COMPRESSED_DIR);
+	if (create_directory(dir))
+		return ERROR_CREATING_FILE;
+
+	out_store->path = strdup(path);
+	return SUCCESS;
+}
+
+void content_store_close(CONTENT_STORE *store) {
+	if (!store)
+		return;
+
+	free(store->path);
+	store->path = NULL;
+}
+
+bool content_store_has(const CONTENT_STORE *store, uint64_t hash, size_t *out_size) {
+	char path[FILENAME_MAX];
+	struct stat st;
+
+	get_entry_path(store, OBJECTS_DIR, hash, false, path, sizeof(path));
+	if (stat(path, &st))
+		return false;
+
+	if (out_size)
+		*out_size = st.st_size;
+	return true;
+}
+
+/*
+ * Adds decompressed quest data to the store, unless identical data is already present. out_added is set to whether
+ * the data was actually written (that is, it was not a duplicate).
+ */
+int content_store_put(const CONTENT_STORE *store, const uint8_t *data, size_t size, uint64_t *out_hash, bool *out_added) {
+	if (!store || !data || !out_hash)
+		return ERROR_INVALID_PARAMS;
+
+	uint64_t hash = xxh64(data, size, 0);
+	size_t existing_size;
+	*out_hash = hash;
+	if (out_added)
+		*out_added = false;
+
+	char path[FILENAME_MAX];
+	if (content_store_has(store, hash, &existing_size)) {
+		// the same hash for different data (a hash collision) can't be stored, and must not be treated as a duplicate
+		if (existing_size != size)
+			return ERROR_BAD_DATA;
+
+		uint8_t *existing_data;
+		uint32_t existing_data_size;
+		get_entry_path(store, OBJECTS_DIR, hash, false, path, sizeof(path));
+		int result = read_file(path, &existing_data, &existing_data_size);
+		if (result)
+			return result;
+		bool identical = (existing_data_size == size) && !memcmp(existing_data, data, size);
+		free(existing_data);
+
+		return identical ? SUCCESS : ERROR_BAD_DATA;
+	}
+
+	if (get_entry_path(store, OBJECTS_DIR, hash, true, path, sizeof(path)))
+		return ERROR_CREATING_FILE;
+
+	int result = write_entry(path, data, size);
+	if (result)
+		return result;
+
+	if (out_added)
+		*out_added = true;
+	return SUCCESS;
+}
+
+int content_store_get(const CONTENT_STORE *store, uint64_t hash, uint8_t **out_data, size_t *out_size) {
+	if (!store || !out_data || !out_size)
+		return ERROR_INVALID_PARAMS;
+
+	char path[FILENAME_MAX];
+	uint32_t size;
+	get_entry_path(store, OBJECTS_DIR, hash, false, path, sizeof(path));
+
+	int result = read_file(path, out_data, &size);
+	if (result)
+		return result;
+
+	if (xxh64(*out_data, size, 0) != hash) {
+		free(*out_data);
+		*out_data = NULL;
+		return ERROR_BAD_DATA;
+	}
+
+	*out_size = size;
+	return SUCCESS;
+}
+
+// looks up the decompressed object previously stored for compressed data with the given hash
+int content_store_get_alias(const CONTENT_STORE *store, uint64_t compressed_hash, uint64_t *out_hash) {
+	if (!store || !out_hash)
+		return ERROR_INVALID_PARAMS;
+
+	char path[FILENAME_MAX];
+	char hash_string[HASH_STRING_LENGTH + 1] = "";
+	get_entry_path(store, COMPRESSED_DIR, compressed_hash, false, path, sizeof(path));
+
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return ERROR_FILE_NOT_FOUND;
+	size_t bytes_read = fread(hash_string, 1, HASH_STRING_LENGTH, fp);
+	fclose(fp);
+	if (bytes_read != HASH_STRING_LENGTH)
+		return ERROR_BAD_DATA;
+
+	return string_to_hash(hash_string, out_hash);
+}
+
+int content_store_put_alias(const CONTENT_STORE *store, uint64_t compressed_hash, uint64_t hash) {
+	if (!store)
+		return ERROR_INVALID_PARAMS;
+
+	char path[FILENAME_MAX];
+	char hash_string[HASH_STRING_LENGTH + 1];
+	if (get_entry_path(store, COMPRESSED_DIR, compressed_hash, true, path, sizeof(path)))
+		return ERROR_CREATING_FILE;
+
+	hash_to_string(hash, hash_string);
+	return write_entry(path, hash_string, HASH_STRING_LENGTH);
+}
+
+int content_store_add_ref(const CONTENT_STORE *store, const char *container_path, const char *container_type, uint64_t bin_hash, uint64_t dat_hash) {
+	if (!store || !container_path || !container_type)
+		return ERROR_INVALID_PARAMS;
+
+	char path[FILENAME_MAX];
+	char bin_hash_string[HASH_STRING_LENGTH + 1];
+	char dat_hash_string[HASH_STRING_LENGTH + 1];
+	snprintf(path, sizeof(path), "%s/%s", store->path, REFS_FILE);
+	hash_to_string(bin_hash, bin_hash_string);
+	hash_to_string(dat_hash, dat_hash_string);
+
+	FILE *fp = fopen(path, "a");
+	if (!fp)
+		return ERROR_CREATING_FILE;
+
+	int result = fprintf(fp, "%s %s %s %s\n", bin_hash_string, dat_hash_string, container_type, container_path);
+	fclose(fp);
+
+	return (result < 0) ? ERROR_IO : SUCCESS;
+}
+
+int content_store_read_refs(const CONTENT_STORE *store, CONTENT_STORE_REF **out_refs, size_t *out_count) {
+	if (!store || !out_refs || !out_count)
+		return ERROR_INVALID_PARAMS;
+
+	char path[FILENAME_MAX];
+	char line[FILENAME_MAX + 64];
+	CONTENT_STORE_REF *refs = NULL;
+	size_t count = 0, capacity = 0;
+
+	*out_refs = NULL;
+	*out_count = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", store->path, REFS_FILE);
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return SUCCESS;  // nothing has been added yet
+
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		char bin_hash_string[HASH_STRING_LENGTH + 1], dat_hash_string[HASH_STRING_LENGTH + 1], type[16];
+		int path_start = 0;
+		if (sscanf(line, "%16s %16s %15s %n", bin_hash_string, dat_hash_string, type, &path_start) != 3 || !path_start)
+			continue;
+
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			CONTENT_STORE_REF *new_refs = realloc(refs, capacity * sizeof(CONTENT_STORE_REF));
+			if (!new_refs) {
+				fclose(fp);
+				content_store_free_refs(refs, count);
+				return ERROR_IO;
+			}
+			refs = new_refs;
+		}
+
+		CONTENT_STORE_REF *ref = &refs[count];
+		if (string_to_hash(bin_hash_string, &ref->bin_hash) || string_to_hash(dat_hash_string, &ref->dat_hash))
+			continue;
+		strncpy(ref->container_type, type, sizeof(ref->container_type));
+		ref->container_path = strdup(line + path_start);
+		++count;
+	}
+
+	fclose(fp);
+	*out_refs = refs;
+	*out_count = count;
+	return SUCCESS;
+}
+
+void content_store_free_refs(CONTENT_STORE_REF *refs, size_t count) {
+	for (size_t i = 0; i < count; ++i)
+		free(refs[i].container_path);
+	free(refs);
+}
+
+static uint64_t hash_ref(const CONTENT_STORE_REF *ref) {
+	return xxh64(ref->container_path, strlen(ref->container_path), ref->bin_hash ^ (ref->dat_hash * 0x9E3779B97F4A7C15ULL));
+}
+
+static bool refs_are_identical(const CONTENT_STORE_REF *a, const CONTENT_STORE_REF *b) {
+	return a->bin_hash == b->bin_hash &&
+	       a->dat_hash == b->dat_hash &&
+	       !strcmp(a->container_type, b->container_type) &&
+	       !strcmp(a->container_path, b->container_path);
+}
+
+// finds the slot that the ref is in, or the empty slot it would go in. there is always at least one empty slot
+static size_t find_ref_slot(const CONTENT_STORE_REF_INDEX *index, const CONTENT_STORE_REF *ref) {
+	size_t slot = hash_ref(ref) & (index->num_slots - 1);
+	while (index->slots[slot] && !refs_are_identical(index->slots[slot], ref))
+		slot = (slot + 1) & (index->num_slots - 1);
+	return slot;
+}
+
+int content_store_ref_index_init(CONTENT_STORE_REF_INDEX *index, size_t expected_count) {
+	if (!index)
+		return ERROR_INVALID_PARAMS;
+
+	// kept at most half full
+	index->num_slots = 64;
+	while (index->num_slots < (expected_count * 2))
+		index->num_slots *= 2;
+	index->count = 0;
+	index->slots = calloc(index->num_slots, sizeof(const CONTENT_STORE_REF*));
+	return index->slots ? SUCCESS : ERROR_IO;
+}
+
+/*
+ * Adds a ref to the index, unless an identical one is already in it. Returns whether it was added. If the index can't
+ * be grown, the ref is treated as not being a duplicate and is not added.
+ */
+bool content_store_ref_index_add(CONTENT_STORE_REF_INDEX *index, const CONTENT_STORE_REF *ref) {
+	size_t slot = find_ref_slot(index, ref);
+	if (index->slots[slot])
+		return false;
+
+	if (((index->count + 1) * 2) > index->num_slots) {
+		CONTENT_STORE_REF_INDEX grown;
+		if (content_store_ref_index_init(&grown, index->count + 1))
+			return true;
+		for (size_t i = 0; i < index->num_slots; ++i) {
+			if (index->slots[i])
+				grown.slots[find_ref_slot(&grown, index->slots[i])] = index->slots[i];
+		}
+		grown.count = index->count;
+		free(index->slots);
+		*index = grown;
+		slot = find_ref_slot(index, ref);
+	}
+
+	index->slots[slot] = ref;
+	++index->count;
+	return true;
+}
+
+void content_store_ref_index_free(CONTENT_STORE_REF_INDEX *index) {
+	if (!index)
+		return;
+
+	free(index->slots);
+	index->slots = NULL;
+	index->num_slots = 0;
+	index->count = 0;
+}
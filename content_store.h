@@ -0,0 +1,62 @@
+#ifndef CONTENT_STORE_H_INCLUDED
+#define CONTENT_STORE_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hash.h"
+
+#define CONTAINER_TYPE_BINDAT          "bindat"
+#define CONTAINER_TYPE_QST_ONLINE      "qst-online"
+#define CONTAINER_TYPE_QST_DOWNLOAD    "qst-download"
+#define CONTAINER_TYPE_GCI             "gci"
+
+/*
+ * A content-addressed store of decompressed quest .bin/.dat data, kept in a directory:
+ *
+ * objects/xx/<hash>        decompressed data, named by the XXH64 hash of that data (xx = first two hash digits)
+ * compressed/xx/<hash>     maps the XXH64 hash of some compressed (PRS) data to the hash of its decompressed object,
+ *                          so the same compressed data never needs to be decompressed more than once
+ * refs                     text file listing every container (.bin/.dat pair, .qst or .gci pair) that was added,
+ *                          one per line: "<bin hash> <dat hash> <container type> <container path>"
+ */
+
+typedef struct {
+	char *path;
+} CONTENT_STORE;
+
+typedef struct {
+	uint64_t bin_hash;
+	uint64_t dat_hash;
+	char container_type[16];
+	char *container_path;
+} CONTENT_STORE_REF;
+
+// refs by their contents (hashes, type and path), so that duplicate refs can be found without comparing every ref with
+// every other one. it only points to the refs added to it, which must stay where they are until it is freed
+typedef struct {
+	const CONTENT_STORE_REF **slots;
+	size_t num_slots;
+	size_t count;
+} CONTENT_STORE_REF_INDEX;
+
+int content_store_open(const char *path, CONTENT_STORE *out_store);
+void content_store_close(CONTENT_STORE *store);
+
+bool content_store_has(const CONTENT_STORE *store, uint64_t hash, size_t *out_size);
+int content_store_put(const CONTENT_STORE *store, const uint8_t *data, size_t size, uint64_t *out_hash, bool *out_added);
+int content_store_get(const CONTENT_STORE *store, uint64_t hash, uint8_t **out_data, size_t *out_size);
+
+int content_store_get_alias(const CONTENT_STORE *store, uint64_t compressed_hash, uint64_t *out_hash);
+int content_store_put_alias(const CONTENT_STORE *store, uint64_t compressed_hash, uint64_t hash);
+
+int content_store_add_ref(const CONTENT_STORE *store, const char *container_path, const char *container_type, uint64_t bin_hash, uint64_t dat_hash);
+int content_store_read_refs(const CONTENT_STORE *store, CONTENT_STORE_REF **out_refs, size_t *out_count);
+void content_store_free_refs(CONTENT_STORE_REF *refs, size_t count);
+
+int content_store_ref_index_init(CONTENT_STORE_REF_INDEX *index, size_t expected_count);
+bool content_store_ref_index_add(CONTENT_STORE_REF_INDEX *index, const CONTENT_STORE_REF *ref);
+void content_store_ref_index_free(CONTENT_STORE_REF_INDEX *index);
+
+#endif
@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include <sylverant/encryption.h>
+
+#include "retvals.h"
+#include "defs.h"
+#include "quests.h"
+#include "session.h"
+#include "crypt_search.h"
+#include "batch.h"
+
+#define GC_KEYS_SIZE          521
+#define GC_MIX_LAG            32
+#define GC_SELF_TEST_SEED     0x4f4b816b
+#define GC_SELF_TEST_WORDS    (GC_KEYS_SIZE * 3)
+#define NUM_JOBS              (int)((1ULL << 32) / CRYPT_SEARCH_SEEDS_PER_JOB)
+#define GC_BASEKEYS           17
+#define WORD_SET_SIZE         ((GC_KEYS_SIZE + 63) / 64)
+
+// a set of key words, by index
+typedef struct {
+	uint64_t bits[WORD_SET_SIZE];
+} WORD_SET;
+
+// the headers that quest download sessions usually start with, in either direction, when some are missing
+const CRYPT_SEARCH_KNOWN_WORD crypt_search_default_known_words[] = {
+	CRYPT_SEARCH_KNOWN_HEADER(PACKET_ID_QUEST_CHUNK_DOWNLOAD, sizeof(QST_DATA_CHUNK)),
+	CRYPT_SEARCH_KNOWN_HEADER(PACKET_ID_QUEST_CHUNK_ONLINE, sizeof(QST_DATA_CHUNK)),
+	CRYPT_SEARCH_KNOWN_HEADER(PACKET_ID_QUEST_INFO_DOWNLOAD, sizeof(QST_HEADER)),
+	CRYPT_SEARCH_KNOWN_HEADER(PACKET_ID_QUEST_INFO_ONLINE, sizeof(QST_HEADER)),
+	CRYPT_SEARCH_KNOWN_HEADER(PACKET_ID_MENU_SELECT, sizeof(MENU_SELECT_PACKET)),
+};
+const int crypt_search_num_default_known_words = sizeof(crypt_search_default_known_words) / sizeof(CRYPT_SEARCH_KNOWN_WORD);
+
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	uint32_t first_word;
+	const CRYPT_SEARCH_KNOWN_WORD *known;
+	int num_known;
+	uint32_t max_offset;
+
+	// the first keystream word for any base keys, as the XOR of one entry per base key byte (see compute_word0_table)
+	uint32_t word0_table[GC_BASEKEYS * 4][256];
+
+	// which of the initial key words XOR together into each of the first keystream words (see compute_subsets)
+	uint16_t subset_words[CRYPT_SEARCH_SUBSET_OFFSETS][GC_KEYS_SIZE];
+	int subset_sizes[CRYPT_SEARCH_SUBSET_OFFSETS];
+
+	// every seed that passed, up to CRYPT_SEARCH_MAX_RESULTS of them. num_found keeps counting past that
+	CRYPT_SEARCH_RESULT results[CRYPT_SEARCH_MAX_RESULTS];
+	int num_found;
+	int jobs_done;
+} CRYPT_SEARCH;
+
+/*
+ * Sets up the Gamecube crypt key state for CRYPT_SEARCH_LANES consecutive seeds at once, the same way libsylverant
+ * does for one (CRYPT_CreateKeys with CRYPT_GAMECUBE). Everything is done across the lanes in the innermost loops, so
+ * the compiler can vectorize it.
+ *
+ * This is done in two steps. gc_basekeys_lanes fills in the first GC_BASEKEYS words from the seed. Every other key
+ * word is then derived from those by gc_expand_keys_lanes, using only shifts and XORs.
+ */
+static void gc_basekeys_lanes(uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES], uint32_t first_seed) {
+	uint32_t seed[CRYPT_SEARCH_LANES];
+	uint32_t basekey[CRYPT_SEARCH_LANES];
+
+	for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane) {
+		seed[lane] = first_seed + lane;
+		basekey[lane] = 0;
+	}
+
+	// each of the first 17 words is made from the top bits of 32 successive LCG states
+	for (int x = 0; x < GC_BASEKEYS; ++x) {
+		for (int y = 0; y < 32; ++y) {
+			for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane) {
+				seed[lane] = seed[lane] * 0x5d588b65 + 1;
+				basekey[lane] = (basekey[lane] >> 1) | (seed[lane] & 0x80000000);
+			}
+		}
+		for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane)
+			keys[x][lane] = basekey[lane];
+	}
+}
+
+static void gc_expand_keys_lanes(uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES]) {
+	for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane)
+		keys[16][lane] = (keys[0][lane] >> 9) ^ (keys[16][lane] << 23) ^ keys[15][lane];
+
+	for (int i = 17; i < GC_KEYS_SIZE; ++i) {
+		for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane)
+			keys[i][lane] = keys[i - 1][lane] ^ (keys[i - 17][lane] << 23) ^ (keys[i - 16][lane] >> 9);
+	}
+}
+
+// the same as libsylverant's key mixing, which produces the next block of GC_KEYS_SIZE keystream words
+static void gc_mix_keys_lanes(uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES]) {
+	for (int i = 0; i < GC_MIX_LAG; ++i) {
+		for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane)
+			keys[i][lane] ^= keys[i + GC_KEYS_SIZE - GC_MIX_LAG][lane];
+	}
+	for (int i = GC_MIX_LAG; i < GC_KEYS_SIZE; ++i) {
+		for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane)
+			keys[i][lane] ^= keys[i - GC_MIX_LAG][lane];
+	}
+}
+
+// sets up the key state so that the first keystream word is in keys[GC_KEYS_SIZE - 1]. the rest of the keystream
+// follows in blocks of GC_KEYS_SIZE words, each produced by gc_mix_keys_lanes
+static void gc_init_lanes(uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES], uint32_t first_seed) {
+	gc_basekeys_lanes(keys, first_seed);
+	gc_expand_keys_lanes(keys);
+	gc_mix_keys_lanes(keys);
+	gc_mix_keys_lanes(keys);
+	gc_mix_keys_lanes(keys);
+}
+
+// generates the first words of the Gamecube keystream for the given seed. the same as what CRYPT_CryptData would
+// XOR the data with
+void crypt_gamecube_keystream(uint32_t seed, uint32_t *out_words, size_t count) {
+	uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES];
+
+	if (!count)
+		return;
+
+	gc_init_lanes(keys, seed);
+	out_words[0] = keys[GC_KEYS_SIZE - 1][0];
+
+	size_t pos = 1;
+	while (pos < count) {
+		gc_mix_keys_lanes(keys);
+		for (int i = 0; i < GC_KEYS_SIZE && pos < count; ++i)
+			out_words[pos++] = keys[i][0];
+	}
+}
+
+static void word_set_xor(WORD_SET *a, const WORD_SET *b) {
+	for (int i = 0; i < WORD_SET_SIZE; ++i)
+		a->bits[i] ^= b->bits[i];
+}
+
+/*
+ * Key mixing only ever XORs whole key words together. So each keystream word is simply the XOR of some subset of the
+ * key words as they are right after gc_expand_keys_lanes, and that subset is the same for every seed. It turns out to
+ * be only around 34 of the 521 words. Working those subsets out once up front (by running the mixing on sets of word
+ * indices instead of on the words themselves) means the first keystream words can be checked for each seed without
+ * having to do any of the mixing.
+ */
+static void compute_subsets(CRYPT_SEARCH *search) {
+	WORD_SET *sets = calloc(GC_KEYS_SIZE, sizeof(WORD_SET));
+
+	for (int i = 0; i < GC_KEYS_SIZE; ++i)
+		sets[i].bits[i / 64] = 1ULL << (i % 64);
+
+	// word offset 0 is the last word after the initial 3 mixes, and the following ones come from the next mix
+	for (int mix = 0; mix < 4; ++mix) {
+		if (mix == 3) {
+			for (int w = 0; w < GC_KEYS_SIZE; ++w) {
+				if (sets[GC_KEYS_SIZE - 1].bits[w / 64] & (1ULL << (w % 64)))
+					search->subset_words[0][search->subset_sizes[0]++] = w;
+			}
+		}
+
+		for (int i = 0; i < GC_MIX_LAG; ++i)
+			word_set_xor(&sets[i], &sets[i + GC_KEYS_SIZE - GC_MIX_LAG]);
+		for (int i = GC_MIX_LAG; i < GC_KEYS_SIZE; ++i)
+			word_set_xor(&sets[i], &sets[i - GC_MIX_LAG]);
+	}
+
+	for (int offset = 1; offset < CRYPT_SEARCH_SUBSET_OFFSETS; ++offset) {
+		const WORD_SET *set = &sets[offset - 1];
+		for (int w = 0; w < GC_KEYS_SIZE; ++w) {
+			if (set->bits[w / 64] & (1ULL << (w % 64)))
+				search->subset_words[offset][search->subset_sizes[offset]++] = w;
+		}
+	}
+
+	free(sets);
+}
+
+// works out the keystream word at the given offset (< CRYPT_SEARCH_SUBSET_OFFSETS) from the freshly expanded keys
+static void subset_word_lanes(const CRYPT_SEARCH *search, const uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES], uint32_t offset, uint32_t out_words[CRYPT_SEARCH_LANES]) {
+	const uint16_t *subset = search->subset_words[offset];
+	int size = search->subset_sizes[offset];
+
+	for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane)
+		out_words[lane] = 0;
+	for (int i = 0; i < size; ++i) {
+		const uint32_t *words = keys[subset[i]];
+		for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane)
+			out_words[lane] ^= words[lane];
+	}
+}
+
+/*
+ * Going one step further than compute_subsets: expanding the keys only uses shifts and XORs as well. So every bit of
+ * the first keystream word is the XOR (parity) of some of the 544 bits of the base keys. This works out what each base
+ * key bit contributes to the first keystream word, and combines those into one lookup table per base key byte. The
+ * first keystream word for a seed then only takes 68 table lookups, rather than expanding all of the keys.
+ */
+static void compute_word0_table(CRYPT_SEARCH *search) {
+	uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES];
+	uint32_t contributions[GC_BASEKEYS * 32];
+
+	for (int bit = 0; bit < GC_BASEKEYS * 32; ++bit) {
+		uint32_t words[CRYPT_SEARCH_LANES];
+		memset(keys, 0, sizeof(keys));
+		keys[bit / 32][0] = 1u << (bit % 32);
+		gc_expand_keys_lanes(keys);
+		subset_word_lanes(search, keys, 0, words);
+		contributions[bit] = words[0];
+	}
+
+	for (int byte = 0; byte < GC_BASEKEYS * 4; ++byte) {
+		for (int value = 0; value < 256; ++value) {
+			uint32_t word = 0;
+			for (int bit = 0; bit < 8; ++bit) {
+				if (value & (1 << bit))
+					word ^= contributions[byte * 8 + bit];
+			}
+			search->word0_table[byte][value] = word;
+		}
+	}
+}
+
+static void table_word0_lanes(const CRYPT_SEARCH *search, const uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES], uint32_t out_words[CRYPT_SEARCH_LANES]) {
+	for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane) {
+		uint32_t word = 0;
+		for (int x = 0; x < GC_BASEKEYS; ++x) {
+			uint32_t basekey = keys[x][lane];
+			word ^= search->word0_table[x * 4 + 0][basekey & 0xff] ^
+			        search->word0_table[x * 4 + 1][(basekey >> 8) & 0xff] ^
+			        search->word0_table[x * 4 + 2][(basekey >> 16) & 0xff] ^
+			        search->word0_table[x * 4 + 3][basekey >> 24];
+		}
+		out_words[lane] = word;
+	}
+}
+
+// advances the crypt state by the given number of (4 byte) words, as if that much data had been encrypted
+void crypt_skip_words(CRYPT_SETUP *cs, uint32_t num_words) {
+	uint8_t buffer[4096];
+	uint64_t remaining = (uint64_t)num_words * 4;
+
+	memset(buffer, 0, sizeof(buffer));
+	while (remaining) {
+		size_t size = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+		CRYPT_CryptData(cs, buffer, size, 0);
+		remaining -= size;
+	}
+}
+
+// whether a (decrypted) packet header is one of the known headers. the flags byte is ignored, as with the quick check
+bool crypt_search_is_known_header(const PACKET_HEADER *header, const CRYPT_SEARCH_KNOWN_WORD *known, int num_known) {
+	uint32_t word;
+	memcpy(&word, header, sizeof(uint32_t));
+	for (int k = 0; k < num_known; ++k) {
+		if (((word ^ known[k].value) & known[k].mask) == 0)
+			return true;
+	}
+	return false;
+}
+
+// whether a (decrypted) packet size is one that a real packet could have
+static bool is_valid_size(uint16_t pkt_size) {
+	return pkt_size >= sizeof(PACKET_HEADER) && pkt_size < CRYPT_SEARCH_MAX_PACKET_SIZE && (pkt_size % 4) == 0;
+}
+
+/*
+ * The slow but sure check, using libsylverant to decrypt the start of the data with a seed that passed the quick check.
+ * One packet header at a time is decrypted and checked, so that almost all wrong seeds are rejected after decrypting
+ * only a few bytes. The first packet header must be one of the known headers, and every packet header after it, up to
+ * CRYPT_SEARCH_VERIFY_PACKETS of them, must have a valid size that keeps the packets within the data. A wrong seed
+ * turns each size into a random number, which is only valid about 1 time in 8, and is then usually too big. If the
+ * data has fewer packets than that, the last one must end exactly at the end of the data.
+ */
+static bool verify_candidate(const CRYPT_SEARCH *search, uint32_t seed, uint32_t offset) {
+	CRYPT_SETUP cs;
+	uint8_t buffer[4096];
+
+	CRYPT_CreateKeys(&cs, &seed, CRYPT_GAMECUBE);
+	crypt_skip_words(&cs, offset);
+
+	size_t pos = 0;
+	for (int i = 0; i < CRYPT_SEARCH_VERIFY_PACKETS; ++i) {
+		if ((pos + sizeof(PACKET_HEADER)) > search->size)
+			return false;
+
+		PACKET_HEADER header;
+		memcpy(&header, search->data + pos, sizeof(PACKET_HEADER));
+		CRYPT_CryptData(&cs, &header, sizeof(PACKET_HEADER), 0);
+		if (i == 0 && !crypt_search_is_known_header(&header, search->known, search->num_known))
+			return false;
+		if (!is_valid_size(header.pkt_size))
+			return false;
+
+		size_t body_size = header.pkt_size - sizeof(PACKET_HEADER);
+		pos += sizeof(PACKET_HEADER);
+		if (body_size > (search->size - pos))
+			return false;
+
+		// the rest of the packet only needs to be decrypted to keep the crypt state in step
+		pos += body_size;
+		if (pos == search->size)
+			break;
+		while (body_size) {
+			size_t size = body_size < sizeof(buffer) ? body_size : sizeof(buffer);
+			CRYPT_CryptData(&cs, buffer, size, 0);
+			body_size -= size;
+		}
+	}
+
+	return true;
+}
+
+static void report_candidate(CRYPT_SEARCH *search, uint32_t seed, uint32_t offset) {
+	if (!verify_candidate(search, seed, offset))
+		return;
+
+	int index = __atomic_fetch_add(&search->num_found, 1, __ATOMIC_ACQ_REL);
+	if (index < CRYPT_SEARCH_MAX_RESULTS) {
+		search->results[index].seed = seed;
+		search->results[index].offset = offset;
+	}
+}
+
+// checks one keystream word (at the given offset) for every lane against the known plaintext
+static void check_word(CRYPT_SEARCH *search, const uint32_t words[CRYPT_SEARCH_LANES], uint32_t first_seed, uint32_t offset) {
+	for (int k = 0; k < search->num_known; ++k) {
+		uint32_t expected = search->first_word ^ search->known[k].value;
+		uint32_t mask = search->known[k].mask;
+
+		uint32_t hits = 0;
+		for (int lane = 0; lane < CRYPT_SEARCH_LANES; ++lane)
+			hits |= (uint32_t)(((words[lane] ^ expected) & mask) == 0) << lane;
+
+		// almost always zero, so each lane is only looked at on the rare occasion that there is a hit
+		for (int lane = 0; hits; ++lane, hits >>= 1) {
+			if (hits & 1)
+				report_candidate(search, first_seed + lane, offset);
+		}
+	}
+}
+
+static void search_job(int job_index, int worker_index, void *context) {
+	(void)worker_index;
+	CRYPT_SEARCH *search = (CRYPT_SEARCH*)context;
+	uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES];
+
+	uint32_t job_first_seed = (uint32_t)job_index * CRYPT_SEARCH_SEEDS_PER_JOB;
+	for (uint32_t i = 0; i < CRYPT_SEARCH_SEEDS_PER_JOB; i += CRYPT_SEARCH_LANES) {
+		uint32_t first_seed = job_first_seed + i;
+		uint32_t words[CRYPT_SEARCH_LANES];
+		gc_basekeys_lanes(keys, first_seed);
+		table_word0_lanes(search, keys, words);
+		check_word(search, words, first_seed, 0);
+		if (!search->max_offset)
+			continue;
+
+		gc_expand_keys_lanes(keys);
+		uint32_t offset;
+		for (offset = 1; offset < CRYPT_SEARCH_SUBSET_OFFSETS && offset <= search->max_offset; ++offset) {
+			uint32_t words[CRYPT_SEARCH_LANES];
+			subset_word_lanes(search, keys, offset, words);
+			check_word(search, words, first_seed, offset);
+		}
+
+		// any further offsets are cheaper to get to by doing the mixing
+		if (offset <= search->max_offset) {
+			gc_mix_keys_lanes(keys);
+			gc_mix_keys_lanes(keys);
+			gc_mix_keys_lanes(keys);
+
+			uint32_t pos = 1;
+			while (offset <= search->max_offset) {
+				gc_mix_keys_lanes(keys);
+				for (int w = 0; w < GC_KEYS_SIZE && offset <= search->max_offset; ++w, ++pos) {
+					if (pos == offset) {
+						check_word(search, keys[w], first_seed, offset);
+						++offset;
+					}
+				}
+			}
+		}
+	}
+
+	int done = __atomic_add_fetch(&search->jobs_done, 1, __ATOMIC_RELAXED);
+	if ((done % (NUM_JOBS / 64)) == 0) {
+		printf("Searched %d%% of keys ...\n", (int)(((int64_t)done * 100) / NUM_JOBS));
+		fflush(stdout);
+	}
+}
+
+// makes sure the keystream generated here (both ways) is exactly the same as what libsylverant produces
+static bool self_test(const CRYPT_SEARCH *search) {
+	uint32_t expected[GC_SELF_TEST_WORDS];
+	uint32_t actual[GC_SELF_TEST_WORDS];
+	uint32_t keys[GC_KEYS_SIZE][CRYPT_SEARCH_LANES];
+	uint32_t seed = GC_SELF_TEST_SEED;
+	CRYPT_SETUP cs;
+
+	memset(expected, 0, sizeof(expected));
+	CRYPT_CreateKeys(&cs, &seed, CRYPT_GAMECUBE);
+	CRYPT_CryptData(&cs, expected, sizeof(expected), 0);
+
+	crypt_gamecube_keystream(seed, actual, GC_SELF_TEST_WORDS);
+	if (memcmp(expected, actual, sizeof(expected)))
+		return false;
+
+	uint32_t words[CRYPT_SEARCH_LANES];
+	gc_basekeys_lanes(keys, seed);
+	table_word0_lanes(search, keys, words);
+	if (words[0] != expected[0])
+		return false;
+
+	gc_expand_keys_lanes(keys);
+	for (int offset = 0; offset < CRYPT_SEARCH_SUBSET_OFFSETS; ++offset) {
+		subset_word_lanes(search, keys, offset, words);
+		if (words[0] != expected[offset])
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Searches all seeds for the ones that the data could have been encrypted with, assuming that the data starts with
+ * packet headers matching the known words, once decrypted. Every seed is searched, even after one has been found.
+ *
+ * out_results must have room for CRYPT_SEARCH_MAX_RESULTS results. out_num_results is set to the number of seeds that
+ * passed, which can be more than were stored. Returns ERROR_NOT_FOUND if none did. For each result, the crypt state to
+ * decrypt the data can be set up with CRYPT_CreateKeys(&cs, &seed, CRYPT_GAMECUBE) followed by
+ * crypt_skip_words(&cs, offset).
+ */
+int crypt_search_gamecube_key(const uint8_t *data, size_t size, const CRYPT_SEARCH_KNOWN_WORD *known, int num_known, uint32_t max_offset, int num_workers, CRYPT_SEARCH_RESULT *out_results, int *out_num_results) {
+	if (!data || size < sizeof(PACKET_HEADER) || !known || num_known <= 0 || !out_results || !out_num_results)
+		return ERROR_INVALID_PARAMS;
+
+	CRYPT_SEARCH *search = calloc(1, sizeof(CRYPT_SEARCH));
+	if (!search)
+		return ERROR_IO;
+
+	search->data = data;
+	search->size = size;
+	memcpy(&search->first_word, data, sizeof(uint32_t));
+	search->known = known;
+	search->num_known = num_known;
+	search->max_offset = max_offset;
+	compute_subsets(search);
+	compute_word0_table(search);
+
+	int returncode;
+	if (!self_test(search)) {
+		returncode = ERROR_BAD_DATA;
+		goto quit;
+	}
+
+	returncode = batch_run(num_workers, NUM_JOBS, search_job, search);
+	if (returncode)
+		goto quit;
+
+	if (!search->num_found) {
+		returncode = ERROR_NOT_FOUND;
+		goto quit;
+	}
+
+	int num_results = search->num_found < CRYPT_SEARCH_MAX_RESULTS ? search->num_found : CRYPT_SEARCH_MAX_RESULTS;
+	memcpy(out_results, search->results, num_results * sizeof(CRYPT_SEARCH_RESULT));
+	*out_num_results = search->num_found;
+	returncode = SUCCESS;
+quit:
+	free(search);
+	return returncode;
+}
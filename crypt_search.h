@@ -0,0 +1,72 @@
+#ifndef CRYPT_SEARCH_H_INCLUDED
+#define CRYPT_SEARCH_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sylverant/encryption.h>
+
+#include "session.h"
+
+/*
+ * Recovers the key (32-bit seed) used to encrypt a stream of Gamecube PSO packets, for captures which are missing the
+ * unencrypted "Welcome" packet that the keys are normally read from.
+ *
+ * This is a known-plaintext search over all 2^32 seeds. The first 4 bytes of the data are assumed to be the start of a
+ * packet header, and at least some of the bits of that header (e.g. the packet id and size, see
+ * CRYPT_SEARCH_KNOWN_HEADER) are assumed to be known. For each seed, the first keystream words are generated and any
+ * seed which doesn't turn the first 4 bytes into one of the known headers is rejected straight away. Only 24 bits of
+ * each header are known, so a few hundred seeds per known header still get through (many more for headers with any
+ * size, see CRYPT_SEARCH_KNOWN_ID). Those are then checked by decrypting the start of the data with libsylverant. Only
+ * the first packet has to be a known one, as the packets after it could be almost anything (e.g. chat or game
+ * subcommands, whose sizes vary). Instead, the sizes of the first CRYPT_SEARCH_VERIFY_PACKETS packets must all be
+ * valid, and each one must lead on to the next packet's header.
+ *
+ * The search always goes through every seed, and returns all of the seeds that pass. If there is more than one, the
+ * data is too short (or has too few of the known packets in it) to tell which is the right one.
+ *
+ * If the capture doesn't start right at the beginning of the encrypted stream (e.g. a few packets were missed), the
+ * number of keystream words used up before the data starts is unknown as well. Up to max_offset words are tried for
+ * each seed, which makes the search only slightly slower.
+ *
+ * The Gamecube keystream is reimplemented here to generate the keystreams for CRYPT_SEARCH_LANES seeds at once. Its
+ * output is checked against libsylverant before every search.
+ */
+
+#define CRYPT_SEARCH_LANES             8
+#define CRYPT_SEARCH_SEEDS_PER_JOB     (1 << 20)
+#define CRYPT_SEARCH_VERIFY_PACKETS    16
+#define CRYPT_SEARCH_MAX_RESULTS       16
+#define CRYPT_SEARCH_SUBSET_OFFSETS    64
+
+// no Gamecube packet is anywhere near this big, so any larger size means the header was decrypted with the wrong key
+#define CRYPT_SEARCH_MAX_PACKET_SIZE   0x8000
+
+// the packet flags byte is not known in general (e.g. it is a counter for quest data chunk packets), so it is ignored
+#define CRYPT_SEARCH_KNOWN_HEADER(id, size) { (uint32_t)(id) | ((uint32_t)(size) << 16), 0xffff00ff }
+
+// a packet id with any (valid) size. only the lowest 2 bits and the top bit of the size are known (as it must be a
+// multiple of 4, and less than CRYPT_SEARCH_MAX_PACKET_SIZE), so many more seeds get through the quick check
+#define CRYPT_SEARCH_KNOWN_ID(id)      { (uint32_t)(id), 0x800300ff }
+
+// known bits (those set in mask) of the first 4 bytes of the data, once decrypted
+typedef struct {
+	uint32_t value;
+	uint32_t mask;
+} CRYPT_SEARCH_KNOWN_WORD;
+
+typedef struct {
+	uint32_t seed;
+	uint32_t offset;
+} CRYPT_SEARCH_RESULT;
+
+extern const CRYPT_SEARCH_KNOWN_WORD crypt_search_default_known_words[];
+extern const int crypt_search_num_default_known_words;
+
+void crypt_gamecube_keystream(uint32_t seed, uint32_t *out_words, size_t count);
+void crypt_skip_words(CRYPT_SETUP *cs, uint32_t num_words);
+bool crypt_search_is_known_header(const PACKET_HEADER *header, const CRYPT_SEARCH_KNOWN_WORD *known, int num_known);
+int crypt_search_gamecube_key(const uint8_t *data, size_t size, const CRYPT_SEARCH_KNOWN_WORD *known, int num_known, uint32_t max_offset, int num_workers, CRYPT_SEARCH_RESULT *out_results, int *out_num_results);
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ * PSO EP1&2 (Gamecube) Quest .dat Table De-duplication Analyser
+ *
+ * Splits the .dat data of any number of quests up into their tables (objects, NPCs, waves, etc) and finds the tables
+ * that are exactly the same (same type, area and contents) in more than one place. Many quests re-use the same tables
+ * for the same areas, and this shows how much memory storing each distinct table only once would save, e.g. with
+ * quest_server's -D option.
+ *
+ * Quests can be given as compressed .dat files, or online or download .qst files.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "retvals.h"
+#include "utils.h"
+#include "stats.h"
+#include "hash.h"
+#include "quests.h"
+#include "decode_cache.h"
+#include "dat_tables.h"
+
+#define DEFAULT_NUM_TOP_TABLES         10
+
+// the rows of the summary: table types 0 to 5, then any other type, then data that isn't a table
+#define NUM_TYPE_ROWS                  8
+
+typedef struct {
+	uint64_t hash;
+	uint32_t size;
+	uint32_t type;
+	uint32_t area;
+	int file_index;
+	const uint8_t *data;
+} TABLE_RECORD;
+
+typedef struct {
+	const TABLE_RECORD *first;
+	uint32_t count;
+} TABLE_GROUP;
+
+typedef struct {
+	uint32_t num_tables;
+	uint32_t num_distinct;
+	size_t bytes;
+	size_t duplicate_bytes;
+} TYPE_SUMMARY;
+
+static int type_row(uint32_t type) {
+	if (type <= 5)
+		return (int)type;
+	return (type == DAT_TABLE_TYPE_NONE) ? 7 : 6;
+}
+
+static const char* type_row_name(int row) {
+	return (row == 6) ? "Unknown" : dat_table_type_name((row == 7) ? DAT_TABLE_TYPE_NONE : (uint32_t)row);
+}
+
+static int compare_records(const void *a, const void *b) {
+	const TABLE_RECORD *ra = (const TABLE_RECORD*)a;
+	const TABLE_RECORD *rb = (const TABLE_RECORD*)b;
+	if (ra->hash != rb->hash)
+		return (ra->hash < rb->hash) ? -1 : 1;
+	if (ra->size != rb->size)
+		return (ra->size < rb->size) ? -1 : 1;
+	int result = memcmp(ra->data, rb->data, ra->size);
+	if (result)
+		return result;
+	return ra->file_index - rb->file_index;
+}
+
+static bool are_identical_tables(const TABLE_RECORD *a, const TABLE_RECORD *b) {
+	return a->hash == b->hash && a->size == b->size && !memcmp(a->data, b->data, a->size);
+}
+
+// most bytes saved first
+static int compare_groups(const void *a, const void *b) {
+	const TABLE_GROUP *ga = (const TABLE_GROUP*)a;
+	const TABLE_GROUP *gb = (const TABLE_GROUP*)b;
+	uint64_t saved_a = (uint64_t)(ga->count - 1) * ga->first->size;
+	uint64_t saved_b = (uint64_t)(gb->count - 1) * gb->first->size;
+	if (saved_a != saved_b)
+		return (saved_a > saved_b) ? -1 : 1;
+	return compare_records(ga->first, gb->first);
+}
+
+/*
+ * Reads a compressed .dat file, or the .dat data out of an online or download .qst file, and decompresses it, without
+ * any junk that decompressing left on the end.
+ */
+int load_dat(const char *filename, uint8_t **out_dat, uint32_t *out_dat_size) {
+	int returncode, result;
+	uint8_t *bin = NULL, *dat_data = NULL;
+	size_t bin_size, dat_size;
+
+	if (string_ends_with(filename, ".qst")) {
+		int qst_type;
+		returncode = decode_cache_load_quest_from_qst(filename, &bin, &bin_size, out_dat, &dat_size, &qst_type);
+		free(bin);
+		if (returncode)
+			return returncode;
+		*out_dat_size = (uint32_t)dat_size;
+		return SUCCESS;
+	}
+
+	uint32_t size;
+	returncode = read_file(filename, &dat_data, &size);
+	if (returncode)
+		return returncode;
+
+	result = decode_cache_decompress_buf(dat_data, out_dat, size);
+	free(dat_data);
+	if (result < 0)
+		return ERROR_BAD_DATA;
+	*out_dat_size = (uint32_t)trim_decompressed_dat_junk(*out_dat, result);
+	return SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+	int returncode;
+	int num_top_tables = DEFAULT_NUM_TOP_TABLES;
+	TABLE_RECORD *records = NULL;
+	TABLE_GROUP *groups = NULL;
+	uint8_t **dats = NULL;
+	size_t num_records = 0, max_records = 0;
+	int num_quests = 0, num_failed = 0;
+
+	stats_parse_args(&argc, argv);
+
+	int argi = 1;
+	while (argi < argc && argv[argi][0] == '-') {
+		if (!strcmp(argv[argi], "-n") && (argi + 1) < argc) {
+			num_top_tables = atoi(argv[argi + 1]);
+			argi += 2;
+		} else {
+			break;
+		}
+	}
+
+	if (argi >= argc || num_top_tables < 0) {
+		printf("Usage: dat_dedup [--stats] [-n num-top-tables] quest.dat|quest.qst ...\n");
+		return 1;
+	}
+
+	char **files = &argv[argi];
+	int num_files = argc - argi;
+
+	// all of the .dat data is kept until the end, so that tables with the same hash can be compared byte for byte
+	dats = calloc(num_files, sizeof(uint8_t*));
+	if (!dats) {
+		printf("Not enough memory for all of the tables.\n");
+		goto error;
+	}
+
+	for (int i = 0; i < num_files; ++i) {
+		uint8_t *dat = NULL;
+		uint32_t dat_size;
+		DAT_TABLE *tables = NULL;
+		uint32_t num_tables;
+
+		returncode = load_dat(files[i], &dat, &dat_size);
+		if (!returncode)
+			returncode = dat_tables_split(dat, dat_size, &tables, &num_tables);
+		if (returncode) {
+			printf("Error code %d (%s) reading quest .dat data: %s. Skipping it.\n", returncode, get_error_message(returncode), files[i]);
+			free(dat);
+			++num_failed;
+			continue;
+		}
+		dats[i] = dat;
+
+		if (num_records + num_tables > max_records) {
+			size_t new_max = (max_records ? max_records * 2 : 256) + num_tables;
+			TABLE_RECORD *new_records = realloc(records, sizeof(TABLE_RECORD) * new_max);
+			if (!new_records) {
+				printf("Not enough memory for all of the tables.\n");
+				free(tables);
+				goto error;
+			}
+			records = new_records;
+			max_records = new_max;
+		}
+
+		for (uint32_t j = 0; j < num_tables; ++j) {
+			TABLE_RECORD *record = &records[num_records++];
+			record->hash = tables[j].hash;
+			record->size = tables[j].size;
+			record->type = tables[j].type;
+			record->area = tables[j].area;
+			record->file_index = i;
+			record->data = dat + tables[j].offset;
+		}
+
+		++num_quests;
+		free(tables);
+	}
+
+	// identical tables end up next to each other
+	if (num_records)
+		qsort(records, num_records, sizeof(TABLE_RECORD), compare_records);
+
+	TYPE_SUMMARY summary[NUM_TYPE_ROWS];
+	TYPE_SUMMARY total;
+	size_t num_groups = 0;
+	memset(summary, 0, sizeof(summary));
+	memset(&total, 0, sizeof(total));
+
+	groups = malloc(sizeof(TABLE_GROUP) * (num_records ? num_records : 1));
+	if (!groups) {
+		printf("Not enough memory for all of the tables.\n");
+		goto error;
+	}
+
+	for (size_t i = 0; i < num_records; ) {
+		TABLE_GROUP *group = &groups[num_groups++];
+		group->first = &records[i];
+		group->count = 0;
+		while (i < num_records && are_identical_tables(&records[i], group->first)) {
+			++group->count;
+			++i;
+		}
+
+		TYPE_SUMMARY *row = &summary[type_row(group->first->type)];
+		size_t bytes = (size_t)group->count * group->first->size;
+		size_t duplicate_bytes = bytes - group->first->size;
+		row->num_tables += group->count;
+		row->num_distinct += 1;
+		row->bytes += bytes;
+		row->duplicate_bytes += duplicate_bytes;
+		total.num_tables += group->count;
+		total.num_distinct += 1;
+		total.bytes += bytes;
+		total.duplicate_bytes += duplicate_bytes;
+	}
+
+	printf("%d quest(s), %u .dat table(s), %zu bytes of .dat data\n\n", num_quests, total.num_tables, total.bytes);
+	printf("Table Type             Tables  Distinct       Bytes  Duplicate Bytes\n");
+	for (int i = 0; i < NUM_TYPE_ROWS; ++i) {
+		const TYPE_SUMMARY *row = &summary[i];
+		if (!row->num_tables)
+			continue;
+		printf("%-21s %7u %9u %11zu %16zu\n", type_row_name(i), row->num_tables, row->num_distinct, row->bytes, row->duplicate_bytes);
+	}
+	printf("%-21s %7u %9u %11zu %16zu\n", "Total", total.num_tables, total.num_distinct, total.bytes, total.duplicate_bytes);
+
+	if (total.bytes) {
+		printf("\nStoring each distinct table once would save %zu bytes (%.1f%%).\n",
+		       total.duplicate_bytes, (100.0 * total.duplicate_bytes) / total.bytes);
+	}
+
+	if (num_groups && num_top_tables) {
+		qsort(groups, num_groups, sizeof(TABLE_GROUP), compare_groups);
+
+		printf("\nMost duplicated tables:\n");
+		printf("Copies   Size  Table Type             Area  Hash              First Found In\n");
+		for (size_t i = 0; i < num_groups && i < (size_t)num_top_tables; ++i) {
+			const TABLE_GROUP *group = &groups[i];
+			if (group->count < 2)
+				break;
+
+			char hash_string[HASH_STRING_LENGTH + 1];
+			hash_to_string(group->first->hash, hash_string);
+			printf("%6u %6u  %-21s %5u  %s  %s\n",
+			       group->count,
+			       group->first->size,
+			       dat_table_type_name(group->first->type),
+			       group->first->area,
+			       hash_string,
+			       files[group->first->file_index]);
+		}
+	}
+
+	if (num_failed)
+		printf("\n%d quest(s) could not be read.\n", num_failed);
+
+	returncode = num_failed ? 1 : 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	free(records);
+	free(groups);
+	if (dats) {
+		for (int i = 0; i < num_files; ++i)
+			free(dats[i]);
+		free(dats);
+	}
+	return returncode;
+}
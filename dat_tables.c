@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "retvals.h"
+#include "hash.h"
+#include "dat_tables.h"
+
+/*
+ * Splits the .dat data up into tables (see dat_tables.h). The tables are allocated with malloc. Empty data gives no
+ * tables, and a NULL *out_tables.
+ */
+int dat_tables_split(const uint8_t *data, uint32_t size, DAT_TABLE **out_tables, uint32_t *out_count) {
+	if ((!data && size) || !out_tables || !out_count)
+		return ERROR_INVALID_PARAMS;
+
+	// every table but the last is at least a header
+	uint32_t max_tables = (size / sizeof(QUEST_DAT_TABLE_HEADER)) + 1;
+	DAT_TABLE *tables = NULL;
+	uint32_t count = 0;
+
+	if (size) {
+		tables = malloc(sizeof(DAT_TABLE) * max_tables);
+		if (!tables)
+			return ERROR_IO;
+	}
+
+	uint32_t offset = 0;
+	while (offset < size) {
+		DAT_TABLE *table = &tables[count++];
+		uint32_t remaining = size - offset;
+		const QUEST_DAT_TABLE_HEADER *header = (const QUEST_DAT_TABLE_HEADER*)(data + offset);
+
+		table->offset = offset;
+		if (remaining >= sizeof(QUEST_DAT_TABLE_HEADER) && header->table_body_size <= remaining - sizeof(QUEST_DAT_TABLE_HEADER)) {
+			table->size = sizeof(QUEST_DAT_TABLE_HEADER) + header->table_body_size;
+			table->type = header->type;
+			table->area = header->area;
+		} else {
+			table->size = remaining;
+			table->type = DAT_TABLE_TYPE_NONE;
+			table->area = 0;
+		}
+		table->hash = xxh64(data + offset, table->size, 0);
+
+		offset += table->size;
+	}
+
+	*out_tables = tables;
+	*out_count = count;
+	return SUCCESS;
+}
+
+const char* dat_table_type_name(uint32_t type) {
+	switch (type) {
+		case QUEST_DAT_TABLE_OBJECTS: return "Object";
+		case QUEST_DAT_TABLE_NPCS:    return "NPC";
+		case QUEST_DAT_TABLE_EVENTS:  return "Wave";
+		case 4:                       return "Challenge Mode Spawns";
+		case 5:                       return "Challenge Mode (?)";
+		case 0:                       return "EOF marker";
+		case DAT_TABLE_TYPE_NONE:     return "Not a table";
+		default:                      return "Unknown";
+	}
+}
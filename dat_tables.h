@@ -0,0 +1,32 @@
+#ifndef DAT_TABLES_H_INCLUDED
+#define DAT_TABLES_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "quests.h"
+
+/*
+ * Splits decompressed quest .dat data up into its tables (each a QUEST_DAT_TABLE_HEADER followed by the table body),
+ * so that identical tables can be found across different quests. Many quests, especially custom ones, re-use the same
+ * object, NPC or wave tables for the same areas.
+ *
+ * The tables returned always cover all of the data, one after the other. Anything at the end of the data that isn't a
+ * complete table (e.g. a table whose body runs past the end, or a byte or two of junk after a PRS decompression) is
+ * returned as a final table of type DAT_TABLE_TYPE_NONE.
+ */
+
+#define DAT_TABLE_TYPE_NONE            0xffffffff
+
+typedef struct {
+	uint32_t offset;               // of the table header, within the .dat data
+	uint32_t size;                 // header and body
+	uint32_t type;
+	uint32_t area;
+	uint64_t hash;                 // XXH64 of the header and body
+} DAT_TABLE;
+
+int dat_tables_split(const uint8_t *data, uint32_t size, DAT_TABLE **out_tables, uint32_t *out_count);
+const char* dat_table_type_name(uint32_t type);
+
+#endif
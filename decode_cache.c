@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <malloc.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#include "fuzziqer_prs.h"
+
+#include "retvals.h"
+#include "utils.h"
+#include "hash.h"
+#include "decode_cache.h"
+#include "quests.h"
+#include "stats.h"
+
+#define ENTRY_EXTENSION                ".pdc"
+
+// once the cache has grown past its maximum size, entries are removed until it is down to this much of it. this way
+// the cache directory only needs to be looked through once in a while, not on every write
+#define EVICT_TARGET_PERCENT           90
+
+typedef struct {
+	char path[FILENAME_MAX];
+	off_t size;
+	struct timespec last_used;
+} CACHE_FILE;
+
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+static char *cache_dir = NULL;
+static uint64_t cache_max_size = 0;
+static int next_temp_id = 0;
+
+// the total size of all of the entries, kept up to date as entries are written so that the cache directory doesn't
+// need to be looked through every time. other processes can be writing to the same cache, so it is only an estimate
+// until evict_entries() recounts it
+static pthread_mutex_t cache_size_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t cache_size = 0;
+static bool cache_size_known = false;
+
+static void load_config() {
+	const char *dir = getenv(DECODE_CACHE_DIR_ENV);
+	if (!dir || !dir[0])
+		return;
+
+	if (create_directory(dir)) {
+		printf("Unable to create decode cache directory %s. Continuing without it.\n", dir);
+		return;
+	}
+
+	uint64_t size_mb = DECODE_CACHE_DEFAULT_SIZE_MB;
+	const char *size = getenv(DECODE_CACHE_SIZE_ENV);
+	if (size && size[0])
+		size_mb = strtoull(size, NULL, 10);
+
+	cache_max_size = size_mb * 1024 * 1024;
+	cache_dir = strdup(dir);
+}
+
+static const char* get_cache_dir() {
+	pthread_once(&config_once, load_config);
+	return cache_dir;
+}
+
+static void get_entry_path(uint64_t compressed_hash, char *out_path, size_t out_path_size) {
+	char hash_string[HASH_STRING_LENGTH + 1];
+	hash_to_string(compressed_hash, hash_string);
+	snprintf(out_path, out_path_size, "%s/%s%s", cache_dir, hash_string, ENTRY_EXTENSION);
+}
+
+static bool is_matching_entry(const DECODE_CACHE_ENTRY_HEADER *header, uint64_t compressed_hash, size_t compressed_size) {
+	return !memcmp(header->magic, DECODE_CACHE_MAGIC, sizeof(header->magic)) &&
+	       header->compressed_hash == compressed_hash &&
+	       header->compressed_size == compressed_size;
+}
+
+static int compare_cache_files_by_last_used(const void *a, const void *b) {
+	const CACHE_FILE *file_a = (const CACHE_FILE*)a;
+	const CACHE_FILE *file_b = (const CACHE_FILE*)b;
+	if (file_a->last_used.tv_sec != file_b->last_used.tv_sec)
+		return (file_a->last_used.tv_sec < file_b->last_used.tv_sec) ? -1 : 1;
+	if (file_a->last_used.tv_nsec != file_b->last_used.tv_nsec)
+		return (file_a->last_used.tv_nsec < file_b->last_used.tv_nsec) ? -1 : 1;
+	return 0;
+}
+
+// adds up the size of every entry in the cache, and if that is more than the configured maximum, removes least
+// recently used entries (by modification time, which is updated on every cache hit) until it is down to
+// EVICT_TARGET_PERCENT of the maximum. returns the total size of the entries left
+static uint64_t evict_entries() {
+	DIR *dir = opendir(cache_dir);
+	if (!dir)
+		return 0;
+
+	CACHE_FILE *files = NULL;
+	size_t num_files = 0, capacity = 0;
+	uint64_t total_size = 0;
+	struct dirent *dirent;
+	struct stat st;
+
+	while ((dirent = readdir(dir))) {
+		if (!string_ends_with(dirent->d_name, ENTRY_EXTENSION))
+			continue;
+
+		if (num_files == capacity) {
+			capacity = capacity ? capacity * 2 : 256;
+			CACHE_FILE *new_files = realloc(files, capacity * sizeof(CACHE_FILE));
+			if (!new_files)
+				goto quit;
+			files = new_files;
+		}
+
+		CACHE_FILE *file = &files[num_files];
+		snprintf(file->path, sizeof(file->path), "%s/%s", cache_dir, dirent->d_name);
+		if (stat(file->path, &st))
+			continue;
+		file->size = st.st_size;
+		file->last_used = st.st_mtim;
+		total_size += st.st_size;
+		++num_files;
+	}
+
+	if (total_size <= cache_max_size)
+		goto quit;
+
+	uint64_t target_size = (cache_max_size / 100) * EVICT_TARGET_PERCENT;
+	qsort(files, num_files, sizeof(CACHE_FILE), compare_cache_files_by_last_used);
+	for (size_t i = 0; i < num_files && total_size > target_size; ++i) {
+		if (!unlink(files[i].path))
+			total_size -= files[i].size;
+	}
+
+quit:
+	free(files);
+	closedir(dir);
+	return total_size;
+}
+
+// counts a newly written entry towards the total size of the cache, and evicts entries if that is now too big
+static void add_to_cache_size(size_t entry_size) {
+	pthread_mutex_lock(&cache_size_mutex);
+	if (!cache_size_known) {
+		// the first entry written by this process. the new entry is already in the directory, so it is counted too
+		cache_size = evict_entries();
+		cache_size_known = true;
+	} else {
+		cache_size += entry_size;
+		if (cache_size > cache_max_size)
+			cache_size = evict_entries();
+	}
+	pthread_mutex_unlock(&cache_size_mutex);
+}
+
+static int read_entry(uint64_t compressed_hash, size_t compressed_size, uint8_t **dst, ARENA *arena) {
+	char path[FILENAME_MAX];
+	struct stat st;
+	int result = -1;
+
+	get_entry_path(compressed_hash, path, sizeof(path));
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(DECODE_CACHE_ENTRY_HEADER))
+		goto quit;
+
+	const uint8_t *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapped == MAP_FAILED)
+		goto quit;
+
+	const DECODE_CACHE_ENTRY_HEADER *header = (const DECODE_CACHE_ENTRY_HEADER*)mapped;
+	const uint8_t *data = mapped + sizeof(DECODE_CACHE_ENTRY_HEADER);
+	if (is_matching_entry(header, compressed_hash, compressed_size) &&
+	    (sizeof(DECODE_CACHE_ENTRY_HEADER) + header->decompressed_size) == (size_t)st.st_size &&
+	    xxh64(data, header->decompressed_size, 0) == header->decompressed_hash) {
+		*dst = arena_alloc(arena, header->decompressed_size);
+		if (*dst) {
+			memcpy(*dst, data, header->decompressed_size);
+			result = (int)header->decompressed_size;
+		}
+	}
+
+	munmap((void*)mapped, st.st_size);
+
+	// mark this entry as recently used
+	if (result >= 0)
+		futimens(fd, NULL);
+
+quit:
+	close(fd);
+	return result;
+}
+
+static void write_entry(uint64_t compressed_hash, size_t compressed_size, const uint8_t *data, size_t size) {
+	char path[FILENAME_MAX];
+	char temp_path[FILENAME_MAX + 32];
+	DECODE_CACHE_ENTRY_HEADER header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DECODE_CACHE_MAGIC, sizeof(header.magic));
+	header.compressed_size = compressed_size;
+	header.compressed_hash = compressed_hash;
+	header.decompressed_hash = xxh64(data, size, 0);
+	header.decompressed_size = size;
+	header.validation_result = DECODE_CACHE_NOT_VALIDATED;
+
+	get_entry_path(compressed_hash, path, sizeof(path));
+	// unique per process and per thread, as several threads could be writing out the same entry at the same time
+	int temp_id = __atomic_fetch_add(&next_temp_id, 1, __ATOMIC_RELAXED);
+	int length = snprintf(temp_path, sizeof(temp_path), "%s.tmp%d.%d", path, (int)getpid(), temp_id);
+	if (length < 0 || (size_t)length >= sizeof(temp_path))
+		return;
+
+	FILE *fp = fopen(temp_path, "wb");
+	if (!fp)
+		return;
+
+	bool written = (fwrite(&header, sizeof(header), 1, fp) == 1) &&
+	               (size == 0 || fwrite(data, size, 1, fp) == 1);
+	fclose(fp);
+
+	if (!written || rename(temp_path, path)) {
+		remove(temp_path);
+		return;
+	}
+
+	add_to_cache_size(sizeof(header) + size);
+}
+
+/*
+ * Drop-in replacement for fuzziqer_prs_decompress_buf() which returns the cached decompressed data if the same
+ * compressed data has been decompressed before. If the decode cache is not enabled, this just decompresses.
+ */
+int decode_cache_decompress_buf(const uint8_t *src, uint8_t **dst, size_t src_len) {
+	return decode_cache_decompress_buf_ex(src, dst, src_len, NULL);
+}
+
+int decode_cache_decompress_buf_ex(const uint8_t *src, uint8_t **dst, size_t src_len, ARENA *arena) {
+	if (!get_cache_dir())
+		return fuzziqer_prs_decompress_buf_ex(src, dst, src_len, arena);
+
+	if (!src || !dst)
+		return -1;
+
+	uint64_t start = stats_start();
+	uint64_t compressed_hash = xxh64(src, src_len, 0);
+	int result = read_entry(compressed_hash, src_len, dst, arena);
+	if (result >= 0) {
+		stats_end(STATS_PRS_DECODE_CACHED, start, result);
+		return result;
+	}
+
+	result = fuzziqer_prs_decompress_buf_ex(src, dst, src_len, arena);
+	if (result >= 0)
+		write_entry(compressed_hash, src_len, *dst, result);
+
+	return result;
+}
+
+/*
+ * Returns true and the previously recorded validation result for the decompressed version of this compressed data,
+ * if there is one.
+ */
+bool decode_cache_get_validation(const uint8_t *src, size_t src_len, int *out_validation_result) {
+	if (!get_cache_dir() || !src || !out_validation_result)
+		return false;
+
+	char path[FILENAME_MAX];
+	DECODE_CACHE_ENTRY_HEADER header;
+	uint64_t compressed_hash = xxh64(src, src_len, 0);
+	get_entry_path(compressed_hash, path, sizeof(path));
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return false;
+	ssize_t bytes_read = read(fd, &header, sizeof(header));
+	close(fd);
+
+	if (bytes_read != sizeof(header) ||
+	    !is_matching_entry(&header, compressed_hash, src_len) ||
+	    header.validation_result == DECODE_CACHE_NOT_VALIDATED)
+		return false;
+
+	*out_validation_result = header.validation_result;
+	return true;
+}
+
+void decode_cache_set_validation(const uint8_t *src, size_t src_len, int validation_result) {
+	if (!get_cache_dir() || !src)
+		return;
+
+	char path[FILENAME_MAX];
+	DECODE_CACHE_ENTRY_HEADER header;
+	uint64_t compressed_hash = xxh64(src, src_len, 0);
+	get_entry_path(compressed_hash, path, sizeof(path));
+
+	int fd = open(path, O_RDWR);
+	if (fd == -1)
+		return;
+
+	int32_t value = validation_result;
+	if (read(fd, &header, sizeof(header)) == sizeof(header) && is_matching_entry(&header, compressed_hash, src_len))
+		pwrite(fd, &value, sizeof(value), offsetof(DECODE_CACHE_ENTRY_HEADER, validation_result));
+
+	close(fd);
+}
+
+int decode_cache_load_quest_from_qst(const char *filename, uint8_t **out_bin, size_t *out_bin_size, uint8_t **out_dat, size_t *out_dat_size, int *out_qst_type) {
+	return decode_cache_load_quest_from_qst_ex(filename, out_bin, out_bin_size, out_dat, out_dat_size, out_qst_type, NULL, NULL, NULL, NULL);
+}
+
+/*
+ * Loads a .qst file of either type, and decompresses its .bin and .dat data (decrypting it first, for download .qst
+ * files). The sizes returned are the real sizes of the data, without any junk left on the end by decompressing. If
+ * out_compressed_bin is not NULL, the compressed (and decrypted) .bin data is returned through it as well.
+ */
+int decode_cache_load_quest_from_qst_ex(const char *filename,
+                                        uint8_t **out_bin,
+                                        size_t *out_bin_size,
+                                        uint8_t **out_dat,
+                                        size_t *out_dat_size,
+                                        int *out_qst_type,
+                                        char *out_bin_filename,
+                                        char *out_dat_filename,
+                                        uint8_t **out_compressed_bin,
+                                        size_t *out_compressed_bin_size) {
+	int returncode, result;
+	uint8_t *bin_data = NULL, *dat_data = NULL;
+	uint8_t *bin = NULL, *dat = NULL;
+	size_t bin_data_size, dat_data_size;
+	size_t bin_size = 0, dat_size = 0;
+
+	if (!filename || !out_bin || !out_bin_size || !out_dat || !out_dat_size || !out_qst_type)
+		return ERROR_INVALID_PARAMS;
+
+	returncode = load_quest_from_qst_ex(filename, &bin_data, &bin_data_size, &dat_data, &dat_data_size, out_qst_type, out_bin_filename, out_dat_filename);
+	if (returncode)
+		goto error;
+
+	if (*out_qst_type == QST_TYPE_DOWNLOAD) {
+		if (bin_data_size < sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER) || dat_data_size < sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER)) {
+			returncode = ERROR_BAD_DATA;
+			goto error;
+		}
+
+		// the decompressed sizes here include the DOWNLOAD_QUEST_CHUNKS_HEADER
+		bin_size = ((DOWNLOAD_QUEST_CHUNKS_HEADER*)bin_data)->decompressed_size;
+		dat_size = ((DOWNLOAD_QUEST_CHUNKS_HEADER*)dat_data)->decompressed_size;
+		if (bin_size < sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER) || dat_size < sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER)) {
+			returncode = ERROR_BAD_DATA;
+			goto error;
+		}
+		bin_size -= sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
+		dat_size -= sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
+
+		returncode = decrypt_qst_bindat(bin_data, &bin_data_size, dat_data, &dat_data_size);
+		if (returncode)
+			goto error;
+	}
+
+	result = decode_cache_decompress_buf(bin_data, &bin, bin_data_size);
+	if (result < 0) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+	if (*out_qst_type != QST_TYPE_DOWNLOAD)
+		bin_size = trim_decompressed_bin_junk(bin, result);
+	else if (bin_size > (size_t)result)
+		bin_size = result;
+
+	result = decode_cache_decompress_buf(dat_data, &dat, dat_data_size);
+	if (result < 0) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+	if (*out_qst_type != QST_TYPE_DOWNLOAD)
+		dat_size = trim_decompressed_dat_junk(dat, result);
+	else if (dat_size > (size_t)result)
+		dat_size = result;
+
+	if (out_compressed_bin) {
+		*out_compressed_bin = bin_data;
+		*out_compressed_bin_size = bin_data_size;
+		bin_data = NULL;
+	}
+
+	*out_bin = bin;
+	*out_bin_size = bin_size;
+	*out_dat = dat;
+	*out_dat_size = dat_size;
+	free(bin_data);
+	free(dat_data);
+	return SUCCESS;
+
+error:
+	free(bin_data);
+	free(dat_data);
+	free(bin);
+	free(dat);
+	return returncode;
+}
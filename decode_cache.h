@@ -0,0 +1,56 @@
+#ifndef DECODE_CACHE_H_INCLUDED
+#define DECODE_CACHE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "arena.h"
+
+/*
+ * An optional on-disk cache of PRS-decompressed data, keyed by the XXH64 hash of the compressed data. It is enabled
+ * by setting these environment variables:
+ *
+ * PSO_DECODE_CACHE         directory to keep the cache in (it will be created if it does not exist)
+ * PSO_DECODE_CACHE_SIZE    maximum total size of the cache, in megabytes. optional, defaults to 256
+ *
+ * When the cache grows past its maximum size, the least recently used entries are removed until it is back down to
+ * 90% of it.
+ */
+
+#define DECODE_CACHE_DIR_ENV           "PSO_DECODE_CACHE"
+#define DECODE_CACHE_SIZE_ENV          "PSO_DECODE_CACHE_SIZE"
+#define DECODE_CACHE_DEFAULT_SIZE_MB   256
+
+#define DECODE_CACHE_MAGIC             "PDC1"
+#define DECODE_CACHE_NOT_VALIDATED     -1
+
+// each cache entry is a file containing this header, immediately followed by the decompressed data. the header is
+// padded out to 32 bytes so that the data is nicely aligned when the file is mmap'd
+typedef struct _PACKED_ {
+	char magic[4];
+	uint32_t compressed_size;
+	uint64_t compressed_hash;
+	uint64_t decompressed_hash;
+	uint32_t decompressed_size;
+	// result of validate_quest_bin / validate_quest_dat on the decompressed data, or DECODE_CACHE_NOT_VALIDATED
+	int32_t validation_result;
+} DECODE_CACHE_ENTRY_HEADER;
+
+int decode_cache_decompress_buf(const uint8_t *src, uint8_t **dst, size_t src_len);
+int decode_cache_decompress_buf_ex(const uint8_t *src, uint8_t **dst, size_t src_len, ARENA *arena);
+bool decode_cache_get_validation(const uint8_t *src, size_t src_len, int *out_validation_result);
+void decode_cache_set_validation(const uint8_t *src, size_t src_len, int validation_result);
+int decode_cache_load_quest_from_qst(const char *filename, uint8_t **out_bin, size_t *out_bin_size, uint8_t **out_dat, size_t *out_dat_size, int *out_qst_type);
+int decode_cache_load_quest_from_qst_ex(const char *filename,
+                                        uint8_t **out_bin,
+                                        size_t *out_bin_size,
+                                        uint8_t **out_dat,
+                                        size_t *out_dat_size,
+                                        int *out_qst_type,
+                                        char *out_bin_filename,
+                                        char *out_dat_filename,
+                                        uint8_t **out_compressed_bin,
+                                        size_t *out_compressed_bin_size);
+
+#endif
@@ -12,43 +12,48 @@
  *
  * Given two binary files containing server->client and client->server packet data (separately), as long as the
  * packet data was captured from the very beginning of the connection, this will decrypt the packet data and display
- * it as raw packets.
+ * it as raw packets. If the capture is missing the "Welcome" packet with the keys in it, the keys are searched for
+ * instead (see crypt_search.h).
  *
  * Gered King, March 2021
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <malloc.h>
 
 #include <sylverant/encryption.h>
 
 #include "defs.h"
+#include "retvals.h"
+#include "session.h"
+#include "crypt_search.h"
+#include "batch.h"
 #include "utils.h"
+#include "stats.h"
 
-typedef struct _PACKED_ {
-	uint8_t pkt_id;
-	uint8_t pkt_flags;
-	uint16_t pkt_size;
-} PACKET_HEADER;
-
-typedef struct _PACKED_ {
-	PACKET_HEADER header;
-	char message[64];
-	uint32_t server_key;
-	uint32_t client_key;
-	// note: there may be more data. if so, it is likely just more text which can be ignored. check header.pkt_size
-} WELCOME_PACKET;
+#define MAX_KNOWN_HEADERS              16
 
 void decrypt_and_display_packets(CRYPT_SETUP *cs, uint8_t *packet_data, size_t size) {
 	size_t pos = 0;
 
+	uint64_t start = stats_start();
 	CRYPT_CryptData(cs, packet_data, size, 0);
+	stats_end(STATS_DECRYPT, start, size);
 
 	while (pos < size) {
 		PACKET_HEADER *header = (PACKET_HEADER*)&packet_data[pos];
 
 		printf("id=%x, flags=%x, size=%d\n", header->pkt_id, header->pkt_flags, header->pkt_size);
+		if (header->pkt_size < sizeof(PACKET_HEADER) || header->pkt_size > (size - pos)) {
+			// most likely the capture ends part way through this packet
+			printf("Bad or truncated packet, stopping here. Remaining data:\n");
+			CRYPT_PrintData(&packet_data[pos], size - pos);
+			printf("\n");
+			break;
+		}
 		CRYPT_PrintData(&packet_data[pos], header->pkt_size);
 		printf("\n");
 
@@ -56,18 +61,92 @@ void decrypt_and_display_packets(CRYPT_SETUP *cs, uint8_t *packet_data, size_t s
 	}
 }
 
+int recover_key(const char *name, const uint8_t *data, size_t size, const CRYPT_SEARCH_KNOWN_WORD *known, int num_known, uint32_t max_offset, int num_workers, CRYPT_SETUP *out_cs) {
+	CRYPT_SEARCH_RESULT results[CRYPT_SEARCH_MAX_RESULTS];
+	int num_results;
+
+	printf("Searching for the %s key ...\n", name);
+	int returncode = crypt_search_gamecube_key(data, size, known, num_known, max_offset, num_workers, results, &num_results);
+	if (returncode) {
+		printf("Error code %d (%s) searching for the %s key.\n", returncode, get_error_message(returncode), name);
+		return returncode;
+	}
+
+	if (num_results > 1) {
+		// any one of these could be right, and decrypting with the wrong one would only display garbage
+		printf("%d possible %s keys were found, so the right one can't be picked:\n", num_results, name);
+		for (int i = 0; i < num_results && i < CRYPT_SEARCH_MAX_RESULTS; ++i)
+			printf("%s_key = 0x%x (%u bytes into the encrypted %s data)\n", name, results[i].seed, results[i].offset * 4, name);
+		printf("The %s data may be too short to tell them apart. Using --header to give only the first packet's header may help.\n", name);
+		return ERROR_NOT_FOUND;
+	}
+
+	printf("%s_key = 0x%x (%u bytes into the encrypted %s data)\n\n", name, results[0].seed, results[0].offset * 4, name);
+	CRYPT_CreateKeys(out_cs, &results[0].seed, CRYPT_GAMECUBE);
+	crypt_skip_words(out_cs, results[0].offset);
+	return SUCCESS;
+}
+
+// parses a "id:size" pair of hex numbers, e.g. "a7:418", or "id:*" for a packet id with any size, e.g. "6c:*"
+bool parse_known_header(const char *s, CRYPT_SEARCH_KNOWN_WORD *out_known) {
+	char *end;
+	unsigned long id = strtoul(s, &end, 16);
+	if (end == s || *end != ':' || id > 0xff)
+		return false;
+
+	const char *size_s = end + 1;
+	if (!strcmp(size_s, "*")) {
+		CRYPT_SEARCH_KNOWN_WORD known = CRYPT_SEARCH_KNOWN_ID(id);
+		*out_known = known;
+		return true;
+	}
+
+	unsigned long size = strtoul(size_s, &end, 16);
+	if (end == size_s || *end || size < sizeof(PACKET_HEADER) || size >= CRYPT_SEARCH_MAX_PACKET_SIZE || (size % 4) != 0)
+		return false;
+
+	CRYPT_SEARCH_KNOWN_WORD known = CRYPT_SEARCH_KNOWN_HEADER(id, size);
+	*out_known = known;
+	return true;
+}
+
 int main(int argc, char *argv[]) {
 	int returncode;
 	uint8_t *server_data = NULL;
 	uint8_t *client_data = NULL;
 
-	if (argc != 3) {
-		printf("Usage: decrypt_packets server-packet-data.bin client-packet-data.bin\n");
+	CRYPT_SEARCH_KNOWN_WORD known[MAX_KNOWN_HEADERS];
+	int num_known = 0;
+	long long max_offset = 0;
+	int num_workers = batch_get_default_num_workers();
+
+	stats_parse_args(&argc, argv);
+
+	int argi = 1;
+	bool valid_args = true;
+	while (argi < argc && argv[argi][0] == '-') {
+		if (!strcmp(argv[argi], "--max-offset") && (argi + 1) < argc) {
+			max_offset = atoll(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "--header") && (argi + 1) < argc && num_known < MAX_KNOWN_HEADERS) {
+			if (!parse_known_header(argv[argi + 1], &known[num_known++]))
+				valid_args = false;
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-j") && (argi + 1) < argc) {
+			num_workers = atoi(argv[argi + 1]);
+			argi += 2;
+		} else {
+			break;
+		}
+	}
+
+	if (!valid_args || (argc - argi) != 2 || max_offset < 0 || max_offset > 0xfffffffcLL || (max_offset % 4) != 0 || num_workers < 1) {
+		printf("Usage: decrypt_packets [--stats] [--max-offset bytes] [--header id:size|id:* ...] [-j num-threads] server-packet-data.bin client-packet-data.bin\n");
 		return 1;
 	}
 
-	const char *server_packet_file = argv[1];
-	const char *client_packet_file = argv[2];
+	const char *server_packet_file = argv[argi];
+	const char *client_packet_file = argv[argi + 1];
 
 	uint32_t server_data_size = 0;
 	returncode = read_file(server_packet_file, &server_data, &server_data_size);
@@ -84,11 +163,32 @@ int main(int argc, char *argv[]) {
 	}
 
 	WELCOME_PACKET *welcome = (WELCOME_PACKET*)server_data;
-	if (welcome->header.pkt_id != 0x02 && welcome->header.pkt_id != 0x17) {
+	if (server_data_size < sizeof(WELCOME_PACKET) || (welcome->header.pkt_id != PACKET_ID_WELCOME && welcome->header.pkt_id != PACKET_ID_WELCOME_PATCH)) {
 		printf("Missing or unrecognized 'Welcome' packet:\n\n");
-		CRYPT_PrintData(welcome, sizeof(WELCOME_PACKET));
-		printf("\nWill not be able to successfully decrypt session. Aborting.\n");
-		goto error;
+		CRYPT_PrintData(server_data, server_data_size < sizeof(WELCOME_PACKET) ? server_data_size : sizeof(WELCOME_PACKET));
+		printf("\nThe keys will have to be searched for instead.\n\n");
+
+		if (!num_known) {
+			num_known = crypt_search_num_default_known_words;
+			memcpy(known, crypt_search_default_known_words, num_known * sizeof(CRYPT_SEARCH_KNOWN_WORD));
+		}
+
+		CRYPT_SETUP server_cs, client_cs;
+		if (server_data_size >= sizeof(PACKET_HEADER)) {
+			if (recover_key("server", server_data, server_data_size, known, num_known, max_offset / 4, num_workers, &server_cs))
+				goto error;
+			printf("**** SERVER -> CLIENT PACKETS ****\n\n");
+			decrypt_and_display_packets(&server_cs, server_data, server_data_size);
+		}
+		if (client_data_size >= sizeof(PACKET_HEADER)) {
+			if (recover_key("client", client_data, client_data_size, known, num_known, max_offset / 4, num_workers, &client_cs))
+				goto error;
+			printf("**** CLIENT -> SERVER PACKETS ****\n\n");
+			decrypt_and_display_packets(&client_cs, client_data, client_data_size);
+		}
+
+		returncode = 0;
+		goto quit;
 	}
 
 	// read client & server crypt keys from the "Welcome" packet the server sends right away. always unencrypted.
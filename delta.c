@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "retvals.h"
+#include "delta.h"
+
+// how many earlier places in the old data with the same hash are checked, for each place in the new data
+#define DELTA_MAX_CANDIDATES           32
+
+#define DELTA_HASH_MULTIPLIER          0x01000193u
+
+typedef struct {
+	uint8_t *data;
+	size_t pos;
+} DELTA_WRITER;
+
+static void put_varint(DELTA_WRITER *writer, uint64_t value) {
+	while (value >= 0x80) {
+		writer->data[writer->pos++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	writer->data[writer->pos++] = (uint8_t)value;
+}
+
+static int get_varint(const uint8_t *data, size_t size, size_t *pos, uint64_t *out_value) {
+	uint64_t value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (*pos >= size)
+			return ERROR_BAD_DATA;
+		uint8_t b = data[(*pos)++];
+		value |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*out_value = value;
+			return SUCCESS;
+		}
+	}
+
+	return ERROR_BAD_DATA;
+}
+
+static void put_insert(DELTA_WRITER *writer, const uint8_t *data, size_t length, DELTA_STATS *stats) {
+	if (!length)
+		return;
+
+	put_varint(writer, (uint64_t)length << 1);
+	memcpy(writer->data + writer->pos, data, length);
+	writer->pos += length;
+
+	++stats->num_inserts;
+	stats->inserted_bytes += length;
+}
+
+static void put_copy(DELTA_WRITER *writer, size_t offset, size_t length, size_t *last_copy_end, DELTA_STATS *stats) {
+	int64_t relative_offset = (int64_t)offset - (int64_t)*last_copy_end;
+
+	put_varint(writer, ((uint64_t)length << 1) | 1);
+	put_varint(writer, ((uint64_t)relative_offset << 1) ^ (uint64_t)(relative_offset >> 63));
+	*last_copy_end = offset + length;
+
+	++stats->num_copies;
+	stats->copied_bytes += length;
+}
+
+// the rolling hash of DELTA_MIN_MATCH_LENGTH bytes starting at data
+static uint32_t window_hash(const uint8_t *data) {
+	uint32_t hash = 0;
+	for (int i = 0; i < DELTA_MIN_MATCH_LENGTH; ++i)
+		hash = (hash * DELTA_HASH_MULTIPLIER) + data[i];
+	return hash;
+}
+
+static uint32_t hash_bucket(uint32_t hash, int bits) {
+	return (hash * 0x9e3779b1u) >> (32 - bits);
+}
+
+/*
+ * Builds a delta that turns old_data into new_data. Every DELTA_MIN_MATCH_LENGTH byte run in the old data is indexed
+ * by a rolling hash, which is then rolled along the new data one byte at a time looking for runs that are also in the
+ * old data. Each one found is extended as far as it goes in both directions and becomes a copy, and whatever is left
+ * in between becomes inserts.
+ *
+ * The delta is allocated with malloc. If out_stats is not NULL, it is filled in with the number and total size of the
+ * copies and inserts in the delta.
+ */
+int delta_create(const uint8_t *old_data,
+                 size_t old_size,
+                 const uint8_t *new_data,
+                 size_t new_size,
+                 uint8_t **out_delta,
+                 size_t *out_delta_size,
+                 DELTA_STATS *out_stats) {
+	int returncode;
+	int32_t *heads = NULL;
+	int32_t *chain = NULL;
+	DELTA_WRITER writer = { NULL, 0 };
+	DELTA_STATS stats;
+
+	if ((!old_data && old_size) || (!new_data && new_size) || !out_delta || !out_delta_size)
+		return ERROR_INVALID_PARAMS;
+	if (old_size > INT32_MAX || new_size > INT32_MAX)
+		return ERROR_INVALID_PARAMS;
+
+	memset(&stats, 0, sizeof(stats));
+
+	// every copy is at least DELTA_MIN_MATCH_LENGTH bytes and costs at most 15 bytes, and there can't be more inserts
+	// than copies, plus one
+	size_t max_copies = (new_size / DELTA_MIN_MATCH_LENGTH) + 1;
+	writer.data = malloc(new_size + (max_copies * 15) + ((max_copies + 1) * 5));
+	if (!writer.data)
+		return ERROR_IO;
+
+	// DELTA_HASH_MULTIPLIER to the power of DELTA_MIN_MATCH_LENGTH - 1, for rolling the hash along
+	uint32_t top = 1;
+	for (int j = 1; j < DELTA_MIN_MATCH_LENGTH; ++j)
+		top *= DELTA_HASH_MULTIPLIER;
+
+	int hash_bits = 8;
+	while (hash_bits < 24 && ((size_t)1 << hash_bits) < old_size)
+		++hash_bits;
+
+	if (old_size >= DELTA_MIN_MATCH_LENGTH) {
+		heads = malloc(sizeof(int32_t) << hash_bits);
+		chain = malloc(sizeof(int32_t) * old_size);
+		if (!heads || !chain) {
+			returncode = ERROR_IO;
+			goto error;
+		}
+		memset(heads, 0xff, sizeof(int32_t) << hash_bits);
+
+		uint32_t hash = window_hash(old_data);
+		for (size_t i = 0; i + DELTA_MIN_MATCH_LENGTH <= old_size; ++i) {
+			if (i)
+				hash = (hash * DELTA_HASH_MULTIPLIER) + old_data[i + DELTA_MIN_MATCH_LENGTH - 1];
+			uint32_t bucket = hash_bucket(hash, hash_bits);
+			chain[i] = heads[bucket];
+			heads[bucket] = (int32_t)i;
+			// remove the byte that is leaving the window, ready for the next one to be added
+			hash -= top * old_data[i];
+		}
+	}
+
+	size_t insert_start = 0, last_copy_end = 0, i = 0;
+	uint32_t hash = 0;
+	bool hash_valid = false;
+
+	while (heads && i + DELTA_MIN_MATCH_LENGTH <= new_size) {
+		if (!hash_valid) {
+			hash = window_hash(new_data + i);
+			hash_valid = true;
+		}
+
+		size_t best_offset = 0, best_length = 0;
+		int32_t candidate = heads[hash_bucket(hash, hash_bits)];
+		for (int n = 0; candidate >= 0 && n < DELTA_MAX_CANDIDATES; ++n, candidate = chain[candidate]) {
+			const uint8_t *old_match = old_data + candidate;
+			if (memcmp(old_match, new_data + i, DELTA_MIN_MATCH_LENGTH))
+				continue;
+
+			size_t max_length = old_size - candidate;
+			if (max_length > new_size - i)
+				max_length = new_size - i;
+			size_t length = DELTA_MIN_MATCH_LENGTH;
+			while (length < max_length && old_match[length] == new_data[i + length])
+				++length;
+
+			if (length > best_length) {
+				best_offset = candidate;
+				best_length = length;
+				if (length == max_length)
+					break;
+			}
+		}
+
+		if (best_length) {
+			// the match may well have started a bit earlier, in what would otherwise be inserted
+			while (i > insert_start && best_offset > 0 && old_data[best_offset - 1] == new_data[i - 1]) {
+				--i;
+				--best_offset;
+				++best_length;
+			}
+
+			put_insert(&writer, new_data + insert_start, i - insert_start, &stats);
+			put_copy(&writer, best_offset, best_length, &last_copy_end, &stats);
+			i += best_length;
+			insert_start = i;
+			hash_valid = false;
+		} else {
+			if (i + DELTA_MIN_MATCH_LENGTH < new_size)
+				hash = ((hash - (top * new_data[i])) * DELTA_HASH_MULTIPLIER) + new_data[i + DELTA_MIN_MATCH_LENGTH];
+			++i;
+		}
+	}
+
+	put_insert(&writer, new_data + insert_start, new_size - insert_start, &stats);
+
+	uint8_t *delta = realloc(writer.data, writer.pos ? writer.pos : 1);
+	*out_delta = delta ? delta : writer.data;
+	*out_delta_size = writer.pos;
+	writer.data = NULL;
+	if (out_stats)
+		*out_stats = stats;
+	returncode = SUCCESS;
+
+error:
+	free(heads);
+	free(chain);
+	free(writer.data);
+	return returncode;
+}
+
+/*
+ * Applies a delta made by delta_create to old_data, giving new_data, which must come out exactly new_size bytes long.
+ * The new data is allocated with malloc. Returns ERROR_BAD_DATA if the delta does not fit the old data or the size.
+ */
+int delta_apply(const uint8_t *old_data,
+                size_t old_size,
+                const uint8_t *delta,
+                size_t delta_size,
+                uint8_t **out_new_data,
+                size_t new_size) {
+	int returncode;
+	size_t pos = 0, new_pos = 0, last_copy_end = 0;
+	uint64_t op, value;
+
+	if ((!old_data && old_size) || (!delta && delta_size) || !out_new_data)
+		return ERROR_INVALID_PARAMS;
+
+	uint8_t *new_data = malloc(new_size ? new_size : 1);
+	if (!new_data)
+		return ERROR_IO;
+
+	while (pos < delta_size) {
+		returncode = get_varint(delta, delta_size, &pos, &op);
+		if (returncode)
+			goto error;
+
+		uint64_t length = op >> 1;
+		if (!length || length > (new_size - new_pos)) {
+			returncode = ERROR_BAD_DATA;
+			goto error;
+		}
+
+		if (op & 1) {
+			returncode = get_varint(delta, delta_size, &pos, &value);
+			if (returncode)
+				goto error;
+
+			int64_t relative_offset = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+			int64_t offset = (int64_t)last_copy_end + relative_offset;
+			if (offset < 0 || (uint64_t)offset > old_size || length > (old_size - (uint64_t)offset)) {
+				returncode = ERROR_BAD_DATA;
+				goto error;
+			}
+
+			memcpy(new_data + new_pos, old_data + offset, length);
+			last_copy_end = offset + length;
+		} else {
+			if (length > (delta_size - pos)) {
+				returncode = ERROR_BAD_DATA;
+				goto error;
+			}
+
+			memcpy(new_data + new_pos, delta + pos, length);
+			pos += length;
+		}
+
+		new_pos += length;
+	}
+
+	if (new_pos != new_size) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+
+	*out_new_data = new_data;
+	return SUCCESS;
+
+error:
+	free(new_data);
+	return returncode;
+}
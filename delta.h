@@ -0,0 +1,47 @@
+#ifndef DELTA_H_INCLUDED
+#define DELTA_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Binary deltas between two versions of some data, made up of a sequence of operations that build the new data:
+ *
+ * copy      copies a run of bytes from somewhere in the old data
+ * insert    inserts a run of bytes that are given in the delta itself
+ *
+ * Every operation starts with a varint (7 bits per byte, least significant first, top bit set on all but the last
+ * byte) of (length << 1) | 1 for a copy, or (length << 1) for an insert. A copy is followed by a zigzag-encoded varint
+ * of where it copies from, relative to the end of the previous copy (or the start of the old data for the first one),
+ * so that runs of copies from the same part of the old data cost only a byte or two each. An insert is followed by the
+ * bytes to insert.
+ *
+ * The delta does not contain the size of the new data, or anything to check that it is being applied to the right
+ * old data. Whatever stores the delta needs to keep track of those.
+ */
+
+// the shortest run of bytes the matcher will look for in the old data. shorter runs are inserted
+#define DELTA_MIN_MATCH_LENGTH         8
+
+typedef struct {
+	uint32_t num_copies;
+	uint32_t num_inserts;
+	size_t copied_bytes;
+	size_t inserted_bytes;
+} DELTA_STATS;
+
+int delta_create(const uint8_t *old_data,
+                 size_t old_size,
+                 const uint8_t *new_data,
+                 size_t new_size,
+                 uint8_t **out_delta,
+                 size_t *out_delta_size,
+                 DELTA_STATS *out_stats);
+int delta_apply(const uint8_t *old_data,
+                size_t old_size,
+                const uint8_t *delta,
+                size_t delta_size,
+                uint8_t **out_new_data,
+                size_t new_size);
+
+#endif
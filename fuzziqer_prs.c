@@ -38,12 +38,41 @@
 */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <malloc.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "fuzziqer_prs.h"
+#include "stats.h"
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef PRS_TOKEN_STATS
+static PRS_TOKEN_COUNTS compress_stats;
+static PRS_TOKEN_COUNTS decompress_stats;
+
+static void count_copy(PRS_TOKEN_COUNTS *stats, int offset, uint32_t size) {
+	int distance = (offset < 0) ? -offset : offset;
+	int bucket = 0;
+	while ((distance >> (bucket + 1)) && bucket < (PRS_STATS_OFFSET_BUCKETS - 1))
+		++bucket;
+	stats->offset_histogram[bucket]++;
+	stats->length_histogram[(size <= PRS_STATS_MAX_LENGTH) ? size : PRS_STATS_MAX_LENGTH]++;
+}
+
+#define COUNT_RAW_BYTE(stats)                    (stats).raw_bytes++
+#define COUNT_COPY(stats, type, offset, size)    do { (stats).type##_copies++; \
+                                                      (stats).type##_copy_bytes += (size); \
+                                                      count_copy(&(stats), (offset), (size)); } while (0)
+#else
+#define COUNT_RAW_BYTE(stats)
+#define COUNT_COPY(stats, type, offset, size)
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -117,12 +146,14 @@ static void prs_finish(PRS_COMPRESSOR *pc) {
 }
 
 static void prs_rawbyte(PRS_COMPRESSOR *pc) {
+	COUNT_RAW_BYTE(compress_stats);
 	prs_put_control_bit_nosave(pc, 1);
 	prs_put_static_data(pc, prs_get_static_data(pc));
 	prs_put_control_save(pc);
 }
 
 static void prs_shortcopy(PRS_COMPRESSOR *pc, int offset, uint8_t size) {
+	COUNT_COPY(compress_stats, short, offset, size);
 	size -= 2;
 	prs_put_control_bit(pc, 0);
 	prs_put_control_bit(pc, 0);
@@ -135,12 +166,14 @@ static void prs_shortcopy(PRS_COMPRESSOR *pc, int offset, uint8_t size) {
 static void prs_longcopy(PRS_COMPRESSOR *pc, int offset, uint8_t size) {
 	uint8_t byte1, byte2;
 	if (size <= 9) {
+		COUNT_COPY(compress_stats, long, offset, size);
 		prs_put_control_bit(pc, 0);
 		prs_put_control_bit_nosave(pc, 1);
 		prs_put_static_data(pc, ((offset << 3) & 0xF8) | ((size - 2) & 0x07));
 		prs_put_static_data(pc, (offset >> 5) & 0xFF);
 		prs_put_control_save(pc);
 	} else {
+		COUNT_COPY(compress_stats, extended, offset, size);
 		prs_put_control_bit(pc, 0);
 		prs_put_control_bit_nosave(pc, 1);
 		prs_put_static_data(pc, (offset << 3) & 0xF8);
@@ -161,40 +194,705 @@ static void prs_copy(PRS_COMPRESSOR *pc, int offset, uint8_t size) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
-static uint32_t prs_compress(const void *source, void *dest, uint32_t size) {
-	PRS_COMPRESSOR pc;
-	int x, y, z;
+/*
+ * Compression levels 1-9 only limit how far back matches are searched for, and stop the search early once a match of
+ * at least nice_length bytes has been found. Level 9 is the original unlimited search, and gives exactly the same
+ * output as before levels existed. PRS_LEVEL_OPTIMAL is different, see prs_optimal_parse().
+ */
+typedef struct {
+	int window;
+	int nice_length;
+} PRS_LEVEL;
+
+static const PRS_LEVEL prs_levels[PRS_LEVEL_MAX + 1] = {
+	{ 0, 0 },           // unused
+	{ 0x100, 16 },
+	{ 0x200, 24 },
+	{ 0x400, 32 },
+	{ 0x800, 48 },
+	{ 0xC00, 64 },
+	{ 0x1000, 96 },
+	{ 0x1400, 128 },
+	{ 0x1800, 192 },
+	{ 0x1FF0, 257 },    // longer than any match, so never stops early
+	{ 0x1FF0, 257 },    // PRS_LEVEL_OPTIMAL
+};
+
+/*
+ * The number of bytes (up to max_length) that a and b have in common at their start. Compares 16 bytes at a time with
+ * SSE2 where available, otherwise 8 bytes at a time, using the position of the lowest differing bit to find the first
+ * differing byte. Never reads past max_length bytes of either.
+ */
+static uint32_t prs_match_length(const uint8_t *a, const uint8_t *b, uint32_t max_length) {
+	uint32_t length = 0;
+
+#ifdef __SSE2__
+	while ((length + 16) <= max_length) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + length));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + length));
+		uint32_t equal = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+		if (equal != 0xFFFF)
+			return length + __builtin_ctz(~equal);
+		length += 16;
+	}
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	while ((length + 8) <= max_length) {
+		uint64_t wa, wb;
+		memcpy(&wa, a + length, 8);
+		memcpy(&wb, b + length, 8);
+		if (wa != wb)
+			return length + (__builtin_ctzll(wa ^ wb) >> 3);
+		length += 8;
+	}
+#endif
+
+	while ((length < max_length) && (a[length] == b[length]))
+		length++;
+	return length;
+}
+
+/*
+ * Levels 1-9 find the positions to look at for matches with hash chains. Every position is put at the head of a chain
+ * of the earlier positions whose first 3 bytes hash to the same value, so each chain runs from the nearest position
+ * backwards. A match needs the first 3 bytes to be the same, so following the chain visits exactly the positions
+ * searching every position backwards would have looked closer at (plus the odd hash collision), in the same order.
+ * The matches found are exactly the same, only without having to step over every other position in the window.
+ */
+#define PRS_HC_HASH_BITS               15
+
+typedef struct {
+	int32_t head[1 << PRS_HC_HASH_BITS];
+	int32_t *prev;                 // the next (earlier) position in each position's chain, or -1
+	int32_t next_insert;           // the first position not yet in any chain
+} PRS_HC;
+
+static uint32_t prs_hc_hash(const uint8_t *src) {
+	uint32_t value = ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+	return (value * 2654435761u) >> (32 - PRS_HC_HASH_BITS);
+}
+
+// adds every position up to and including the given one to the chains
+static void prs_hc_insert(PRS_HC *hc, const uint8_t *src, int up_to) {
+	while (hc->next_insert <= up_to) {
+		uint32_t hash = prs_hc_hash(src + hc->next_insert);
+		hc->prev[hc->next_insert] = hc->head[hash];
+		hc->head[hash] = hc->next_insert;
+		hc->next_insert++;
+	}
+}
+
+/*
+ * Finds the longest earlier match for the data at x, within the given level's limits. Of equally long matches, the
+ * nearest one wins. Returns the match's length (0 if there is none, otherwise at least 3) and its (negative) offset.
+ * Shared by prs_compress() and prs_compressed_size(), so that both always make exactly the same choices. Positions
+ * are found with hc (see PRS_HC) if it is not NULL, or by simply trying every position otherwise.
+ *
+ * The original search grew each match one byte at a time, re-comparing the whole match with memcmp() every time,
+ * until it hit a differing byte, 256 bytes, the position being matched or the end of the data. That always comes out
+ * as min(bytes in common, 255, x - y - 1, size - x), but never less than the 3 bytes already known to match (which
+ * can run past the end of the data. see quest_synth.c), and that is what is worked out directly here instead. The
+ * original also stopped searching as soon as it found a 255 byte match, which is the longest a match can be.
+ */
+static uint32_t prs_find_match(const uint8_t *src, int x, uint32_t size, const PRS_LEVEL *level, PRS_HC *hc, int *out_offset) {
+	int y;
 	uint32_t xsize;
+	int lsoffset = 0, lssize = 0;
+	int stop_length = (level->nice_length < 255) ? level->nice_length : 255;
+
+	// the last couple of positions are still tried one by one, as their first 3 bytes run past the end of the data
+	if ((x + 3) > (int)size)
+		hc = NULL;
+
+	y = x - 3;
+	if (hc) {
+		prs_hc_insert(hc, src, x - 3);
+		y = (x >= 3) ? hc->head[prs_hc_hash(src + x)] : -1;
+	}
+
+	for (; (y > 0) && (y > (x - level->window)) && (lssize < stop_length); y = hc ? hc->prev[y] : (y - 1)) {
+		// there is no point looking any closer at a match that can't be longer than the best one found so far
+		if (src[y + lssize] != src[x + lssize])
+			continue;
+		if (memcmp(src + y, src + x, 3))
+			continue;
+
+		uint32_t max_length = 255;
+		if (max_length > (uint32_t)(x - y - 1))
+			max_length = x - y - 1;
+		if (max_length > (size - x))
+			max_length = size - x;
+
+		xsize = 3;
+		if (max_length > 3)
+			xsize += prs_match_length(src + y + 3, src + x + 3, max_length - 3);
+		if (xsize > lssize) {
+			lsoffset = -(x - y);
+			lssize = xsize;
+
+			// nothing can be longer than the rest of the data (and reading any further would run past the end of it)
+			if (lssize >= (size - x))
+				break;
+		}
+	}
+
+	*out_offset = lsoffset;
+	return lssize;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * PRS_LEVEL_OPTIMAL works out the whole token stream up front (see prs_optimal_parse), using a binary tree match
+ * finder in the style of LZMA's "bt" match finders: every position in the window is a node in a binary search tree
+ * (one per hash of the first 3 bytes) ordered by the data following that position. Inserting the current position
+ * at the root walks down the tree towards the positions whose data is the most similar, which is where the longest
+ * matches are, re-arranging the tree around the new root on the way. Unlike searching every position in the window,
+ * this does not get any slower on long runs of the same repeated data, which are common in .dat tables.
+ *
+ * It keeps to the same limits as the other levels: matches are at most 255 bytes, from no more than 0x1FEF bytes
+ * back, and never overlap the data being matched (or run past the end of the data).
+ */
+
+#define PRS_OPTIMAL_MAX_DISTANCE       0x1FEF
+#define PRS_OPTIMAL_MAX_LENGTH         255
+#define PRS_OPTIMAL_WINDOW             (PRS_OPTIMAL_MAX_DISTANCE + 1)
+#define PRS_BT_HASH_BITS               16
+#define PRS_BT_MAX_DEPTH               64     // how many tree nodes are looked at for each position, at most
+
+typedef struct {
+	uint32_t *heads;               // per hash: position + 1 of the tree's root, 0 if empty
+	uint32_t *children;            // per position in the window (cyclic): position + 1 of its smaller and larger child
+} PRS_BT;
+
+static uint32_t prs_bt_hash(const uint8_t *src) {
+	uint32_t value = src[0] | (src[1] << 8) | (src[2] << 16);
+	return (value * 2654435761u) >> (32 - PRS_BT_HASH_BITS);
+}
+
+/*
+ * Inserts pos into the tree, and returns the length and distance of the longest usable match for it (0 if there is
+ * none of at least 3 bytes). Must be called for every position in order.
+ */
+static uint32_t prs_bt_find(PRS_BT *bt, const uint8_t *src, uint32_t pos, uint32_t size, uint32_t *out_distance) {
+	uint32_t avail = size - pos;
+	if (avail > PRS_OPTIMAL_MAX_LENGTH)
+		avail = PRS_OPTIMAL_MAX_LENGTH;
+	if (avail < 3)
+		return 0;
+
+	uint32_t *head = &bt->heads[prs_bt_hash(src + pos)];
+	uint32_t node = *head;
+	*head = pos + 1;
+
+	uint32_t *smaller = &bt->children[2 * (pos % PRS_OPTIMAL_WINDOW)];
+	uint32_t *larger = smaller + 1;
+	uint32_t smaller_length = 0, larger_length = 0;
+	uint32_t best_length = 0, best_distance = 0;
+	uint32_t overlap_length = 0, overlap_distance = 0;
+	int depth = PRS_BT_MAX_DEPTH;
+
+	while (node && ((pos - (node - 1)) <= PRS_OPTIMAL_MAX_DISTANCE) && depth--) {
+		uint32_t candidate = node - 1;
+		uint32_t distance = pos - candidate;
+		uint32_t *candidate_children = &bt->children[2 * (candidate % PRS_OPTIMAL_WINDOW)];
+
+		// everything down this far in the tree is known to have at least this much in common with pos
+		uint32_t length = (smaller_length < larger_length) ? smaller_length : larger_length;
+		length += prs_match_length(src + candidate + length, src + pos + length, avail - length);
+
+		uint32_t usable_length = (length < distance) ? length : distance;
+		if (usable_length > best_length) {
+			best_length = usable_length;
+			best_distance = distance;
+		}
+		if (length > usable_length && length > overlap_length) {
+			overlap_length = length;
+			overlap_distance = distance;
+		}
+
+		if (length == avail) {
+			// pos replaces candidate in the tree entirely
+			*smaller = candidate_children[0];
+			*larger = candidate_children[1];
+			goto found;
+		}
+
+		if (src[candidate + length] < src[pos + length]) {
+			*smaller = node;
+			smaller = &candidate_children[1];
+			node = *smaller;
+			smaller_length = length;
+		} else {
+			*larger = node;
+			larger = &candidate_children[0];
+			node = *larger;
+			larger_length = length;
+		}
+	}
+	*smaller = 0;
+	*larger = 0;
+
+found:
+	/*
+	 * a match that would overlap the data being matched means the data repeats every overlap_distance bytes. the
+	 * same data is then also found at multiples of that distance back, far enough back to not overlap. the further
+	 * back the better, as long as it is still inside the repeating data
+	 */
+	if (overlap_length > best_length) {
+		for (uint32_t k = (overlap_length + overlap_distance - 1) / overlap_distance; k >= 2; --k) {
+			uint32_t distance = k * overlap_distance;
+			if (distance > pos || distance > PRS_OPTIMAL_MAX_DISTANCE)
+				continue;
+			// smaller multiples can't give anything longer than this
+			if (distance - overlap_distance <= best_length)
+				break;
+
+			uint32_t length = prs_match_length(src + pos - distance, src + pos, avail);
+			if (length > distance)
+				length = distance;
+			if (length > best_length) {
+				best_length = length;
+				best_distance = distance;
+			}
+		}
+	}
+
+	if (best_length < 3)
+		return 0;
+	*out_distance = best_distance;
+	return best_length;
+}
+
+/*
+ * The longest match of up to 5 bytes from up to 255 bytes back, which is what a short copy can encode. Short copies
+ * are the only tokens that can copy just 2 bytes.
+ */
+static uint32_t prs_find_short_match(const uint8_t *src, uint32_t pos, uint32_t size, uint32_t *out_distance) {
+	uint32_t max_length = size - pos;
+	if (max_length > 5)
+		max_length = 5;
+	uint32_t max_distance = (pos < 0xFF) ? pos : 0xFF;
+	uint32_t best_length = 0, best_distance = 0;
+
+	for (uint32_t distance = 2; distance <= max_distance; ++distance) {
+		if (distance <= best_length || src[pos - distance + best_length] != src[pos + best_length])
+			continue;
+
+		uint32_t length = prs_match_length(src + pos - distance, src + pos, max_length);
+		if (length > distance)
+			length = distance;
+		if (length > best_length) {
+			best_length = length;
+			best_distance = distance;
+			if (best_length == max_length)
+				break;
+		}
+	}
+
+	if (best_length < 2)
+		return 0;
+	*out_distance = best_distance;
+	return best_length;
+}
+
+/*
+ * Finds the cheapest possible sequence of tokens for the data, given the matches found at each position: with the
+ * cheapest way to encode the first i bytes known, every token that can start at i is tried to see if it is a cheaper
+ * way to encode the first i + length bytes. Costs are in bits (control bits + 8 per data byte), so this comes out
+ * within a byte of the smallest output possible with those matches.
+ *
+ * Only the longest match found at each position is needed, as any shorter length can be copied from the same place,
+ * and all copies that are not short copies cost the same no matter where they copy from. Short copies are looked for
+ * separately, as they can only copy from up to 255 bytes back.
+ *
+ * The resulting token stream is returned as the copy length (0 for a raw byte) and distance at each position a token
+ * starts at. Both arrays are allocated from the given arena (or with malloc if arena is NULL).
+ */
+static int prs_optimal_parse(const uint8_t *src, uint32_t size, uint16_t **out_lengths, uint16_t **out_distances, ARENA *arena) {
+	int returncode = -ENOMEM;
+	PRS_BT bt;
+	uint32_t *costs = NULL;
+	uint16_t *from_lengths = NULL, *from_distances = NULL;
+	uint16_t *lengths = NULL, *distances = NULL;
+
+	size_t heads_size = sizeof(uint32_t) << PRS_BT_HASH_BITS;
+	size_t children_size = sizeof(uint32_t) * 2 * PRS_OPTIMAL_WINDOW;
+	bt.heads = arena_alloc(arena, heads_size);
+	bt.children = arena_alloc(arena, children_size);
+	costs = arena_alloc(arena, sizeof(uint32_t) * (size + 1));
+	from_lengths = arena_alloc(arena, sizeof(uint16_t) * (size + 1));
+	from_distances = arena_alloc(arena, sizeof(uint16_t) * (size + 1));
+	lengths = arena_alloc(arena, sizeof(uint16_t) * size);
+	distances = arena_alloc(arena, sizeof(uint16_t) * size);
+	if (!bt.heads || !bt.children || !costs || !from_lengths || !from_distances || !lengths || !distances)
+		goto error;
+
+	memset(bt.heads, 0, heads_size);
+	memset(bt.children, 0, children_size);
+	costs[0] = 0;
+	for (uint32_t i = 1; i <= size; ++i)
+		costs[i] = UINT32_MAX;
+
+#define PRS_RELAX(to, cost, length, distance) \
+	do { if ((cost) < costs[to]) { costs[to] = (cost); from_lengths[to] = (length); from_distances[to] = (distance); } } while (0)
+
+	for (uint32_t i = 0; i < size; ++i) {
+		uint32_t cost = costs[i];
+		uint32_t distance;
+
+		PRS_RELAX(i + 1, cost + 1 + 8, 1, 0);
+
+		uint32_t short_length = prs_find_short_match(src, i, size, &distance);
+		for (uint32_t length = 2; length <= short_length; ++length)
+			PRS_RELAX(i + length, cost + 4 + 8, length, distance);
+
+		uint32_t long_length = prs_bt_find(&bt, src, i, size, &distance);
+		for (uint32_t length = 3; length <= long_length; ++length)
+			PRS_RELAX(i + length, cost + ((length <= 9) ? (2 + 16) : (2 + 24)), length, distance);
+	}
+
+#undef PRS_RELAX
+
+	// follow the cheapest path back from the end, leaving the tokens at the positions they start at
+	for (uint32_t i = size; i > 0; ) {
+		uint32_t length = from_lengths[i];
+		i -= length;
+		lengths[i] = (length == 1) ? 0 : length;
+		distances[i] = from_distances[i + length];
+	}
+
+	*out_lengths = lengths;
+	*out_distances = distances;
+	lengths = distances = NULL;
+	returncode = 0;
+
+error:
+	arena_free(arena, bt.heads);
+	arena_free(arena, bt.children);
+	arena_free(arena, costs);
+	arena_free(arena, from_lengths);
+	arena_free(arena, from_distances);
+	arena_free(arena, lengths);
+	arena_free(arena, distances);
+	return returncode;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// where prs_compress() and prs_compressed_size() get their matches from, for the given compression level
+typedef struct {
+	const PRS_LEVEL *level;
+	PRS_HC *hc;                    // levels 1-9 only, see prs_find_match()
+	uint16_t *lengths;             // PRS_LEVEL_OPTIMAL only, see prs_optimal_parse()
+	uint16_t *distances;
+} PRS_MATCHER;
+
+static int prs_matcher_init(PRS_MATCHER *matcher, const uint8_t *src, uint32_t size, int level, ARENA *arena) {
+	matcher->level = &prs_levels[level];
+	matcher->hc = NULL;
+	matcher->lengths = NULL;
+	matcher->distances = NULL;
+
+	if (level == PRS_LEVEL_OPTIMAL)
+		return prs_optimal_parse(src, size, &matcher->lengths, &matcher->distances, arena);
+
+	matcher->hc = arena_alloc(arena, sizeof(PRS_HC));
+	if (!matcher->hc)
+		return -ENOMEM;
+	matcher->hc->prev = arena_alloc(arena, sizeof(int32_t) * size);
+	if (!matcher->hc->prev) {
+		arena_free(arena, matcher->hc);
+		matcher->hc = NULL;
+		return -ENOMEM;
+	}
+	memset(matcher->hc->head, 0xff, sizeof(matcher->hc->head));
+	matcher->hc->next_insert = 0;
+	return 0;
+}
+
+static void prs_matcher_free(PRS_MATCHER *matcher, ARENA *arena) {
+	if (matcher->hc) {
+		arena_free(arena, matcher->hc->prev);
+		arena_free(arena, matcher->hc);
+	}
+	arena_free(arena, matcher->lengths);
+	arena_free(arena, matcher->distances);
+}
+
+static uint32_t prs_next_match(PRS_MATCHER *matcher, const uint8_t *src, int x, uint32_t size, int *out_offset) {
+	if (matcher->lengths) {
+		*out_offset = -(int)matcher->distances[x];
+		return matcher->lengths[x];
+	}
+	return prs_find_match(src, x, size, matcher->level, matcher->hc, out_offset);
+}
+
+static uint32_t prs_compress(const void *source, void *dest, uint32_t size, PRS_MATCHER *matcher) {
+	PRS_COMPRESSOR pc;
+	int x;
 	int lsoffset, lssize;
 	uint8_t *src = (uint8_t *) source, *dst = (uint8_t *) dest;
 	prs_init(&pc, source, dest);
 
 	for (x = 0; x < size; x++) {
-		lsoffset = lssize = xsize = 0;
-		for (y = x - 3; (y > 0) && (y > (x - 0x1FF0)) && (xsize < 255); y--) {
-			xsize = 3;
-			if (!memcmp(src + y, src + x, xsize)) {
-				do xsize++;
-				while (!memcmp(src + y, src + x, xsize) &&
-				       (xsize < 256) &&
-				       ((y + xsize) < x) &&
-				       ((x + xsize) <= size)
-						);
-				xsize--;
-				if (xsize > lssize) {
-					lsoffset = -(x - y);
-					lssize = xsize;
+		lssize = prs_next_match(matcher, src, x, size, &lsoffset);
+		if (lssize == 0) {
+			prs_rawbyte(&pc);
+		} else {
+			prs_copy(&pc, lsoffset, lssize);
+			x += (lssize - 1);
+		}
+	}
+	prs_finish(&pc);
+	return pc.dstptr - pc.dstptr_orig;
+}
+
+/*
+ * A "dry run" of prs_compress(), making all of the same choices but only adding up what each token would cost instead
+ * of writing anything out. Returns exactly the size prs_compress() would, including the initial control byte, any
+ * control bytes started along the way and the two zero bytes prs_finish() ends with.
+ */
+static uint32_t prs_compressed_size(const uint8_t *src, uint32_t size, PRS_MATCHER *matcher) {
+	int x;
+	int lsoffset, lssize;
+	uint64_t control_bits = 0;
+	uint64_t data_bytes = 0;
+
+	for (x = 0; x < size; x++) {
+		lssize = prs_next_match(matcher, src, x, size, &lsoffset);
+		if (lssize == 0) {
+			control_bits += 1;
+			data_bytes += 1;
+		} else {
+			// the same choice between token types as prs_copy() and prs_longcopy() make
+			if ((lsoffset > -0x100) && (lssize <= 5)) {
+				control_bits += 4;
+				data_bytes += 1;
+			} else {
+				control_bits += 2;
+				data_bytes += (lssize <= 9) ? 2 : 3;
+			}
+			x += (lssize - 1);
+		}
+	}
+
+	// prs_finish()'s end marker token. a new control byte is started every time 8 bits have been put in the last one
+	control_bits += 2;
+	data_bytes += 2;
+	return (uint32_t)(1 + (control_bits / 8) + data_bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Incremental recompression, for when some data that was compressed before has only been changed a little. The
+ * previous compressed data's tokens still describe every part of the new data that has not changed, as long as
+ * whatever they copy from has not changed either. So the tokens are re-used as they are from the start of the data
+ * up to the first changed byte, and again from the first point after the changes where every remaining token only
+ * copies from the unchanged data at the end. Only what is in between is actually compressed again.
+ */
+
+typedef struct {
+	uint32_t position;             // in the decompressed data
+	uint16_t length;               // 0 for a raw byte
+	uint16_t distance;
+} PRS_TOKEN;
+
+typedef struct {
+	const uint8_t *src;
+	size_t length;
+	size_t pos;
+	uint8_t control;
+	int control_bits_left;
+} PRS_TOKEN_READER;
+
+static int prs_read_control_bit(PRS_TOKEN_READER *reader) {
+	if (!reader->control_bits_left) {
+		if (reader->pos >= reader->length)
+			return -1;
+		reader->control = reader->src[reader->pos++];
+		reader->control_bits_left = 8;
+	}
+	int bit = reader->control & 1;
+	reader->control >>= 1;
+	reader->control_bits_left--;
+	return bit;
+}
+
+static int prs_read_data_byte(PRS_TOKEN_READER *reader) {
+	if (reader->pos >= reader->length)
+		return -1;
+	return reader->src[reader->pos++];
+}
+
+/*
+ * Reads the tokens that make up some PRS-compressed data, the same way prs_decompress() does, but never reading past
+ * the end of the data. If tokens is NULL, they are only counted. Returns the number of tokens (the end marker is not
+ * included) and the total number of bytes they decompress to, or -EBADMSG if the data ends before the end marker.
+ */
+static int prs_read_tokens(const uint8_t *src, size_t src_len, PRS_TOKEN *tokens, uint32_t *out_size) {
+	PRS_TOKEN_READER reader = { src, src_len, 0, 0, 0 };
+	uint32_t position = 0;
+	int count = 0;
+
+	for (;;) {
+		PRS_TOKEN token = { position, 0, 0 };
+		int bit = prs_read_control_bit(&reader);
+		if (bit < 0)
+			return -EBADMSG;
+
+		if (bit) {
+			if (prs_read_data_byte(&reader) < 0)
+				return -EBADMSG;
+		} else {
+			bit = prs_read_control_bit(&reader);
+			if (bit < 0)
+				return -EBADMSG;
+
+			if (bit) {
+				int low = prs_read_data_byte(&reader);
+				int high = prs_read_data_byte(&reader);
+				if (low < 0 || high < 0)
+					return -EBADMSG;
+				int offset = (high << 8) | low;
+				if (offset == 0)
+					break;
+
+				if (low & 7) {
+					token.length = (low & 7) + 2;
+				} else {
+					int size = prs_read_data_byte(&reader);
+					if (size < 0)
+						return -EBADMSG;
+					token.length = size + 1;
 				}
+				token.distance = 0x2000 - (offset >> 3);
+			} else {
+				int high = prs_read_control_bit(&reader);
+				int low = prs_read_control_bit(&reader);
+				int offset = prs_read_data_byte(&reader);
+				if (high < 0 || low < 0 || offset < 0)
+					return -EBADMSG;
+				token.length = ((high << 1) | low) + 2;
+				token.distance = 0x100 - offset;
 			}
 		}
+
+		if (tokens)
+			tokens[count] = token;
+		++count;
+		position += token.length ? token.length : 1;
+	}
+
+	*out_size = position;
+	return count;
+}
+
+/*
+ * Whether a token can be written out again as it is, at the given position in src. Copies have to stay within the
+ * limits the compressor here keeps to (see prs_find_match and prs_optimal_parse), whatever compressed them before, and
+ * still have to copy the right bytes. Only the part of a copy before the end of src is checked, as the last token can
+ * run past the end (see prs_find_match). Raw bytes always can.
+ */
+static bool prs_token_is_reusable(const PRS_TOKEN *token, const uint8_t *src, uint32_t size, uint32_t position) {
+	if (!token->length)
+		return true;
+	// other compressors can write an extended copy of 1 byte, which prs_copy() can't
+	if (token->length < 2 || token->length > 255 || token->distance > 0x1FEF || token->distance < token->length ||
+	    token->distance > position)
+		return false;
+	// 2 byte copies can only be short copies
+	if (token->length < 3 && token->distance >= 0x100)
+		return false;
+
+	uint32_t length = ((position + token->length) > size) ? (size - position) : token->length;
+	return !memcmp(src + position, src + position - token->distance, length);
+}
+
+static void prs_put_token(PRS_COMPRESSOR *pc, const PRS_TOKEN *token) {
+	if (token->length)
+		prs_copy(pc, -(int)token->distance, token->length);
+	else
+		prs_rawbyte(pc);
+}
+
+static uint32_t prs_recompress(const uint8_t *prev_src,
+                               uint32_t prev_size,
+                               const PRS_TOKEN *tokens,
+                               uint32_t num_tokens,
+                               const uint8_t *src,
+                               uint32_t size,
+                               uint8_t *dest,
+                               PRS_MATCHER *matcher,
+                               uint32_t *out_reused) {
+	PRS_COMPRESSOR pc;
+	uint32_t reused = 0;
+	uint32_t i, x;
+
+	uint32_t min_size = (prev_size < size) ? prev_size : size;
+	uint32_t prefix_size = 0;
+	while (prefix_size < min_size && prev_src[prefix_size] == src[prefix_size])
+		++prefix_size;
+	uint32_t suffix_size = 0;
+	while ((prefix_size + suffix_size) < min_size && prev_src[prev_size - suffix_size - 1] == src[size - suffix_size - 1])
+		++suffix_size;
+
+	prs_init(&pc, src, dest);
+
+	// tokens entirely before the first changed byte
+	for (i = 0; i < num_tokens; ++i) {
+		const PRS_TOKEN *token = &tokens[i];
+		uint32_t length = token->length ? token->length : 1;
+		if ((token->position + length) > prefix_size || !prs_token_is_reusable(token, src, size, token->position))
+			break;
+		prs_put_token(&pc, token);
+		reused += length;
+	}
+	x = (i > 0) ? (tokens[i - 1].position + (tokens[i - 1].length ? tokens[i - 1].length : 1)) : 0;
+
+	// the first of the tokens at the end that only copy from the unchanged data at the end, and so still work there
+	uint32_t prev_suffix_start = prev_size - suffix_size;
+	uint32_t suffix_start = size - suffix_size;
+	uint32_t sync = num_tokens;
+	while (sync > i) {
+		const PRS_TOKEN *token = &tokens[sync - 1];
+		if (token->position < prev_suffix_start || token->position >= prev_size)
+			break;
+		uint32_t position = token->position - prev_suffix_start + suffix_start;
+		if (token->length && (token->distance > token->position || (token->position - token->distance) < prev_suffix_start))
+			break;
+		if (!prs_token_is_reusable(token, src, size, position))
+			break;
+		--sync;
+	}
+	while (sync < num_tokens && (tokens[sync].position - prev_suffix_start + suffix_start) < x)
+		++sync;
+	uint32_t end = (sync < num_tokens) ? (tokens[sync].position - prev_suffix_start + suffix_start) : size;
+
+	// everything in between is compressed again, as normal except that nothing can run into the re-used tokens
+	while (x < end) {
+		int lsoffset;
+		uint32_t lssize = prs_find_match(src, x, end, matcher->level, matcher->hc, &lsoffset);
+		if (lssize && (x + lssize) > end && end < size)
+			lssize = 0;
 		if (lssize == 0) {
 			prs_rawbyte(&pc);
+			x++;
 		} else {
 			prs_copy(&pc, lsoffset, lssize);
-			x += (lssize - 1);
+			x += lssize;
 		}
 	}
+
+	for (i = sync; i < num_tokens; ++i) {
+		prs_put_token(&pc, &tokens[i]);
+		reused += tokens[i].length ? tokens[i].length : 1;
+	}
+
 	prs_finish(&pc);
+	*out_reused = reused;
 	return pc.dstptr - pc.dstptr_orig;
 }
 
@@ -226,6 +924,7 @@ static uint32_t prs_decompress(const void *source, void *dest) // 800F7CB0 throu
 		flag = currentbyte & 1;
 		currentbyte = currentbyte >> 1;
 		if (flag) {
+			COUNT_RAW_BYTE(decompress_stats);
 			destptr[0] = sourceptr[0];
 			sourceptr++;
 			destptr++;
@@ -254,6 +953,12 @@ static uint32_t prs_decompress(const void *source, void *dest) // 800F7CB0 throu
 			} else r3 += 2;
 			//r5 += (uint32_t)destptr;
 			ptr_reg = destptr + ((int32_t) ((offset >> 3) | 0xFFFFE000));
+#ifdef PRS_TOKEN_STATS
+			if (flag)
+				COUNT_COPY(decompress_stats, long, (int32_t)((offset >> 3) | 0xFFFFE000), r3);
+			else
+				COUNT_COPY(decompress_stats, extended, (int32_t)((offset >> 3) | 0xFFFFE000), r3);
+#endif
 		} else {
 			r3 = 0;
 			for (x = 0; x < 2; x++) {
@@ -273,6 +978,7 @@ static uint32_t prs_decompress(const void *source, void *dest) // 800F7CB0 throu
 			sourceptr++;
 			//r5 = offset + (uint32_t)destptr;
 			ptr_reg = destptr + offset;
+			COUNT_COPY(decompress_stats, short, offset, r3);
 		}
 		if (r3 == 0) continue;
 		t = r3;
@@ -370,9 +1076,14 @@ static uint32_t prs_decompress_size(const void *source) {
 ////////////////////////////////////////////////////////////////////////////////
 
 // borrowed from libsylverant: https://github.com/Sylverant/libsylverant/blob/master/src/utils/prs-comp.c
+/*
+ * Nothing compresses to more than every byte written as a raw byte (1 control bit + 1 byte each), plus the initial
+ * control byte, the end marker's 2 control bits and 2 bytes, and the control bytes started along the way (see
+ * prs_compressed_size). Except that the last copy can run past the end of the data (see prs_find_match), so it can
+ * stand for as little as 1 byte while costing up to 4 control bits + 1 byte or 2 control bits + 2 bytes.
+ */
 static size_t prs_max_compressed_size(size_t len) {
-	len += 2;
-	return len + (len >> 3) + ((len & 0x07) ? 1 : 0);
+	return 1 + ((len + 5) >> 3) + len + 3;
 }
 
 /*
@@ -383,9 +1094,20 @@ static size_t prs_max_compressed_size(size_t len) {
  */
 
 int fuzziqer_prs_compress(const uint8_t *src, uint8_t **dst, size_t src_len) {
+	return fuzziqer_prs_compress_ex(src, dst, src_len, NULL);
+}
+
+int fuzziqer_prs_compress_ex(const uint8_t *src, uint8_t **dst, size_t src_len, ARENA *arena) {
+	return fuzziqer_prs_compress_level_ex(src, dst, src_len, PRS_LEVEL_DEFAULT, arena);
+}
+
+int fuzziqer_prs_compress_level_ex(const uint8_t *src, uint8_t **dst, size_t src_len, int level, ARENA *arena) {
 	if (!src || !dst)
 		return -EFAULT;
 
+	if (level < PRS_LEVEL_MIN || level > PRS_LEVEL_MAX)
+		return -EINVAL;
+
 	if (!src_len)
 		return -EINVAL;
 
@@ -395,21 +1117,136 @@ int fuzziqer_prs_compress(const uint8_t *src, uint8_t **dst, size_t src_len) {
 	/* Allocate probably more than enough space for the compressed output. */
 	uint8_t *temp_dst;
 	size_t max_compressed_size = prs_max_compressed_size(src_len);
-	if (!(temp_dst = (uint8_t *)malloc(max_compressed_size)))
-		return -errno;
+	if (!(temp_dst = (uint8_t *)arena_alloc(arena, max_compressed_size)))
+		return -ENOMEM;
+
+	/* prs_finish() can leave the last control byte unwritten when the data ends on a control byte boundary. Zero
+	   it all first, so the output never depends on whatever the buffer held before (e.g. a re-used arena). */
+	memset(temp_dst, 0, max_compressed_size);
 
 	/* TODO: this version of prs_compress doesn't really do much in the way of error checking ... */
-	uint32_t size = prs_compress(src, temp_dst, src_len);
+	uint64_t start = stats_start();
+	PRS_MATCHER matcher;
+	int result = prs_matcher_init(&matcher, src, src_len, level, arena);
+	if (result) {
+		arena_free(arena, temp_dst);
+		return result;
+	}
+	uint32_t size = prs_compress(src, temp_dst, src_len, &matcher);
+	prs_matcher_free(&matcher, arena);
+	stats_end(STATS_PRS_ENCODE, start, src_len);
 
 	/* Resize the output (if realloc fails to resize it, then just use the
 	   unshortened buffer). */
-	if(!(*dst = realloc(temp_dst, size)))
+	if(!(*dst = arena_realloc(arena, temp_dst, max_compressed_size, size)))
 		*dst = temp_dst;
 
 	return size;
 }
 
+// returns exactly the size fuzziqer_prs_compress_level_ex would compress the data to, without writing anything out
+int fuzziqer_prs_compressed_size(const uint8_t *src, size_t src_len, int level) {
+	if (!src)
+		return -EFAULT;
+
+	if (level < PRS_LEVEL_MIN || level > PRS_LEVEL_MAX)
+		return -EINVAL;
+
+	if (!src_len)
+		return -EINVAL;
+
+	if (src_len < 3)
+		return -EBADMSG;
+
+	PRS_MATCHER matcher;
+	int result = prs_matcher_init(&matcher, src, src_len, level, NULL);
+	if (result)
+		return result;
+	uint32_t size = prs_compressed_size(src, src_len, &matcher);
+	prs_matcher_free(&matcher, NULL);
+	return size;
+}
+
+/*
+ * Compresses src, given that prev_src (which is probably mostly the same) was compressed to prev_compressed before, by
+ * re-using as much of prev_compressed as possible (see prs_recompress). This is much quicker than compressing all of
+ * src again when only a small part of it has changed. The number of bytes of src covered by re-used tokens is
+ * returned in out_reused, if it is not NULL.
+ *
+ * The new parts are compressed at PRS_LEVEL_DEFAULT. prev_compressed can come from any PRS compressor, but only those
+ * of its tokens that this one could have written are re-used.
+ */
+int fuzziqer_prs_recompress_ex(const uint8_t *prev_src,
+                               size_t prev_src_len,
+                               const uint8_t *prev_compressed,
+                               size_t prev_compressed_len,
+                               const uint8_t *src,
+                               uint8_t **dst,
+                               size_t src_len,
+                               size_t *out_reused,
+                               ARENA *arena) {
+	if (!prev_src || !prev_compressed || !src || !dst)
+		return -EFAULT;
+
+	if (!src_len)
+		return -EINVAL;
+
+	if (src_len < 3)
+		return -EBADMSG;
+
+	uint64_t start = stats_start();
+
+	// even when nothing has changed at all, prev_compressed isn't simply copied. it might not decompress to prev_src,
+	// and every token is checked as it is re-used anyway
+	uint32_t decompressed_size;
+	int num_tokens = prs_read_tokens(prev_compressed, prev_compressed_len, NULL, &decompressed_size);
+	if (num_tokens < 0)
+		return num_tokens;
+	// the last token can run a little past the end of the data (see prs_find_match)
+	if (decompressed_size < prev_src_len || decompressed_size > (prev_src_len + 2))
+		return -EBADMSG;
+
+	PRS_TOKEN *tokens = arena_alloc(arena, sizeof(PRS_TOKEN) * (num_tokens ? num_tokens : 1));
+	if (!tokens)
+		return -ENOMEM;
+	prs_read_tokens(prev_compressed, prev_compressed_len, tokens, &decompressed_size);
+
+	uint8_t *temp_dst;
+	size_t max_compressed_size = prs_max_compressed_size(src_len);
+	if (!(temp_dst = (uint8_t *)arena_alloc(arena, max_compressed_size))) {
+		arena_free(arena, tokens);
+		return -ENOMEM;
+	}
+	// see fuzziqer_prs_compress_level_ex
+	memset(temp_dst, 0, max_compressed_size);
+
+	PRS_MATCHER matcher;
+	int result = prs_matcher_init(&matcher, src, src_len, PRS_LEVEL_DEFAULT, arena);
+	if (result) {
+		arena_free(arena, tokens);
+		arena_free(arena, temp_dst);
+		return result;
+	}
+
+	uint32_t reused;
+	uint32_t size = prs_recompress(prev_src, prev_src_len, tokens, num_tokens, src, src_len, temp_dst, &matcher, &reused);
+	prs_matcher_free(&matcher, arena);
+	arena_free(arena, tokens);
+	stats_end(STATS_PRS_ENCODE, start, src_len);
+
+	if (!(*dst = arena_realloc(arena, temp_dst, max_compressed_size, size)))
+		*dst = temp_dst;
+	if (out_reused)
+		*out_reused = reused;
+
+	return size;
+}
+
 int fuzziqer_prs_decompress_buf(const uint8_t *src, uint8_t **dst, size_t src_len) {
+	return fuzziqer_prs_decompress_buf_ex(src, dst, src_len, NULL);
+}
+
+int fuzziqer_prs_decompress_buf_ex(const uint8_t *src, uint8_t **dst, size_t src_len, ARENA *arena) {
 	if (!src || !dst)
 		return -EFAULT;
 
@@ -421,12 +1258,14 @@ int fuzziqer_prs_decompress_buf(const uint8_t *src, uint8_t **dst, size_t src_le
 	if (src_len < 3)
 		return -EBADMSG;
 
+	uint64_t start = stats_start();
 	uint32_t dst_len = prs_decompress_size(src);
-	if (!(*dst = malloc(dst_len)))
-		return -errno;
+	if (!(*dst = arena_alloc(arena, dst_len)))
+		return -ENOMEM;
 
 	/* TODO: this version of prs_decompress doesn't really do much in the way of error checking ... */
 	uint32_t size = prs_decompress(src, *dst);
+	stats_end(STATS_PRS_DECODE, start, size);
 
 	return size;
 }
@@ -445,3 +1284,17 @@ int fuzziqer_prs_decompress_size(const uint8_t *src, size_t src_len) {
 
 	return prs_decompress_size(src);
 }
+
+#ifdef PRS_TOKEN_STATS
+void fuzziqer_prs_get_token_stats(PRS_TOKEN_COUNTS *out_compress_stats, PRS_TOKEN_COUNTS *out_decompress_stats) {
+	if (out_compress_stats)
+		memcpy(out_compress_stats, &compress_stats, sizeof(PRS_TOKEN_COUNTS));
+	if (out_decompress_stats)
+		memcpy(out_decompress_stats, &decompress_stats, sizeof(PRS_TOKEN_COUNTS));
+}
+
+void fuzziqer_prs_reset_token_stats(void) {
+	memset(&compress_stats, 0, sizeof(PRS_TOKEN_COUNTS));
+	memset(&decompress_stats, 0, sizeof(PRS_TOKEN_COUNTS));
+}
+#endif
@@ -3,8 +3,61 @@
 
 #include <stdint.h>
 
+#include "arena.h"
+
+// compression levels trade compression ratio for speed. see prs_levels and prs_optimal_parse() in fuzziqer_prs.c
+#define PRS_LEVEL_MIN                  1
+#define PRS_LEVEL_DEFAULT              9      // the original compressor's output, known to work with the game
+#define PRS_LEVEL_OPTIMAL              10     // smallest output, from a differently built token stream
+#define PRS_LEVEL_MAX                  PRS_LEVEL_OPTIMAL
+
 int fuzziqer_prs_compress(const uint8_t *src, uint8_t **dst, size_t src_len);
 int fuzziqer_prs_decompress_buf(const uint8_t *src, uint8_t **dst, size_t src_len);
 int fuzziqer_prs_decompress_size(const uint8_t *src, size_t src_len);
 
+// same as the above, but the output buffer is allocated from the given arena (or with malloc, if arena is NULL)
+int fuzziqer_prs_compress_ex(const uint8_t *src, uint8_t **dst, size_t src_len, ARENA *arena);
+int fuzziqer_prs_decompress_buf_ex(const uint8_t *src, uint8_t **dst, size_t src_len, ARENA *arena);
+int fuzziqer_prs_compress_level_ex(const uint8_t *src, uint8_t **dst, size_t src_len, int level, ARENA *arena);
+
+// the exact size the data would compress to at the given level, without allocating or writing any output. the match
+// search is still all done the same as when compressing, and that is most of the work, so this is only a little quicker
+int fuzziqer_prs_compressed_size(const uint8_t *src, size_t src_len, int level);
+
+// compresses src by re-using as much as possible of what prev_src (an earlier version of it) was compressed to
+int fuzziqer_prs_recompress_ex(const uint8_t *prev_src,
+                               size_t prev_src_len,
+                               const uint8_t *prev_compressed,
+                               size_t prev_compressed_len,
+                               const uint8_t *src,
+                               uint8_t **dst,
+                               size_t src_len,
+                               size_t *out_reused,
+                               ARENA *arena);
+
+#ifdef PRS_TOKEN_STATS
+/*
+ * Optional (compile-time, define PRS_TOKEN_STATS) counters of the tokens written by the compressor and read by the
+ * decompressor. These are global and not thread-safe, they are only intended for analysis tools (see prs_stats).
+ */
+
+#define PRS_STATS_MAX_LENGTH           256
+#define PRS_STATS_OFFSET_BUCKETS       14   // power-of-two buckets, 1, 2-3, 4-7, ... 8192-16383
+
+typedef struct {
+	uint64_t raw_bytes;             // literal bytes. 1 control bit + 1 byte each
+	uint64_t short_copies;          // 2-5 bytes, offset up to 255 back. 4 control bits + 1 byte each
+	uint64_t short_copy_bytes;
+	uint64_t long_copies;           // 3-9 bytes, offset up to 8191 back. 2 control bits + 2 bytes each
+	uint64_t long_copy_bytes;
+	uint64_t extended_copies;       // 1-256 bytes, offset up to 8191 back. 2 control bits + 3 bytes each
+	uint64_t extended_copy_bytes;
+	uint64_t length_histogram[PRS_STATS_MAX_LENGTH + 1];
+	uint64_t offset_histogram[PRS_STATS_OFFSET_BUCKETS];
+} PRS_TOKEN_COUNTS;
+
+void fuzziqer_prs_get_token_stats(PRS_TOKEN_COUNTS *out_compress_stats, PRS_TOKEN_COUNTS *out_decompress_stats);
+void fuzziqer_prs_reset_token_stats(void);
+#endif
+
 #endif
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include <sylverant/encryption.h>
+#include "fuzziqer_prs.h"
+
+#include "retvals.h"
+#include "quests.h"
+#include "stats.h"
+#include "gcdl.h"
+
+/*
+ * Sets the "download" flag in the given (decompressed) .bin data and then re-compresses it.
+ */
+int prepare_download_quest_bin(QUEST_BIN_HEADER *decompressed_bin, size_t decompressed_bin_size, uint8_t **out_compressed_bin, size_t *out_compressed_bin_size, ARENA *arena) {
+	if (!decompressed_bin || !out_compressed_bin || !out_compressed_bin_size)
+		return ERROR_INVALID_PARAMS;
+
+	decompressed_bin->download = 1;  // gamecube pso client will not find quests on a memory card if this is not set!
+
+	// note: see header comment in fuzziqer_prs.c for explanation on why this is used instead of prs_compress()
+	int result = fuzziqer_prs_compress_ex((uint8_t*)decompressed_bin, out_compressed_bin, decompressed_bin_size, arena);
+	if (result < 0)
+		return ERROR_BAD_DATA;
+
+	*out_compressed_bin_size = result;
+	return SUCCESS;
+}
+
+/*
+ * The same as prepare_download_quest_bin, but given an earlier version of the same quest's .bin data (as it was before
+ * being compressed, with the "download" flag already set) and what that was compressed to, re-uses as much of that
+ * earlier compressed data as possible instead of compressing everything again (see fuzziqer_prs_recompress_ex). The
+ * number of bytes of the .bin data that did not need compressing again is returned in out_reused_size, if not NULL.
+ */
+int prepare_download_quest_bin_incremental(QUEST_BIN_HEADER *decompressed_bin,
+                                           size_t decompressed_bin_size,
+                                           const uint8_t *previous_bin,
+                                           size_t previous_bin_size,
+                                           const uint8_t *previous_compressed_bin,
+                                           size_t previous_compressed_bin_size,
+                                           uint8_t **out_compressed_bin,
+                                           size_t *out_compressed_bin_size,
+                                           size_t *out_reused_size,
+                                           ARENA *arena) {
+	if (!decompressed_bin || !previous_bin || !previous_compressed_bin || !out_compressed_bin || !out_compressed_bin_size)
+		return ERROR_INVALID_PARAMS;
+
+	decompressed_bin->download = 1;
+
+	int result = fuzziqer_prs_recompress_ex(previous_bin,
+	                                        previous_bin_size,
+	                                        previous_compressed_bin,
+	                                        previous_compressed_bin_size,
+	                                        (uint8_t*)decompressed_bin,
+	                                        out_compressed_bin,
+	                                        decompressed_bin_size,
+	                                        out_reused_size,
+	                                        arena);
+	if (result < 0)
+		return ERROR_BAD_DATA;
+
+	*out_compressed_bin_size = result;
+	return SUCCESS;
+}
+
+/*
+ * Encrypts PRS-compressed .bin or .dat data, using the PC crypt method with the given crypt key, and prefixes it with
+ * the unencrypted download quest chunks header.
+ */
+int encrypt_download_quest_data(const uint8_t *compressed_data, size_t compressed_size, size_t decompressed_size, uint32_t crypt_key, uint8_t **out_data, size_t *out_size, ARENA *arena) {
+	if (!compressed_data || !out_data || !out_size)
+		return ERROR_INVALID_PARAMS;
+
+	size_t final_size = compressed_size + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
+	uint8_t *final_data = arena_alloc(arena, final_size);
+	if (!final_data)
+		return ERROR_IO;
+
+	memset(final_data, 0, final_size);
+	uint8_t *crypt_compressed_data = final_data + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
+	DOWNLOAD_QUEST_CHUNKS_HEADER *dlchunks_header = (DOWNLOAD_QUEST_CHUNKS_HEADER*)final_data;
+	dlchunks_header->decompressed_size = decompressed_size + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
+	dlchunks_header->crypt_key = crypt_key;
+	memcpy(crypt_compressed_data, compressed_data, compressed_size);
+
+	uint64_t start = stats_start();
+	CRYPT_SETUP cs;
+
+	// yes, we need to use PC encryption even for gamecube download quests
+	CRYPT_CreateKeys(&cs, &crypt_key, CRYPT_PC);
+
+	// NOTE: encrypts the compressed data in-place
+	CRYPT_CryptData(&cs, crypt_compressed_data, compressed_size, 1);
+	stats_end(STATS_ENCRYPT, start, compressed_size);
+
+	*out_data = final_data;
+	*out_size = final_size;
+	return SUCCESS;
+}
+
+/*
+ * Writes out a download .qst file containing the given encrypted + compressed .bin and .dat data. The chunk data is
+ * written out as interleaved 0xA7 packets containing 1024 bytes each.
+ */
+int write_download_quest_qst(const char *filename,
+                             const char *bin_base_filename,
+                             const char *dat_base_filename,
+                             const QUEST_BIN_HEADER *bin_header,
+                             const uint8_t *final_bin,
+                             size_t final_bin_size,
+                             const uint8_t *final_dat,
+                             size_t final_dat_size) {
+	return write_qst_file(filename, bin_base_filename, dat_base_filename, bin_header, final_bin, final_bin_size, final_dat, final_dat_size, QST_TYPE_DOWNLOAD);
+}
@@ -0,0 +1,38 @@
+#ifndef GCDL_H_INCLUDED
+#define GCDL_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "quests.h"
+#include "arena.h"
+
+/*
+ * The individual steps involved in turning a quest's .bin/.dat data into a Gamecube download/offline .qst file.
+ * Shared by bindat_to_gcdl and gcdl_batch.
+ *
+ * Output buffers are allocated from the given arena, or with malloc if arena is NULL (see arena.h).
+ */
+
+int prepare_download_quest_bin(QUEST_BIN_HEADER *decompressed_bin, size_t decompressed_bin_size, uint8_t **out_compressed_bin, size_t *out_compressed_bin_size, ARENA *arena);
+int prepare_download_quest_bin_incremental(QUEST_BIN_HEADER *decompressed_bin,
+                                           size_t decompressed_bin_size,
+                                           const uint8_t *previous_bin,
+                                           size_t previous_bin_size,
+                                           const uint8_t *previous_compressed_bin,
+                                           size_t previous_compressed_bin_size,
+                                           uint8_t **out_compressed_bin,
+                                           size_t *out_compressed_bin_size,
+                                           size_t *out_reused_size,
+                                           ARENA *arena);
+int encrypt_download_quest_data(const uint8_t *compressed_data, size_t compressed_size, size_t decompressed_size, uint32_t crypt_key, uint8_t **out_data, size_t *out_size, ARENA *arena);
+int write_download_quest_qst(const char *filename,
+                             const char *bin_base_filename,
+                             const char *dat_base_filename,
+                             const QUEST_BIN_HEADER *bin_header,
+                             const uint8_t *final_bin,
+                             size_t final_bin_size,
+                             const uint8_t *final_dat,
+                             size_t final_dat_size);
+
+#endif
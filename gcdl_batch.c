@@ -0,0 +1,308 @@
+/*
+ * PSO EP1&2 (Gamecube) Batch Quest .bin/.dat File to Download/Offline .qst File Converter
+ *
+ * Does the same thing as bindat_to_gcdl, but for any number of quests at once, spread out over multiple threads.
+ *
+ * Each worker thread has its own arena (see arena.h) which all of a quest's buffers are allocated from, and which is
+ * reset once that quest is done. So after the first few quests, the workers are just re-using the same memory over
+ * and over again instead of all competing with each other in malloc() / free().
+ *
+ * With --gci, each quest is instead written out as a pair of .gci memory card files (see gci.h), ready to be imported
+ * into a memory card image or put in an emulator's GCI folder.
+ *
+ * Optionally, a Chrome trace-event format JSON file can be written out showing what every worker thread was doing
+ * (which quest, and which stage of processing that quest) over the entire run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "decode_cache.h"
+#include "gcdl.h"
+#include "gci.h"
+#include "arena.h"
+#include "batch.h"
+#include "trace.h"
+#include "utils.h"
+#include "stats.h"
+
+typedef struct {
+	const char *bin_filename;
+	const char *dat_filename;
+	char output_qst_filename[FILENAME_MAX];
+	char bin_card_filename[32];    // only used with --gci
+	char dat_card_filename[32];
+	char output_bin_gci_filename[FILENAME_MAX];
+	char output_dat_gci_filename[FILENAME_MAX];
+	int result;
+} GCDL_JOB;
+
+typedef struct {
+	GCDL_JOB *jobs;
+	ARENA *arenas;                 // one per worker thread
+	unsigned int base_seed;
+	bool gci;
+	char region;
+	uint32_t timestamp;
+} GCDL_BATCH;
+
+int decompress_and_validate(const uint8_t *compressed, size_t compressed_size, bool is_bin, uint8_t **out_data, size_t *out_size, ARENA *arena) {
+	int validation_result;
+
+	int result = decode_cache_decompress_buf_ex(compressed, out_data, compressed_size, arena);
+	if (result < 0)
+		return ERROR_BAD_DATA;
+	*out_size = result;
+
+	if (!decode_cache_get_validation(compressed, compressed_size, &validation_result)) {
+		if (is_bin)
+			validation_result = validate_quest_bin((QUEST_BIN_HEADER*)*out_data, *out_size, false);
+		else
+			validation_result = validate_quest_dat(*out_data, *out_size, false);
+		decode_cache_set_validation(compressed, compressed_size, validation_result);
+	}
+
+	// the only fix-ups these apply are to the decompressed size, which is safe to do in any case
+	if (is_bin)
+		validation_result = handle_quest_bin_validation_issues_ex(validation_result, (QUEST_BIN_HEADER*)*out_data, out_data, out_size, false, arena);
+	else
+		validation_result = handle_quest_dat_validation_issues_ex(validation_result, out_data, out_size, false);
+
+	return validation_result ? ERROR_BAD_DATA : SUCCESS;
+}
+
+// all buffers are allocated from the arena, so nothing needs to be freed here. the arena is reset after every quest
+static int write_gci(const char *filename, const uint8_t *data, size_t size, const char *card_filename, const QUEST_BIN_HEADER *bin_header, const GCDL_BATCH *batch, ARENA *arena) {
+	int returncode;
+	uint8_t *gci;
+	size_t gci_size;
+
+	returncode = build_quest_gci(data, size, batch->region, card_filename, bin_header->name, batch->timestamp, &gci, &gci_size, arena);
+	if (returncode)
+		return returncode;
+
+	return write_file(filename, gci, gci_size);
+}
+
+int convert_quest(const GCDL_JOB *job, const GCDL_BATCH *batch, unsigned int *seed, ARENA *arena) {
+	int returncode;
+	uint8_t *compressed_bin, *compressed_dat;
+	uint8_t *decompressed_bin, *decompressed_dat;
+	uint8_t *recompressed_bin;
+	uint8_t *final_bin, *final_dat;
+	uint32_t compressed_bin_size, compressed_dat_size;
+	size_t decompressed_bin_size, decompressed_dat_size, recompressed_bin_size, final_bin_size, final_dat_size;
+
+	const char *bin_base_filename = path_to_filename(job->bin_filename);
+	const char *dat_base_filename = path_to_filename(job->dat_filename);
+	if (strlen(bin_base_filename) > QUEST_FILENAME_MAX_LENGTH || strlen(dat_base_filename) > QUEST_FILENAME_MAX_LENGTH)
+		return ERROR_INVALID_PARAMS;
+
+	returncode = read_file_ex(job->bin_filename, &compressed_bin, &compressed_bin_size, arena);
+	if (returncode)
+		return returncode;
+	returncode = read_file_ex(job->dat_filename, &compressed_dat, &compressed_dat_size, arena);
+	if (returncode)
+		return returncode;
+
+	returncode = decompress_and_validate(compressed_bin, compressed_bin_size, true, &decompressed_bin, &decompressed_bin_size, arena);
+	if (returncode)
+		return returncode;
+	returncode = decompress_and_validate(compressed_dat, compressed_dat_size, false, &decompressed_dat, &decompressed_dat_size, arena);
+	if (returncode)
+		return returncode;
+
+	QUEST_BIN_HEADER *bin_header = (QUEST_BIN_HEADER*)decompressed_bin;
+	returncode = prepare_download_quest_bin(bin_header, decompressed_bin_size, &recompressed_bin, &recompressed_bin_size, arena);
+	if (returncode)
+		return returncode;
+
+	// the data on a memory card is just PRS-compressed, without the encryption and chunks header a .qst file needs
+	if (batch->gci) {
+		returncode = write_gci(job->output_bin_gci_filename, recompressed_bin, recompressed_bin_size, job->bin_card_filename, bin_header, batch, arena);
+		if (returncode)
+			return returncode;
+		return write_gci(job->output_dat_gci_filename, compressed_dat, compressed_dat_size, job->dat_card_filename, bin_header, batch, arena);
+	}
+
+	returncode = encrypt_download_quest_data(recompressed_bin, recompressed_bin_size, decompressed_bin_size, rand_r(seed), &final_bin, &final_bin_size, arena);
+	if (returncode)
+		return returncode;
+	returncode = encrypt_download_quest_data(compressed_dat, compressed_dat_size, decompressed_dat_size, rand_r(seed), &final_dat, &final_dat_size, arena);
+	if (returncode)
+		return returncode;
+
+	return write_download_quest_qst(job->output_qst_filename,
+	                                bin_base_filename,
+	                                dat_base_filename,
+	                                bin_header,
+	                                final_bin,
+	                                final_bin_size,
+	                                final_dat,
+	                                final_dat_size);
+}
+
+void run_job(int job_index, int worker_index, void *context) {
+	GCDL_BATCH *batch = (GCDL_BATCH*)context;
+	GCDL_JOB *job = &batch->jobs[job_index];
+	ARENA *arena = &batch->arenas[worker_index];
+
+	// every quest gets its own crypt key seed, so the results don't depend on which worker ran which quest
+	unsigned int seed = batch->base_seed + (unsigned int)job_index;
+
+	uint64_t start = trace_begin();
+	job->result = convert_quest(job, batch, &seed, arena);
+	arena_reset(arena);
+	trace_end("quest", "quest", job->bin_filename, start);
+
+	if (job->result)
+		printf("Error code %d (%s) converting quest: %s\n", job->result, get_error_message(job->result), job->bin_filename);
+	else if (batch->gci)
+		printf("%s -> %s, %s\n", job->bin_filename, job->output_bin_gci_filename, job->output_dat_gci_filename);
+	else
+		printf("%s -> %s\n", job->bin_filename, job->output_qst_filename);
+}
+
+int main(int argc, char *argv[]) {
+	int returncode;
+	int num_workers = batch_get_default_num_workers();
+	const char *trace_filename = NULL;
+	bool gci = false;
+	char region = 'E';
+	GCDL_JOB *jobs = NULL;
+	ARENA *arenas = NULL;
+
+	stats_parse_args(&argc, argv);
+
+	int argi = 1;
+	while (argi < argc && argv[argi][0] == '-') {
+		if (!strcmp(argv[argi], "-j") && (argi + 1) < argc) {
+			num_workers = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], TRACE_ARG) && (argi + 1) < argc) {
+			trace_filename = argv[argi + 1];
+			argi += 2;
+		} else if (!strcmp(argv[argi], "--gci")) {
+			gci = true;
+			argi += 1;
+		} else if (!strcmp(argv[argi], "-r") && (argi + 1) < argc) {
+			region = argv[argi + 1][0];
+			argi += 2;
+		} else {
+			break;
+		}
+	}
+
+	int num_files = argc - argi - 1;
+	if (num_files < 2 || (num_files % 2) != 0 || num_workers < 1 || (region != 'E' && region != 'J' && region != 'P')) {
+		printf("Usage: gcdl_batch [--stats] [-j num-threads] [--trace trace.json] [--gci [-r E|J|P]] output-dir quest1.bin quest1.dat [quest2.bin quest2.dat ...]\n");
+		return 1;
+	}
+
+	const char *output_dir = argv[argi];
+	char **files = &argv[argi + 1];
+	int num_jobs = num_files / 2;
+
+	if (create_directory(output_dir)) {
+		printf("Error creating output directory: %s\n", output_dir);
+		goto error;
+	}
+
+	jobs = calloc(num_jobs, sizeof(GCDL_JOB));
+	if (!jobs) {
+		printf("Not enough memory for %d quest(s).\n", num_jobs);
+		goto error;
+	}
+	for (int i = 0; i < num_jobs; ++i) {
+		GCDL_JOB *job = &jobs[i];
+		job->bin_filename = files[i * 2];
+		job->dat_filename = files[(i * 2) + 1];
+		if (!string_ends_with(job->bin_filename, ".bin") || !string_ends_with(job->dat_filename, ".dat")) {
+			printf("Expected a .bin file followed by a .dat file, but got: %s %s\n", job->bin_filename, job->dat_filename);
+			goto error;
+		}
+
+		// output file is named after the .bin file, e.g. "quest1.bin" -> "output-dir/quest1.qst"
+		const char *bin_base_filename = path_to_filename(job->bin_filename);
+		snprintf(job->output_qst_filename, sizeof(job->output_qst_filename), "%s/%.*s.qst",
+		         output_dir, (int)(strlen(bin_base_filename) - 4), bin_base_filename);
+
+		// .gci files are instead numbered in the order given, two per quest, e.g. "8P-GPOE-PSO______000.gci" and
+		// "8P-GPOE-PSO______001.gci" for the first quest
+		char gci_filename[64];
+		get_quest_card_filename(i * 2, job->bin_card_filename, sizeof(job->bin_card_filename));
+		get_quest_card_filename((i * 2) + 1, job->dat_card_filename, sizeof(job->dat_card_filename));
+		get_quest_gci_filename(job->bin_card_filename, region, gci_filename, sizeof(gci_filename));
+		snprintf(job->output_bin_gci_filename, sizeof(job->output_bin_gci_filename), "%s/%s", output_dir, gci_filename);
+		get_quest_gci_filename(job->dat_card_filename, region, gci_filename, sizeof(gci_filename));
+		snprintf(job->output_dat_gci_filename, sizeof(job->output_dat_gci_filename), "%s/%s", output_dir, gci_filename);
+	}
+
+	if (trace_filename) {
+		returncode = trace_start(trace_filename);
+		if (returncode) {
+			printf("Error code %d (%s) creating trace file: %s\n", returncode, get_error_message(returncode), trace_filename);
+			goto error;
+		}
+		trace_set_thread_name("main");
+	}
+
+	arenas = calloc(num_workers, sizeof(ARENA));
+	if (!arenas) {
+		printf("Not enough memory for %d thread(s).\n", num_workers);
+		goto error;
+	}
+	for (int i = 0; i < num_workers; ++i)
+		arena_init(&arenas[i], ARENA_DEFAULT_BLOCK_SIZE);
+
+	GCDL_BATCH batch;
+	batch.jobs = jobs;
+	batch.arenas = arenas;
+	batch.base_seed = (unsigned int)time(NULL);
+	batch.gci = gci;
+	batch.region = region;
+	batch.timestamp = (uint32_t)(time(NULL) - GCI_TIME_EPOCH);
+
+	uint64_t start = trace_begin();
+	returncode = batch_run(num_workers, num_jobs, run_job, &batch);
+	trace_end("batch", "batch", NULL, start);
+	if (returncode) {
+		printf("Error code %d (%s) running batch.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
+
+	if (trace_filename) {
+		printf("Writing trace to %s ...\n", trace_filename);
+		returncode = trace_finish();
+		if (returncode) {
+			printf("Error code %d (%s) writing trace file: %s\n", returncode, get_error_message(returncode), trace_filename);
+			goto error;
+		}
+	}
+
+	int num_failed = 0;
+	for (int i = 0; i < num_jobs; ++i) {
+		if (jobs[i].result)
+			++num_failed;
+	}
+	printf("Converted %d of %d quest(s) using %d thread(s).\n", num_jobs - num_failed, num_jobs, num_workers);
+
+	returncode = num_failed ? 1 : 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	if (arenas) {
+		for (int i = 0; i < num_workers; ++i)
+			arena_destroy(&arenas[i]);
+	}
+	free(arenas);
+	free(jobs);
+	return returncode;
+}
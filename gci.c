@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "retvals.h"
+#include "gci.h"
+#include "stats.h"
+
+int get_quest_data(const char *filename, uint8_t **dest, uint32_t *dest_size, GCI_DECRYPTED_DLQUEST_HEADER *header) {
+	if (!filename || !dest || !dest_size)
+		return ERROR_INVALID_PARAMS;
+
+	uint64_t start = stats_start();
+	FILE *fp = fopen(filename, "rb");
+	if (!fp)
+		return ERROR_FILE_NOT_FOUND;
+
+	int bytes_read;
+
+	bytes_read = fread(header, 1, sizeof(GCI_DECRYPTED_DLQUEST_HEADER), fp);
+	if (bytes_read != sizeof(GCI_DECRYPTED_DLQUEST_HEADER)) {
+		fclose(fp);
+		return ERROR_BAD_DATA;
+	}
+
+	// think this is all the game codes we could encounter ... ?
+	if (memcmp("GPOJ", header->gci_header.gamecode, 4) &&
+	    memcmp("GPOE", header->gci_header.gamecode, 4) &&
+	    memcmp("GPOP", header->gci_header.gamecode, 4)) {
+		fclose(fp);
+		return ERROR_BAD_DATA;
+	}
+
+	if (memcmp("8P", header->gci_header.company, 2)) {
+		fclose(fp);
+		return ERROR_BAD_DATA;
+	}
+
+	if (!header->size) {
+		fclose(fp);
+		return ERROR_BAD_DATA;
+	}
+
+	header->size = ENDIAN_SWAP_32(header->size);
+	uint32_t quest_data_size = header->size - sizeof(header->unknown1);
+	uint8_t *data = malloc(quest_data_size);
+	bytes_read = fread(data, 1, quest_data_size, fp);
+	if (bytes_read != quest_data_size) {
+		fclose(fp);
+		free(data);
+		return ERROR_BAD_DATA;
+	}
+
+	fclose(fp);
+	stats_end(STATS_READ, start, sizeof(GCI_DECRYPTED_DLQUEST_HEADER) + quest_data_size);
+	*dest = data;
+	*dest_size = quest_data_size;
+
+	return SUCCESS;
+}
+
+/*
+ * The reverse of get_quest_data. Builds the contents of a .gci file holding the given (unencrypted, PRS-compressed)
+ * quest .bin or .dat data, in the same layout get_quest_data reads. region is the last letter of the game code ('E',
+ * 'J' or 'P'). The file has no banner or icon, and its two comments ("PSO EPISODE I & II" and the given comment) are
+ * stored at the start of the card file data, which is otherwise zeroed. The file is padded out to a whole number of
+ * memory card blocks, as memory card managers and emulators expect.
+ *
+ * The output buffer is allocated from the given arena, or with malloc if arena is NULL (see arena.h).
+ */
+int build_quest_gci(const uint8_t *data,
+                    uint32_t size,
+                    char region,
+                    const char *card_filename,
+                    const char *comment,
+                    uint32_t timestamp,
+                    uint8_t **out_gci,
+                    size_t *out_gci_size,
+                    ARENA *arena) {
+	if (!data || !size || !card_filename || !out_gci || !out_gci_size)
+		return ERROR_INVALID_PARAMS;
+	if (region != 'E' && region != 'J' && region != 'P')
+		return ERROR_INVALID_PARAMS;
+	if (strlen(card_filename) >= sizeof(((GCI*)0)->filename))
+		return ERROR_INVALID_PARAMS;
+
+	uint32_t num_blocks = get_quest_gci_num_blocks(size);
+	size_t gci_size = sizeof(GCI) + ((size_t)num_blocks * GCI_BLOCK_SIZE);
+
+	uint8_t *gci = arena_alloc(arena, gci_size);
+	if (!gci)
+		return ERROR_IO;
+	memset(gci, 0, gci_size);
+
+	GCI_DECRYPTED_DLQUEST_HEADER *header = (GCI_DECRYPTED_DLQUEST_HEADER*)gci;
+	memcpy(header->gci_header.gamecode, "GPO", 3);
+	header->gci_header.gamecode[3] = (uint8_t)region;
+	memcpy(header->gci_header.company, "8P", 2);
+	header->gci_header.reserved01 = 0xff;
+	header->gci_header.banner_fmt = 0;
+	strncpy((char*)header->gci_header.filename, card_filename, sizeof(header->gci_header.filename));
+	header->gci_header.time = ENDIAN_SWAP_32(timestamp);
+	header->gci_header.icon_addr = 0xffffffff;
+	header->gci_header.icon_fmt = 0;
+	header->gci_header.icon_speed = 0;
+	header->gci_header.unknown1 = 0;
+	header->gci_header.unknown2 = 0;
+	header->gci_header.index = 0;
+	header->gci_header.filesize8 = ENDIAN_SWAP_16((uint16_t)num_blocks);
+	header->gci_header.reserved02 = 0xffff;
+	header->gci_header.comment_addr = 0;
+
+	strncpy((char*)header->card_file_header, "PSO EPISODE I & II", GCI_COMMENT_SIZE - 1);
+	if (comment)
+		strncpy((char*)header->card_file_header + GCI_COMMENT_SIZE, comment, GCI_COMMENT_SIZE - 1);
+
+	// as read back by get_quest_data, the size includes the 4 bytes following it
+	header->size = ENDIAN_SWAP_32(size + (uint32_t)sizeof(header->unknown1));
+	memcpy(gci + sizeof(GCI_DECRYPTED_DLQUEST_HEADER), data, size);
+
+	*out_gci = gci;
+	*out_gci_size = gci_size;
+	return SUCCESS;
+}
+
+// the number of memory card blocks a .gci file built by build_quest_gci from the given size of quest data takes up
+uint32_t get_quest_gci_num_blocks(uint32_t size) {
+	// everything after the GCI header counts towards the file's size on the memory card
+	size_t card_file_size = sizeof(GCI_DECRYPTED_DLQUEST_HEADER) - sizeof(GCI) + size;
+	return (card_file_size + GCI_BLOCK_SIZE - 1) / GCI_BLOCK_SIZE;
+}
+
+// the memory card filename of the given number, in the same form as the quest files saved by the game itself
+void get_quest_card_filename(uint32_t number, char *out_filename, size_t out_filename_size) {
+	snprintf(out_filename, out_filename_size, "PSO______%03u", number);
+}
+
+// the filename Dolphin (and most memory card managers) use when exporting a file, e.g. "8P-GPOE-PSO______012.gci"
+int get_quest_gci_filename(const char *card_filename, char region, char *out_filename, size_t out_filename_size) {
+	if (!card_filename || !out_filename)
+		return ERROR_INVALID_PARAMS;
+
+	snprintf(out_filename, out_filename_size, "8P-GPO%c-%s.gci", region, card_filename);
+	return SUCCESS;
+}
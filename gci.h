@@ -0,0 +1,68 @@
+#ifndef GCI_H_INCLUDED
+#define GCI_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "defs.h"
+#include "arena.h"
+
+#define ENDIAN_SWAP_32(x) ( (((x) >> 24) & 0x000000FF) | \
+                            (((x) >>  8) & 0x0000FF00) | \
+                            (((x) <<  8) & 0x00FF0000) | \
+                            (((x) << 24) & 0xFF000000) )
+#define ENDIAN_SWAP_16(x) ( (((x) >> 8) & 0x00FF) | \
+                            (((x) << 8) & 0xFF00) )
+
+#define GCI_BLOCK_SIZE                 8192
+#define GCI_COMMENT_SIZE               32     // there are two comments, each this size
+#define GCI_TIME_EPOCH                 946684800  // 2000-01-01, which memory card timestamps count seconds from
+
+
+// copied from https://github.com/suloku/gcmm/blob/master/source/gci.h
+typedef struct _PACKED_ {
+	uint8_t gamecode[4];
+	uint8_t company[2];
+	uint8_t reserved01;    /*** Always 0xff ***/
+	uint8_t banner_fmt;
+	uint8_t filename[32];
+	uint32_t time;
+	uint32_t icon_addr;  /*** Offset to banner/icon data ***/
+	uint16_t icon_fmt;
+	uint16_t icon_speed;
+	uint8_t unknown1;    /*** Permission key ***/
+	uint8_t unknown2;    /*** Copy Counter ***/
+	uint16_t index;        /*** Start block of savegame in memory card (Ignore - and throw away) ***/
+	uint16_t filesize8;    /*** File size / 8192 ***/
+	uint16_t reserved02;    /*** Always 0xffff ***/
+	uint32_t comment_addr;
+} GCI;
+
+typedef struct _PACKED_ {
+	GCI gci_header;
+	uint8_t card_file_header[0x2040];  // big area containing the icon and such other things. ignored
+
+	// this is stored in big-endian format in the original card data. we will convert right after loading...
+	// this size value indicates the size of the quest data. it DOES NOT include the size value itself, 'nor
+	// the subsequent "unknown" bytes (which we are not interested in and will be skipping during load)
+	uint32_t size;
+
+	uint32_t unknown1;
+	uint8_t unknown2[16];
+} GCI_DECRYPTED_DLQUEST_HEADER;
+
+int get_quest_data(const char *filename, uint8_t **dest, uint32_t *dest_size, GCI_DECRYPTED_DLQUEST_HEADER *header);
+int build_quest_gci(const uint8_t *data,
+                    uint32_t size,
+                    char region,
+                    const char *card_filename,
+                    const char *comment,
+                    uint32_t timestamp,
+                    uint8_t **out_gci,
+                    size_t *out_gci_size,
+                    ARENA *arena);
+uint32_t get_quest_gci_num_blocks(uint32_t size);
+void get_quest_card_filename(uint32_t number, char *out_filename, size_t out_filename_size);
+int get_quest_gci_filename(const char *card_filename, char region, char *out_filename, size_t out_filename_size);
+
+#endif
@@ -21,103 +21,15 @@
 #include <string.h>
 #include <malloc.h>
 
-#include <sylverant/encryption.h>
-#include <sylverant/prs.h>
 #include "fuzziqer_prs.h"
 
 #include "defs.h"
 
 #include "quests.h"
+#include "gci.h"
+#include "decode_cache.h"
 #include "utils.h"
-
-#define ENDIAN_SWAP_32(x) ( (((x) >> 24) & 0x000000FF) | \
-                            (((x) >>  8) & 0x0000FF00) | \
-                            (((x) <<  8) & 0x00FF0000) | \
-                            (((x) << 24) & 0xFF000000) )
-
-
-// copied from https://github.com/suloku/gcmm/blob/master/source/gci.h
-typedef struct _PACKED_ {
-	uint8_t gamecode[4];
-	uint8_t company[2];
-	uint8_t reserved01;    /*** Always 0xff ***/
-	uint8_t banner_fmt;
-	uint8_t filename[32];
-	uint32_t time;
-	uint32_t icon_addr;  /*** Offset to banner/icon data ***/
-	uint16_t icon_fmt;
-	uint16_t icon_speed;
-	uint8_t unknown1;    /*** Permission key ***/
-	uint8_t unknown2;    /*** Copy Counter ***/
-	uint16_t index;        /*** Start block of savegame in memory card (Ignore - and throw away) ***/
-	uint16_t filesize8;    /*** File size / 8192 ***/
-	uint16_t reserved02;    /*** Always 0xffff ***/
-	uint32_t comment_addr;
-} GCI;
-
-typedef struct _PACKED_ {
-	GCI gci_header;
-	uint8_t card_file_header[0x2040];  // big area containing the icon and such other things. ignored
-
-	// this is stored in big-endian format in the original card data. we will convert right after loading...
-	// this size value indicates the size of the quest data. it DOES NOT include the size value itself, 'nor
-	// the subsequent "unknown" bytes (which we are not interested in and will be skipping during load)
-	uint32_t size;
-
-	uint32_t unknown1;
-	uint8_t unknown2[16];
-} GCI_DECRYPTED_DLQUEST_HEADER;
-
-int get_quest_data(const char *filename, uint8_t **dest, uint32_t *dest_size, GCI_DECRYPTED_DLQUEST_HEADER *header) {
-	if (!filename || !dest || !dest_size)
-		return ERROR_INVALID_PARAMS;
-
-	FILE *fp = fopen(filename, "rb");
-	if (!fp)
-		return ERROR_FILE_NOT_FOUND;
-
-	int bytes_read;
-
-	bytes_read = fread(header, 1, sizeof(GCI_DECRYPTED_DLQUEST_HEADER), fp);
-	if (bytes_read != sizeof(GCI_DECRYPTED_DLQUEST_HEADER)) {
-		fclose(fp);
-		return ERROR_BAD_DATA;
-	}
-
-	// think this is all the game codes we could encounter ... ?
-	if (memcmp("GPOJ", header->gci_header.gamecode, 4) &&
-	    memcmp("GPOE", header->gci_header.gamecode, 4) &&
-	    memcmp("GPOP", header->gci_header.gamecode, 4)) {
-		fclose(fp);
-		return ERROR_BAD_DATA;
-	}
-
-	if (memcmp("8P", header->gci_header.company, 2)) {
-		fclose(fp);
-		return ERROR_BAD_DATA;
-	}
-
-	if (!header->size) {
-		fclose(fp);
-		return ERROR_BAD_DATA;
-	}
-
-	header->size = ENDIAN_SWAP_32(header->size);
-	uint32_t quest_data_size = header->size - sizeof(header->unknown1);
-	uint8_t *data = malloc(quest_data_size);
-	bytes_read = fread(data, 1, quest_data_size, fp);
-	if (bytes_read != quest_data_size) {
-		fclose(fp);
-		free(data);
-		return ERROR_BAD_DATA;
-	}
-
-	fclose(fp);
-	*dest = data;
-	*dest_size = quest_data_size;
-
-	return SUCCESS;
-}
+#include "stats.h"
 
 int main(int argc, char *argv[]) {
 	int returncode, validation_result;
@@ -130,8 +42,10 @@ int main(int argc, char *argv[]) {
 	size_t decompressed_bin_size, decompressed_dat_size;
 	char out_filename[FILENAME_MAX];
 
+	stats_parse_args(&argc, argv);
+
 	if (argc != 3 && argc != 5) {
-		printf("Usage: gci quest-bin.gci quest-dat.gci [output.bin] [output.dat]\n");
+		printf("Usage: gci [--stats] quest-bin.gci quest-dat.gci [output.bin] [output.dat]\n");
 		return 1;
 	}
 
@@ -162,8 +76,7 @@ int main(int argc, char *argv[]) {
 	/** decompress loaded quest .bin data and validate it **/
 	printf("Validating quest .bin data ...\n");
 
-	//result = prs_decompress_buf(bin_data, &decompressed_bin_data, bin_data_size);
-	result = fuzziqer_prs_decompress_buf(bin_data, &decompressed_bin_data, bin_data_size);
+	result = decode_cache_decompress_buf(bin_data, &decompressed_bin_data, bin_data_size);
 	if (result < 0) {
 		printf("Error code %d decompressing .bin data.\n", result);
 		goto error;
@@ -171,7 +84,11 @@ int main(int argc, char *argv[]) {
 	decompressed_bin_size = result;
 
 	QUEST_BIN_HEADER *bin_header = (QUEST_BIN_HEADER*)decompressed_bin_data;
-	validation_result = validate_quest_bin(bin_header, decompressed_bin_size, true);
+	// a previously cached failed validation is re-run anyway, so the same issues will still be displayed
+	if (!decode_cache_get_validation(bin_data, bin_data_size, &validation_result) || validation_result) {
+		validation_result = validate_quest_bin(bin_header, decompressed_bin_size, true);
+		decode_cache_set_validation(bin_data, bin_data_size, validation_result);
+	}
 	validation_result = handle_quest_bin_validation_issues(validation_result, bin_header, &decompressed_bin_data, &decompressed_bin_size);
 	if (validation_result) {
 		printf("Aborting due to invalid quest .bin data.\n");
@@ -182,14 +99,17 @@ int main(int argc, char *argv[]) {
 	/** decompress loaded quest .dat data and validate it. this decompressed data is not used otherwise **/
 	printf("Validating quest .dat data ...\n");
 
-	result = prs_decompress_buf(dat_data, &decompressed_dat_data, dat_data_size);
+	result = decode_cache_decompress_buf(dat_data, &decompressed_dat_data, dat_data_size);
 	if (result < 0) {
 		printf("Error code %d decompressing .dat data.\n", result);
 		goto error;
 	}
 	decompressed_dat_size = result;
 
-	validation_result = validate_quest_dat(decompressed_dat_data, decompressed_dat_size, true);
+	if (!decode_cache_get_validation(dat_data, dat_data_size, &validation_result) || validation_result) {
+		validation_result = validate_quest_dat(decompressed_dat_data, decompressed_dat_size, true);
+		decode_cache_set_validation(dat_data, dat_data_size, validation_result);
+	}
 	validation_result = handle_quest_dat_validation_issues(validation_result, &decompressed_dat_data, &decompressed_dat_size);
 	if (validation_result) {
 		printf("Aborting due to invalid quest .dat data.\n");
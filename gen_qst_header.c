@@ -4,6 +4,9 @@
  * Given a set of input .bin/.dat quest files, this will automatically generate .hdr files for each appropriate for
  * a .qst file containing these .bin/.dat files.
  *
+ * Optionally, a UTF-8 quest name can be given which will be used in the generated headers instead of the name found
+ * in the .bin file. It is converted to Shift-JIS as the game expects.
+ *
  * This tool was originally made to supplement the "qst_tool" found here https://github.com/Sylverant/pso_tools
  * which has somewhat primitive support for automatically generating .qst header information.
  *
@@ -15,26 +18,32 @@
 #include <malloc.h>
 #include <string.h>
 
-#include <sylverant/prs.h>
-
+#include "retvals.h"
 #include "utils.h"
+#include "stats.h"
 #include "quests.h"
-//#include "textconv.h"
+#include "decode_cache.h"
 
 int main(int argc, char *argv[]) {
 	int returncode, validation_result;
+	int32_t result;
+	uint8_t *compressed_bin = NULL;
+	uint8_t *compressed_dat = NULL;
 	uint8_t *bin_data = NULL;
 	uint8_t *dat_data = NULL;
 	char *bin_hdr_file = NULL;
 	char *dat_hdr_file = NULL;
 
-	if (argc != 3) {
-		printf("Usage: gen_qst_header quest.bin quest.dat\n");
+	stats_parse_args(&argc, argv);
+
+	if (argc != 3 && argc != 4) {
+		printf("Usage: gen_qst_header [--stats] quest.bin quest.dat [\"quest name\"]\n");
 		return 1;
 	}
 
 	const char *bin_file = argv[1];
 	const char *dat_file = argv[2];
+	const char *quest_name = (argc == 4 ? argv[3] : NULL);
 
 	const char *bin_base_filename = path_to_filename(bin_file);
 	if (strlen(bin_base_filename) > QUEST_FILENAME_MAX_LENGTH) {
@@ -47,44 +56,45 @@ int main(int argc, char *argv[]) {
 		goto error;
 	}
 
-	size_t bin_compressed_size, dat_compressed_size;
+	uint32_t bin_compressed_size, dat_compressed_size;
 
-	returncode = get_filesize(bin_file, &bin_compressed_size);
+	returncode = read_file(bin_file, &compressed_bin, &bin_compressed_size);
 	if (returncode) {
-		printf("Error code %d (%s) getting size of bin file: %s\n", returncode, get_error_message(returncode), bin_file);
+		printf("Error code %d (%s) reading bin file: %s\n", returncode, get_error_message(returncode), bin_file);
 		goto error;
 	}
-	returncode = get_filesize(dat_file, &dat_compressed_size);
+	returncode = read_file(dat_file, &compressed_dat, &dat_compressed_size);
 	if (returncode) {
-		printf("Error code %d (%s) getting size of dat file: %s\n", returncode, get_error_message(returncode), dat_file);
+		printf("Error code %d (%s) reading dat file: %s\n", returncode, get_error_message(returncode), dat_file);
 		goto error;
 	}
 
 
-	size_t bin_decompressed_size = prs_decompress_file(bin_file, &bin_data);
-	if (bin_decompressed_size < 0) {
-		printf("Error opening and decompressing bin file: %s\n", bin_file);
+	result = decode_cache_decompress_buf(compressed_bin, &bin_data, bin_compressed_size);
+	if (result < 0) {
+		printf("Error code %d decompressing bin file: %s\n", result, bin_file);
 		goto error;
 	}
+	size_t bin_decompressed_size = result;
 
-	size_t dat_decompressed_size = prs_decompress_file(dat_file, &dat_data);
-	if (dat_decompressed_size < 0) {
-		printf("Error opening and decompressing dat file: %s\n", dat_file);
+	result = decode_cache_decompress_buf(compressed_dat, &dat_data, dat_compressed_size);
+	if (result < 0) {
+		printf("Error code %d decompressing dat file: %s\n", result, dat_file);
 		goto error;
 	}
 
 
 	QUEST_BIN_HEADER *bin_header = (QUEST_BIN_HEADER*)bin_data;
-	validation_result = validate_quest_bin(bin_header, bin_decompressed_size, true);
+	// a previously cached failed validation is re-run anyway, so the same issues will still be displayed
+	if (!decode_cache_get_validation(compressed_bin, bin_compressed_size, &validation_result) || validation_result) {
+		validation_result = validate_quest_bin(bin_header, bin_decompressed_size, true);
+		decode_cache_set_validation(compressed_bin, bin_compressed_size, validation_result);
+	}
 	if (validation_result) {
 		printf("Aborting due to invalid quest .bin data.\n");
 		goto error;
 	}
 
-	//sjis_to_utf8(bin_header->name, sizeof(bin_header->name));
-	//sjis_to_utf8(bin_header->short_description, sizeof(bin_header->short_description));
-	//sjis_to_utf8(bin_header->long_description, sizeof(bin_header->long_description));
-
 	print_quick_quest_info(bin_header, bin_compressed_size, dat_compressed_size);
 
 
@@ -92,6 +102,13 @@ int main(int argc, char *argv[]) {
 	generate_qst_header(bin_base_filename, bin_compressed_size, bin_header, &qst_bin_header);
 	generate_qst_header(dat_base_filename, dat_compressed_size, bin_header, &qst_dat_header);
 
+	if (quest_name) {
+		returncode = set_qst_header_name(&qst_bin_header, quest_name);
+		if (returncode == ERROR_TRUNCATED)
+			printf("WARNING: Quest name \"%s\" is too long and has been truncated.\n", quest_name);
+		set_qst_header_name(&qst_dat_header, quest_name);
+	}
+
 	bin_hdr_file = append_string(bin_file, ".hdr");
 	dat_hdr_file = append_string(dat_file, ".hdr");
 
@@ -115,6 +132,8 @@ error:
 quit:
 	free(bin_hdr_file);
 	free(dat_hdr_file);
+	free(compressed_bin);
+	free(compressed_dat);
 	free(bin_data);
 	free(dat_data);
 	return returncode;
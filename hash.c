@@ -0,0 +1,131 @@
+/*
+ * XXH64 implementation, following the xxHash specification:
+ * https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ *
+ * Used for content-addressing decompressed quest data. It is fast enough to not really matter next to PRS
+ * decompression, and the 64-bit hashes are plenty for the number of quests we are ever going to deal with.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "retvals.h"
+#include "hash.h"
+
+#define PRIME64_1                      0x9E3779B185EBCA87ULL
+#define PRIME64_2                      0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3                      0x165667B19E3779F9ULL
+#define PRIME64_4                      0x85EBCA77C2B2AE63ULL
+#define PRIME64_5                      0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+// memcpy keeps these safe for unaligned data. the input is always treated as little-endian, as all of our data is
+static inline uint64_t read64(const uint8_t *p) {
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t value) {
+	acc ^= xxh64_round(0, value);
+	return (acc * PRIME64_1) + PRIME64_4;
+}
+
+uint64_t xxh64(const void *data, size_t length, uint64_t seed) {
+	const uint8_t *p = (const uint8_t*)data;
+	const uint8_t *end = p + length;
+	uint64_t h;
+
+	if (length >= 32) {
+		const uint8_t *limit = end - 32;
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+
+		do {
+			v1 = xxh64_round(v1, read64(p));
+			v2 = xxh64_round(v2, read64(p + 8));
+			v3 = xxh64_round(v3, read64(p + 16));
+			v4 = xxh64_round(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = xxh64_merge_round(h, v1);
+		h = xxh64_merge_round(h, v2);
+		h = xxh64_merge_round(h, v3);
+		h = xxh64_merge_round(h, v4);
+	} else {
+		h = seed + PRIME64_5;
+	}
+
+	h += (uint64_t)length;
+
+	while ((p + 8) <= end) {
+		h ^= xxh64_round(0, read64(p));
+		h = (rotl64(h, 27) * PRIME64_1) + PRIME64_4;
+		p += 8;
+	}
+	if ((p + 4) <= end) {
+		h ^= (uint64_t)read32(p) * PRIME64_1;
+		h = (rotl64(h, 23) * PRIME64_2) + PRIME64_3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= (*p) * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+		++p;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+// out_string must have room for HASH_STRING_LENGTH + 1 characters
+void hash_to_string(uint64_t hash, char *out_string) {
+	snprintf(out_string, HASH_STRING_LENGTH + 1, "%016llx", (unsigned long long)hash);
+}
+
+int string_to_hash(const char *s, uint64_t *out_hash) {
+	if (!s || !out_hash || strlen(s) != HASH_STRING_LENGTH)
+		return ERROR_INVALID_PARAMS;
+
+	uint64_t hash = 0;
+	for (int i = 0; i < HASH_STRING_LENGTH; ++i) {
+		char c = s[i];
+		hash <<= 4;
+		if (c >= '0' && c <= '9')
+			hash |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			hash |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			hash |= c - 'A' + 10;
+		else
+			return ERROR_BAD_DATA;
+	}
+
+	*out_hash = hash;
+	return SUCCESS;
+}
@@ -0,0 +1,14 @@
+#ifndef HASH_H_INCLUDED
+#define HASH_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+// length of a hash formatted as a hex string, not including the null terminator
+#define HASH_STRING_LENGTH             16
+
+uint64_t xxh64(const void *data, size_t length, uint64_t seed);
+void hash_to_string(uint64_t hash, char *out_string);
+int string_to_hash(const char *s, uint64_t *out_hash);
+
+#endif
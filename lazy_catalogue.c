@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "retvals.h"
+#include "lazy_catalogue.h"
+#include "utils.h"
+
+static void evict(LAZY_CATALOGUE *catalogue, LAZY_CATALOGUE_ENTRY *entry) {
+	quest_catalogue_free_quest(&entry->body);
+	memset(&entry->body, 0, sizeof(CATALOGUE_QUEST));
+	catalogue->resident_bytes -= entry->body_size;
+	--catalogue->num_resident;
+	entry->body_size = 0;
+	entry->resident = false;
+	entry->referenced = false;
+	++entry->evictions;
+}
+
+// evicts bodies until everything in memory fits within the budget again (or everything left is pinned)
+static void enforce_budget(LAZY_CATALOGUE *catalogue) {
+	// two full sweeps: the first may only be clearing reference bits
+	int remaining = catalogue->num_entries * 2;
+	while (catalogue->resident_bytes > catalogue->budget && remaining-- > 0) {
+		LAZY_CATALOGUE_ENTRY *entry = &catalogue->entries[catalogue->clock_hand];
+		catalogue->clock_hand = (catalogue->clock_hand + 1) % catalogue->num_entries;
+
+		if (!entry->resident || entry->pins)
+			continue;
+
+		if (entry->referenced)
+			entry->referenced = false;
+		else
+			evict(catalogue, entry);
+	}
+}
+
+/*
+ * Loads each quest once, to check that it can be served and to keep its QUEST_BIN_HEADER. The bodies are then
+ * dropped again, and only loaded back in as they are asked for.
+ */
+int lazy_catalogue_init(LAZY_CATALOGUE *catalogue, const char **qst_filenames, int num_files, size_t budget) {
+	int returncode;
+
+	if (!catalogue || !qst_filenames || num_files <= 0)
+		return ERROR_INVALID_PARAMS;
+
+	memset(catalogue, 0, sizeof(LAZY_CATALOGUE));
+	catalogue->budget = budget;
+	catalogue->entries = calloc(num_files, sizeof(LAZY_CATALOGUE_ENTRY));
+	if (!catalogue->entries)
+		return ERROR_IO;
+	catalogue->num_entries = num_files;
+
+	for (int i = 0; i < num_files; ++i) {
+		LAZY_CATALOGUE_ENTRY *entry = &catalogue->entries[i];
+		CATALOGUE_QUEST quest;
+
+		entry->filename = strdup(qst_filenames[i]);
+		if (!entry->filename) {
+			returncode = ERROR_IO;
+			goto error;
+		}
+
+		returncode = quest_catalogue_load_quest(qst_filenames[i], &quest);
+		if (returncode) {
+			printf("Error code %d (%s) loading quest file: %s. Only download/offline .qst files can be served.\n", returncode, get_error_message(returncode), qst_filenames[i]);
+			goto error;
+		}
+
+		if (quest.bin_size < sizeof(QUEST_BIN_HEADER)) {
+			printf("Quest file %s has a .bin file too small to be valid.\n", qst_filenames[i]);
+			quest_catalogue_free_quest(&quest);
+			returncode = ERROR_BAD_DATA;
+			goto error;
+		}
+
+		memcpy(&entry->bin_header, quest.bin_data, sizeof(QUEST_BIN_HEADER));
+		quest_catalogue_free_quest(&quest);
+	}
+
+	return SUCCESS;
+
+error:
+	lazy_catalogue_destroy(catalogue);
+	return returncode;
+}
+
+void lazy_catalogue_destroy(LAZY_CATALOGUE *catalogue) {
+	if (!catalogue)
+		return;
+
+	for (int i = 0; i < catalogue->num_entries; ++i) {
+		quest_catalogue_free_quest(&catalogue->entries[i].body);
+		free(catalogue->entries[i].filename);
+	}
+	free(catalogue->entries);
+	memset(catalogue, 0, sizeof(LAZY_CATALOGUE));
+}
+
+/*
+ * Returns a quest with its body loaded, loading it first if it isn't in memory. The entry is pinned (it will not be
+ * evicted) until it is given back with lazy_catalogue_release.
+ */
+int lazy_catalogue_acquire(LAZY_CATALOGUE *catalogue, uint32_t index, LAZY_CATALOGUE_ENTRY **out_entry) {
+	int returncode;
+
+	if (!catalogue || !out_entry || index >= (uint32_t)catalogue->num_entries)
+		return ERROR_INVALID_PARAMS;
+
+	LAZY_CATALOGUE_ENTRY *entry = &catalogue->entries[index];
+	if (entry->resident) {
+		++entry->hits;
+	} else {
+		++entry->misses;
+		returncode = quest_catalogue_load_quest(entry->filename, &entry->body);
+		if (returncode) {
+			printf("Error code %d (%s) loading quest file: %s\n", returncode, get_error_message(returncode), entry->filename);
+			return returncode;
+		}
+
+		entry->body_size = entry->body.qst_size + entry->body.bin_size + entry->body.dat_size;
+		entry->resident = true;
+		catalogue->resident_bytes += entry->body_size;
+		++catalogue->num_resident;
+		if (catalogue->resident_bytes > catalogue->peak_resident_bytes)
+			catalogue->peak_resident_bytes = catalogue->resident_bytes;
+	}
+
+	entry->referenced = true;
+	++entry->pins;
+	enforce_budget(catalogue);
+
+	*out_entry = entry;
+	return SUCCESS;
+}
+
+void lazy_catalogue_release(LAZY_CATALOGUE *catalogue, LAZY_CATALOGUE_ENTRY *entry) {
+	if (!catalogue || !entry || !entry->pins)
+		return;
+
+	--entry->pins;
+	if (!entry->pins)
+		enforce_budget(catalogue);
+}
+
+void lazy_catalogue_print_stats(const LAZY_CATALOGUE *catalogue) {
+	uint64_t hits = 0, misses = 0, evictions = 0;
+
+	printf("Quest body cache (budget %zu bytes, peak %zu bytes, %d of %d resident now):\n",
+	       catalogue->budget, catalogue->peak_resident_bytes, catalogue->num_resident, catalogue->num_entries);
+	for (int i = 0; i < catalogue->num_entries; ++i) {
+		const LAZY_CATALOGUE_ENTRY *entry = &catalogue->entries[i];
+		hits += entry->hits;
+		misses += entry->misses;
+		evictions += entry->evictions;
+		if (entry->hits || entry->misses) {
+			printf("Quest %d: %llu hit(s), %llu miss(es), %llu eviction(s) - %s\n", i,
+			       (unsigned long long)entry->hits, (unsigned long long)entry->misses,
+			       (unsigned long long)entry->evictions, entry->filename);
+		}
+	}
+
+	uint64_t total = hits + misses;
+	printf("Total: %llu hit(s), %llu miss(es), %llu eviction(s). Hit rate %.1f%%\n",
+	       (unsigned long long)hits, (unsigned long long)misses, (unsigned long long)evictions,
+	       total ? (100.0 * hits / total) : 0.0);
+}
@@ -0,0 +1,56 @@
+#ifndef LAZY_CATALOGUE_H_INCLUDED
+#define LAZY_CATALOGUE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "quests.h"
+#include "quest_catalogue.h"
+
+/*
+ * A quest catalogue which only keeps quest bodies (the .qst packet stream and the decompressed .bin and .dat data) in
+ * memory while they are being used, up to a byte budget. Only each quest's QUEST_BIN_HEADER and a little index data is
+ * always kept. A quest's body is loaded from its file the first time it is asked for. Once the bodies in memory add
+ * up to more than the budget, unused ones are evicted using the CLOCK policy (an approximation of LRU). Bodies still
+ * being downloaded are pinned and never evicted, so a single download always works even when its quest is larger
+ * than the whole budget.
+ *
+ * Hits, misses (loads) and evictions are counted per quest, to help pick a budget.
+ *
+ * This is not thread-safe. It is meant to be used by a single thread, e.g. the one running a QST_SENDER.
+ */
+
+typedef struct {
+	char *filename;
+	QUEST_BIN_HEADER bin_header;
+
+	CATALOGUE_QUEST body;
+	size_t body_size;
+	bool resident;
+	bool referenced;            // CLOCK reference bit, set on each hit
+	uint32_t pins;
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+} LAZY_CATALOGUE_ENTRY;
+
+typedef struct {
+	LAZY_CATALOGUE_ENTRY *entries;
+	int num_entries;
+	int clock_hand;
+
+	size_t budget;
+	size_t resident_bytes;
+	size_t peak_resident_bytes;
+	int num_resident;
+} LAZY_CATALOGUE;
+
+int lazy_catalogue_init(LAZY_CATALOGUE *catalogue, const char **qst_filenames, int num_files, size_t budget);
+void lazy_catalogue_destroy(LAZY_CATALOGUE *catalogue);
+int lazy_catalogue_acquire(LAZY_CATALOGUE *catalogue, uint32_t index, LAZY_CATALOGUE_ENTRY **out_entry);
+void lazy_catalogue_release(LAZY_CATALOGUE *catalogue, LAZY_CATALOGUE_ENTRY *entry);
+void lazy_catalogue_print_stats(const LAZY_CATALOGUE *catalogue);
+
+#endif
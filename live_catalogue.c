@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "retvals.h"
+#include "live_catalogue.h"
+#include "utils.h"
+#include "stats.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+#define POLL_INTERVAL_MS 100
+
+static int is_qst_file(const struct dirent *entry) {
+	return entry->d_name[0] != '.' && string_ends_with(entry->d_name, ".qst");
+}
+
+static void entry_add_ref(LIVE_CATALOGUE_ENTRY *entry) {
+	__atomic_add_fetch(&entry->refs, 1, __ATOMIC_RELAXED);
+}
+
+// drops a reference to an entry, freeing it if it was the last one. this can happen on any thread
+void live_catalogue_release(LIVE_CATALOGUE_ENTRY *entry) {
+	if (!entry)
+		return;
+
+	if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		quest_catalogue_free_quest(&entry->quest);
+		free(entry->filename);
+		free(entry);
+	}
+}
+
+static void free_snapshot(LIVE_CATALOGUE_SNAPSHOT *snapshot) {
+	if (!snapshot)
+		return;
+
+	for (int i = 0; i < snapshot->num_entries; ++i)
+		live_catalogue_release(snapshot->entries[i]);
+	free(snapshot->entries);
+	free(snapshot);
+}
+
+static bool same_file(const LIVE_CATALOGUE_ENTRY *entry, const struct stat *st) {
+	return entry->inode == st->st_ino &&
+	       entry->size == st->st_size &&
+	       entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+	       entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static LIVE_CATALOGUE_ENTRY* find_entry(const LIVE_CATALOGUE_SNAPSHOT *snapshot, const char *filename) {
+	if (!snapshot)
+		return NULL;
+
+	for (int i = 0; i < snapshot->num_entries; ++i) {
+		if (!strcmp(snapshot->entries[i]->filename, filename))
+			return snapshot->entries[i];
+	}
+	return NULL;
+}
+
+static LIVE_CATALOGUE_ENTRY* load_entry(const char *directory, const char *filename, const struct stat *st) {
+	char path[FILENAME_MAX];
+	int returncode;
+
+	snprintf(path, FILENAME_MAX, "%s/%s", directory, filename);
+
+	LIVE_CATALOGUE_ENTRY *entry = calloc(1, sizeof(LIVE_CATALOGUE_ENTRY));
+	if (!entry)
+		return NULL;
+
+	returncode = quest_catalogue_load_quest(path, &entry->quest);
+	if (returncode) {
+		printf("Error code %d (%s) loading quest file: %s. Only download/offline .qst files can be served.\n", returncode, get_error_message(returncode), path);
+		free(entry);
+		return NULL;
+	}
+
+	entry->filename = strdup(filename);
+	entry->inode = st->st_ino;
+	entry->size = st->st_size;
+	entry->mtime = st->st_mtim;
+	entry->refs = 1;
+	return entry;
+}
+
+// frees every retired snapshot that no reader can still be using. only called by the thread doing the reloading
+static void reclaim_snapshots(LIVE_CATALOGUE *catalogue) {
+	uint64_t oldest = UINT64_MAX;
+	for (int i = 0; i < catalogue->num_readers; ++i) {
+		uint64_t epoch = __atomic_load_n(&catalogue->reader_epochs[i], __ATOMIC_SEQ_CST);
+		if (epoch && epoch < oldest)
+			oldest = epoch;
+	}
+
+	// a reader that entered epoch e (or later) did so after every snapshot retired at epoch e had been replaced, so it
+	// can only have seen newer snapshots
+	LIVE_CATALOGUE_SNAPSHOT **link = &catalogue->retired;
+	while (*link) {
+		LIVE_CATALOGUE_SNAPSHOT *snapshot = *link;
+		if (snapshot->retired_epoch <= oldest) {
+			*link = snapshot->next_retired;
+			free_snapshot(snapshot);
+		} else {
+			link = &snapshot->next_retired;
+		}
+	}
+}
+
+static void publish_snapshot(LIVE_CATALOGUE *catalogue, LIVE_CATALOGUE_SNAPSHOT *snapshot) {
+	LIVE_CATALOGUE_SNAPSHOT *old = __atomic_exchange_n(&catalogue->current, snapshot, __ATOMIC_SEQ_CST);
+	if (old) {
+		old->retired_epoch = __atomic_add_fetch(&catalogue->epoch, 1, __ATOMIC_SEQ_CST);
+		old->next_retired = catalogue->retired;
+		catalogue->retired = old;
+	}
+	reclaim_snapshots(catalogue);
+}
+
+/*
+ * Scans the directory and publishes a new snapshot if any .qst files were added, changed or removed. Files which are
+ * unchanged since the current snapshot are not loaded again. If a changed file can't be loaded (e.g. it is only
+ * partly written so far), the previous version of that quest is kept.
+ */
+int live_catalogue_reload(LIVE_CATALOGUE *catalogue, bool *out_changed) {
+	struct dirent **names = NULL;
+	LIVE_CATALOGUE_SNAPSHOT *snapshot = NULL;
+	LIVE_CATALOGUE_SNAPSHOT *current = catalogue->current;   // only this thread ever replaces it
+	bool changed = false;
+	int returncode;
+
+	if (out_changed)
+		*out_changed = false;
+
+	int num_names = scandir(catalogue->directory, &names, is_qst_file, alphasort);
+	if (num_names < 0)
+		return ERROR_IO;
+
+	snapshot = calloc(1, sizeof(LIVE_CATALOGUE_SNAPSHOT));
+	if (!snapshot) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+	snapshot->entries = calloc(num_names ? num_names : 1, sizeof(LIVE_CATALOGUE_ENTRY*));
+	if (!snapshot->entries) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	for (int i = 0; i < num_names; ++i) {
+		char path[FILENAME_MAX];
+		struct stat st;
+		const char *filename = names[i]->d_name;
+
+		snprintf(path, FILENAME_MAX, "%s/%s", catalogue->directory, filename);
+		if (stat(path, &st) || !S_ISREG(st.st_mode))
+			continue;
+
+		LIVE_CATALOGUE_ENTRY *old_entry = find_entry(current, filename);
+		LIVE_CATALOGUE_ENTRY *entry = NULL;
+		if (old_entry && same_file(old_entry, &st)) {
+			entry = old_entry;
+			entry_add_ref(entry);
+		} else {
+			entry = load_entry(catalogue->directory, filename, &st);
+			if (entry) {
+				printf("%s quest file: %s\n", old_entry ? "Reloaded" : "Loaded", filename);
+				changed = true;
+			} else if (old_entry) {
+				printf("Keeping the previous version of %s.\n", filename);
+				entry = old_entry;
+				entry_add_ref(entry);
+			}
+		}
+
+		if (entry)
+			snapshot->entries[snapshot->num_entries++] = entry;
+	}
+
+	if (current) {
+		for (int i = 0; i < current->num_entries; ++i) {
+			if (!find_entry(snapshot, current->entries[i]->filename)) {
+				printf("Removed quest file: %s\n", current->entries[i]->filename);
+				changed = true;
+			}
+		}
+		if (snapshot->num_entries != current->num_entries)
+			changed = true;
+	} else {
+		changed = true;
+	}
+
+	if (changed) {
+		snapshot->generation = current ? current->generation + 1 : 1;
+		publish_snapshot(catalogue, snapshot);
+		++catalogue->num_reloads;
+	} else {
+		free_snapshot(snapshot);
+	}
+
+	if (out_changed)
+		*out_changed = changed;
+	returncode = SUCCESS;
+	goto quit;
+
+error:
+	free_snapshot(snapshot);
+quit:
+	for (int i = 0; i < num_names; ++i)
+		free(names[i]);
+	free(names);
+	return returncode;
+}
+
+int live_catalogue_init(LIVE_CATALOGUE *catalogue, const char *directory) {
+	int returncode;
+
+	if (!catalogue || !directory)
+		return ERROR_INVALID_PARAMS;
+
+	memset(catalogue, 0, sizeof(LIVE_CATALOGUE));
+	catalogue->inotify_fd = -1;
+	catalogue->epoch = 1;
+	catalogue->directory = strdup(directory);
+	if (!catalogue->directory)
+		return ERROR_IO;
+
+	// start watching before the first scan, so nothing that changes in between is missed
+	catalogue->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (catalogue->inotify_fd < 0 || inotify_add_watch(catalogue->inotify_fd, directory, WATCH_EVENTS | IN_ONLYDIR) < 0) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	returncode = live_catalogue_reload(catalogue, NULL);
+	if (returncode)
+		goto error;
+
+	return SUCCESS;
+
+error:
+	live_catalogue_destroy(catalogue);
+	return returncode;
+}
+
+// must only be called once nothing else is using the catalogue anymore
+void live_catalogue_destroy(LIVE_CATALOGUE *catalogue) {
+	if (!catalogue)
+		return;
+
+	free_snapshot(catalogue->current);
+	catalogue->current = NULL;
+	while (catalogue->retired) {
+		LIVE_CATALOGUE_SNAPSHOT *next = catalogue->retired->next_retired;
+		free_snapshot(catalogue->retired);
+		catalogue->retired = next;
+	}
+
+	if (catalogue->inotify_fd >= 0)
+		close(catalogue->inotify_fd);
+	catalogue->inotify_fd = -1;
+	free(catalogue->directory);
+	catalogue->directory = NULL;
+}
+
+/*
+ * Watches the directory for changes, reloading whenever they have settled down, until *stopping is set. This is
+ * meant to be run on its own thread, while the catalogue is being read on others.
+ */
+int live_catalogue_watch(LIVE_CATALOGUE *catalogue, volatile sig_atomic_t *stopping) {
+	uint8_t buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	uint64_t last_change = 0;
+	bool pending = false;
+
+	struct pollfd pfd;
+	pfd.fd = catalogue->inotify_fd;
+	pfd.events = POLLIN;
+
+	while (!*stopping) {
+		int result = poll(&pfd, 1, POLL_INTERVAL_MS);
+		if (result < 0 && errno != EINTR)
+			return ERROR_IO;
+
+		if (result > 0) {
+			ssize_t length;
+			while ((length = read(catalogue->inotify_fd, buffer, sizeof(buffer))) > 0) {
+				for (ssize_t pos = 0; pos < length; ) {
+					const struct inotify_event *event = (const struct inotify_event*)(buffer + pos);
+					if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+						printf("Quest directory %s went away. No longer watching it.\n", catalogue->directory);
+						return ERROR_IO;
+					}
+					if (!event->len || string_ends_with(event->name, ".qst")) {
+						pending = true;
+						last_change = stats_get_time();
+					}
+					pos += sizeof(struct inotify_event) + event->len;
+				}
+			}
+		}
+
+		if (pending && (stats_get_time() - last_change) >= (uint64_t)LIVE_CATALOGUE_SETTLE_MS * 1000000) {
+			bool changed;
+			pending = false;
+			int returncode = live_catalogue_reload(catalogue, &changed);
+			if (returncode)
+				printf("Error code %d (%s) reloading quests from %s\n", returncode, get_error_message(returncode), catalogue->directory);
+			else if (changed)
+				live_catalogue_print(catalogue);
+		}
+
+		// readers that were busy last time may be done with older snapshots by now
+		if (catalogue->retired)
+			reclaim_snapshots(catalogue);
+	}
+
+	return SUCCESS;
+}
+
+void live_catalogue_print(LIVE_CATALOGUE *catalogue) {
+	const LIVE_CATALOGUE_SNAPSHOT *snapshot = catalogue->current;
+	printf("Quest catalogue generation %llu, %d quest(s):\n", (unsigned long long)snapshot->generation, snapshot->num_entries);
+	for (int i = 0; i < snapshot->num_entries; ++i)
+		printf("Quest %d: %s\n", i, snapshot->entries[i]->filename);
+}
+
+// each thread that looks up quests needs its own reader slot. returns the slot, or -1 if there are none left
+int live_catalogue_add_reader(LIVE_CATALOGUE *catalogue) {
+	int reader = __atomic_fetch_add(&catalogue->num_readers, 1, __ATOMIC_SEQ_CST);
+	if (reader >= LIVE_CATALOGUE_MAX_READERS) {
+		__atomic_fetch_sub(&catalogue->num_readers, 1, __ATOMIC_SEQ_CST);
+		return -1;
+	}
+	return reader;
+}
+
+/*
+ * Looks up a quest by number in the current snapshot, without taking any locks. The entry returned stays valid
+ * (even if the catalogue is reloaded in the meantime) until it is given back with live_catalogue_release.
+ */
+int live_catalogue_acquire(LIVE_CATALOGUE *catalogue, int reader, uint32_t index, LIVE_CATALOGUE_ENTRY **out_entry) {
+	int returncode = ERROR_INVALID_PARAMS;
+
+	if (reader < 0 || reader >= LIVE_CATALOGUE_MAX_READERS || !out_entry)
+		return ERROR_INVALID_PARAMS;
+
+	// announce the epoch before loading the snapshot pointer, so the snapshot can't be freed while it is being used
+	uint64_t epoch = __atomic_load_n(&catalogue->epoch, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&catalogue->reader_epochs[reader], epoch, __ATOMIC_SEQ_CST);
+
+	const LIVE_CATALOGUE_SNAPSHOT *snapshot = __atomic_load_n(&catalogue->current, __ATOMIC_SEQ_CST);
+	if (snapshot && index < (uint32_t)snapshot->num_entries) {
+		*out_entry = snapshot->entries[index];
+		entry_add_ref(*out_entry);
+		returncode = SUCCESS;
+	}
+
+	__atomic_store_n(&catalogue->reader_epochs[reader], 0, __ATOMIC_RELEASE);
+	return returncode;
+}
@@ -0,0 +1,71 @@
+#ifndef LIVE_CATALOGUE_H_INCLUDED
+#define LIVE_CATALOGUE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "quest_catalogue.h"
+
+/*
+ * A quest catalogue for a directory of download/offline .qst files, which is kept up to date while quests are being
+ * served. It watches the directory with inotify. Whenever .qst files are added, changed or removed, it builds a new
+ * snapshot of the catalogue and publishes it with a single atomic pointer swap. Only quests whose files have changed
+ * are loaded again. Everything else is shared with the previous snapshot.
+ *
+ * Readers (e.g. the quest sender) never take a lock, and always see either the old snapshot or the new one, never
+ * anything in between. Old snapshots are reclaimed using epochs. Each reader announces the current epoch while it is
+ * looking something up. Publishing a snapshot advances the epoch. A replaced snapshot is freed once no reader is
+ * still inside an epoch from before the replacement. Each quest entry also has a reference count, held by every
+ * snapshot containing it and every download in progress, so a quest that is replaced or removed mid-download stays
+ * around until that download is done.
+ *
+ * Quest numbers are positions in the directory's .qst files, sorted by filename, starting at 0.
+ */
+
+#define LIVE_CATALOGUE_MAX_READERS     64
+#define LIVE_CATALOGUE_SETTLE_MS       200    // wait for changes to stop for this long before reloading
+
+typedef struct {
+	char *filename;             // just the name, within the directory
+	ino_t inode;
+	off_t size;
+	struct timespec mtime;
+	CATALOGUE_QUEST quest;
+	uint32_t refs;
+} LIVE_CATALOGUE_ENTRY;
+
+typedef struct LIVE_CATALOGUE_SNAPSHOT {
+	uint64_t generation;
+	int num_entries;
+	LIVE_CATALOGUE_ENTRY **entries;
+	uint64_t retired_epoch;
+	struct LIVE_CATALOGUE_SNAPSHOT *next_retired;
+} LIVE_CATALOGUE_SNAPSHOT;
+
+typedef struct {
+	char *directory;
+	int inotify_fd;
+
+	LIVE_CATALOGUE_SNAPSHOT *current;          // only ever swapped atomically
+	uint64_t epoch;
+	uint64_t reader_epochs[LIVE_CATALOGUE_MAX_READERS];   // 0 while a reader isn't looking anything up
+	int num_readers;
+
+	// only touched by the thread doing the reloading
+	LIVE_CATALOGUE_SNAPSHOT *retired;
+	uint64_t num_reloads;
+} LIVE_CATALOGUE;
+
+int live_catalogue_init(LIVE_CATALOGUE *catalogue, const char *directory);
+void live_catalogue_destroy(LIVE_CATALOGUE *catalogue);
+int live_catalogue_reload(LIVE_CATALOGUE *catalogue, bool *out_changed);
+int live_catalogue_watch(LIVE_CATALOGUE *catalogue, volatile sig_atomic_t *stopping);
+void live_catalogue_print(LIVE_CATALOGUE *catalogue);
+
+int live_catalogue_add_reader(LIVE_CATALOGUE *catalogue);
+int live_catalogue_acquire(LIVE_CATALOGUE *catalogue, int reader, uint32_t index, LIVE_CATALOGUE_ENTRY **out_entry);
+void live_catalogue_release(LIVE_CATALOGUE_ENTRY *entry);
+
+#endif
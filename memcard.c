@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "retvals.h"
+#include "memcard.h"
+#include "utils.h"
+
+#define MEMCARD_BLOCK(card, n)         ((card)->data + ((size_t)(n) * GCI_BLOCK_SIZE))
+
+/*
+ * Both checksums are calculated over the big-endian 16-bit words of the data, one as a plain sum and the other as a
+ * sum of the inverted words. Neither is ever allowed to be 0xffff, as that is what erased (unformatted) flash reads as.
+ */
+static void calculate_checksums(const uint8_t *data, size_t size, uint16_t *out_checksum, uint16_t *out_checksum_inv) {
+	uint16_t checksum = 0, checksum_inv = 0;
+
+	for (size_t i = 0; i < size; i += 2) {
+		uint16_t word = (uint16_t)((data[i] << 8) | data[i + 1]);
+		checksum += word;
+		checksum_inv += (uint16_t)(word ^ 0xffff);
+	}
+
+	if (checksum == 0xffff)
+		checksum = 0;
+	if (checksum_inv == 0xffff)
+		checksum_inv = 0;
+
+	*out_checksum = ENDIAN_SWAP_16(checksum);
+	*out_checksum_inv = ENDIAN_SWAP_16(checksum_inv);
+}
+
+/*
+ * Creates an empty, formatted memory card image in memory. num_usable_blocks must be one of the official card sizes
+ * (MEMCARD_59_BLOCKS etc). region is the same as for build_quest_gci, and only decides the card's text encoding.
+ *
+ * The serial number and format time are left at zero, so the same files always give exactly the same image.
+ */
+int memcard_create(MEMCARD *card, uint32_t num_usable_blocks, char region) {
+	if (!card)
+		return ERROR_INVALID_PARAMS;
+	if (num_usable_blocks != MEMCARD_59_BLOCKS &&
+	    num_usable_blocks != MEMCARD_251_BLOCKS &&
+	    num_usable_blocks != MEMCARD_507_BLOCKS &&
+	    num_usable_blocks != MEMCARD_1019_BLOCKS &&
+	    num_usable_blocks != MEMCARD_2043_BLOCKS)
+		return ERROR_INVALID_PARAMS;
+	if (region != 'E' && region != 'J' && region != 'P')
+		return ERROR_INVALID_PARAMS;
+
+	memset(card, 0, sizeof(MEMCARD));
+	card->num_blocks = num_usable_blocks + MEMCARD_SYSTEM_BLOCKS;
+	card->next_free_block = MEMCARD_SYSTEM_BLOCKS;
+
+	size_t size = (size_t)card->num_blocks * GCI_BLOCK_SIZE;
+	card->data = malloc(size);
+	if (!card->data)
+		return ERROR_IO;
+
+	// erased flash reads as all 0xff, which is also what the unused parts of the system blocks are expected to be
+	memset(card->data, 0xff, size);
+
+	MEMCARD_HEADER *header = (MEMCARD_HEADER*)MEMCARD_BLOCK(card, 0);
+	memset(header, 0, offsetof(MEMCARD_HEADER, unused));
+	header->size_mbits = ENDIAN_SWAP_16((uint16_t)(card->num_blocks / 16));
+	header->encoding = ENDIAN_SWAP_16(region == 'J' ? 1 : 0);
+	header->update_counter = 0;
+
+	// unused directory entries stay all 0xff, only the counter at the end needs setting
+	for (int i = 1; i <= 2; ++i) {
+		MEMCARD_DIRECTORY *directory = (MEMCARD_DIRECTORY*)MEMCARD_BLOCK(card, i);
+		directory->update_counter = 0;
+	}
+
+	for (int i = 3; i <= 4; ++i) {
+		MEMCARD_BAT *bat = (MEMCARD_BAT*)MEMCARD_BLOCK(card, i);
+		memset(bat, 0, sizeof(MEMCARD_BAT));
+		bat->free_blocks = ENDIAN_SWAP_16((uint16_t)num_usable_blocks);
+		bat->last_allocated_block = ENDIAN_SWAP_16(MEMCARD_SYSTEM_BLOCKS - 1);
+	}
+
+	return SUCCESS;
+}
+
+void memcard_free(MEMCARD *card) {
+	if (!card)
+		return;
+
+	free(card->data);
+	card->data = NULL;
+}
+
+uint32_t memcard_get_free_blocks(const MEMCARD *card) {
+	return card->num_blocks - card->next_free_block;
+}
+
+/*
+ * Adds a .gci file (its GCI header followed by its blocks of card file data, as written by build_quest_gci or exported
+ * by a memory card manager) to the card. Files are laid out one after the other, each in consecutive blocks.
+ * Returns ERROR_NO_SPACE if there are not enough free blocks or directory entries left for it.
+ */
+int memcard_add_gci(MEMCARD *card, const uint8_t *gci, size_t gci_size) {
+	if (!card || !card->data || !gci || gci_size < sizeof(GCI))
+		return ERROR_INVALID_PARAMS;
+
+	const GCI *gci_header = (const GCI*)gci;
+	uint16_t num_file_blocks = ENDIAN_SWAP_16(gci_header->filesize8);
+	if (!num_file_blocks || gci_size != sizeof(GCI) + ((size_t)num_file_blocks * GCI_BLOCK_SIZE))
+		return ERROR_BAD_DATA;
+
+	if (card->num_files >= MEMCARD_MAX_FILES || num_file_blocks > memcard_get_free_blocks(card))
+		return ERROR_NO_SPACE;
+
+	uint32_t first_block = card->next_free_block;
+	memcpy(MEMCARD_BLOCK(card, first_block), gci + sizeof(GCI), (size_t)num_file_blocks * GCI_BLOCK_SIZE);
+
+	for (int i = 1; i <= 2; ++i) {
+		MEMCARD_DIRECTORY *directory = (MEMCARD_DIRECTORY*)MEMCARD_BLOCK(card, i);
+		GCI *entry = &directory->entries[card->num_files];
+		memcpy(entry, gci_header, sizeof(GCI));
+		entry->index = ENDIAN_SWAP_16((uint16_t)first_block);
+	}
+
+	for (int i = 3; i <= 4; ++i) {
+		MEMCARD_BAT *bat = (MEMCARD_BAT*)MEMCARD_BLOCK(card, i);
+		for (uint32_t block = first_block; block < first_block + num_file_blocks; ++block) {
+			uint16_t next = (block == first_block + num_file_blocks - 1) ? 0xffff : (uint16_t)(block + 1);
+			bat->map[block - MEMCARD_SYSTEM_BLOCKS] = ENDIAN_SWAP_16(next);
+		}
+		bat->free_blocks = ENDIAN_SWAP_16((uint16_t)(memcard_get_free_blocks(card) - num_file_blocks));
+		bat->last_allocated_block = ENDIAN_SWAP_16((uint16_t)(first_block + num_file_blocks - 1));
+	}
+
+	card->next_free_block += num_file_blocks;
+	++card->num_files;
+	return SUCCESS;
+}
+
+// fills in the checksums of all of the system blocks, and writes the whole image out
+int memcard_write(MEMCARD *card, const char *filename) {
+	if (!card || !card->data || !filename)
+		return ERROR_INVALID_PARAMS;
+
+	uint16_t checksum, checksum_inv;
+
+	MEMCARD_HEADER *header = (MEMCARD_HEADER*)MEMCARD_BLOCK(card, 0);
+	calculate_checksums((uint8_t*)header, offsetof(MEMCARD_HEADER, checksum), &checksum, &checksum_inv);
+	header->checksum = checksum;
+	header->checksum_inv = checksum_inv;
+
+	for (int i = 1; i <= 2; ++i) {
+		MEMCARD_DIRECTORY *directory = (MEMCARD_DIRECTORY*)MEMCARD_BLOCK(card, i);
+		calculate_checksums((uint8_t*)directory, offsetof(MEMCARD_DIRECTORY, checksum), &checksum, &checksum_inv);
+		directory->checksum = checksum;
+		directory->checksum_inv = checksum_inv;
+	}
+
+	// unlike the others, the BAT checksums come first and cover everything after them
+	for (int i = 3; i <= 4; ++i) {
+		MEMCARD_BAT *bat = (MEMCARD_BAT*)MEMCARD_BLOCK(card, i);
+		calculate_checksums((uint8_t*)bat + offsetof(MEMCARD_BAT, update_counter), sizeof(MEMCARD_BAT) - offsetof(MEMCARD_BAT, update_counter), &checksum, &checksum_inv);
+		bat->checksum = checksum;
+		bat->checksum_inv = checksum_inv;
+	}
+
+	return write_file(filename, card->data, (size_t)card->num_blocks * GCI_BLOCK_SIZE);
+}
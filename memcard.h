@@ -0,0 +1,81 @@
+#ifndef MEMCARD_H_INCLUDED
+#define MEMCARD_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "defs.h"
+#include "gci.h"
+
+/*
+ * Builds raw Gamecube memory card images (as used by Dolphin, and by most memory card backup tools), from .gci files.
+ *
+ * A card is a number of GCI_BLOCK_SIZE blocks. The first 5 are the system blocks:
+ *
+ * 0       header (serial number, format time, card size and text encoding)
+ * 1, 2    directory, one GCI header (see gci.h) per file, plus a backup copy
+ * 3, 4    block allocation table (BAT), saying which block follows which within a file, plus a backup copy
+ *
+ * and the rest hold file data. Every system block carries a checksum, which the game and Dolphin both check.
+ */
+
+#define MEMCARD_SYSTEM_BLOCKS          5
+#define MEMCARD_MAX_FILES              127
+
+// the number of blocks usable for files, for each of the official memory card sizes
+#define MEMCARD_59_BLOCKS              59
+#define MEMCARD_251_BLOCKS             251
+#define MEMCARD_507_BLOCKS             507
+#define MEMCARD_1019_BLOCKS            1019
+#define MEMCARD_2043_BLOCKS            2043
+
+typedef struct _PACKED_ {
+	uint8_t serial[12];
+	uint64_t format_time;
+	uint32_t sram_bias;
+	uint32_t sram_language;
+	uint8_t unknown1[4];
+	uint16_t device_id;
+	uint16_t size_mbits;           // card size, in megabits
+	uint16_t encoding;             // 0 = ANSI (Western), 1 = SHIFT-JIS (Japan)
+	uint8_t unused[468];           // always 0xff
+	uint16_t update_counter;
+	uint16_t checksum;
+	uint16_t checksum_inv;
+} MEMCARD_HEADER;
+
+typedef struct _PACKED_ {
+	GCI entries[MEMCARD_MAX_FILES];  // unused entries are all 0xff
+	uint8_t padding[0x3a];         // always 0xff
+	uint16_t update_counter;
+	uint16_t checksum;
+	uint16_t checksum_inv;
+} MEMCARD_DIRECTORY;
+
+typedef struct _PACKED_ {
+	uint16_t checksum;
+	uint16_t checksum_inv;
+	uint16_t update_counter;
+	uint16_t free_blocks;
+	uint16_t last_allocated_block;
+	// one entry per data block, starting with the first one after the system blocks. each is the number of the next
+	// block of the same file, 0xffff if it is the last block of its file, or 0 if the block is free
+	uint16_t map[0xffb];
+} MEMCARD_BAT;
+
+// all of the multi-byte values in the above structs are big-endian in the image data
+
+typedef struct {
+	uint8_t *data;
+	uint32_t num_blocks;           // including the system blocks
+	uint32_t next_free_block;
+	uint32_t num_files;
+} MEMCARD;
+
+int memcard_create(MEMCARD *card, uint32_t num_usable_blocks, char region);
+void memcard_free(MEMCARD *card);
+uint32_t memcard_get_free_blocks(const MEMCARD *card);
+int memcard_add_gci(MEMCARD *card, const uint8_t *gci, size_t gci_size);
+int memcard_write(MEMCARD *card, const char *filename);
+
+#endif
@@ -0,0 +1,452 @@
+/*
+ * PSO EP1&2 (Gamecube) Memory Card Image Quest Packer
+ *
+ * Puts as many download/offline quests as possible onto a raw memory card image (see memcard.h), as .gci files in the
+ * same form gcdl_batch --gci writes them.
+ *
+ * Every file on a memory card takes up a whole number of blocks, so what matters is not how small each quest's data
+ * can be compressed, but whether a smaller size crosses a block boundary. Each .bin and .dat file is compressed at
+ * the fastest compression level first, and the slower levels are only tried when they look like they would save a
+ * block. How much a level gains is estimated from the exact compressed size of just a sample of the data at every
+ * level (see fuzziqer_prs_compressed_size), which is much quicker than compressing all of it at every level. The
+ * lowest level that is estimated to reach the fewest blocks is used, falling back to the highest level if the
+ * estimate turns out to be too optimistic.
+ *
+ * Once every quest's size in blocks is known, quests are packed smallest first, which gets the largest possible
+ * number of them onto the card.
+ *
+ * Quests are compressed in parallel, each worker thread using its own arena (see arena.h) like gcdl_batch does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "fuzziqer_prs.h"
+#include "decode_cache.h"
+#include "gci.h"
+#include "memcard.h"
+#include "arena.h"
+#include "batch.h"
+#include "utils.h"
+#include "stats.h"
+
+// how much of the data is compressed at every level to estimate how well all of it would compress at each level
+#define ESTIMATE_SAMPLE_SIZE           (16 * 1024)
+
+typedef struct {
+	uint8_t *data;                 // PRS-compressed, allocated with malloc
+	size_t size;
+	int level;
+	uint32_t num_blocks;
+	uint32_t min_level_num_blocks; // the number of blocks it would have taken at PRS_LEVEL_MIN
+} PACK_FILE;
+
+typedef struct {
+	const char *filename;          // .bin or .qst file
+	const char *dat_filename;      // NULL for .qst files
+	char name[32];                 // the quest's name, from the .bin header. used as the .gci comment
+	PACK_FILE bin;
+	PACK_FILE dat;
+	bool packed;
+	int result;
+} PACK_JOB;
+
+typedef struct {
+	PACK_JOB *jobs;
+	ARENA *arenas;                 // one per worker thread
+	int max_level;
+} PACK_BATCH;
+
+// keeps the given level's output if it takes fewer blocks than the best found so far
+static int try_level(const uint8_t *data, size_t size, int level, uint8_t **best_compressed, int *best_size, int *best_level, ARENA *arena) {
+	uint8_t *compressed;
+
+	int compressed_size = fuzziqer_prs_compress_level_ex(data, &compressed, size, level, arena);
+	if (compressed_size < 0)
+		return ERROR_BAD_DATA;
+
+	if (get_quest_gci_num_blocks(compressed_size) < get_quest_gci_num_blocks(*best_size)) {
+		*best_compressed = compressed;
+		*best_size = compressed_size;
+		*best_level = level;
+	}
+	return SUCCESS;
+}
+
+/*
+ * Compresses data at the level that gives the fewest memory card blocks, preferring lower (faster) levels when more
+ * than one gives the same number of blocks. See the comment at the top of this file.
+ */
+static int compress_for_card(const uint8_t *data, size_t size, int max_level, PACK_FILE *out_file, ARENA *arena) {
+	int returncode;
+	uint8_t *best_compressed;
+	int best_size, best_level;
+	int sample_sizes[PRS_LEVEL_MAX + 1];
+
+	best_level = PRS_LEVEL_MIN;
+	best_size = fuzziqer_prs_compress_level_ex(data, &best_compressed, size, best_level, arena);
+	if (best_size < 0)
+		return ERROR_BAD_DATA;
+	uint32_t min_level_blocks = get_quest_gci_num_blocks(best_size);
+
+	if (max_level > PRS_LEVEL_MIN && size <= ESTIMATE_SAMPLE_SIZE * 2) {
+		// small enough that estimating would take about as long as just compressing it at the highest level
+		returncode = try_level(data, size, max_level, &best_compressed, &best_size, &best_level, arena);
+		if (returncode)
+			return returncode;
+
+	} else if (max_level > PRS_LEVEL_MIN) {
+		for (int level = PRS_LEVEL_MIN; level <= max_level; ++level) {
+			sample_sizes[level] = fuzziqer_prs_compressed_size(data, ESTIMATE_SAMPLE_SIZE, level);
+			if (sample_sizes[level] < 0)
+				return ERROR_BAD_DATA;
+		}
+
+		// the lowest level estimated to take as few blocks as the highest level would
+		uint64_t estimated_size = (uint64_t)best_size * sample_sizes[max_level] / sample_sizes[PRS_LEVEL_MIN];
+		uint32_t target_blocks = get_quest_gci_num_blocks(estimated_size);
+		int level = PRS_LEVEL_MIN;
+		if (target_blocks < min_level_blocks) {
+			for (level = PRS_LEVEL_MIN + 1; level < max_level; ++level) {
+				estimated_size = (uint64_t)best_size * sample_sizes[level] / sample_sizes[PRS_LEVEL_MIN];
+				if (get_quest_gci_num_blocks(estimated_size) <= target_blocks)
+					break;
+			}
+		}
+
+		if (level > PRS_LEVEL_MIN) {
+			returncode = try_level(data, size, level, &best_compressed, &best_size, &best_level, arena);
+			if (returncode)
+				return returncode;
+
+			// the estimate for that level may have been a little too optimistic, so the highest level is the last resort
+			if (level < max_level && get_quest_gci_num_blocks(best_size) > target_blocks) {
+				returncode = try_level(data, size, max_level, &best_compressed, &best_size, &best_level, arena);
+				if (returncode)
+					return returncode;
+			}
+		}
+	}
+
+	// everything else is thrown away with the arena, but this has to outlive it
+	out_file->data = malloc(best_size);
+	if (!out_file->data)
+		return ERROR_IO;
+	memcpy(out_file->data, best_compressed, best_size);
+	out_file->size = best_size;
+	out_file->level = best_level;
+	out_file->num_blocks = get_quest_gci_num_blocks(best_size);
+	out_file->min_level_num_blocks = min_level_blocks;
+	return SUCCESS;
+}
+
+// loads a quest's PRS-compressed .bin and .dat data, from either a .bin/.dat pair or a .qst file. allocated with malloc
+static int load_quest(const PACK_JOB *job, uint8_t **out_bin, size_t *out_bin_size, uint8_t **out_dat, size_t *out_dat_size) {
+	int returncode;
+	int qst_type;
+
+	if (job->dat_filename)
+		return load_quest_from_bindat(job->filename, job->dat_filename, out_bin, out_bin_size, out_dat, out_dat_size);
+
+	returncode = load_quest_from_qst(job->filename, out_bin, out_bin_size, out_dat, out_dat_size, &qst_type);
+	if (returncode)
+		return returncode;
+
+	if (qst_type == QST_TYPE_DOWNLOAD) {
+		returncode = decrypt_qst_bindat(*out_bin, out_bin_size, *out_dat, out_dat_size);
+		if (returncode) {
+			free(*out_bin);
+			free(*out_dat);
+			return returncode;
+		}
+	}
+
+	return SUCCESS;
+}
+
+int prepare_quest(PACK_JOB *job, int max_level, ARENA *arena) {
+	int returncode;
+	uint8_t *compressed_bin = NULL, *compressed_dat = NULL;
+	uint8_t *bin, *dat;
+	size_t compressed_bin_size, compressed_dat_size;
+	size_t bin_size, dat_size;
+	int result;
+
+	returncode = load_quest(job, &compressed_bin, &compressed_bin_size, &compressed_dat, &compressed_dat_size);
+	if (returncode)
+		return returncode;
+
+	result = decode_cache_decompress_buf_ex(compressed_bin, &bin, compressed_bin_size, arena);
+	if (result < 0) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+	bin_size = result;
+	result = decode_cache_decompress_buf_ex(compressed_dat, &dat, compressed_dat_size, arena);
+	if (result < 0) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+	dat_size = result;
+
+	QUEST_BIN_HEADER *bin_header = (QUEST_BIN_HEADER*)bin;
+	result = validate_quest_bin(bin_header, bin_size, false);
+	result = handle_quest_bin_validation_issues_ex(result, bin_header, &bin, &bin_size, false, arena);
+	if (result) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+	bin_header = (QUEST_BIN_HEADER*)bin;
+
+	// a zero-length table before the end of the .dat data is only a warning everywhere else, so it is here too
+	if (validate_quest_dat(dat, dat_size, false) & ~QUESTDAT_ERROR_PREMATURE_EOF) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+
+	memcpy(job->name, bin_header->name, sizeof(job->name));
+	bin_header->download = 1;  // gamecube pso client will not find quests on a memory card if this is not set!
+
+	returncode = compress_for_card(bin, bin_size, max_level, &job->bin, arena);
+	if (returncode)
+		goto error;
+	returncode = compress_for_card(dat, dat_size, max_level, &job->dat, arena);
+	if (returncode)
+		goto error;
+
+error:
+	free(compressed_bin);
+	free(compressed_dat);
+	return returncode;
+}
+
+void run_job(int job_index, int worker_index, void *context) {
+	PACK_BATCH *batch = (PACK_BATCH*)context;
+	PACK_JOB *job = &batch->jobs[job_index];
+	ARENA *arena = &batch->arenas[worker_index];
+
+	job->result = prepare_quest(job, batch->max_level, arena);
+	arena_reset(arena);
+
+	if (job->result)
+		printf("Error code %d (%s) preparing quest: %s\n", job->result, get_error_message(job->result), job->filename);
+}
+
+static uint32_t get_quest_num_blocks(const PACK_JOB *job) {
+	return job->bin.num_blocks + job->dat.num_blocks;
+}
+
+static int compare_jobs_by_size(const void *a, const void *b) {
+	const PACK_JOB *job_a = *(const PACK_JOB**)a;
+	const PACK_JOB *job_b = *(const PACK_JOB**)b;
+	uint32_t blocks_a = get_quest_num_blocks(job_a);
+	uint32_t blocks_b = get_quest_num_blocks(job_b);
+
+	if (blocks_a != blocks_b)
+		return blocks_a < blocks_b ? -1 : 1;
+
+	// keep the order given for quests of the same size, so which ones are left out is predictable
+	return job_a < job_b ? -1 : (job_a > job_b ? 1 : 0);
+}
+
+static int add_to_card(MEMCARD *card, const PACK_FILE *file, uint32_t card_number, char region, const char *comment) {
+	int returncode;
+	char card_filename[32];
+	uint8_t *gci;
+	size_t gci_size;
+
+	get_quest_card_filename(card_number, card_filename, sizeof(card_filename));
+
+	// the timestamp is left at zero, like the card's format time, so the same quests always give the same image
+	returncode = build_quest_gci(file->data, file->size, region, card_filename, comment, 0, &gci, &gci_size, NULL);
+	if (returncode)
+		return returncode;
+
+	returncode = memcard_add_gci(card, gci, gci_size);
+	free(gci);
+	return returncode;
+}
+
+int main(int argc, char *argv[]) {
+	int returncode;
+	int num_workers = batch_get_default_num_workers();
+	uint32_t card_blocks = MEMCARD_251_BLOCKS;
+	char region = 'E';
+	int max_level = PRS_LEVEL_DEFAULT;
+	PACK_JOB *jobs = NULL;
+	PACK_JOB **sorted_jobs = NULL;
+	ARENA *arenas = NULL;
+	MEMCARD card;
+	int num_jobs = 0;
+
+	memset(&card, 0, sizeof(card));
+	stats_parse_args(&argc, argv);
+
+	int argi = 1;
+	while (argi < argc && argv[argi][0] == '-') {
+		if (!strcmp(argv[argi], "-b") && (argi + 1) < argc) {
+			card_blocks = (uint32_t)atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-r") && (argi + 1) < argc) {
+			region = argv[argi + 1][0];
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-l") && (argi + 1) < argc) {
+			max_level = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-j") && (argi + 1) < argc) {
+			num_workers = atoi(argv[argi + 1]);
+			argi += 2;
+		} else {
+			break;
+		}
+	}
+
+	if ((argc - argi) < 2 || num_workers < 1 || max_level < PRS_LEVEL_MIN || max_level > PRS_LEVEL_MAX) {
+		printf("Usage: memcard_pack [--stats] [-b card-blocks] [-r E|J|P] [-l max-level] [-j num-threads] output.raw quest1.bin quest1.dat|quest1.qst [...]\n");
+		return 1;
+	}
+
+	const char *output_filename = argv[argi];
+	char **files = &argv[argi + 1];
+	int num_files = argc - argi - 1;
+
+	returncode = memcard_create(&card, card_blocks, region);
+	if (returncode) {
+		printf("Error code %d (%s) creating a %u block memory card image. Card sizes are 59, 251, 507, 1019 or 2043 blocks, and regions are E, J or P.\n",
+		       returncode, get_error_message(returncode), card_blocks);
+		goto error;
+	}
+
+	jobs = calloc(num_files, sizeof(PACK_JOB));
+	if (!jobs) {
+		printf("Not enough memory for %d file(s).\n", num_files);
+		goto error;
+	}
+	for (int i = 0; i < num_files; ++i) {
+		PACK_JOB *job = &jobs[num_jobs];
+		job->filename = files[i];
+		if (string_ends_with(files[i], ".bin")) {
+			if ((i + 1) >= num_files || !string_ends_with(files[i + 1], ".dat")) {
+				printf("Expected a .dat file after: %s\n", files[i]);
+				goto error;
+			}
+			job->dat_filename = files[++i];
+		} else if (!string_ends_with(files[i], ".qst")) {
+			printf("Expected a .bin/.dat pair or a .qst file, but got: %s\n", files[i]);
+			goto error;
+		}
+		++num_jobs;
+	}
+
+	arenas = calloc(num_workers, sizeof(ARENA));
+	if (!arenas) {
+		printf("Not enough memory for %d thread(s).\n", num_workers);
+		goto error;
+	}
+	for (int i = 0; i < num_workers; ++i)
+		arena_init(&arenas[i], ARENA_DEFAULT_BLOCK_SIZE);
+
+	PACK_BATCH batch;
+	batch.jobs = jobs;
+	batch.arenas = arenas;
+	batch.max_level = max_level;
+
+	printf("Compressing %d quest(s) using %d thread(s) ...\n", num_jobs, num_workers);
+	returncode = batch_run(num_workers, num_jobs, run_job, &batch);
+	if (returncode) {
+		printf("Error code %d (%s) running batch.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
+
+	// decide which quests go on the card, smallest first. each quest is two files, and both have to fit
+	int num_sorted = 0;
+	sorted_jobs = calloc(num_jobs, sizeof(PACK_JOB*));
+	if (!sorted_jobs) {
+		printf("Not enough memory for %d quest(s).\n", num_jobs);
+		goto error;
+	}
+	for (int i = 0; i < num_jobs; ++i) {
+		if (!jobs[i].result)
+			sorted_jobs[num_sorted++] = &jobs[i];
+	}
+	qsort(sorted_jobs, num_sorted, sizeof(PACK_JOB*), compare_jobs_by_size);
+
+	uint32_t blocks_left = card_blocks;
+	int files_left = MEMCARD_MAX_FILES;
+	for (int i = 0; i < num_sorted; ++i) {
+		PACK_JOB *job = sorted_jobs[i];
+		if (get_quest_num_blocks(job) <= blocks_left && files_left >= 2) {
+			job->packed = true;
+			blocks_left -= get_quest_num_blocks(job);
+			files_left -= 2;
+		}
+	}
+
+	// the quests are put on the card (and numbered) in the order they were given in
+	int num_packed = 0;
+	uint32_t blocks_saved = 0;
+	for (int i = 0; i < num_jobs; ++i) {
+		PACK_JOB *job = &jobs[i];
+		if (job->result)
+			continue;
+
+		printf("%s: .bin %u block(s) (level %d), .dat %u block(s) (level %d)",
+		       job->filename, job->bin.num_blocks, job->bin.level, job->dat.num_blocks, job->dat.level);
+		if (!job->packed) {
+			printf(", does not fit\n");
+			continue;
+		}
+		printf("\n");
+
+		returncode = add_to_card(&card, &job->bin, num_packed * 2, region, job->name);
+		if (!returncode)
+			returncode = add_to_card(&card, &job->dat, (num_packed * 2) + 1, region, job->name);
+		if (returncode) {
+			printf("Error code %d (%s) adding quest to memory card image: %s\n", returncode, get_error_message(returncode), job->filename);
+			goto error;
+		}
+
+		++num_packed;
+		blocks_saved += (job->bin.min_level_num_blocks - job->bin.num_blocks) + (job->dat.min_level_num_blocks - job->dat.num_blocks);
+	}
+
+	returncode = memcard_write(&card, output_filename);
+	if (returncode) {
+		printf("Error code %d (%s) writing memory card image: %s\n", returncode, get_error_message(returncode), output_filename);
+		goto error;
+	}
+
+	int num_failed = num_jobs - num_sorted;
+	printf("Packed %d of %d quest(s) into %u of %u block(s), %u block(s) free.\n",
+	       num_packed, num_jobs, card_blocks - memcard_get_free_blocks(&card), card_blocks, memcard_get_free_blocks(&card));
+	printf("Choosing compression levels saved %u block(s).\n", blocks_saved);
+	if (num_failed)
+		printf("%d quest(s) could not be loaded.\n", num_failed);
+
+	returncode = num_failed ? 1 : 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	if (jobs) {
+		for (int i = 0; i < num_jobs; ++i) {
+			free(jobs[i].bin.data);
+			free(jobs[i].dat.data);
+		}
+	}
+	if (arenas) {
+		for (int i = 0; i < num_workers; ++i)
+			arena_destroy(&arenas[i]);
+	}
+	free(arenas);
+	free(sorted_jobs);
+	free(jobs);
+	memcard_free(&card);
+	return returncode;
+}
@@ -0,0 +1,144 @@
+/*
+ * Regression tests for fuzziqer_prs_recompress_ex, run by ctest.
+ *
+ * The previous compressed data given to fuzziqer_prs_recompress_ex can come from any PRS compressor, so these build
+ * their own, using tokens that the compressor here never writes itself, and make sure that the result still
+ * decompresses to exactly the new data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "fuzziqer_prs.h"
+
+#define TEST_DATA_SIZE                 81
+
+typedef struct {
+	uint8_t data[256];
+	size_t pos;
+	size_t control_pos;
+	int control_bits_left;
+} PRS_WRITER;
+
+// control bits are packed into a byte that is put in front of the data bytes written after it, as they are read
+static void put_bit(PRS_WRITER *writer, int bit) {
+	if (!writer->control_bits_left) {
+		writer->control_pos = writer->pos++;
+		writer->data[writer->control_pos] = 0;
+		writer->control_bits_left = 8;
+	}
+	writer->data[writer->control_pos] |= (uint8_t)(bit << (8 - writer->control_bits_left));
+	--writer->control_bits_left;
+}
+
+static void put_raw(PRS_WRITER *writer, uint8_t value) {
+	put_bit(writer, 1);
+	writer->data[writer->pos++] = value;
+}
+
+// a long copy with the size in its own byte (which is the size - 1), which can be used for any size up to 256
+static void put_extended_copy(PRS_WRITER *writer, uint32_t distance, uint32_t size) {
+	uint32_t offset = 0x2000 - distance;
+	put_bit(writer, 0);
+	put_bit(writer, 1);
+	writer->data[writer->pos++] = (uint8_t)(offset << 3);
+	writer->data[writer->pos++] = (uint8_t)(offset >> 5);
+	writer->data[writer->pos++] = (uint8_t)(size - 1);
+}
+
+static void put_end(PRS_WRITER *writer) {
+	put_bit(writer, 0);
+	put_bit(writer, 1);
+	writer->data[writer->pos++] = 0;
+	writer->data[writer->pos++] = 0;
+}
+
+static void make_test_data(uint8_t *data) {
+	for (int i = 0; i < TEST_DATA_SIZE; ++i)
+		data[i] = (uint8_t)('A' + (i * 7) % 26);
+}
+
+// recompresses src, and checks that it decompresses back to exactly src (give or take the usual junk on the end)
+static bool check_recompress(const char *name, const uint8_t *prev_src, const uint8_t *prev_compressed, size_t prev_compressed_size, const uint8_t *src) {
+	uint8_t *compressed = NULL, *decompressed = NULL;
+	size_t reused;
+	bool passed = false;
+
+	int compressed_size = fuzziqer_prs_recompress_ex(prev_src, TEST_DATA_SIZE, prev_compressed, prev_compressed_size, src, &compressed, TEST_DATA_SIZE, &reused, NULL);
+	if (compressed_size < 0) {
+		printf("%s: recompressing failed with %d\n", name, compressed_size);
+		goto quit;
+	}
+
+	int decompressed_size = fuzziqer_prs_decompress_buf(compressed, &decompressed, compressed_size);
+	if (decompressed_size < TEST_DATA_SIZE || decompressed_size > (TEST_DATA_SIZE + 2) || memcmp(decompressed, src, TEST_DATA_SIZE)) {
+		printf("%s: recompressed data decompresses to %d bytes which are not the new data\n", name, decompressed_size);
+		goto quit;
+	}
+
+	printf("%s: ok (%d bytes, %zu bytes re-used)\n", name, compressed_size, reused);
+	passed = true;
+quit:
+	free(compressed);
+	free(decompressed);
+	return passed;
+}
+
+/*
+ * An extended copy of only 1 byte (size byte 0) is valid PRS, but prs_copy() can't write a 1 byte copy. Re-using it
+ * used to write it as a short copy of 5 bytes.
+ */
+static bool test_one_byte_copy(void) {
+	uint8_t prev_src[TEST_DATA_SIZE], src[TEST_DATA_SIZE];
+	PRS_WRITER writer;
+	memset(&writer, 0, sizeof(writer));
+
+	make_test_data(prev_src);
+	prev_src[4] = prev_src[0];
+	for (int i = 0; i < TEST_DATA_SIZE; ++i) {
+		if (i == 4)
+			put_extended_copy(&writer, 4, 1);
+		else
+			put_raw(&writer, prev_src[i]);
+	}
+	put_end(&writer);
+
+	// only the end changes, so the copy is in the part that gets re-used
+	memcpy(src, prev_src, TEST_DATA_SIZE);
+	src[TEST_DATA_SIZE - 1] ^= 0xff;
+
+	return check_recompress("1 byte extended copy", prev_src, writer.data, writer.pos, src);
+}
+
+/*
+ * Previous compressed data for the same src, which does not actually decompress to it. This used to be returned as-is.
+ */
+static bool test_unchanged_src(void) {
+	uint8_t prev_src[TEST_DATA_SIZE], other[TEST_DATA_SIZE];
+	PRS_WRITER writer;
+	memset(&writer, 0, sizeof(writer));
+
+	make_test_data(prev_src);
+	memcpy(other, prev_src, TEST_DATA_SIZE);
+	other[TEST_DATA_SIZE / 2] ^= 0xff;
+	for (int i = 0; i < TEST_DATA_SIZE; ++i)
+		put_raw(&writer, other[i]);
+	put_end(&writer);
+
+	return check_recompress("unchanged data", prev_src, writer.data, writer.pos, prev_src);
+}
+
+int main(void) {
+	int failed = 0;
+
+	if (!test_one_byte_copy())
+		++failed;
+	if (!test_unchanged_src())
+		++failed;
+
+	return failed ? 1 : 0;
+}
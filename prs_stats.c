@@ -0,0 +1,281 @@
+/*
+ * PRS Compression Token Statistics Tool
+ *
+ * Displays statistics about the PRS tokens (raw bytes, short copies and long copies) that make up PRS-compressed quest
+ * data, both as it was found in the given files (counted while decompressing), and as it is when re-compressed with
+ * our own PRS compressor (counted while compressing). Intended to help with tuning the compressor.
+ *
+ * Quest data can be given as any of the following types of files (in any combination):
+ *
+ * - Compressed .bin or .dat files (on their own, unlike the other tools)
+ * - Online-play, unencrypted (0x44 / 0x13) .qst file
+ * - Download/Offline-play, encrypted (0xA6 / 0xA7) .qst file
+ *
+ * This tool is built with PRS_TOKEN_STATS defined, which is what enables the token counters in fuzziqer_prs.c.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "fuzziqer_prs.h"
+
+#include "retvals.h"
+#include "utils.h"
+#include "quests.h"
+#include "stats.h"
+
+#ifndef PRS_TOKEN_STATS
+#error "prs_stats must be built with PRS_TOKEN_STATS defined"
+#endif
+
+#define HISTOGRAM_BAR_WIDTH            40
+
+typedef struct {
+	size_t num_streams;
+	size_t compressed_size;
+	size_t decompressed_size;
+	size_t recompressed_size;
+} TOTALS;
+
+// total size of all tokens (not including the end-of-data marker), in bits
+uint64_t get_encoded_bits(const PRS_TOKEN_COUNTS *stats) {
+	return (stats->raw_bytes * (1 + 8)) +
+	       (stats->short_copies * (4 + 8)) +
+	       (stats->long_copies * (2 + 16)) +
+	       (stats->extended_copies * (2 + 24));
+}
+
+void subtract_stats(PRS_TOKEN_COUNTS *a, const PRS_TOKEN_COUNTS *b) {
+	uint64_t *a_values = (uint64_t*)a;
+	const uint64_t *b_values = (const uint64_t*)b;
+	for (size_t i = 0; i < (sizeof(PRS_TOKEN_COUNTS) / sizeof(uint64_t)); ++i)
+		a_values[i] -= b_values[i];
+}
+
+void print_token_summary(const char *label, const PRS_TOKEN_COUNTS *stats) {
+	uint64_t total_bytes = stats->raw_bytes + stats->short_copy_bytes + stats->long_copy_bytes + stats->extended_copy_bytes;
+	uint64_t total_tokens = stats->raw_bytes + stats->short_copies + stats->long_copies + stats->extended_copies;
+	if (!total_bytes)
+		total_bytes = 1;
+
+	printf("  %-12s tokens=%llu, raw=%llu (%.1f%%), short=%llu (%.1f%%), long=%llu (%.1f%%), long+size=%llu (%.1f%%), encoded=%llu bytes\n",
+	       label,
+	       (unsigned long long)total_tokens,
+	       (unsigned long long)stats->raw_bytes, (stats->raw_bytes * 100.0) / total_bytes,
+	       (unsigned long long)stats->short_copies, (stats->short_copy_bytes * 100.0) / total_bytes,
+	       (unsigned long long)stats->long_copies, (stats->long_copy_bytes * 100.0) / total_bytes,
+	       (unsigned long long)stats->extended_copies, (stats->extended_copy_bytes * 100.0) / total_bytes,
+	       (unsigned long long)((get_encoded_bits(stats) + 7) / 8));
+}
+
+void print_token_table(const PRS_TOKEN_COUNTS *stats) {
+	uint64_t total_bytes = stats->raw_bytes + stats->short_copy_bytes + stats->long_copy_bytes + stats->extended_copy_bytes;
+	uint64_t encoded_bits = get_encoded_bits(stats);
+	if (!total_bytes)
+		total_bytes = 1;
+	if (!encoded_bits)
+		encoded_bits = 1;
+
+	struct { const char *name; uint64_t count; uint64_t bytes; uint64_t bits_each; } rows[] = {
+		{ "raw byte",          stats->raw_bytes,       stats->raw_bytes,           1 + 8 },
+		{ "short copy",        stats->short_copies,    stats->short_copy_bytes,    4 + 8 },
+		{ "long copy",         stats->long_copies,     stats->long_copy_bytes,     2 + 16 },
+		{ "long copy + size",  stats->extended_copies, stats->extended_copy_bytes, 2 + 24 },
+	};
+
+	printf("TOKEN TYPE                  COUNT   DECOMPRESSED BYTES   %% OF DATA   ENCODED BYTES   %% OF OUTPUT   AVG LENGTH\n");
+	printf("===============================================================================================================\n");
+	for (size_t i = 0; i < (sizeof(rows) / sizeof(rows[0])); ++i) {
+		uint64_t bits = rows[i].count * rows[i].bits_each;
+		printf("%-20s %12llu %20llu %10.1f%% %15.1f %12.1f%% %12.2f\n",
+		       rows[i].name,
+		       (unsigned long long)rows[i].count,
+		       (unsigned long long)rows[i].bytes,
+		       (rows[i].bytes * 100.0) / total_bytes,
+		       bits / 8.0,
+		       (bits * 100.0) / encoded_bits,
+		       rows[i].count ? ((double)rows[i].bytes / rows[i].count) : 0.0);
+	}
+	printf("\n");
+}
+
+void print_histogram_row(const char *label, uint64_t count, uint64_t max_count, uint64_t total) {
+	int bar_length = max_count ? (int)((count * HISTOGRAM_BAR_WIDTH) / max_count) : 0;
+	printf("%-12s %12llu %7.2f%% ", label, (unsigned long long)count, total ? (count * 100.0) / total : 0.0);
+	for (int i = 0; i < bar_length; ++i)
+		putchar('#');
+	printf("\n");
+}
+
+void print_histograms(const PRS_TOKEN_COUNTS *stats) {
+	uint64_t max_count = 0, total = 0;
+	char label[32];
+
+	printf("COPY LENGTH        COUNT\n");
+	printf("===============================\n");
+	for (int i = 0; i <= PRS_STATS_MAX_LENGTH; ++i) {
+		total += stats->length_histogram[i];
+		if (stats->length_histogram[i] > max_count)
+			max_count = stats->length_histogram[i];
+	}
+	for (int i = 0; i <= PRS_STATS_MAX_LENGTH; ++i) {
+		if (!stats->length_histogram[i])
+			continue;
+		snprintf(label, sizeof(label), "%d", i);
+		print_histogram_row(label, stats->length_histogram[i], max_count, total);
+	}
+	printf("\n");
+
+	max_count = total = 0;
+	printf("COPY OFFSET        COUNT\n");
+	printf("===============================\n");
+	for (int i = 0; i < PRS_STATS_OFFSET_BUCKETS; ++i) {
+		total += stats->offset_histogram[i];
+		if (stats->offset_histogram[i] > max_count)
+			max_count = stats->offset_histogram[i];
+	}
+	for (int i = 0; i < PRS_STATS_OFFSET_BUCKETS; ++i) {
+		snprintf(label, sizeof(label), "%d-%d", 1 << i, (2 << i) - 1);
+		print_histogram_row(label, stats->offset_histogram[i], max_count, total);
+	}
+	printf("\n");
+}
+
+int analyse_stream(const char *label, const uint8_t *data, size_t size, bool histograms, TOTALS *totals) {
+	int result;
+	uint8_t *decompressed = NULL;
+	uint8_t *recompressed = NULL;
+	PRS_TOKEN_COUNTS compress_before, decompress_before, compress_after, decompress_after;
+
+	fuzziqer_prs_get_token_stats(&compress_before, &decompress_before);
+
+	result = fuzziqer_prs_decompress_buf(data, &decompressed, size);
+	if (result < 0)
+		goto error;
+	size_t decompressed_size = result;
+
+	result = fuzziqer_prs_compress(decompressed, &recompressed, decompressed_size);
+	if (result < 0)
+		goto error;
+	size_t recompressed_size = result;
+
+	fuzziqer_prs_get_token_stats(&compress_after, &decompress_after);
+	subtract_stats(&compress_after, &compress_before);
+	subtract_stats(&decompress_after, &decompress_before);
+
+	printf("%s: %zu bytes compressed, %zu bytes decompressed, %zu bytes re-compressed\n", label, size, decompressed_size, recompressed_size);
+	print_token_summary("original:", &decompress_after);
+	print_token_summary("recompressed:", &compress_after);
+	if (histograms) {
+		printf("\n");
+		printf("ORIGINAL (AS DECOMPRESSED)\n\n");
+		print_histograms(&decompress_after);
+		printf("RE-COMPRESSED\n\n");
+		print_histograms(&compress_after);
+	}
+
+	totals->num_streams++;
+	totals->compressed_size += size;
+	totals->decompressed_size += decompressed_size;
+	totals->recompressed_size += recompressed_size;
+	result = SUCCESS;
+
+error:
+	free(decompressed);
+	free(recompressed);
+	return (result < 0) ? ERROR_BAD_DATA : SUCCESS;
+}
+
+int analyse_file(const char *filename, bool histograms, TOTALS *totals) {
+	int returncode;
+	uint8_t *bin_data = NULL;
+	uint8_t *dat_data = NULL;
+	size_t bin_data_size, dat_data_size;
+	char label[FILENAME_MAX + 16];
+
+	if (string_ends_with(filename, ".qst")) {
+		int qst_type;
+		returncode = load_quest_from_qst(filename, &bin_data, &bin_data_size, &dat_data, &dat_data_size, &qst_type);
+		if (returncode)
+			goto error;
+		if (qst_type == QST_TYPE_DOWNLOAD) {
+			returncode = decrypt_qst_bindat(bin_data, &bin_data_size, dat_data, &dat_data_size);
+			if (returncode)
+				goto error;
+		}
+
+		snprintf(label, sizeof(label), "%s (.bin)", filename);
+		returncode = analyse_stream(label, bin_data, bin_data_size, histograms, totals);
+		if (returncode)
+			goto error;
+		snprintf(label, sizeof(label), "%s (.dat)", filename);
+		returncode = analyse_stream(label, dat_data, dat_data_size, histograms, totals);
+
+	} else {
+		uint32_t size;
+		returncode = read_file(filename, &bin_data, &size);
+		if (returncode)
+			goto error;
+		returncode = analyse_stream(filename, bin_data, size, histograms, totals);
+	}
+
+error:
+	free(bin_data);
+	free(dat_data);
+	return returncode;
+}
+
+int main(int argc, char *argv[]) {
+	TOTALS totals;
+	PRS_TOKEN_COUNTS compress_stats, decompress_stats;
+	int num_failed = 0;
+	bool histograms = false;
+
+	stats_parse_args(&argc, argv);
+
+	int argi = 1;
+	if (argi < argc && !strcmp(argv[argi], "--histograms")) {
+		histograms = true;
+		++argi;
+	}
+
+	if (argi >= argc) {
+		printf("Usage: prs_stats [--stats] [--histograms] file.bin|file.dat|file.qst ...\n");
+		return 1;
+	}
+
+	memset(&totals, 0, sizeof(totals));
+	fuzziqer_prs_reset_token_stats();
+
+	for (int i = argi; i < argc; ++i) {
+		int returncode = analyse_file(argv[i], histograms, &totals);
+		if (returncode) {
+			printf("Error code %d (%s) analysing file: %s. Skipping it.\n", returncode, get_error_message(returncode), argv[i]);
+			++num_failed;
+		}
+	}
+
+	fuzziqer_prs_get_token_stats(&compress_stats, &decompress_stats);
+
+	printf("\n\n");
+	printf("TOTALS OVER %zu PRS STREAM(S)\n", totals.num_streams);
+	printf("%zu bytes decompressed, %zu bytes original compressed (%.1f%%), %zu bytes re-compressed (%.1f%%)\n\n",
+	       totals.decompressed_size,
+	       totals.compressed_size,
+	       totals.decompressed_size ? (totals.compressed_size * 100.0) / totals.decompressed_size : 0.0,
+	       totals.recompressed_size,
+	       totals.decompressed_size ? (totals.recompressed_size * 100.0) / totals.decompressed_size : 0.0);
+
+	printf("ORIGINAL (AS DECOMPRESSED)\n\n");
+	print_token_table(&decompress_stats);
+	print_histograms(&decompress_stats);
+
+	printf("RE-COMPRESSED\n\n");
+	print_token_table(&compress_stats);
+	print_histograms(&compress_stats);
+
+	return num_failed ? 1 : 0;
+}
@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "session.h"
+#include "qst_sender.h"
+
+#define MAX_EVENTS                     256
+
+static int set_events(QST_SENDER *sender, QST_SENDER_CONNECTION *connection, uint32_t events) {
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = connection;
+	return epoll_ctl(sender->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) ? ERROR_NETWORK : SUCCESS;
+}
+
+static void ring_add(QST_SENDER *sender, QST_SENDER_CONNECTION *connection) {
+	if (connection->in_ring)
+		return;
+
+	// added at the end of the ring, i.e. just before the connection that gets the next turn
+	if (!sender->ring) {
+		connection->next = connection;
+		connection->prev = connection;
+		sender->ring = connection;
+	} else {
+		connection->next = sender->ring;
+		connection->prev = sender->ring->prev;
+		sender->ring->prev->next = connection;
+		sender->ring->prev = connection;
+	}
+	connection->in_ring = true;
+	++sender->ring_size;
+}
+
+static void ring_remove(QST_SENDER *sender, QST_SENDER_CONNECTION *connection) {
+	if (!connection->in_ring)
+		return;
+
+	if (connection->next == connection) {
+		sender->ring = NULL;
+	} else {
+		connection->prev->next = connection->next;
+		connection->next->prev = connection->prev;
+		if (sender->ring == connection)
+			sender->ring = connection->next;
+	}
+	connection->next = NULL;
+	connection->prev = NULL;
+	connection->in_ring = false;
+	--sender->ring_size;
+}
+
+// lets go of the quest data for the download in progress (if any)
+static void release_download(QST_SENDER *sender, QST_SENDER_CONNECTION *connection) {
+	if (connection->qst_data && sender->release)
+		sender->release(connection->qst_handle, sender->lookup_context);
+	connection->qst_data = NULL;
+	connection->qst_handle = NULL;
+	connection->qst_size = 0;
+	connection->qst_pos = 0;
+}
+
+static void close_connection(QST_SENDER *sender, QST_SENDER_CONNECTION *connection) {
+	if (connection->closed)
+		return;
+
+	release_download(sender, connection);
+	ring_remove(sender, connection);
+	close(connection->fd);
+	connection->fd = -1;
+	connection->closed = true;
+
+	if (connection->prev_open)
+		connection->prev_open->next_open = connection->next_open;
+	else
+		sender->open = connection->next_open;
+	if (connection->next_open)
+		connection->next_open->prev_open = connection->prev_open;
+	--sender->num_open;
+
+	// there may still be events for this connection waiting to be handled, so it isn't freed just yet
+	connection->prev_open = NULL;
+	connection->next_open = sender->closed;
+	sender->closed = connection;
+}
+
+static void free_closed_connections(QST_SENDER *sender) {
+	QST_SENDER_CONNECTION *connection = sender->closed;
+	while (connection) {
+		QST_SENDER_CONNECTION *next = connection->next_open;
+		free(connection->out_buffer);
+		free(connection);
+		connection = next;
+	}
+	sender->closed = NULL;
+}
+
+static void finish_download(QST_SENDER *sender, QST_SENDER_CONNECTION *connection) {
+	release_download(sender, connection);
+	ring_remove(sender, connection);
+	++sender->num_quests_sent;
+}
+
+// handles requests sitting in the receive buffer. only one download per connection is in progress at any time, so
+// requests made while one is in progress are left in the buffer until it is done
+static int process_requests(QST_SENDER *sender, QST_SENDER_CONNECTION *connection) {
+	while (!connection->qst_data && connection->recv_size >= sizeof(PACKET_HEADER)) {
+		PACKET_HEADER *header = (PACKET_HEADER*)connection->recv_buffer;
+		if (!connection->header_decrypted) {
+			session_decrypt_data(&connection->session, connection->recv_buffer, sizeof(PACKET_HEADER));
+			connection->header_decrypted = true;
+			if (header->pkt_size < sizeof(PACKET_HEADER) || header->pkt_size > QST_SENDER_RECV_BUFFER_SIZE || (header->pkt_size % 4) != 0)
+				return ERROR_BAD_DATA;
+		}
+
+		size_t size = header->pkt_size;
+		if (connection->recv_size < size)
+			return SUCCESS;
+
+		session_decrypt_data(&connection->session, connection->recv_buffer + sizeof(PACKET_HEADER), size - sizeof(PACKET_HEADER));
+
+		// anything other than a quest being picked is ignored
+		if (header->pkt_id == PACKET_ID_MENU_SELECT && size >= sizeof(MENU_SELECT_PACKET)) {
+			const MENU_SELECT_PACKET *select = (const MENU_SELECT_PACKET*)connection->recv_buffer;
+			int returncode = sender->lookup(select->item_id, &connection->qst_data, &connection->qst_size, &connection->qst_handle, sender->lookup_context);
+			if (returncode)
+				return returncode;
+			connection->qst_pos = 0;
+			ring_add(sender, connection);
+		}
+
+		connection->recv_size -= size;
+		if (connection->recv_size)
+			memmove(connection->recv_buffer, connection->recv_buffer + size, connection->recv_size);
+		connection->header_decrypted = false;
+	}
+
+	return SUCCESS;
+}
+
+static int handle_readable(QST_SENDER *sender, QST_SENDER_CONNECTION *connection) {
+	for (;;) {
+		size_t space = QST_SENDER_RECV_BUFFER_SIZE - connection->recv_size;
+		if (!space)
+			return ERROR_BAD_DATA;   // a client sending this much while waiting on a download is misbehaving
+
+		ssize_t received = recv(connection->fd, connection->recv_buffer + connection->recv_size, space, 0);
+		if (received < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return ERROR_NETWORK;
+		}
+		if (received == 0)
+			return ERROR_NETWORK;    // client disconnected
+
+		connection->recv_size += received;
+		connection->session.bytes_received += received;
+	}
+
+	return process_requests(sender, connection);
+}
+
+// encrypts up to a window's worth of the next packets of the download in progress, just before they are written
+static int encrypt_window(QST_SENDER *sender, QST_SENDER_CONNECTION *connection) {
+	connection->out_pos = 0;
+	connection->out_size = 0;
+	connection->out_packets = 0;
+
+	while (connection->out_packets < sender->window && connection->qst_pos < connection->qst_size) {
+		size_t remaining = connection->qst_size - connection->qst_pos;
+		const PACKET_HEADER *header = (const PACKET_HEADER*)(connection->qst_data + connection->qst_pos);
+		if (remaining < sizeof(PACKET_HEADER) || header->pkt_size > remaining || header->pkt_size > sizeof(QST_DATA_CHUNK))
+			return ERROR_BAD_DATA;
+
+		int returncode = session_encrypt_packet(&connection->session, header, header->pkt_size, connection->out_buffer + connection->out_size);
+		if (returncode)
+			return returncode;
+
+		connection->out_packet_sizes[connection->out_packets++] = header->pkt_size;
+		connection->out_size += header->pkt_size;
+		connection->qst_pos += header->pkt_size;
+	}
+
+	return SUCCESS;
+}
+
+// one connection's turn: writes out (at most) one window of packets
+static int send_turn(QST_SENDER *sender, QST_SENDER_CONNECTION *connection) {
+	int returncode;
+	struct iovec iov[QST_SENDER_MAX_WINDOW];
+	int iov_count = 0;
+
+	if (connection->out_pos == connection->out_size) {
+		returncode = encrypt_window(sender, connection);
+		if (returncode)
+			return returncode;
+	}
+
+	// one iovec per packet, skipping whatever was already written by a previous partial write
+	size_t offset = 0;
+	for (int i = 0; i < connection->out_packets; ++i) {
+		size_t packet_end = offset + connection->out_packet_sizes[i];
+		if (packet_end > connection->out_pos) {
+			size_t start = (connection->out_pos > offset) ? connection->out_pos : offset;
+			iov[iov_count].iov_base = connection->out_buffer + start;
+			iov[iov_count].iov_len = packet_end - start;
+			++iov_count;
+		}
+		offset = packet_end;
+	}
+
+	ssize_t written;
+	do {
+		written = writev(connection->fd, iov, iov_count);
+	} while (written < 0 && errno == EINTR);
+
+	if (written < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return ERROR_NETWORK;
+		written = 0;
+	}
+
+	connection->out_pos += written;
+	connection->session.bytes_sent += written;
+	sender->num_bytes_sent += written;
+
+	if (connection->out_pos < connection->out_size) {
+		// socket is full. the rest of this window stays queued (already encrypted) until it can take more
+		connection->writable = false;
+		return set_events(sender, connection, EPOLLIN | EPOLLOUT);
+	}
+
+	if (connection->qst_pos == connection->qst_size) {
+		finish_download(sender, connection);
+		return process_requests(sender, connection);
+	}
+
+	return SUCCESS;
+}
+
+// gives every connection in the ring one turn. returns true if there is still more that can be sent right away
+static bool run_send_round(QST_SENDER *sender) {
+	bool more = false;
+	int turns = sender->ring_size;
+
+	for (int i = 0; i < turns && sender->ring; ++i) {
+		QST_SENDER_CONNECTION *connection = sender->ring;
+		sender->ring = connection->next;
+		if (!connection->writable)
+			continue;
+
+		int returncode = send_turn(sender, connection);
+		if (returncode)
+			close_connection(sender, connection);
+		else if (connection->in_ring && connection->writable)
+			more = true;
+	}
+
+	return more;
+}
+
+static void accept_connections(QST_SENDER *sender) {
+	for (;;) {
+		// the new socket is left blocking until after the "Welcome" packet is sent, which will always fit in the
+		// socket buffer of a brand new connection anyway
+		int fd = accept(sender->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				printf("Error accepting connection: %s\n", strerror(errno));
+			return;
+		}
+
+		QST_SENDER_CONNECTION *connection = calloc(1, sizeof(QST_SENDER_CONNECTION));
+		if (connection)
+			connection->out_buffer = malloc(sender->window * sizeof(QST_DATA_CHUNK));
+		if (!connection || !connection->out_buffer) {
+			if (connection)
+				free(connection);
+			close(fd);
+			continue;
+		}
+
+		uint32_t server_key = (uint32_t)rand_r(&sender->seed);
+		uint32_t client_key = (uint32_t)rand_r(&sender->seed);
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.ptr = connection;
+
+		if (session_accept(fd, server_key, client_key, &connection->session) ||
+		    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) ||
+		    epoll_ctl(sender->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+			free(connection->out_buffer);
+			free(connection);
+			close(fd);
+			continue;
+		}
+
+		connection->fd = fd;
+		connection->writable = true;
+		connection->next_open = sender->open;
+		if (sender->open)
+			sender->open->prev_open = connection;
+		sender->open = connection;
+		++sender->num_open;
+		++sender->num_connections;
+	}
+}
+
+int qst_sender_init(QST_SENDER *sender, int listen_fd, int window, QST_SENDER_LOOKUP_FUNC lookup, QST_SENDER_RELEASE_FUNC release, void *lookup_context) {
+	if (!sender || listen_fd < 0 || !lookup)
+		return ERROR_INVALID_PARAMS;
+
+	if (window < 1)
+		window = QST_SENDER_DEFAULT_WINDOW;
+	if (window > QST_SENDER_MAX_WINDOW)
+		window = QST_SENDER_MAX_WINDOW;
+
+	memset(sender, 0, sizeof(QST_SENDER));
+	sender->listen_fd = listen_fd;
+	sender->window = window;
+	sender->seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+	sender->lookup = lookup;
+	sender->release = release;
+	sender->lookup_context = lookup_context;
+
+	if (fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK))
+		return ERROR_NETWORK;
+
+	sender->epoll_fd = epoll_create1(0);
+	if (sender->epoll_fd < 0)
+		return ERROR_NETWORK;
+
+	struct epoll_event event;
+	// EPOLLEXCLUSIVE, so when several processes share the same listening socket (quest_server -w), a new connection
+	// only wakes up one of them
+	event.events = EPOLLIN | EPOLLEXCLUSIVE;
+	event.data.ptr = NULL;       // NULL means the listening socket
+	if (epoll_ctl(sender->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event)) {
+		close(sender->epoll_fd);
+		return ERROR_NETWORK;
+	}
+
+	return SUCCESS;
+}
+
+/*
+ * Accepts connections and serves quest downloads until *stopping is set (e.g. from a signal handler).
+ */
+int qst_sender_run(QST_SENDER *sender, volatile sig_atomic_t *stopping) {
+	struct epoll_event events[MAX_EVENTS];
+
+	while (!*stopping) {
+		bool more = run_send_round(sender);
+		free_closed_connections(sender);
+
+		// if there is more that can be sent right away, just check for new events without waiting for any
+		int num_events = epoll_wait(sender->epoll_fd, events, MAX_EVENTS, more ? 0 : -1);
+		if (num_events < 0) {
+			if (errno == EINTR)
+				continue;
+			return ERROR_NETWORK;
+		}
+
+		for (int i = 0; i < num_events; ++i) {
+			QST_SENDER_CONNECTION *connection = (QST_SENDER_CONNECTION*)events[i].data.ptr;
+			if (!connection) {
+				accept_connections(sender);
+				continue;
+			}
+			if (connection->closed)
+				continue;
+
+			int returncode = SUCCESS;
+			if ((events[i].events & EPOLLOUT) && !connection->writable) {
+				connection->writable = true;
+				returncode = set_events(sender, connection, EPOLLIN);
+			}
+			if (!returncode && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+				returncode = handle_readable(sender, connection);
+
+			if (returncode)
+				close_connection(sender, connection);
+		}
+		free_closed_connections(sender);
+	}
+
+	return SUCCESS;
+}
+
+void qst_sender_destroy(QST_SENDER *sender) {
+	if (!sender)
+		return;
+
+	while (sender->open)
+		close_connection(sender, sender->open);
+	free_closed_connections(sender);
+
+	if (sender->epoll_fd >= 0)
+		close(sender->epoll_fd);
+	sender->epoll_fd = -1;
+}
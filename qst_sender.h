@@ -0,0 +1,90 @@
+#ifndef QST_SENDER_H_INCLUDED
+#define QST_SENDER_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+
+#include "session.h"
+
+/*
+ * An event-driven (epoll, non-blocking sockets) sender for serving quest downloads to many clients at once from a
+ * single thread.
+ *
+ * Sending a whole quest to one client before moving on to the next would let a large quest (or a slow client) hold
+ * up everyone else. Instead, every connection with a download in progress is kept in a ring. Each turn, a connection
+ * gets to send at most its window of packets, and then it is the next connection's turn. A packet is encrypted using
+ * the connection's crypt state only when it is about to be written. Packets that could not be written because the
+ * socket was full stay queued, already encrypted, until the socket is writable again. So the memory used per
+ * connection is bounded by its window, no matter how large the quest is.
+ *
+ * The .qst file data given to the sender (see QST_SENDER_LOOKUP_FUNC) is sent as-is, packet by packet. It must stay
+ * valid until the sender is done with it. If a release function was given, it is called with the handle that the
+ * lookup returned once the download has finished (or its connection has been closed). Otherwise, the data must stay
+ * valid for as long as the sender is running.
+ */
+
+#define QST_SENDER_DEFAULT_WINDOW      4
+#define QST_SENDER_MAX_WINDOW          64
+#define QST_SENDER_RECV_BUFFER_SIZE    256
+
+// returns the .qst file data for the quest a client picked, or an error if there is no such quest (which disconnects
+// the client)
+typedef int (*QST_SENDER_LOOKUP_FUNC)(uint32_t item_id, const uint8_t **out_qst_data, size_t *out_qst_size, void **out_handle, void *context);
+typedef void (*QST_SENDER_RELEASE_FUNC)(void *handle, void *context);
+
+typedef struct QST_SENDER_CONNECTION {
+	int fd;
+	SESSION session;
+
+	uint8_t recv_buffer[QST_SENDER_RECV_BUFFER_SIZE];
+	size_t recv_size;
+	bool header_decrypted;
+
+	// the download currently in progress, if any. qst_pos is the offset of the next packet to be encrypted
+	const uint8_t *qst_data;
+	size_t qst_size;
+	size_t qst_pos;
+	void *qst_handle;
+
+	// packets which have been encrypted but not written out completely yet
+	uint8_t *out_buffer;
+	size_t out_pos;
+	size_t out_size;
+	size_t out_packet_sizes[QST_SENDER_MAX_WINDOW];
+	int out_packets;
+
+	bool writable;
+	bool closed;
+	bool in_ring;
+	struct QST_SENDER_CONNECTION *next;       // in the ring of connections with a download in progress
+	struct QST_SENDER_CONNECTION *prev;
+	struct QST_SENDER_CONNECTION *next_open;  // in the list of all open connections (or closed ones, once closed)
+	struct QST_SENDER_CONNECTION *prev_open;
+} QST_SENDER_CONNECTION;
+
+typedef struct {
+	int epoll_fd;
+	int listen_fd;
+	int window;
+	unsigned int seed;
+	QST_SENDER_LOOKUP_FUNC lookup;
+	QST_SENDER_RELEASE_FUNC release;
+	void *lookup_context;
+
+	QST_SENDER_CONNECTION *ring;              // next connection to get a turn, or NULL if nothing is being sent
+	int ring_size;
+	QST_SENDER_CONNECTION *open;
+	int num_open;
+	QST_SENDER_CONNECTION *closed;            // freed only once it is certain no epoll event still refers to them
+
+	uint64_t num_connections;
+	uint64_t num_quests_sent;
+	uint64_t num_bytes_sent;
+} QST_SENDER;
+
+int qst_sender_init(QST_SENDER *sender, int listen_fd, int window, QST_SENDER_LOOKUP_FUNC lookup, QST_SENDER_RELEASE_FUNC release, void *lookup_context);
+int qst_sender_run(QST_SENDER *sender, volatile sig_atomic_t *stopping);
+void qst_sender_destroy(QST_SENDER *sender);
+
+#endif
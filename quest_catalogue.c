@@ -0,0 +1,450 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "retvals.h"
+#include "quest_catalogue.h"
+#include "decode_cache.h"
+#include "dat_tables.h"
+#include "utils.h"
+
+#define CATALOGUE_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+// one .dat table of one quest, while working out where the single stored copy of each distinct table goes
+typedef struct {
+	const uint8_t *data;
+	uint32_t size;
+	uint64_t hash;
+	uint64_t *offset;
+} POOL_TABLE;
+
+static uint64_t align_offset(uint64_t offset) {
+	return (offset + (QUEST_CATALOGUE_ALIGNMENT - 1)) & ~(uint64_t)(QUEST_CATALOGUE_ALIGNMENT - 1);
+}
+
+static uint64_t align_table_offset(uint64_t offset) {
+	return (offset + (QUEST_CATALOGUE_TABLE_ALIGNMENT - 1)) & ~(uint64_t)(QUEST_CATALOGUE_TABLE_ALIGNMENT - 1);
+}
+
+// identical tables sort next to each other, even if two different ones happen to have the same hash
+static int compare_pool_tables(const void *a, const void *b) {
+	const POOL_TABLE *ta = (const POOL_TABLE*)a;
+	const POOL_TABLE *tb = (const POOL_TABLE*)b;
+	if (ta->hash != tb->hash)
+		return (ta->hash < tb->hash) ? -1 : 1;
+	if (ta->size != tb->size)
+		return (ta->size < tb->size) ? -1 : 1;
+	return memcmp(ta->data, tb->data, ta->size);
+}
+
+void quest_catalogue_free_quest(CATALOGUE_QUEST *quest) {
+	free(quest->qst_data);
+	free(quest->bin_data);
+	free(quest->dat_data);
+}
+
+/*
+ * Reads a download/offline .qst file, making sure it is made up entirely of complete download quest packets (so it
+ * can be sent to clients as-is later), and decrypts and decompresses the .bin and .dat data it contains. Free it with
+ * quest_catalogue_free_quest when done.
+ */
+int quest_catalogue_load_quest(const char *filename, CATALOGUE_QUEST *out_quest) {
+	int returncode;
+	int32_t result;
+	QST_REASSEMBLER reassembler;
+	bool found_bin_header = false, found_dat_header = false;
+	size_t pos = 0;
+
+	memset(out_quest, 0, sizeof(CATALOGUE_QUEST));
+	qst_reassembler_init(&reassembler);
+
+	returncode = read_file(filename, &out_quest->qst_data, &out_quest->qst_size);
+	if (returncode)
+		goto error;
+
+	const uint8_t *data = out_quest->qst_data;
+	size_t size = out_quest->qst_size;
+	while (pos < size) {
+		const PACKET_HEADER *header = (const PACKET_HEADER*)(data + pos);
+		if ((size - pos) < sizeof(PACKET_HEADER) || header->pkt_size > (size - pos)) {
+			returncode = ERROR_BAD_DATA;
+			goto error;
+		}
+
+		returncode = qst_reassembler_add_packet(&reassembler, data + pos, header->pkt_size);
+		if (returncode)
+			goto error;
+
+		if (header->pkt_id == PACKET_ID_QUEST_INFO_DOWNLOAD && header->pkt_size == sizeof(QST_HEADER)) {
+			const QST_HEADER *qst_header = (const QST_HEADER*)(data + pos);
+			if (string_ends_with(qst_header->filename, ".bin")) {
+				out_quest->bin_qst_header = *qst_header;
+				found_bin_header = true;
+			} else {
+				out_quest->dat_qst_header = *qst_header;
+				found_dat_header = true;
+			}
+		}
+
+		pos += header->pkt_size;
+	}
+
+	if (!qst_reassembler_is_complete(&reassembler) || reassembler.qst_type != QST_TYPE_DOWNLOAD || !found_bin_header || !found_dat_header) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+
+	if (reassembler.bin_length <= sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER) || reassembler.dat_length <= sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER)) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+
+	returncode = decrypt_qst_bindat(reassembler.bin_data, &reassembler.bin_length, reassembler.dat_data, &reassembler.dat_length);
+	if (returncode)
+		goto error;
+
+	result = decode_cache_decompress_buf(reassembler.bin_data, &out_quest->bin_data, reassembler.bin_length);
+	if (result < 0) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+	out_quest->bin_size = result;
+
+	result = decode_cache_decompress_buf(reassembler.dat_data, &out_quest->dat_data, reassembler.dat_length);
+	if (result < 0) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+	out_quest->dat_size = result;
+
+	qst_reassembler_free(&reassembler);
+	return SUCCESS;
+
+error:
+	qst_reassembler_free(&reassembler);
+	quest_catalogue_free_quest(out_quest);
+	memset(out_quest, 0, sizeof(CATALOGUE_QUEST));
+	return returncode;
+}
+
+/*
+ * Loads all of the given download/offline .qst files and builds the catalogue into a new sealed memfd, returning the
+ * fd. The caller can then map it with quest_catalogue_map, and pass the fd on to other processes (e.g. by fork()) so
+ * they can do the same.
+ */
+int quest_catalogue_build(const char **qst_filenames, int num_files, int *out_fd) {
+	return quest_catalogue_build_ex(qst_filenames, num_files, 0, out_fd);
+}
+
+/*
+ * The same as quest_catalogue_build, with flags. With QUEST_CATALOGUE_DEDUP_DAT_TABLES, identical .dat tables are
+ * only stored once (see quest_catalogue.h).
+ */
+int quest_catalogue_build_ex(const char **qst_filenames, int num_files, int flags, int *out_fd) {
+	int returncode;
+	int fd = -1;
+	uint8_t *segment = MAP_FAILED;
+	uint64_t total_size = 0;
+	CATALOGUE_QUEST *quests = NULL;
+	DAT_TABLE **dat_tables = NULL;
+	uint32_t *num_dat_tables = NULL;
+	uint64_t **dat_table_offsets = NULL;
+	POOL_TABLE *pool_tables = NULL;
+	size_t num_pool_tables = 0;
+	uint64_t pool_size = 0;
+	bool dedup = (flags & QUEST_CATALOGUE_DEDUP_DAT_TABLES) != 0;
+
+	if (!qst_filenames || num_files <= 0 || !out_fd)
+		return ERROR_INVALID_PARAMS;
+
+	quests = calloc(num_files, sizeof(CATALOGUE_QUEST));
+	dat_tables = calloc(num_files, sizeof(DAT_TABLE*));
+	num_dat_tables = calloc(num_files, sizeof(uint32_t));
+	dat_table_offsets = calloc(num_files, sizeof(uint64_t*));
+	if (!quests || !dat_tables || !num_dat_tables || !dat_table_offsets) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	for (int i = 0; i < num_files; ++i) {
+		returncode = quest_catalogue_load_quest(qst_filenames[i], &quests[i]);
+		if (returncode) {
+			printf("Error code %d (%s) loading quest file: %s. Only download/offline .qst files can be served.\n", returncode, get_error_message(returncode), qst_filenames[i]);
+			goto error;
+		}
+	}
+
+	if (dedup) {
+		for (int i = 0; i < num_files; ++i) {
+			returncode = dat_tables_split(quests[i].dat_data, quests[i].dat_size, &dat_tables[i], &num_dat_tables[i]);
+			if (returncode)
+				goto error;
+			num_pool_tables += num_dat_tables[i];
+
+			dat_table_offsets[i] = malloc(sizeof(uint64_t) * (num_dat_tables[i] ? num_dat_tables[i] : 1));
+			if (!dat_table_offsets[i]) {
+				returncode = ERROR_IO;
+				goto error;
+			}
+		}
+
+		pool_tables = malloc(sizeof(POOL_TABLE) * (num_pool_tables ? num_pool_tables : 1));
+		if (!pool_tables) {
+			returncode = ERROR_IO;
+			goto error;
+		}
+
+		size_t n = 0;
+		for (int i = 0; i < num_files; ++i) {
+			for (uint32_t j = 0; j < num_dat_tables[i]; ++j) {
+				POOL_TABLE *table = &pool_tables[n++];
+				table->data = quests[i].dat_data + dat_tables[i][j].offset;
+				table->size = dat_tables[i][j].size;
+				table->hash = dat_tables[i][j].hash;
+				table->offset = &dat_table_offsets[i][j];
+			}
+		}
+
+		// each run of identical tables shares the one copy of the first. offsets are within the pool for now
+		qsort(pool_tables, num_pool_tables, sizeof(POOL_TABLE), compare_pool_tables);
+		for (size_t j = 0; j < num_pool_tables; ++j) {
+			if (j && !compare_pool_tables(&pool_tables[j - 1], &pool_tables[j])) {
+				*pool_tables[j].offset = *pool_tables[j - 1].offset;
+			} else {
+				pool_size = align_table_offset(pool_size);
+				*pool_tables[j].offset = pool_size;
+				pool_size += pool_tables[j].size;
+			}
+		}
+	}
+
+	// work out where everything goes
+	uint64_t entries_offset = align_offset(sizeof(QUEST_CATALOGUE_HEADER));
+	uint64_t pool_offset = align_offset(entries_offset + (uint64_t)num_files * sizeof(QUEST_CATALOGUE_ENTRY));
+	total_size = align_offset(pool_offset + pool_size);
+	for (int i = 0; i < num_files; ++i) {
+		total_size = align_offset(total_size + quests[i].qst_size);
+		total_size = align_offset(total_size + quests[i].bin_size);
+		if (dedup)
+			total_size = align_offset(total_size + (uint64_t)num_dat_tables[i] * sizeof(QUEST_CATALOGUE_DAT_TABLE));
+		else
+			total_size = align_offset(total_size + quests[i].dat_size);
+	}
+
+	fd = memfd_create("quest_catalogue", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	if (ftruncate(fd, total_size)) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	segment = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (segment == MAP_FAILED) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	QUEST_CATALOGUE_HEADER *header = (QUEST_CATALOGUE_HEADER*)segment;
+	QUEST_CATALOGUE_ENTRY *entries = (QUEST_CATALOGUE_ENTRY*)(segment + entries_offset);
+	header->magic = QUEST_CATALOGUE_MAGIC;
+	header->version = QUEST_CATALOGUE_VERSION;
+	header->num_quests = num_files;
+	header->entries_offset = (uint32_t)entries_offset;
+	header->total_size = total_size;
+
+	for (size_t j = 0; j < num_pool_tables; ++j)
+		memcpy(segment + pool_offset + *pool_tables[j].offset, pool_tables[j].data, pool_tables[j].size);
+
+	uint64_t offset = align_offset(pool_offset + pool_size);
+	for (int i = 0; i < num_files; ++i) {
+		const CATALOGUE_QUEST *quest = &quests[i];
+		QUEST_CATALOGUE_ENTRY *entry = &entries[i];
+
+		entry->bin_qst_header = quest->bin_qst_header;
+		entry->dat_qst_header = quest->dat_qst_header;
+
+		entry->qst_offset = offset;
+		entry->qst_size = quest->qst_size;
+		memcpy(segment + offset, quest->qst_data, quest->qst_size);
+		offset = align_offset(offset + quest->qst_size);
+
+		entry->bin_offset = offset;
+		entry->bin_size = quest->bin_size;
+		memcpy(segment + offset, quest->bin_data, quest->bin_size);
+		offset = align_offset(offset + quest->bin_size);
+
+		entry->dat_offset = offset;
+		entry->dat_size = quest->dat_size;
+		if (dedup) {
+			QUEST_CATALOGUE_DAT_TABLE *refs = (QUEST_CATALOGUE_DAT_TABLE*)(segment + offset);
+			entry->num_dat_tables = num_dat_tables[i];
+			for (uint32_t j = 0; j < num_dat_tables[i]; ++j) {
+				refs[j].offset = pool_offset + dat_table_offsets[i][j];
+				refs[j].size = dat_tables[i][j].size;
+				refs[j].unused = 0;
+			}
+			offset = align_offset(offset + (uint64_t)num_dat_tables[i] * sizeof(QUEST_CATALOGUE_DAT_TABLE));
+		} else {
+			memcpy(segment + offset, quest->dat_data, quest->dat_size);
+			offset = align_offset(offset + quest->dat_size);
+		}
+	}
+
+	// the writable mapping has to be gone before F_SEAL_WRITE can be added
+	munmap(segment, total_size);
+	segment = MAP_FAILED;
+
+	if (fcntl(fd, F_ADD_SEALS, CATALOGUE_SEALS)) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	*out_fd = fd;
+	returncode = SUCCESS;
+	goto quit;
+
+error:
+	if (segment != MAP_FAILED)
+		munmap(segment, total_size);
+	if (fd >= 0)
+		close(fd);
+quit:
+	for (int i = 0; quests && i < num_files; ++i)
+		quest_catalogue_free_quest(&quests[i]);
+	for (int i = 0; dat_tables && i < num_files; ++i)
+		free(dat_tables[i]);
+	for (int i = 0; dat_table_offsets && i < num_files; ++i)
+		free(dat_table_offsets[i]);
+	free(quests);
+	free(dat_tables);
+	free(num_dat_tables);
+	free(dat_table_offsets);
+	free(pool_tables);
+	return returncode;
+}
+
+/*
+ * Maps a catalogue built by quest_catalogue_build read-only. The fd must be sealed, and every offset in the catalogue
+ * is checked against the size of the segment before it is used.
+ */
+int quest_catalogue_map(int fd, QUEST_CATALOGUE *out_catalogue) {
+	struct stat st;
+
+	if (fd < 0 || !out_catalogue)
+		return ERROR_INVALID_PARAMS;
+
+	memset(out_catalogue, 0, sizeof(QUEST_CATALOGUE));
+	out_catalogue->fd = -1;
+
+	int seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || (seals & CATALOGUE_SEALS) != CATALOGUE_SEALS)
+		return ERROR_BAD_DATA;
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(QUEST_CATALOGUE_HEADER))
+		return ERROR_BAD_DATA;
+
+	size_t size = st.st_size;
+	const uint8_t *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		return ERROR_IO;
+
+	const QUEST_CATALOGUE_HEADER *header = (const QUEST_CATALOGUE_HEADER*)base;
+	if (header->magic != QUEST_CATALOGUE_MAGIC ||
+	    header->version != QUEST_CATALOGUE_VERSION ||
+	    header->total_size != size ||
+	    header->entries_offset > size ||
+	    header->num_quests > (size - header->entries_offset) / sizeof(QUEST_CATALOGUE_ENTRY))
+		goto bad_data;
+
+	const QUEST_CATALOGUE_ENTRY *entries = (const QUEST_CATALOGUE_ENTRY*)(base + header->entries_offset);
+	for (uint32_t i = 0; i < header->num_quests; ++i) {
+		const QUEST_CATALOGUE_ENTRY *entry = &entries[i];
+		if (entry->qst_offset > size || entry->qst_size > (size - entry->qst_offset) ||
+		    entry->bin_offset > size || entry->bin_size > (size - entry->bin_offset) ||
+		    entry->dat_offset > size)
+			goto bad_data;
+
+		if (!entry->num_dat_tables) {
+			if (entry->dat_size > (size - entry->dat_offset))
+				goto bad_data;
+			continue;
+		}
+
+		if (entry->num_dat_tables > (size - entry->dat_offset) / sizeof(QUEST_CATALOGUE_DAT_TABLE))
+			goto bad_data;
+		const QUEST_CATALOGUE_DAT_TABLE *refs = (const QUEST_CATALOGUE_DAT_TABLE*)(base + entry->dat_offset);
+		uint64_t dat_size = 0;
+		for (uint32_t j = 0; j < entry->num_dat_tables; ++j) {
+			if (refs[j].offset > size || refs[j].size > (size - refs[j].offset))
+				goto bad_data;
+			dat_size += refs[j].size;
+		}
+		if (dat_size != entry->dat_size)
+			goto bad_data;
+	}
+
+	out_catalogue->fd = fd;
+	out_catalogue->base = base;
+	out_catalogue->size = size;
+	out_catalogue->header = header;
+	out_catalogue->entries = entries;
+	return SUCCESS;
+
+bad_data:
+	munmap((void*)base, size);
+	return ERROR_BAD_DATA;
+}
+
+// unmaps the catalogue. the fd itself is left open, as it belongs to whoever built the catalogue
+void quest_catalogue_unmap(QUEST_CATALOGUE *catalogue) {
+	if (!catalogue)
+		return;
+
+	if (catalogue->base)
+		munmap((void*)catalogue->base, catalogue->size);
+
+	catalogue->base = NULL;
+	catalogue->header = NULL;
+	catalogue->entries = NULL;
+}
+
+/*
+ * Gets a copy of a quest's decompressed .dat data, whether or not the catalogue was built with its .dat tables
+ * de-duplicated. The copy is allocated with malloc.
+ */
+int quest_catalogue_read_dat(const QUEST_CATALOGUE *catalogue, uint32_t index, uint8_t **out_dat_data, size_t *out_dat_size) {
+	if (!catalogue || !catalogue->base || !out_dat_data || !out_dat_size || index >= catalogue->header->num_quests)
+		return ERROR_INVALID_PARAMS;
+
+	const QUEST_CATALOGUE_ENTRY *entry = &catalogue->entries[index];
+	uint8_t *dat_data = malloc(entry->dat_size ? entry->dat_size : 1);
+	if (!dat_data)
+		return ERROR_IO;
+
+	if (entry->num_dat_tables) {
+		const QUEST_CATALOGUE_DAT_TABLE *refs = (const QUEST_CATALOGUE_DAT_TABLE*)(catalogue->base + entry->dat_offset);
+		size_t pos = 0;
+		for (uint32_t i = 0; i < entry->num_dat_tables; ++i) {
+			memcpy(dat_data + pos, catalogue->base + refs[i].offset, refs[i].size);
+			pos += refs[i].size;
+		}
+	} else {
+		memcpy(dat_data, catalogue->base + entry->dat_offset, entry->dat_size);
+	}
+
+	*out_dat_data = dat_data;
+	*out_dat_size = entry->dat_size;
+	return SUCCESS;
+}
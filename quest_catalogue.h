@@ -0,0 +1,96 @@
+#ifndef QUEST_CATALOGUE_H_INCLUDED
+#define QUEST_CATALOGUE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "defs.h"
+#include "quests.h"
+
+/*
+ * A read-only catalogue of download/offline quests, built once into a single sealed memfd segment which any number of
+ * processes can then map and share. Several server processes on the same host can all serve quests from the one copy
+ * in memory, instead of each loading their own. And a worker process that is restarted only has to map the segment
+ * again, rather than re-reading and re-decompressing every quest.
+ *
+ * Segment layout (everything is little-endian, and referred to by offsets from the start of the segment, so that it
+ * doesn't matter where each process ends up mapping it):
+ *
+ * QUEST_CATALOGUE_HEADER
+ * QUEST_CATALOGUE_ENTRY * num_quests
+ * per quest: the .qst file data (the packet stream that is sent to clients as-is), then the decompressed .bin and
+ *            .dat data. each of these starts on a QUEST_CATALOGUE_ALIGNMENT boundary.
+ *
+ * Built with QUEST_CATALOGUE_DEDUP_DAT_TABLES, each distinct .dat table (see dat_tables.h) is instead stored only once,
+ * in a pool of tables that comes straight after the entries, and each quest's .dat is a list of
+ * QUEST_CATALOGUE_DAT_TABLE references into the pool, in order. Many quests use exactly the same tables for the same
+ * areas. Use quest_catalogue_read_dat to get a quest's .dat data back either way.
+ *
+ * Once built, the segment is sealed against writing, growing and shrinking, so a process mapping it can trust that
+ * the contents (which are validated when mapped) will never change underneath it.
+ */
+
+#define QUEST_CATALOGUE_MAGIC          0x54414351   // "QCAT"
+#define QUEST_CATALOGUE_VERSION        2
+#define QUEST_CATALOGUE_ALIGNMENT      64
+#define QUEST_CATALOGUE_TABLE_ALIGNMENT  4
+
+// quest_catalogue_build_ex flags
+#define QUEST_CATALOGUE_DEDUP_DAT_TABLES  0x1
+
+typedef struct _PACKED_ {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_quests;
+	uint32_t entries_offset;
+	uint64_t total_size;
+} QUEST_CATALOGUE_HEADER;
+
+typedef struct _PACKED_ {
+	QST_HEADER bin_qst_header;
+	QST_HEADER dat_qst_header;
+	uint64_t qst_offset;
+	uint64_t bin_offset;
+	uint64_t dat_offset;
+	uint32_t qst_size;
+	uint32_t bin_size;
+	uint32_t dat_size;
+	uint32_t num_dat_tables;       // 0 if the .dat data is stored as-is at dat_offset, otherwise see above
+} QUEST_CATALOGUE_ENTRY;
+
+typedef struct _PACKED_ {
+	uint64_t offset;
+	uint32_t size;
+	uint32_t unused;
+} QUEST_CATALOGUE_DAT_TABLE;
+
+// everything loaded for one quest, before it is copied into a catalogue
+typedef struct {
+	uint8_t *qst_data;
+	uint32_t qst_size;
+	uint8_t *bin_data;
+	uint8_t *dat_data;
+	uint32_t bin_size;
+	uint32_t dat_size;
+	QST_HEADER bin_qst_header;
+	QST_HEADER dat_qst_header;
+} CATALOGUE_QUEST;
+
+typedef struct {
+	int fd;
+	const uint8_t *base;
+	size_t size;
+	const QUEST_CATALOGUE_HEADER *header;
+	const QUEST_CATALOGUE_ENTRY *entries;
+} QUEST_CATALOGUE;
+
+int quest_catalogue_load_quest(const char *filename, CATALOGUE_QUEST *out_quest);
+void quest_catalogue_free_quest(CATALOGUE_QUEST *quest);
+
+int quest_catalogue_build(const char **qst_filenames, int num_files, int *out_fd);
+int quest_catalogue_build_ex(const char **qst_filenames, int num_files, int flags, int *out_fd);
+int quest_catalogue_map(int fd, QUEST_CATALOGUE *out_catalogue);
+void quest_catalogue_unmap(QUEST_CATALOGUE *catalogue);
+int quest_catalogue_read_dat(const QUEST_CATALOGUE *catalogue, uint32_t index, uint8_t **out_dat_data, size_t *out_dat_size);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * PSO EP1&2 (Gamecube) Quest Download Client Emulator
+ *
+ * Connects to a quest_server (or anything else speaking the same minimal subset of the PSO protocol) with any number
+ * of concurrent connections, each of which downloads a quest some number of times, decrypting and reassembling the
+ * 0xA6 / 0xA7 quest packets as a real client would. Displays the overall download throughput and the latency of each
+ * quest download (from the quest being picked until the last of its packets was received).
+ *
+ * Optionally, the .bin and .dat files of the first downloaded quest can be written out, to check that the quest was
+ * received intact.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "session.h"
+#include "batch.h"
+#include "utils.h"
+#include "stats.h"
+
+typedef struct {
+	int result;
+	int num_downloads;
+	uint64_t bytes_received;
+	uint64_t total_latency;
+	uint64_t min_latency;
+	uint64_t max_latency;
+} CLIENT_CONNECTION;
+
+typedef struct {
+	const char *host;
+	const char *port;
+	uint32_t quest_number;
+	int downloads_per_connection;
+	const char *output_dir;
+	CLIENT_CONNECTION *connections;
+} CLIENT_RUN;
+
+int write_downloaded_quest(const char *output_dir, QST_REASSEMBLER *reassembler) {
+	char path[FILENAME_MAX];
+	char filename[QUEST_FILENAME_MAX_LENGTH + 1];
+	int returncode;
+
+	if (reassembler->qst_type == QST_TYPE_DOWNLOAD) {
+		returncode = decrypt_qst_bindat(reassembler->bin_data, &reassembler->bin_length, reassembler->dat_data, &reassembler->dat_length);
+		if (returncode)
+			return returncode;
+	}
+
+	returncode = create_directory(output_dir);
+	if (returncode)
+		return returncode;
+
+	memset(filename, 0, sizeof(filename));
+	strncpy(filename, reassembler->bin_filename, QUEST_FILENAME_MAX_LENGTH);
+	snprintf(path, sizeof(path), "%s/%s", output_dir, filename);
+	returncode = write_file(path, reassembler->bin_data, reassembler->bin_length);
+	if (returncode)
+		return returncode;
+	printf("Wrote %s\n", path);
+
+	strncpy(filename, reassembler->dat_filename, QUEST_FILENAME_MAX_LENGTH);
+	snprintf(path, sizeof(path), "%s/%s", output_dir, filename);
+	returncode = write_file(path, reassembler->dat_data, reassembler->dat_length);
+	if (returncode)
+		return returncode;
+	printf("Wrote %s\n", path);
+
+	return SUCCESS;
+}
+
+int run_connection(const CLIENT_RUN *run, int connection_index, CLIENT_CONNECTION *connection) {
+	int returncode;
+	SESSION session;
+	QST_REASSEMBLER reassembler;
+
+	int fd = session_dial(run->host, run->port);
+	if (fd < 0)
+		return ERROR_NETWORK;
+
+	returncode = session_connect(fd, &session);
+	if (returncode) {
+		close(fd);
+		return returncode;
+	}
+
+	for (int i = 0; i < run->downloads_per_connection; ++i) {
+		MENU_SELECT_PACKET select;
+		memset(&select, 0, sizeof(select));
+		select.header.pkt_id = PACKET_ID_MENU_SELECT;
+		select.header.pkt_size = sizeof(select);
+		select.item_id = run->quest_number;
+
+		qst_reassembler_init(&reassembler);
+
+		uint64_t start = stats_get_time();
+		returncode = session_send_packet(&session, &select, sizeof(select));
+		if (!returncode)
+			returncode = session_recv_qst(&session, &reassembler);
+		uint64_t latency = stats_get_time() - start;
+
+		if (!returncode && connection_index == 0 && i == 0 && run->output_dir)
+			returncode = write_downloaded_quest(run->output_dir, &reassembler);
+
+		qst_reassembler_free(&reassembler);
+		if (returncode)
+			break;
+
+		connection->num_downloads++;
+		connection->total_latency += latency;
+		if (!connection->min_latency || latency < connection->min_latency)
+			connection->min_latency = latency;
+		if (latency > connection->max_latency)
+			connection->max_latency = latency;
+	}
+
+	connection->bytes_received = session.bytes_received;
+	session_close(&session);
+	return returncode;
+}
+
+void run_job(int job_index, int worker_index, void *context) {
+	(void)worker_index;
+	CLIENT_RUN *run = (CLIENT_RUN*)context;
+	CLIENT_CONNECTION *connection = &run->connections[job_index];
+
+	connection->result = run_connection(run, job_index, connection);
+	if (connection->result)
+		printf("Error code %d (%s) on connection %d after %d download(s).\n", connection->result, get_error_message(connection->result), job_index, connection->num_downloads);
+}
+
+int main(int argc, char *argv[]) {
+	int returncode;
+	int num_connections = 1;
+	CLIENT_RUN run;
+
+	memset(&run, 0, sizeof(run));
+	run.downloads_per_connection = 1;
+
+	stats_parse_args(&argc, argv);
+
+	int argi = 1;
+	while (argi < argc && argv[argi][0] == '-') {
+		if (!strcmp(argv[argi], "-c") && (argi + 1) < argc) {
+			num_connections = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-n") && (argi + 1) < argc) {
+			run.downloads_per_connection = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-q") && (argi + 1) < argc) {
+			run.quest_number = (uint32_t)strtoul(argv[argi + 1], NULL, 10);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-o") && (argi + 1) < argc) {
+			run.output_dir = argv[argi + 1];
+			argi += 2;
+		} else {
+			break;
+		}
+	}
+
+	if ((argc - argi) != 2 || num_connections < 1 || run.downloads_per_connection < 1) {
+		printf("Usage: quest_client [--stats] [-c connections] [-n downloads-per-connection] [-q quest-number] [-o output-dir] host port\n");
+		return 1;
+	}
+
+	run.host = argv[argi];
+	run.port = argv[argi + 1];
+	run.connections = calloc(num_connections, sizeof(CLIENT_CONNECTION));
+	if (!run.connections) {
+		printf("Not enough memory for %d connection(s).\n", num_connections);
+		goto error;
+	}
+
+	uint64_t start = stats_get_time();
+	returncode = batch_run(num_connections, num_connections, run_job, &run);
+	uint64_t elapsed = stats_get_time() - start;
+	if (returncode) {
+		printf("Error code %d (%s) running connections.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
+
+	int num_failed = 0, num_downloads = 0;
+	uint64_t bytes_received = 0, total_latency = 0, min_latency = 0, max_latency = 0;
+	for (int i = 0; i < num_connections; ++i) {
+		CLIENT_CONNECTION *connection = &run.connections[i];
+		if (connection->result)
+			++num_failed;
+		num_downloads += connection->num_downloads;
+		bytes_received += connection->bytes_received;
+		total_latency += connection->total_latency;
+		if (connection->num_downloads && (!min_latency || connection->min_latency < min_latency))
+			min_latency = connection->min_latency;
+		if (connection->max_latency > max_latency)
+			max_latency = connection->max_latency;
+	}
+
+	double seconds = elapsed / 1000000000.0;
+	printf("%d connection(s), %d failed. %d download(s) of quest %u in %.3f seconds.\n", num_connections, num_failed, num_downloads, run.quest_number, seconds);
+	printf("Throughput: %.1f downloads/s, %.2f MB/s\n", num_downloads / seconds, (bytes_received / (1024.0 * 1024.0)) / seconds);
+	if (num_downloads)
+		printf("Latency: min %.3f ms, avg %.3f ms, max %.3f ms\n", min_latency / 1000000.0, (total_latency / (double)num_downloads) / 1000000.0, max_latency / 1000000.0);
+
+	returncode = num_failed ? 1 : 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	free(run.connections);
+	return returncode;
+}
@@ -0,0 +1,466 @@
+/*
+ * PSO EP1&2 (Gamecube) Quest Delta Tool
+ *
+ * Makes small patch files that turn one version of a quest into another, and applies them. So when a quest is
+ * updated, only the patch needs to be sent to anywhere that already has the old version, instead of the whole
+ * new quest.
+ *
+ * Patches are made from the decompressed .bin and .dat data (compressed data changes all over the place after even a
+ * small change to the data), so either version of the quest can be in any of the following types of files:
+ *
+ * - Compressed .bin + .dat file combo
+ * - Online-play, unencrypted (0x44 / 0x13) .qst file
+ * - Download/Offline-play, encrypted (0xA6 / 0xA7) .qst file
+ *
+ * When a patch is applied, the new quest's data is compressed (and encrypted, for download quests) again and written
+ * out as .bin/.dat files or a .qst file.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "defs.h"
+#include "fuzziqer_prs.h"
+
+#include "retvals.h"
+#include "utils.h"
+#include "stats.h"
+#include "hash.h"
+#include "quests.h"
+#include "gcdl.h"
+#include "decode_cache.h"
+#include "delta.h"
+
+#define QUEST_DELTA_MAGIC              "QDLT"
+#define QUEST_DELTA_VERSION            2
+
+/*
+ * A patch file is one of these, followed by the .bin delta and then the .dat delta (see delta.h), which are PRS
+ * compressed together at PRS_LEVEL_OPTIMAL. The hashes are XXH64 hashes of the decompressed data, with the .bin
+ * header's download flag cleared (see load_quest).
+ */
+typedef struct _PACKED_ {
+	char magic[4];
+	uint8_t version;
+	uint8_t qst_type;              // of the new quest, or QST_TYPE_NONE if it was .bin/.dat files
+	uint16_t unused;
+	char bin_filename[QUEST_FILENAME_MAX_LENGTH];  // the new quest's .bin/.dat filenames, used in .qst files
+	char dat_filename[QUEST_FILENAME_MAX_LENGTH];
+	uint64_t old_bin_hash;
+	uint64_t old_dat_hash;
+	uint64_t new_bin_hash;
+	uint64_t new_dat_hash;
+	uint32_t new_bin_size;
+	uint32_t new_dat_size;
+	uint32_t bin_delta_size;
+	uint32_t dat_delta_size;
+} QUEST_DELTA_HEADER;
+
+typedef struct {
+	uint8_t *bin_data;
+	uint8_t *dat_data;
+	size_t bin_size;
+	size_t dat_size;
+	int qst_type;
+	char bin_filename[QUEST_FILENAME_MAX_LENGTH + 1];
+	char dat_filename[QUEST_FILENAME_MAX_LENGTH + 1];
+} QUEST_DATA;
+
+static void free_quest(QUEST_DATA *quest) {
+	free(quest->bin_data);
+	free(quest->dat_data);
+	memset(quest, 0, sizeof(QUEST_DATA));
+}
+
+/*
+ * Loads a quest from either a .qst file, or a .bin file and a .dat file (if dat_filename is not NULL), and
+ * decompresses its .bin and .dat data, without any junk that decompressing left on the end. The .bin header's download
+ * flag is cleared, as it is only set in download .qst files, so that the data is the same whichever type of file the
+ * quest was in. write_quest sets it again when writing a download .qst file.
+ */
+static int load_quest(const char *filename, const char *dat_filename, QUEST_DATA *out_quest) {
+	int returncode, result;
+	uint8_t *bin_data = NULL, *dat_data = NULL;
+	size_t bin_data_size, dat_data_size;
+
+	memset(out_quest, 0, sizeof(QUEST_DATA));
+
+	if (dat_filename) {
+		out_quest->qst_type = QST_TYPE_NONE;
+		strncpy(out_quest->bin_filename, path_to_filename(filename), QUEST_FILENAME_MAX_LENGTH);
+		strncpy(out_quest->dat_filename, path_to_filename(dat_filename), QUEST_FILENAME_MAX_LENGTH);
+		returncode = load_quest_from_bindat(filename, dat_filename, &bin_data, &bin_data_size, &dat_data, &dat_data_size);
+		if (returncode)
+			goto error;
+
+		result = decode_cache_decompress_buf(bin_data, &out_quest->bin_data, bin_data_size);
+		if (result < 0) {
+			returncode = ERROR_BAD_DATA;
+			goto error;
+		}
+		out_quest->bin_size = trim_decompressed_bin_junk(out_quest->bin_data, result);
+
+		result = decode_cache_decompress_buf(dat_data, &out_quest->dat_data, dat_data_size);
+		if (result < 0) {
+			returncode = ERROR_BAD_DATA;
+			goto error;
+		}
+		out_quest->dat_size = trim_decompressed_dat_junk(out_quest->dat_data, result);
+
+	} else {
+		returncode = decode_cache_load_quest_from_qst_ex(filename,
+		                                                 &out_quest->bin_data,
+		                                                 &out_quest->bin_size,
+		                                                 &out_quest->dat_data,
+		                                                 &out_quest->dat_size,
+		                                                 &out_quest->qst_type,
+		                                                 out_quest->bin_filename,
+		                                                 out_quest->dat_filename,
+		                                                 NULL,
+		                                                 NULL);
+		if (returncode)
+			goto error;
+	}
+
+	if (out_quest->bin_size < sizeof(QUEST_BIN_HEADER)) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+	((QUEST_BIN_HEADER*)out_quest->bin_data)->download = 0;
+
+	free(bin_data);
+	free(dat_data);
+	return SUCCESS;
+
+error:
+	free(bin_data);
+	free(dat_data);
+	free_quest(out_quest);
+	return returncode;
+}
+
+/*
+ * Loads the quest given by the arguments starting at files[*index], which is either a .qst file, or a .bin file
+ * followed by a .dat file, and moves *index past them.
+ */
+static int load_quest_args(int num_files, char *files[], int *index, QUEST_DATA *out_quest) {
+	const char *filename = files[*index];
+	const char *dat_filename = NULL;
+
+	if (string_ends_with(filename, ".bin")) {
+		if ((*index + 1) >= num_files || !string_ends_with(files[*index + 1], ".dat")) {
+			printf("%s is not followed by a .dat file\n", filename);
+			return ERROR_INVALID_PARAMS;
+		}
+		dat_filename = files[*index + 1];
+	}
+
+	printf("Reading quest %s ...\n", filename);
+	int returncode = load_quest(filename, dat_filename, out_quest);
+	if (returncode)
+		printf("Error code %d (%s) reading quest: %s\n", returncode, get_error_message(returncode), filename);
+
+	*index += dat_filename ? 2 : 1;
+	return returncode;
+}
+
+static int compress_quest(const QUEST_DATA *quest, uint8_t **out_bin, size_t *out_bin_size, uint8_t **out_dat, size_t *out_dat_size) {
+	// note: see header comment in fuzziqer_prs.c for explanation on why this is used instead of prs_compress()
+	int result = fuzziqer_prs_compress(quest->bin_data, out_bin, quest->bin_size);
+	if (result < 0)
+		return ERROR_BAD_DATA;
+	*out_bin_size = result;
+
+	result = fuzziqer_prs_compress(quest->dat_data, out_dat, quest->dat_size);
+	if (result < 0) {
+		free(*out_bin);
+		*out_bin = NULL;
+		return ERROR_BAD_DATA;
+	}
+	*out_dat_size = result;
+
+	return SUCCESS;
+}
+
+/*
+ * Writes out a quest as .bin/.dat files, or (if dat_filename is NULL) a .qst file of the given type. The crypt keys
+ * for download .qst files come from the data's hashes, so the same quest data always gives exactly the same file.
+ */
+static int write_quest(const QUEST_DATA *quest, int qst_type, const char *filename, const char *dat_filename) {
+	int returncode;
+	uint8_t *compressed_bin = NULL, *compressed_dat = NULL;
+	uint8_t *final_bin = NULL, *final_dat = NULL;
+	size_t compressed_bin_size, compressed_dat_size;
+	size_t final_bin_size, final_dat_size;
+
+	// see load_quest
+	((QUEST_BIN_HEADER*)quest->bin_data)->download = (qst_type == QST_TYPE_DOWNLOAD && !dat_filename) ? 1 : 0;
+
+	returncode = compress_quest(quest, &compressed_bin, &compressed_bin_size, &compressed_dat, &compressed_dat_size);
+	if (returncode)
+		goto error;
+
+	if (dat_filename) {
+		returncode = write_file(filename, compressed_bin, compressed_bin_size);
+		if (returncode)
+			goto error;
+		returncode = write_file(dat_filename, compressed_dat, compressed_dat_size);
+
+	} else if (qst_type == QST_TYPE_DOWNLOAD) {
+		uint32_t bin_crypt_key = (uint32_t)xxh64(quest->bin_data, quest->bin_size, 0);
+		uint32_t dat_crypt_key = (uint32_t)xxh64(quest->dat_data, quest->dat_size, 0);
+
+		returncode = encrypt_download_quest_data(compressed_bin, compressed_bin_size, quest->bin_size, bin_crypt_key, &final_bin, &final_bin_size, NULL);
+		if (returncode)
+			goto error;
+		returncode = encrypt_download_quest_data(compressed_dat, compressed_dat_size, quest->dat_size, dat_crypt_key, &final_dat, &final_dat_size, NULL);
+		if (returncode)
+			goto error;
+
+		returncode = write_download_quest_qst(filename,
+		                                      quest->bin_filename,
+		                                      quest->dat_filename,
+		                                      (const QUEST_BIN_HEADER*)quest->bin_data,
+		                                      final_bin,
+		                                      final_bin_size,
+		                                      final_dat,
+		                                      final_dat_size);
+
+	} else {
+		returncode = write_qst_file(filename,
+		                            quest->bin_filename,
+		                            quest->dat_filename,
+		                            (const QUEST_BIN_HEADER*)quest->bin_data,
+		                            compressed_bin,
+		                            compressed_bin_size,
+		                            compressed_dat,
+		                            compressed_dat_size,
+		                            QST_TYPE_ONLINE);
+	}
+
+error:
+	free(compressed_bin);
+	free(compressed_dat);
+	free(final_bin);
+	free(final_dat);
+	return returncode;
+}
+
+static void print_delta_stats(const char *name, const DELTA_STATS *stats, size_t delta_size) {
+	printf("%s: %u copies (%zu bytes), %u inserts (%zu bytes), %zu byte delta\n",
+	       name, stats->num_copies, stats->copied_bytes, stats->num_inserts, stats->inserted_bytes, delta_size);
+}
+
+int diff_quests(int num_files, char *files[]) {
+	int returncode, result;
+	QUEST_DATA old_quest, new_quest;
+	uint8_t *bin_delta = NULL, *dat_delta = NULL;
+	uint8_t *deltas = NULL, *compressed_deltas = NULL, *patch = NULL;
+	size_t bin_delta_size, dat_delta_size;
+	DELTA_STATS bin_stats, dat_stats;
+	int index = 0;
+
+	memset(&old_quest, 0, sizeof(old_quest));
+	memset(&new_quest, 0, sizeof(new_quest));
+
+	if (load_quest_args(num_files, files, &index, &old_quest))
+		goto error;
+	if (index >= num_files || load_quest_args(num_files, files, &index, &new_quest))
+		goto error;
+	if (index != num_files - 1) {
+		printf("Expected a patch filename after the old and new quests.\n");
+		goto error;
+	}
+	const char *patch_filename = files[index];
+
+	returncode = delta_create(old_quest.bin_data, old_quest.bin_size, new_quest.bin_data, new_quest.bin_size, &bin_delta, &bin_delta_size, &bin_stats);
+	if (returncode) {
+		printf("Error code %d (%s) comparing .bin data.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
+	print_delta_stats(".bin", &bin_stats, bin_delta_size);
+
+	returncode = delta_create(old_quest.dat_data, old_quest.dat_size, new_quest.dat_data, new_quest.dat_size, &dat_delta, &dat_delta_size, &dat_stats);
+	if (returncode) {
+		printf("Error code %d (%s) comparing .dat data.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
+	print_delta_stats(".dat", &dat_stats, dat_delta_size);
+
+	size_t deltas_size = bin_delta_size + dat_delta_size;
+	deltas = malloc(deltas_size + 3);
+	if (!deltas) {
+		printf("Not enough memory for the patch.\n");
+		goto error;
+	}
+	memcpy(deltas, bin_delta, bin_delta_size);
+	memcpy(deltas + bin_delta_size, dat_delta, dat_delta_size);
+
+	// the compressor needs at least 3 bytes. whatever is past the end of the deltas is never looked at
+	size_t padded_size = (deltas_size < 3) ? 3 : deltas_size;
+	memset(deltas + deltas_size, 0, padded_size - deltas_size);
+	result = fuzziqer_prs_compress_level_ex(deltas, &compressed_deltas, padded_size, PRS_LEVEL_OPTIMAL, NULL);
+	if (result < 0) {
+		printf("Error code %d compressing the patch.\n", result);
+		goto error;
+	}
+
+	size_t patch_size = sizeof(QUEST_DELTA_HEADER) + result;
+	patch = malloc(patch_size);
+	if (!patch) {
+		printf("Not enough memory for the patch.\n");
+		goto error;
+	}
+
+	QUEST_DELTA_HEADER *header = (QUEST_DELTA_HEADER*)patch;
+	memset(header, 0, sizeof(QUEST_DELTA_HEADER));
+	memcpy(header->magic, QUEST_DELTA_MAGIC, sizeof(header->magic));
+	header->version = QUEST_DELTA_VERSION;
+	header->qst_type = (uint8_t)new_quest.qst_type;
+	memcpy(header->bin_filename, new_quest.bin_filename, QUEST_FILENAME_MAX_LENGTH);
+	memcpy(header->dat_filename, new_quest.dat_filename, QUEST_FILENAME_MAX_LENGTH);
+	header->old_bin_hash = xxh64(old_quest.bin_data, old_quest.bin_size, 0);
+	header->old_dat_hash = xxh64(old_quest.dat_data, old_quest.dat_size, 0);
+	header->new_bin_hash = xxh64(new_quest.bin_data, new_quest.bin_size, 0);
+	header->new_dat_hash = xxh64(new_quest.dat_data, new_quest.dat_size, 0);
+	header->new_bin_size = (uint32_t)new_quest.bin_size;
+	header->new_dat_size = (uint32_t)new_quest.dat_size;
+	header->bin_delta_size = (uint32_t)bin_delta_size;
+	header->dat_delta_size = (uint32_t)dat_delta_size;
+	memcpy(patch + sizeof(QUEST_DELTA_HEADER), compressed_deltas, result);
+
+	printf("Writing %s ...\n", patch_filename);
+	returncode = write_file(patch_filename, patch, patch_size);
+	if (returncode) {
+		printf("Error code %d (%s) writing patch file: %s\n", returncode, get_error_message(returncode), patch_filename);
+		goto error;
+	}
+
+	printf("Patch is %zu bytes, for %zu bytes of new quest data.\n", patch_size, new_quest.bin_size + new_quest.dat_size);
+
+	returncode = 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	free_quest(&old_quest);
+	free_quest(&new_quest);
+	free(bin_delta);
+	free(dat_delta);
+	free(deltas);
+	free(compressed_deltas);
+	free(patch);
+	return returncode;
+}
+
+int apply_patch(int num_files, char *files[]) {
+	int returncode, result;
+	QUEST_DATA old_quest, new_quest;
+	uint8_t *patch = NULL, *deltas = NULL;
+	uint32_t patch_size;
+	int index = 0;
+
+	memset(&old_quest, 0, sizeof(old_quest));
+	memset(&new_quest, 0, sizeof(new_quest));
+
+	if (load_quest_args(num_files, files, &index, &old_quest))
+		goto error;
+
+	// the patch, then either output.bin output.dat or output.qst
+	int num_outputs = num_files - index - 1;
+	if (num_outputs < 1 || num_outputs > 2 ||
+	    (num_outputs == 2 && (!string_ends_with(files[index + 1], ".bin") || !string_ends_with(files[index + 2], ".dat")))) {
+		printf("Expected a patch filename, followed by either output .bin and .dat filenames or an output .qst filename, after the old quest.\n");
+		goto error;
+	}
+	const char *patch_filename = files[index];
+	const char *output_filename = files[index + 1];
+	const char *output_dat_filename = (num_outputs == 2) ? files[index + 2] : NULL;
+
+	printf("Reading patch %s ...\n", patch_filename);
+	returncode = read_file(patch_filename, &patch, &patch_size);
+	if (returncode) {
+		printf("Error code %d (%s) reading patch file: %s\n", returncode, get_error_message(returncode), patch_filename);
+		goto error;
+	}
+
+	const QUEST_DELTA_HEADER *header = (const QUEST_DELTA_HEADER*)patch;
+	if (patch_size < sizeof(QUEST_DELTA_HEADER) + 3 ||
+	    memcmp(header->magic, QUEST_DELTA_MAGIC, sizeof(header->magic)) ||
+	    header->version != QUEST_DELTA_VERSION) {
+		printf("Not a quest patch file: %s\n", patch_filename);
+		goto error;
+	}
+
+	if (header->old_bin_hash != xxh64(old_quest.bin_data, old_quest.bin_size, 0) ||
+	    header->old_dat_hash != xxh64(old_quest.dat_data, old_quest.dat_size, 0)) {
+		printf("This patch is not for this version of the quest.\n");
+		goto error;
+	}
+
+	result = fuzziqer_prs_decompress_buf(patch + sizeof(QUEST_DELTA_HEADER), &deltas, patch_size - sizeof(QUEST_DELTA_HEADER));
+	if (result < 0 || (size_t)result < (size_t)header->bin_delta_size + header->dat_delta_size) {
+		printf("Error decompressing patch data.\n");
+		goto error;
+	}
+
+	new_quest.qst_type = header->qst_type;
+	memcpy(new_quest.bin_filename, header->bin_filename, QUEST_FILENAME_MAX_LENGTH);
+	memcpy(new_quest.dat_filename, header->dat_filename, QUEST_FILENAME_MAX_LENGTH);
+
+	returncode = delta_apply(old_quest.bin_data, old_quest.bin_size, deltas, header->bin_delta_size, &new_quest.bin_data, header->new_bin_size);
+	if (returncode) {
+		printf("Error code %d (%s) applying .bin delta.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
+	new_quest.bin_size = header->new_bin_size;
+
+	returncode = delta_apply(old_quest.dat_data, old_quest.dat_size, deltas + header->bin_delta_size, header->dat_delta_size, &new_quest.dat_data, header->new_dat_size);
+	if (returncode) {
+		printf("Error code %d (%s) applying .dat delta.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
+	new_quest.dat_size = header->new_dat_size;
+
+	if (header->new_bin_hash != xxh64(new_quest.bin_data, new_quest.bin_size, 0) ||
+	    header->new_dat_hash != xxh64(new_quest.dat_data, new_quest.dat_size, 0) ||
+	    new_quest.bin_size < sizeof(QUEST_BIN_HEADER)) {
+		printf("The patched quest data does not match what the patch was made from.\n");
+		goto error;
+	}
+
+	int qst_type = (new_quest.qst_type == QST_TYPE_DOWNLOAD) ? QST_TYPE_DOWNLOAD : QST_TYPE_ONLINE;
+	printf("Writing %s ...\n", output_filename);
+	returncode = write_quest(&new_quest, qst_type, output_filename, output_dat_filename);
+	if (returncode) {
+		printf("Error code %d (%s) writing patched quest: %s\n", returncode, get_error_message(returncode), output_filename);
+		goto error;
+	}
+
+	returncode = 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	free_quest(&old_quest);
+	free_quest(&new_quest);
+	free(patch);
+	free(deltas);
+	return returncode;
+}
+
+int main(int argc, char *argv[]) {
+	stats_parse_args(&argc, argv);
+
+	if (argc >= 5 && strcmp(argv[1], "diff") == 0) {
+		return diff_quests(argc - 2, &argv[2]);
+	} else if (argc >= 5 && strcmp(argv[1], "apply") == 0) {
+		return apply_patch(argc - 2, &argv[2]);
+	} else {
+		printf("Usage: quest_delta [--stats] diff old.bin old.dat|old.qst new.bin new.dat|new.qst patch.qdelta\n");
+		printf("       quest_delta [--stats] apply old.bin old.dat|old.qst patch.qdelta output.bin output.dat|output.qst\n");
+		return 1;
+	}
+}
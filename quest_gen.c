@@ -0,0 +1,382 @@
+/*
+ * PSO EP1&2 (Gamecube) Synthetic Quest Corpus Generator
+ *
+ * Generates any number of made-up, but valid, quests (see quest_synth.h) and writes each of them out in every quest
+ * container format the other tools accept, so that benchmarks can be run on a corpus that can be shared freely and
+ * re-created exactly, at whatever size is needed.
+ *
+ * Quests are generated in parallel, each worker thread using its own arena (see arena.h) like gcdl_batch does. Every
+ * quest only depends on the seed and its own index, so the output is identical no matter how many threads are used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "quest_synth.h"
+#include "fuzziqer_prs.h"
+#include "gcdl.h"
+#include "gci.h"
+#include "arena.h"
+#include "batch.h"
+#include "trace.h"
+#include "utils.h"
+#include "stats.h"
+
+#define FORMAT_BINDAT                  1
+#define FORMAT_ONLINE                  2
+#define FORMAT_DOWNLOAD                4
+#define FORMAT_GCI                     8
+#define FORMAT_ALL                     (FORMAT_BINDAT | FORMAT_ONLINE | FORMAT_DOWNLOAD | FORMAT_GCI)
+
+typedef struct {
+	int result;
+	size_t bin_size;
+	size_t dat_size;
+	size_t compressed_bin_size;
+	size_t compressed_dat_size;
+} QUEST_GEN_JOB;
+
+typedef struct {
+	QUEST_GEN_JOB *jobs;
+	ARENA *arenas;                 // one per worker thread
+	QUEST_SYNTH_PARAMS params;
+	uint64_t seed;
+	int formats;
+	int name_digits;
+	const char *output_dir;
+} QUEST_GEN;
+
+static int parse_formats(const char *s) {
+	int formats = 0;
+
+	while (*s) {
+		size_t length = strcspn(s, ",");
+		if (length == 6 && !strncmp(s, "bindat", length))
+			formats |= FORMAT_BINDAT;
+		else if (length == 6 && !strncmp(s, "online", length))
+			formats |= FORMAT_ONLINE;
+		else if (length == 8 && !strncmp(s, "download", length))
+			formats |= FORMAT_DOWNLOAD;
+		else if (length == 3 && !strncmp(s, "gci", length))
+			formats |= FORMAT_GCI;
+		else if (length == 3 && !strncmp(s, "all", length))
+			formats |= FORMAT_ALL;
+		else
+			return 0;
+
+		s += length;
+		if (*s == ',')
+			++s;
+	}
+
+	return formats;
+}
+
+static int write_gci(const QUEST_GEN *gen, uint32_t card_number, const uint8_t *data, size_t size, const QUEST_BIN_HEADER *bin_header, ARENA *arena) {
+	int returncode;
+	uint8_t *gci;
+	size_t gci_size;
+	char card_filename[32], gci_filename[64], path[FILENAME_MAX];
+
+	get_quest_card_filename(card_number, card_filename, sizeof(card_filename));
+	returncode = build_quest_gci(data, size, 'E', card_filename, bin_header->name, 0, &gci, &gci_size, arena);
+	if (returncode)
+		return returncode;
+
+	get_quest_gci_filename(card_filename, 'E', gci_filename, sizeof(gci_filename));
+	snprintf(path, sizeof(path), "%s/gci/%s", gen->output_dir, gci_filename);
+	return write_file(path, gci, gci_size);
+}
+
+// all buffers are allocated from the arena, so nothing needs to be freed here. the arena is reset after every quest
+int generate_quest(const QUEST_GEN *gen, uint32_t quest_index, QUEST_GEN_JOB *job, ARENA *arena) {
+	int returncode, result;
+	uint8_t *bin, *dat;
+	uint8_t *compressed_bin, *compressed_dat;
+	size_t bin_size, dat_size;
+	char bin_base_filename[QUEST_FILENAME_MAX_LENGTH + 1];
+	char dat_base_filename[QUEST_FILENAME_MAX_LENGTH + 1];
+	char path[FILENAME_MAX];
+
+	returncode = quest_synth_generate(&gen->params, gen->seed, quest_index, &bin, &bin_size, &dat, &dat_size, arena);
+	if (returncode)
+		return returncode;
+
+	job->bin_size = bin_size;
+	job->dat_size = dat_size;
+
+	// e.g. "q000001.bin", which easily fits in the 16 characters a .qst file allows for it
+	snprintf(bin_base_filename, sizeof(bin_base_filename), "q%0*u.bin", gen->name_digits, quest_index);
+	snprintf(dat_base_filename, sizeof(dat_base_filename), "q%0*u.dat", gen->name_digits, quest_index);
+
+	result = fuzziqer_prs_compress_ex(bin, &compressed_bin, bin_size, arena);
+	if (result < 0)
+		return ERROR_BAD_DATA;
+	job->compressed_bin_size = result;
+
+	result = fuzziqer_prs_compress_ex(dat, &compressed_dat, dat_size, arena);
+	if (result < 0)
+		return ERROR_BAD_DATA;
+	job->compressed_dat_size = result;
+
+	if (gen->formats & FORMAT_BINDAT) {
+		snprintf(path, sizeof(path), "%s/bindat/%s", gen->output_dir, bin_base_filename);
+		returncode = write_file(path, compressed_bin, job->compressed_bin_size);
+		if (returncode)
+			return returncode;
+
+		snprintf(path, sizeof(path), "%s/bindat/%s", gen->output_dir, dat_base_filename);
+		returncode = write_file(path, compressed_dat, job->compressed_dat_size);
+		if (returncode)
+			return returncode;
+	}
+
+	if (gen->formats & FORMAT_ONLINE) {
+		snprintf(path, sizeof(path), "%s/online/q%0*u.qst", gen->output_dir, gen->name_digits, quest_index);
+		returncode = write_qst_file(path,
+		                            bin_base_filename,
+		                            dat_base_filename,
+		                            (QUEST_BIN_HEADER*)bin,
+		                            compressed_bin,
+		                            job->compressed_bin_size,
+		                            compressed_dat,
+		                            job->compressed_dat_size,
+		                            QST_TYPE_ONLINE);
+		if (returncode)
+			return returncode;
+	}
+
+	if (!(gen->formats & (FORMAT_DOWNLOAD | FORMAT_GCI)))
+		return SUCCESS;
+
+	uint8_t *download_bin;
+	size_t download_bin_size;
+
+	// note: this sets the "download" flag in the .bin header, so it has to come after the other formats
+	returncode = prepare_download_quest_bin((QUEST_BIN_HEADER*)bin, bin_size, &download_bin, &download_bin_size, arena);
+	if (returncode)
+		return returncode;
+
+	if (gen->formats & FORMAT_DOWNLOAD) {
+		uint8_t *final_bin, *final_dat;
+		size_t final_bin_size, final_dat_size;
+
+		// the crypt keys come from the quest's seed too, so these files are also reproducible
+		uint64_t key_state = quest_synth_seed(gen->seed + 1, quest_index);
+
+		returncode = encrypt_download_quest_data(download_bin, download_bin_size, bin_size, quest_synth_random(&key_state), &final_bin, &final_bin_size, arena);
+		if (returncode)
+			return returncode;
+		returncode = encrypt_download_quest_data(compressed_dat, job->compressed_dat_size, dat_size, quest_synth_random(&key_state), &final_dat, &final_dat_size, arena);
+		if (returncode)
+			return returncode;
+
+		snprintf(path, sizeof(path), "%s/download/q%0*u.qst", gen->output_dir, gen->name_digits, quest_index);
+		returncode = write_download_quest_qst(path,
+		                                      bin_base_filename,
+		                                      dat_base_filename,
+		                                      (QUEST_BIN_HEADER*)bin,
+		                                      final_bin,
+		                                      final_bin_size,
+		                                      final_dat,
+		                                      final_dat_size);
+		if (returncode)
+			return returncode;
+	}
+
+	if (gen->formats & FORMAT_GCI) {
+		// numbered two per quest, the same as gcdl_batch does. the timestamp is left at zero to keep them reproducible
+		uint32_t card_number = (quest_index - 1) * 2;
+		returncode = write_gci(gen, card_number, download_bin, download_bin_size, (QUEST_BIN_HEADER*)bin, arena);
+		if (returncode)
+			return returncode;
+		returncode = write_gci(gen, card_number + 1, compressed_dat, job->compressed_dat_size, (QUEST_BIN_HEADER*)bin, arena);
+		if (returncode)
+			return returncode;
+	}
+
+	return SUCCESS;
+}
+
+void run_job(int job_index, int worker_index, void *context) {
+	QUEST_GEN *gen = (QUEST_GEN*)context;
+	QUEST_GEN_JOB *job = &gen->jobs[job_index];
+	ARENA *arena = &gen->arenas[worker_index];
+
+	// quest numbers (and so filenames) start from 1
+	uint32_t quest_index = (uint32_t)job_index + 1;
+
+	uint64_t start = trace_begin();
+	job->result = generate_quest(gen, quest_index, job, arena);
+	arena_reset(arena);
+	trace_end("quest", "quest", NULL, start);
+
+	if (job->result)
+		printf("Error code %d (%s) generating quest %u.\n", job->result, get_error_message(job->result), quest_index);
+}
+
+static int create_output_directories(const char *output_dir, int formats) {
+	char path[FILENAME_MAX];
+
+	if (create_directory(output_dir))
+		return ERROR_CREATING_FILE;
+
+	const char *subdirs[] = { "bindat", "online", "download", "gci" };
+	const int subdir_formats[] = { FORMAT_BINDAT, FORMAT_ONLINE, FORMAT_DOWNLOAD, FORMAT_GCI };
+	for (int i = 0; i < 4; ++i) {
+		if (!(formats & subdir_formats[i]))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", output_dir, subdirs[i]);
+		if (create_directory(path))
+			return ERROR_CREATING_FILE;
+	}
+
+	return SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+	int returncode;
+	int num_workers = batch_get_default_num_workers();
+	int num_quests = 100;
+	const char *trace_filename = NULL;
+	QUEST_GEN gen;
+	QUEST_GEN_JOB *jobs = NULL;
+	ARENA *arenas = NULL;
+
+	memset(&gen, 0, sizeof(gen));
+	quest_synth_default_params(&gen.params);
+	gen.formats = FORMAT_ALL;
+
+	stats_parse_args(&argc, argv);
+
+	int argi = 1;
+	while (argi < argc && argv[argi][0] == '-') {
+		if (!strcmp(argv[argi], "-n") && (argi + 1) < argc) {
+			num_quests = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-s") && (argi + 1) < argc) {
+			gen.seed = strtoull(argv[argi + 1], NULL, 0);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-b") && (argi + 1) < argc) {
+			gen.params.bin_size = (uint32_t)strtoul(argv[argi + 1], NULL, 10) * 1024;
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-d") && (argi + 1) < argc) {
+			gen.params.dat_size = (uint32_t)strtoul(argv[argi + 1], NULL, 10) * 1024;
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-e") && (argi + 1) < argc) {
+			gen.params.entropy = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-f") && (argi + 1) < argc) {
+			gen.formats = parse_formats(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-j") && (argi + 1) < argc) {
+			num_workers = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], TRACE_ARG) && (argi + 1) < argc) {
+			trace_filename = argv[argi + 1];
+			argi += 2;
+		} else {
+			break;
+		}
+	}
+
+	if ((argc - argi) != 1 || num_quests < 1 || num_workers < 1 || !gen.formats ||
+	    gen.params.entropy < 0 || gen.params.entropy > 100 ||
+	    gen.params.bin_size > (64 * 1024 * 1024) || gen.params.dat_size > (64 * 1024 * 1024)) {
+		printf("Usage: quest_gen [--stats] [-n num-quests] [-s seed] [-b bin-size-kb] [-d dat-size-kb] [-e entropy] [-f formats] [-j num-threads] [--trace trace.json] output-dir\n");
+		printf("Formats are a comma-separated list of: bindat, online, download, gci, all\n");
+		return 1;
+	}
+
+	gen.output_dir = argv[argi];
+
+	// filenames are zero-padded to at least 6 digits, so that they sort in order
+	gen.name_digits = 6;
+	for (int n = num_quests / 1000000; n > 0; n /= 10)
+		++gen.name_digits;
+
+	returncode = create_output_directories(gen.output_dir, gen.formats);
+	if (returncode) {
+		printf("Error creating output directories in: %s\n", gen.output_dir);
+		goto error;
+	}
+
+	if (trace_filename) {
+		returncode = trace_start(trace_filename);
+		if (returncode) {
+			printf("Error code %d (%s) creating trace file: %s\n", returncode, get_error_message(returncode), trace_filename);
+			goto error;
+		}
+		trace_set_thread_name("main");
+	}
+
+	jobs = calloc(num_quests, sizeof(QUEST_GEN_JOB));
+	arenas = calloc(num_workers, sizeof(ARENA));
+	if (!jobs || !arenas) {
+		printf("Not enough memory for %d quest(s).\n", num_quests);
+		goto error;
+	}
+	for (int i = 0; i < num_workers; ++i)
+		arena_init(&arenas[i], ARENA_DEFAULT_BLOCK_SIZE);
+
+	gen.jobs = jobs;
+	gen.arenas = arenas;
+
+	printf("Generating %d quest(s) with seed %llu, using %d thread(s) ...\n", num_quests, (unsigned long long)gen.seed, num_workers);
+
+	uint64_t start = trace_begin();
+	returncode = batch_run(num_workers, num_quests, run_job, &gen);
+	trace_end("batch", "batch", NULL, start);
+	if (returncode) {
+		printf("Error code %d (%s) running batch.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
+
+	if (trace_filename) {
+		printf("Writing trace to %s ...\n", trace_filename);
+		returncode = trace_finish();
+		if (returncode) {
+			printf("Error code %d (%s) writing trace file: %s\n", returncode, get_error_message(returncode), trace_filename);
+			goto error;
+		}
+	}
+
+	int num_failed = 0;
+	uint64_t bin_total = 0, dat_total = 0, compressed_bin_total = 0, compressed_dat_total = 0;
+	for (int i = 0; i < num_quests; ++i) {
+		if (jobs[i].result) {
+			++num_failed;
+			continue;
+		}
+		bin_total += jobs[i].bin_size;
+		dat_total += jobs[i].dat_size;
+		compressed_bin_total += jobs[i].compressed_bin_size;
+		compressed_dat_total += jobs[i].compressed_dat_size;
+	}
+
+	printf("Generated %d of %d quest(s).\n", num_quests - num_failed, num_quests);
+	printf(".bin data: %llu bytes, %llu bytes compressed (%.1f%%)\n",
+	       (unsigned long long)bin_total, (unsigned long long)compressed_bin_total,
+	       bin_total ? (100.0 * compressed_bin_total / bin_total) : 0.0);
+	printf(".dat data: %llu bytes, %llu bytes compressed (%.1f%%)\n",
+	       (unsigned long long)dat_total, (unsigned long long)compressed_dat_total,
+	       dat_total ? (100.0 * compressed_dat_total / dat_total) : 0.0);
+
+	returncode = num_failed ? 1 : 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	if (arenas) {
+		for (int i = 0; i < num_workers; ++i)
+			arena_destroy(&arenas[i]);
+	}
+	free(arenas);
+	free(jobs);
+	return returncode;
+}
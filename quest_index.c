@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "quest_index.h"
+
+#define CHAR_CLASS_SEPARATOR           0
+#define CHAR_CLASS_WORD                1
+#define CHAR_CLASS_CJK                 2
+
+#define MAX_QUERY_TOKENS               64
+
+/** tokenizer **/
+
+// minimal UTF-8 decoder. the text being tokenized comes from sjis_to_utf8 (or the command line), so malformed
+// sequences are not expected, but are treated as single separator bytes anyway
+static size_t next_char(const uint8_t *s, uint32_t *out_codepoint) {
+	if (s[0] < 0x80) {
+		*out_codepoint = s[0];
+		return 1;
+	} else if ((s[0] & 0xe0) == 0xc0 && (s[1] & 0xc0) == 0x80) {
+		*out_codepoint = ((s[0] & 0x1f) << 6) | (s[1] & 0x3f);
+		return 2;
+	} else if ((s[0] & 0xf0) == 0xe0 && (s[1] & 0xc0) == 0x80 && (s[2] & 0xc0) == 0x80) {
+		*out_codepoint = ((s[0] & 0x0f) << 12) | ((s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+		return 3;
+	} else {
+		*out_codepoint = 0xfffd;
+		return 1;
+	}
+}
+
+// word characters are returned folded to lowercase ASCII (including full-width letters/digits, which are common in
+// japanese quest text) via out_folded
+static int classify_char(uint32_t codepoint, char *out_folded) {
+	if ((codepoint >= '0' && codepoint <= '9') || (codepoint >= 'a' && codepoint <= 'z')) {
+		*out_folded = (char)codepoint;
+		return CHAR_CLASS_WORD;
+	}
+	if (codepoint >= 'A' && codepoint <= 'Z') {
+		*out_folded = (char)(codepoint - 'A' + 'a');
+		return CHAR_CLASS_WORD;
+	}
+	if (codepoint >= 0xff10 && codepoint <= 0xff19) {
+		*out_folded = (char)(codepoint - 0xff10 + '0');
+		return CHAR_CLASS_WORD;
+	}
+	if (codepoint >= 0xff21 && codepoint <= 0xff3a) {
+		*out_folded = (char)(codepoint - 0xff21 + 'a');
+		return CHAR_CLASS_WORD;
+	}
+	if (codepoint >= 0xff41 && codepoint <= 0xff5a) {
+		*out_folded = (char)(codepoint - 0xff41 + 'a');
+		return CHAR_CLASS_WORD;
+	}
+
+	if ((codepoint >= 0x3041 && codepoint <= 0x30ff) ||   // hiragana, katakana
+	    (codepoint >= 0x3400 && codepoint <= 0x4dbf) ||   // CJK unified ideographs extension A
+	    (codepoint >= 0x4e00 && codepoint <= 0x9fff) ||   // CJK unified ideographs
+	    (codepoint >= 0xff66 && codepoint <= 0xff9f) ||   // half-width katakana
+	    codepoint == 0x3005)                              // ideographic iteration mark
+		return CHAR_CLASS_CJK;
+
+	return CHAR_CLASS_SEPARATOR;
+}
+
+/*
+ * Splits text up into index terms. Runs of (case-folded) letters and digits become word tokens. There are no spaces
+ * between words in japanese text, so runs of kana/kanji are instead indexed as both single characters and overlapping
+ * character bigrams (so "ABCD" yields "A", "AB", "B", "BC", "C", "CD", "D"). Searching for japanese text then just
+ * means searching for all of the query's bigrams. PSO's in-text color codes ("\tC6" etc.) are skipped over.
+ */
+void quest_index_tokenize(const char *utf8_text, QUEST_INDEX_TOKEN_CALLBACK callback, void *context) {
+	const uint8_t *s = (const uint8_t*)utf8_text;
+	char word[QUEST_INDEX_MAX_TOKEN_LENGTH];
+	size_t word_length = 0;
+	const uint8_t *prev_cjk = NULL;
+	size_t prev_cjk_length = 0;
+
+	while (1) {
+		uint32_t codepoint = 0;
+		size_t length = 0;
+		int char_class = CHAR_CLASS_SEPARATOR;
+		char folded = 0;
+
+		if (*s) {
+			if (s[0] == '\t' && s[1] == 'C' && s[2] != '\0') {
+				length = 3;
+			} else {
+				length = next_char(s, &codepoint);
+				char_class = classify_char(codepoint, &folded);
+			}
+		}
+
+		if (char_class != CHAR_CLASS_WORD && word_length) {
+			callback(word, word_length, context);
+			word_length = 0;
+		}
+		if (char_class != CHAR_CLASS_CJK)
+			prev_cjk = NULL;
+
+		if (char_class == CHAR_CLASS_WORD) {
+			if (word_length < sizeof(word))
+				word[word_length++] = folded;
+		} else if (char_class == CHAR_CLASS_CJK) {
+			callback((const char*)s, length, context);
+			if (prev_cjk)
+				callback((const char*)prev_cjk, prev_cjk_length + length, context);
+			prev_cjk = s;
+			prev_cjk_length = length;
+		}
+
+		if (!*s)
+			break;
+		s += length;
+	}
+}
+
+/** index building **/
+
+static int grow_array(void **array, uint32_t *capacity, uint32_t required, size_t element_size) {
+	if (required <= *capacity)
+		return SUCCESS;
+
+	uint32_t new_capacity = *capacity ? *capacity : 64;
+	while (new_capacity < required)
+		new_capacity *= 2;
+
+	void *new_array = realloc(*array, new_capacity * element_size);
+	if (!new_array)
+		return ERROR_IO;
+
+	*array = new_array;
+	*capacity = new_capacity;
+	return SUCCESS;
+}
+
+static int add_string(QUEST_INDEX_BUILDER *builder, const char *s, size_t length, bool null_terminate, uint32_t *out_offset) {
+	uint32_t required = builder->strings_size + length + (null_terminate ? 1 : 0);
+	if (grow_array((void**)&builder->strings, &builder->strings_capacity, required, 1))
+		return ERROR_IO;
+
+	*out_offset = builder->strings_size;
+	memcpy(builder->strings + builder->strings_size, s, length);
+	builder->strings_size += length;
+	if (null_terminate)
+		builder->strings[builder->strings_size++] = '\0';
+
+	return SUCCESS;
+}
+
+typedef struct {
+	QUEST_INDEX_BUILDER *builder;
+	uint32_t quest_index;
+	int result;
+} ADD_TOKEN_CONTEXT;
+
+static void add_token(const char *token, size_t length, void *context) {
+	ADD_TOKEN_CONTEXT *add_context = (ADD_TOKEN_CONTEXT*)context;
+	QUEST_INDEX_BUILDER *builder = add_context->builder;
+	if (add_context->result)
+		return;
+
+	uint32_t offset;
+	if (add_string(builder, token, length, false, &offset) ||
+	    grow_array((void**)&builder->postings, &builder->postings_capacity, builder->num_postings + 1, sizeof(QUEST_INDEX_BUILDER_POSTING))) {
+		add_context->result = ERROR_IO;
+		return;
+	}
+
+	QUEST_INDEX_BUILDER_POSTING *posting = &builder->postings[builder->num_postings++];
+	posting->term_offset = offset;
+	posting->term_length = length;
+	posting->quest_index = add_context->quest_index;
+}
+
+void quest_index_builder_init(QUEST_INDEX_BUILDER *builder) {
+	memset(builder, 0, sizeof(QUEST_INDEX_BUILDER));
+}
+
+int quest_index_builder_add(QUEST_INDEX_BUILDER *builder, const char *path, const QUEST_BIN_HEADER *bin_header) {
+	if (!builder || !path || !bin_header)
+		return ERROR_INVALID_PARAMS;
+
+	if (grow_array((void**)&builder->quests, &builder->quests_capacity, builder->num_quests + 1, sizeof(QUEST_INDEX_QUEST)))
+		return ERROR_IO;
+
+	QUEST_BIN_HEADER_TEXT text;
+	get_quest_bin_header_text(bin_header, &text);
+
+	uint32_t path_offset, name_offset;
+	if (add_string(builder, path, strlen(path), true, &path_offset) ||
+	    add_string(builder, text.name, strlen(text.name), true, &name_offset))
+		return ERROR_IO;
+
+	QUEST_INDEX_QUEST *quest = &builder->quests[builder->num_quests];
+	memset(quest, 0, sizeof(QUEST_INDEX_QUEST));
+	quest->path_offset = path_offset;
+	quest->name_offset = name_offset;
+	quest->quest_number_word = bin_header->quest_number_word;
+	quest->episode = bin_header->episode;
+
+	ADD_TOKEN_CONTEXT context = { builder, builder->num_quests, SUCCESS };
+	quest_index_tokenize(text.name, add_token, &context);
+	quest_index_tokenize(text.short_description, add_token, &context);
+	quest_index_tokenize(text.long_description, add_token, &context);
+	if (context.result)
+		return context.result;
+
+	++builder->num_quests;
+	return SUCCESS;
+}
+
+static int compare_terms(const char *a, uint32_t a_length, const char *b, uint32_t b_length) {
+	int result = memcmp(a, b, (a_length < b_length) ? a_length : b_length);
+	if (result)
+		return result;
+	return (a_length > b_length) - (a_length < b_length);
+}
+
+// qsort does not allow passing any context to the comparison function ...
+static const char *sort_strings;
+
+static int compare_postings(const void *a, const void *b) {
+	const QUEST_INDEX_BUILDER_POSTING *pa = (const QUEST_INDEX_BUILDER_POSTING*)a;
+	const QUEST_INDEX_BUILDER_POSTING *pb = (const QUEST_INDEX_BUILDER_POSTING*)b;
+	int result = compare_terms(sort_strings + pa->term_offset, pa->term_length, sort_strings + pb->term_offset, pb->term_length);
+	if (result)
+		return result;
+	return (pa->quest_index > pb->quest_index) - (pa->quest_index < pb->quest_index);
+}
+
+int quest_index_builder_write(QUEST_INDEX_BUILDER *builder, const char *filename) {
+	if (!builder || !filename)
+		return ERROR_INVALID_PARAMS;
+
+	int returncode;
+	FILE *fp = NULL;
+	QUEST_INDEX_QUEST *quests = NULL;
+	QUEST_INDEX_TERM *terms = NULL;
+	uint32_t *postings = NULL;
+	char *strings = NULL;
+
+	sort_strings = builder->strings;
+	qsort(builder->postings, builder->num_postings, sizeof(QUEST_INDEX_BUILDER_POSTING), compare_postings);
+
+	// the output strings area only contains quest paths/names and one copy of each distinct term. it can't be any
+	// larger than the builder's string pool which also has a copy of every term occurrence
+	quests = malloc(builder->num_quests * sizeof(QUEST_INDEX_QUEST) + 1);
+	terms = malloc(builder->num_postings * sizeof(QUEST_INDEX_TERM) + 1);
+	postings = malloc(builder->num_postings * sizeof(uint32_t) + 1);
+	strings = malloc(builder->strings_size + 1);
+	if (!quests || !terms || !postings || !strings) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	uint32_t strings_size = 0;
+	for (uint32_t i = 0; i < builder->num_quests; ++i) {
+		const char *path = builder->strings + builder->quests[i].path_offset;
+		const char *name = builder->strings + builder->quests[i].name_offset;
+
+		quests[i] = builder->quests[i];
+		quests[i].path_offset = strings_size;
+		memcpy(strings + strings_size, path, strlen(path) + 1);
+		strings_size += strlen(path) + 1;
+		quests[i].name_offset = strings_size;
+		memcpy(strings + strings_size, name, strlen(name) + 1);
+		strings_size += strlen(name) + 1;
+	}
+
+	uint32_t num_terms = 0;
+	uint32_t num_postings = 0;
+	for (uint32_t i = 0; i < builder->num_postings; ++i) {
+		const QUEST_INDEX_BUILDER_POSTING *posting = &builder->postings[i];
+		const char *term = builder->strings + posting->term_offset;
+
+		QUEST_INDEX_TERM *current = num_terms ? &terms[num_terms - 1] : NULL;
+		if (!current || compare_terms(strings + current->string_offset, current->string_length, term, posting->term_length)) {
+			current = &terms[num_terms++];
+			current->string_offset = strings_size;
+			current->string_length = posting->term_length;
+			current->postings_index = num_postings;
+			current->postings_count = 0;
+			memcpy(strings + strings_size, term, posting->term_length);
+			strings_size += posting->term_length;
+		} else if (postings[num_postings - 1] == posting->quest_index) {
+			// same term appearing multiple times for the same quest
+			continue;
+		}
+
+		postings[num_postings++] = posting->quest_index;
+		++current->postings_count;
+	}
+
+	QUEST_INDEX_HEADER header;
+	memset(&header, 0, sizeof(QUEST_INDEX_HEADER));
+	memcpy(header.magic, QUEST_INDEX_MAGIC, sizeof(header.magic));
+	header.version = QUEST_INDEX_VERSION;
+	header.num_quests = builder->num_quests;
+	header.num_terms = num_terms;
+	header.num_postings = num_postings;
+	header.quests_offset = sizeof(QUEST_INDEX_HEADER);
+	header.terms_offset = header.quests_offset + (builder->num_quests * sizeof(QUEST_INDEX_QUEST));
+	header.postings_offset = header.terms_offset + (num_terms * sizeof(QUEST_INDEX_TERM));
+	header.strings_offset = header.postings_offset + (num_postings * sizeof(uint32_t));
+	header.strings_size = strings_size;
+
+	fp = fopen(filename, "wb");
+	if (!fp) {
+		returncode = ERROR_CREATING_FILE;
+		goto error;
+	}
+
+	if (fwrite(&header, sizeof(QUEST_INDEX_HEADER), 1, fp) != 1 ||
+	    fwrite(quests, sizeof(QUEST_INDEX_QUEST), builder->num_quests, fp) != builder->num_quests ||
+	    fwrite(terms, sizeof(QUEST_INDEX_TERM), num_terms, fp) != num_terms ||
+	    fwrite(postings, sizeof(uint32_t), num_postings, fp) != num_postings ||
+	    fwrite(strings, 1, strings_size, fp) != strings_size) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	returncode = SUCCESS;
+error:
+	if (fp)
+		fclose(fp);
+	free(quests);
+	free(terms);
+	free(postings);
+	free(strings);
+	return returncode;
+}
+
+void quest_index_builder_free(QUEST_INDEX_BUILDER *builder) {
+	if (!builder)
+		return;
+
+	free(builder->quests);
+	free(builder->postings);
+	free(builder->strings);
+	memset(builder, 0, sizeof(QUEST_INDEX_BUILDER));
+}
+
+/** index searching **/
+
+int quest_index_open(const char *filename, QUEST_INDEX *out_index) {
+	if (!filename || !out_index)
+		return ERROR_INVALID_PARAMS;
+
+	memset(out_index, 0, sizeof(QUEST_INDEX));
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return ERROR_FILE_NOT_FOUND;
+
+	struct stat st;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(QUEST_INDEX_HEADER)) {
+		close(fd);
+		return ERROR_BAD_DATA;
+	}
+
+	size_t size = st.st_size;
+	uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return ERROR_IO;
+
+	const QUEST_INDEX_HEADER *header = (const QUEST_INDEX_HEADER*)data;
+	uint64_t expected_size = (uint64_t)header->strings_offset + header->strings_size;
+	if (memcmp(header->magic, QUEST_INDEX_MAGIC, sizeof(header->magic)) ||
+	    header->version != QUEST_INDEX_VERSION ||
+	    expected_size != (uint64_t)size ||
+	    header->quests_offset < sizeof(QUEST_INDEX_HEADER) ||
+	    header->quests_offset + ((uint64_t)header->num_quests * sizeof(QUEST_INDEX_QUEST)) > header->terms_offset ||
+	    header->terms_offset + ((uint64_t)header->num_terms * sizeof(QUEST_INDEX_TERM)) > header->postings_offset ||
+	    header->postings_offset + ((uint64_t)header->num_postings * sizeof(uint32_t)) > header->strings_offset)
+		goto bad_data;
+
+	const QUEST_INDEX_QUEST *quests = (const QUEST_INDEX_QUEST*)(data + header->quests_offset);
+	const QUEST_INDEX_TERM *terms = (const QUEST_INDEX_TERM*)(data + header->terms_offset);
+	const uint32_t *postings = (const uint32_t*)(data + header->postings_offset);
+	const char *strings = (const char*)(data + header->strings_offset);
+
+	// everything read out of the index later on is checked once here, so searching doesn't need to
+	for (uint32_t i = 0; i < header->num_quests; ++i) {
+		if (quests[i].path_offset >= header->strings_size ||
+		    !memchr(strings + quests[i].path_offset, 0, header->strings_size - quests[i].path_offset) ||
+		    quests[i].name_offset >= header->strings_size ||
+		    !memchr(strings + quests[i].name_offset, 0, header->strings_size - quests[i].name_offset))
+			goto bad_data;
+	}
+
+	for (uint32_t i = 0; i < header->num_terms; ++i) {
+		if (terms[i].string_offset > header->strings_size ||
+		    terms[i].string_length > (header->strings_size - terms[i].string_offset) ||
+		    terms[i].postings_index > header->num_postings ||
+		    terms[i].postings_count > (header->num_postings - terms[i].postings_index))
+			goto bad_data;
+	}
+
+	for (uint32_t i = 0; i < header->num_postings; ++i) {
+		if (postings[i] >= header->num_quests)
+			goto bad_data;
+	}
+
+	out_index->data = data;
+	out_index->size = size;
+	out_index->header = header;
+	out_index->quests = quests;
+	out_index->terms = terms;
+	out_index->postings = postings;
+	out_index->strings = strings;
+
+	return SUCCESS;
+
+bad_data:
+	munmap(data, size);
+	return ERROR_BAD_DATA;
+}
+
+void quest_index_close(QUEST_INDEX *index) {
+	if (index && index->data)
+		munmap(index->data, index->size);
+	if (index)
+		memset(index, 0, sizeof(QUEST_INDEX));
+}
+
+static const QUEST_INDEX_TERM* find_term(const QUEST_INDEX *index, const char *term, uint32_t length) {
+	uint32_t low = 0;
+	uint32_t high = index->header->num_terms;
+
+	while (low < high) {
+		uint32_t mid = low + ((high - low) / 2);
+		const QUEST_INDEX_TERM *t = &index->terms[mid];
+		int result = compare_terms(index->strings + t->string_offset, t->string_length, term, length);
+		if (result == 0)
+			return t;
+		else if (result < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return NULL;
+}
+
+static bool postings_contain(const uint32_t *postings, uint32_t count, uint32_t quest_index) {
+	uint32_t low = 0;
+	uint32_t high = count;
+
+	while (low < high) {
+		uint32_t mid = low + ((high - low) / 2);
+		if (postings[mid] == quest_index)
+			return true;
+		else if (postings[mid] < quest_index)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return false;
+}
+
+typedef struct {
+	const QUEST_INDEX *index;
+	const QUEST_INDEX_TERM *terms[MAX_QUERY_TOKENS];
+	int num_terms;
+	bool missing_term;
+} QUERY_CONTEXT;
+
+static void add_query_token(const char *token, size_t length, void *context) {
+	QUERY_CONTEXT *query = (QUERY_CONTEXT*)context;
+	if (query->missing_term || query->num_terms >= MAX_QUERY_TOKENS)
+		return;
+
+	const QUEST_INDEX_TERM *term = find_term(query->index, token, length);
+	if (!term) {
+		query->missing_term = true;
+		return;
+	}
+
+	// keep the terms ordered by posting list length, so intersecting starts from the shortest list
+	int pos = query->num_terms++;
+	while (pos > 0 && query->terms[pos - 1]->postings_count > term->postings_count) {
+		query->terms[pos] = query->terms[pos - 1];
+		--pos;
+	}
+	query->terms[pos] = term;
+}
+
+/*
+ * Finds all quests containing every term in the query (which is tokenized the same way quest text is). Up to
+ * max_results matching quest indices are written to out_results in ascending order. out_count is set to the total
+ * number of matches, which may be larger than max_results.
+ */
+int quest_index_search(const QUEST_INDEX *index, const char *utf8_query, uint32_t *out_results, uint32_t max_results, uint32_t *out_count) {
+	if (!index || !index->data || !utf8_query || !out_count || (max_results && !out_results))
+		return ERROR_INVALID_PARAMS;
+
+	QUERY_CONTEXT query;
+	memset(&query, 0, sizeof(QUERY_CONTEXT));
+	query.index = index;
+	quest_index_tokenize(utf8_query, add_query_token, &query);
+
+	*out_count = 0;
+	if (query.missing_term)
+		return SUCCESS;
+	if (query.num_terms == 0)
+		return ERROR_INVALID_PARAMS;
+
+	const QUEST_INDEX_TERM *shortest = query.terms[0];
+	const uint32_t *candidates = index->postings + shortest->postings_index;
+	for (uint32_t i = 0; i < shortest->postings_count; ++i) {
+		bool match = true;
+		for (int t = 1; t < query.num_terms && match; ++t) {
+			const QUEST_INDEX_TERM *term = query.terms[t];
+			match = postings_contain(index->postings + term->postings_index, term->postings_count, candidates[i]);
+		}
+
+		if (match) {
+			if (*out_count < max_results)
+				out_results[*out_count] = candidates[i];
+			++(*out_count);
+		}
+	}
+
+	return SUCCESS;
+}
+
+const char* quest_index_get_path(const QUEST_INDEX *index, uint32_t quest_index) {
+	if (!index || quest_index >= index->header->num_quests)
+		return NULL;
+	return index->strings + index->quests[quest_index].path_offset;
+}
+
+const char* quest_index_get_name(const QUEST_INDEX *index, uint32_t quest_index) {
+	if (!index || quest_index >= index->header->num_quests)
+		return NULL;
+	return index->strings + index->quests[quest_index].name_offset;
+}
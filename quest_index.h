@@ -0,0 +1,103 @@
+#ifndef QUEST_INDEX_H_INCLUDED
+#define QUEST_INDEX_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "quests.h"
+
+#define QUEST_INDEX_MAGIC              "QIDX"
+#define QUEST_INDEX_VERSION            1
+
+// longest token that will be indexed. longer words are truncated to this length (in bytes)
+#define QUEST_INDEX_MAX_TOKEN_LENGTH   32
+
+/*
+ * On-disk inverted index file layout. Everything is little-endian and referenced using offsets relative to the start
+ * of the file, so the whole file can simply be mmap'd and used as-is.
+ *
+ * QUEST_INDEX_HEADER
+ * QUEST_INDEX_QUEST[num_quests]
+ * QUEST_INDEX_TERM[num_terms]          (sorted by term string, compared bytewise, to allow binary searching)
+ * uint32_t postings[]                  (quest indices. each term's list is sorted in ascending order)
+ * char strings[]                       (term strings, which are NOT null terminated, and quest paths/names which are)
+ */
+
+typedef struct _PACKED_ {
+	char magic[4];
+	uint32_t version;
+	uint32_t num_quests;
+	uint32_t num_terms;
+	uint32_t num_postings;
+	uint32_t quests_offset;
+	uint32_t terms_offset;
+	uint32_t postings_offset;
+	uint32_t strings_offset;
+	uint32_t strings_size;
+} QUEST_INDEX_HEADER;
+
+typedef struct _PACKED_ {
+	uint32_t path_offset;              // relative to the start of the strings area
+	uint32_t name_offset;              // relative to the start of the strings area. UTF-8
+	uint16_t quest_number_word;
+	uint8_t episode;
+	uint8_t unused;
+} QUEST_INDEX_QUEST;
+
+typedef struct _PACKED_ {
+	uint32_t string_offset;            // relative to the start of the strings area
+	uint32_t string_length;
+	uint32_t postings_index;           // index of this term's first entry in the postings area
+	uint32_t postings_count;
+} QUEST_INDEX_TERM;
+
+// an opened (mmap'd) index file
+typedef struct {
+	uint8_t *data;
+	size_t size;
+	const QUEST_INDEX_HEADER *header;
+	const QUEST_INDEX_QUEST *quests;
+	const QUEST_INDEX_TERM *terms;
+	const uint32_t *postings;
+	const char *strings;
+} QUEST_INDEX;
+
+typedef struct {
+	uint32_t term_offset;
+	uint32_t term_length;
+	uint32_t quest_index;
+} QUEST_INDEX_BUILDER_POSTING;
+
+typedef struct {
+	QUEST_INDEX_QUEST *quests;
+	uint32_t num_quests;
+	uint32_t quests_capacity;
+
+	QUEST_INDEX_BUILDER_POSTING *postings;
+	uint32_t num_postings;
+	uint32_t postings_capacity;
+
+	// holds quest paths/names, and a copy of every token occurrence referenced by postings
+	char *strings;
+	uint32_t strings_size;
+	uint32_t strings_capacity;
+} QUEST_INDEX_BUILDER;
+
+typedef void (*QUEST_INDEX_TOKEN_CALLBACK)(const char *token, size_t length, void *context);
+
+void quest_index_tokenize(const char *utf8_text, QUEST_INDEX_TOKEN_CALLBACK callback, void *context);
+
+void quest_index_builder_init(QUEST_INDEX_BUILDER *builder);
+int quest_index_builder_add(QUEST_INDEX_BUILDER *builder, const char *path, const QUEST_BIN_HEADER *bin_header);
+int quest_index_builder_write(QUEST_INDEX_BUILDER *builder, const char *filename);
+void quest_index_builder_free(QUEST_INDEX_BUILDER *builder);
+
+int quest_index_open(const char *filename, QUEST_INDEX *out_index);
+void quest_index_close(QUEST_INDEX *index);
+int quest_index_search(const QUEST_INDEX *index, const char *utf8_query, uint32_t *out_results, uint32_t max_results, uint32_t *out_count);
+const char* quest_index_get_path(const QUEST_INDEX *index, uint32_t quest_index);
+const char* quest_index_get_name(const QUEST_INDEX *index, uint32_t quest_index);
+
+#endif
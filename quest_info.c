@@ -17,27 +17,11 @@
 #include <string.h>
 #include <malloc.h>
 
-#include <sylverant/encryption.h>
-#include "fuzziqer_prs.h"
-
 #include "retvals.h"
 #include "utils.h"
+#include "stats.h"
 #include "quests.h"
-
-typedef struct _PACKED_ {
-	uint8_t pkt_id;
-	uint8_t pkt_flags;
-	uint16_t pkt_size;
-} PACKET_HEADER;
-
-#define PACKET_TYPE_ERROR  0
-#define PACKET_TYPE_HEADER 1
-#define PACKET_TYPE_DATA   2
-#define PACKET_TYPE_EOF    4   // not really a packet type, lol
-
-#define QST_TYPE_NONE     0
-#define QST_TYPE_ONLINE   1
-#define QST_TYPE_DOWNLOAD 2
+#include "decode_cache.h"
 
 const char* get_area_string(int area, int episode) {
 	if (episode == 0) {
@@ -97,7 +81,7 @@ void display_info(uint8_t *bin_data, size_t bin_length, uint8_t *dat_data, size_
 	size_t decompressed_bin_length, decompressed_dat_length;
 
 	printf("Decompressing .bin data ...\n");
-	result = fuzziqer_prs_decompress_buf(bin_data, &decompressed_bin_data, bin_length);
+	result = decode_cache_decompress_buf(bin_data, &decompressed_bin_data, bin_length);
 	if (result < 0) {
 		printf("Error code %d decompressing .bin data.\n", result);
 		goto error;
@@ -105,7 +89,7 @@ void display_info(uint8_t *bin_data, size_t bin_length, uint8_t *dat_data, size_
 	decompressed_bin_length = result;
 
 	printf("Decompressing .dat data ...\n");
-	result = fuzziqer_prs_decompress_buf(dat_data, &decompressed_dat_data, dat_length);
+	result = decode_cache_decompress_buf(dat_data, &decompressed_dat_data, dat_length);
 	if (result < 0) {
 		printf("Error code %d decompressing .dat data.\n", result);
 		goto error;
@@ -115,7 +99,11 @@ void display_info(uint8_t *bin_data, size_t bin_length, uint8_t *dat_data, size_
 
 	printf("Validating .bin data ...\n");
 	QUEST_BIN_HEADER *bin_header = (QUEST_BIN_HEADER*)decompressed_bin_data;
-	validation_result = validate_quest_bin(bin_header, decompressed_bin_length, true);
+	// a previously cached failed validation is re-run anyway, so the same issues will still be displayed
+	if (!decode_cache_get_validation(bin_data, bin_length, &validation_result) || validation_result) {
+		validation_result = validate_quest_bin(bin_header, decompressed_bin_length, true);
+		decode_cache_set_validation(bin_data, bin_length, validation_result);
+	}
 	validation_result = handle_quest_bin_validation_issues(validation_result, bin_header, &decompressed_bin_data,
 	                                                       &decompressed_bin_length);
 	if (validation_result) {
@@ -125,13 +113,19 @@ void display_info(uint8_t *bin_data, size_t bin_length, uint8_t *dat_data, size_
 
 
 	printf("Validating .dat data ...\n");
-	validation_result = validate_quest_dat(decompressed_dat_data, decompressed_dat_length, true);
+	if (!decode_cache_get_validation(dat_data, dat_length, &validation_result) || validation_result) {
+		validation_result = validate_quest_dat(decompressed_dat_data, decompressed_dat_length, true);
+		decode_cache_set_validation(dat_data, dat_length, validation_result);
+	}
 	validation_result = handle_quest_dat_validation_issues(validation_result, &decompressed_dat_data, &decompressed_dat_length);
 	if (validation_result) {
 		printf("Aborting due to invalid quest .dat data.\n");
 		goto error;
 	}
 
+	QUEST_BIN_HEADER_TEXT bin_text;
+	get_quest_bin_header_text(bin_header, &bin_text);
+
 	printf("\n\n");
 
 	printf("QUEST FILE FORMAT: ");
@@ -146,15 +140,15 @@ void display_info(uint8_t *bin_data, size_t bin_length, uint8_t *dat_data, size_
 
 	printf("QUEST .BIN FILE\n");
 	printf("======================================================================\n");
-	printf("name:                             %s\n", bin_header->name);
+	printf("name:                             %s\n", bin_text.name);
 	printf("download flag:                    %d\n", bin_header->download);
 	printf("quest_number:                     %d (8-bit)     %d, 0x%04x (16-bit)\n", bin_header->quest_number_byte, bin_header->quest_number_word, bin_header->quest_number_word);
 	printf("episode:                          %d (0x%02x)\n", bin_header->episode + 1, bin_header->episode);
 	printf("xffffffff:                        0x%08x\n", bin_header->xffffffff);
 	printf("unknown:                          0x%02x\n", bin_header->unknown);
 	printf("\n");
-	printf("short_description:\n%s\n\n", bin_header->short_description);
-	printf("long_description:\n%s\n", bin_header->long_description);
+	printf("short_description:\n%s\n\n", bin_text.short_description);
+	printf("long_description:\n%s\n", bin_text.long_description);
 	printf("object_code_offset:               %d\n", bin_header->object_code_offset);
 	printf("function_offset_table_offset:     %d\n", bin_header->function_offset_table_offset);
 	printf("object_code_size:                 %d\n", (bin_header->function_offset_table_offset - bin_header->object_code_offset));
@@ -231,185 +225,14 @@ error:
 	free(decompressed_dat_data);
 }
 
-int read_next_qst_packet(FILE *fp, QST_HEADER *out_header_packet, QST_DATA_CHUNK *out_data_packet) {
-	size_t bytes_read;
-	PACKET_HEADER packet_header;
-
-	bytes_read = fread(&packet_header, 1, sizeof(PACKET_HEADER), fp);
-	if (bytes_read == 0 && feof(fp))
-		return PACKET_TYPE_EOF;
-	if (bytes_read != sizeof(PACKET_HEADER))
-		return PACKET_TYPE_ERROR;
-
-	if (packet_header.pkt_size == sizeof(QST_HEADER) &&
-	    (packet_header.pkt_id == PACKET_ID_QUEST_INFO_ONLINE ||
-	     packet_header.pkt_id == PACKET_ID_QUEST_INFO_DOWNLOAD)) {
-		memcpy(out_header_packet, &packet_header, sizeof(PACKET_HEADER));
-		size_t remaining_bytes = sizeof(QST_HEADER) - sizeof(PACKET_HEADER);
-		bytes_read = fread((uint8_t*)out_header_packet + sizeof(PACKET_HEADER), 1, remaining_bytes, fp);
-		if (bytes_read != remaining_bytes)
-			return PACKET_TYPE_ERROR;
-		else
-			return PACKET_TYPE_HEADER;
-
-	} else if (packet_header.pkt_size == sizeof(QST_DATA_CHUNK) &&
-	           (packet_header.pkt_id == PACKET_ID_QUEST_CHUNK_ONLINE ||
-	            packet_header.pkt_id == PACKET_ID_QUEST_CHUNK_DOWNLOAD)) {
-		memcpy(out_data_packet, &packet_header, sizeof(PACKET_HEADER));
-		size_t remaining_bytes = sizeof(QST_DATA_CHUNK) - sizeof(PACKET_HEADER);
-		bytes_read = fread((uint8_t*)out_data_packet + sizeof(PACKET_HEADER), 1, remaining_bytes, fp);
-		if (bytes_read != remaining_bytes)
-			return PACKET_TYPE_ERROR;
-		else
-			return PACKET_TYPE_DATA;
-
-	} else
-		return PACKET_TYPE_ERROR;
-}
-
-int load_quest_from_qst(const char *filename, uint8_t **out_bin_data, size_t *out_bin_length, uint8_t **out_dat_data, size_t *out_dat_length, int *out_qst_type) {
-	int returncode;
-	FILE *fp = NULL;
-	uint8_t *bin_data = NULL;
-	uint8_t *dat_data = NULL;
-	int qst_type;
-
-	fp = fopen(filename, "rb");
-	if (!fp) {
-		returncode = ERROR_FILE_NOT_FOUND;
-		goto error;
-	}
-
-	char bin_filename[QUEST_FILENAME_MAX_LENGTH] = "";
-	char dat_filename[QUEST_FILENAME_MAX_LENGTH] = "";
-	size_t bin_data_length, dat_data_length;
-	size_t bin_data_pos, dat_data_pos;
-
-	while (!feof(fp)) {
-		QST_HEADER header;
-		QST_DATA_CHUNK data;
-		int type = read_next_qst_packet(fp, &header, &data);
-
-		if (type == PACKET_TYPE_EOF && bin_data && dat_data)
-			break;
-
-		if (type == PACKET_TYPE_ERROR) {
-			returncode = ERROR_BAD_DATA;
-			goto error;
-
-		} else if (type == PACKET_TYPE_HEADER) {
-			//CRYPT_PrintData(&header, sizeof(QST_HEADER));
-			if (string_ends_with(header.filename, ".bin")) {
-				strncpy(bin_filename, header.filename, QUEST_FILENAME_MAX_LENGTH);
-				bin_data_length = header.size;
-				bin_data_pos = 0;
-				bin_data = malloc(bin_data_length);
-			} else if (string_ends_with(header.filename, ".dat")) {
-				strncpy(dat_filename, header.filename, QUEST_FILENAME_MAX_LENGTH);
-				dat_data_length = header.size;
-				dat_data_pos = 0;
-				dat_data = malloc(dat_data_length);
-			} else {
-				returncode = ERROR_BAD_DATA;
-				goto error;
-			}
-
-			if (header.pkt_id == PACKET_ID_QUEST_INFO_ONLINE)
-				qst_type = QST_TYPE_ONLINE;
-			else
-				qst_type = QST_TYPE_DOWNLOAD;
-
-		} else if (type == PACKET_TYPE_DATA) {
-			//CRYPT_PrintData(&data, sizeof(QST_DATA_CHUNK));
-			if (strncmp(data.filename, bin_filename, QUEST_FILENAME_MAX_LENGTH) == 0) {
-				memcpy(bin_data + bin_data_pos, data.data, data.size);
-				bin_data_pos += data.size;
-
-			} else if (strncmp(data.filename, dat_filename, QUEST_FILENAME_MAX_LENGTH) == 0) {
-				memcpy(dat_data + dat_data_pos, data.data, data.size);
-				dat_data_pos += data.size;
-
-			} else {
-				returncode = ERROR_BAD_DATA;
-				goto error;
-			}
-		}
-	}
-
-	fclose(fp);
-
-	*out_bin_length = bin_data_length;
-	*out_dat_length = dat_data_length;
-	*out_bin_data = bin_data;
-	*out_dat_data = dat_data;
-	*out_qst_type = qst_type;
-
-	return SUCCESS;
-
-error:
-	fclose(fp);
-	free(bin_data);
-	free(dat_data);
-	return returncode;
-}
-
-int decrypt_qst_bindat(uint8_t *bin_data, size_t *bin_length, uint8_t *dat_data, size_t *dat_length) {
-	DOWNLOAD_QUEST_CHUNKS_HEADER *bin_dl_header = (DOWNLOAD_QUEST_CHUNKS_HEADER*)bin_data;
-	DOWNLOAD_QUEST_CHUNKS_HEADER *dat_dl_header = (DOWNLOAD_QUEST_CHUNKS_HEADER*)dat_data;
-
-	CRYPT_SETUP bin_cs, dat_cs;
-	CRYPT_CreateKeys(&bin_cs, &bin_dl_header->crypt_key, CRYPT_PC);
-	CRYPT_CreateKeys(&dat_cs, &dat_dl_header->crypt_key, CRYPT_PC);
-
-	uint8_t *actual_bin_data = bin_data + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	uint8_t *actual_dat_data = dat_data + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	size_t decrypted_bin_length = *bin_length - sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	size_t decrypted_dat_length = *dat_length - sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
-	CRYPT_CryptData(&bin_cs, bin_data + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER), decrypted_bin_length, 0);
-	CRYPT_CryptData(&dat_cs, dat_data + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER), decrypted_dat_length, 0);
-
-	memmove(bin_data, actual_bin_data, decrypted_bin_length);
-	memmove(dat_data, actual_dat_data, decrypted_dat_length);
-
-	*bin_length = decrypted_bin_length;
-	*dat_length = decrypted_dat_length;
-
-	return SUCCESS;
-}
-
-int load_quest_from_bindat(const char *bin_filename, const char *dat_filename, uint8_t **out_bin_data, size_t *out_bin_length, uint8_t **out_dat_data, size_t *out_dat_length) {
-	int returncode;
-	uint8_t *bin_data = NULL;
-	uint8_t *dat_data = NULL;
-	uint32_t bin_data_length, dat_data_length;
-
-	returncode = read_file(bin_filename, &bin_data, &bin_data_length);
-	if (returncode)
-		goto error;
-
-	returncode = read_file(dat_filename, &dat_data, &dat_data_length);
-	if (returncode)
-		goto error;
-
-	*out_bin_length = bin_data_length;
-	*out_dat_length = dat_data_length;
-	*out_bin_data = bin_data;
-	*out_dat_data = dat_data;
-
-	return SUCCESS;
-
-error:
-	free(bin_data);
-	free(dat_data);
-	return returncode;
-}
-
 int main(int argc, char *argv[]) {
 	int returncode;
 
+	stats_parse_args(&argc, argv);
+
 	if (argc != 2 && argc != 3) {
-		printf("Usage: quest_info quest.bin quest.dat\n");
-		printf("       quest_info quest.qst\n");
+		printf("Usage: quest_info [--stats] quest.bin quest.dat\n");
+		printf("       quest_info [--stats] quest.qst\n");
 		return 1;
 	}
 
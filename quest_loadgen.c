@@ -0,0 +1,464 @@
+/*
+ * PSO EP1&2 (Gamecube) Quest Download Load Generator
+ *
+ * Emulates a large number (thousands, even) of Gamecube clients all downloading quests from a quest_server at the
+ * same time, to see how download throughput and latency hold up as the number of concurrent clients grows.
+ *
+ * Unlike quest_client, which uses a thread and blocking socket calls per connection, every connection here is a
+ * non-blocking socket driven by an epoll event loop. Connections are split evenly between a (small) number of
+ * threads, each with its own event loop. Every connection still does all of the work a real client would: the
+ * "Welcome" packet key setup, decrypting every received packet and reassembling the quest from its 0xA6 / 0xA7
+ * packets.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "session.h"
+#include "batch.h"
+#include "utils.h"
+#include "stats.h"
+
+#define RECV_BUFFER_SIZE               8192
+#define MAX_EVENTS                     256
+
+#define STATE_CONNECTING               0
+#define STATE_WELCOME                  1
+#define STATE_DOWNLOADING              2
+#define STATE_DONE                     3
+#define STATE_FAILED                   4
+
+typedef struct {
+	int fd;
+	int state;
+	int result;
+	int num_downloads;
+	SESSION session;
+	QST_REASSEMBLER reassembler;
+	uint64_t request_start;
+	uint64_t bytes_received;
+	uint64_t *latencies;           // one per download, filled in as each download completes
+
+	uint8_t recv_buffer[RECV_BUFFER_SIZE];
+	size_t recv_size;
+	bool header_decrypted;         // whether the header of the packet at the start of recv_buffer is decrypted yet
+
+	uint8_t send_buffer[sizeof(MENU_SELECT_PACKET)];
+	size_t send_pos;
+	size_t send_size;
+} LOADGEN_CONNECTION;
+
+typedef struct {
+	const struct addrinfo *address;
+	uint32_t quest_number;
+	int downloads_per_connection;
+	int num_connections;
+	int num_workers;
+	LOADGEN_CONNECTION *connections;
+	uint64_t *latencies;
+} LOADGEN;
+
+static void fail_connection(LOADGEN_CONNECTION *connection, int result, int *num_active) {
+	if (connection->state == STATE_DONE || connection->state == STATE_FAILED)
+		return;
+
+	connection->state = STATE_FAILED;
+	connection->result = result;
+	qst_reassembler_free(&connection->reassembler);
+	close(connection->fd);
+	connection->fd = -1;
+	--(*num_active);
+}
+
+static void finish_connection(LOADGEN_CONNECTION *connection, int *num_active) {
+	connection->state = STATE_DONE;
+	close(connection->fd);
+	connection->fd = -1;
+	--(*num_active);
+}
+
+static int update_events(int epoll_fd, LOADGEN_CONNECTION *connection, uint32_t events) {
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = connection;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) ? ERROR_NETWORK : SUCCESS;
+}
+
+static int flush_send(int epoll_fd, LOADGEN_CONNECTION *connection) {
+	while (connection->send_pos < connection->send_size) {
+		ssize_t sent = send(connection->fd,
+		                    connection->send_buffer + connection->send_pos,
+		                    connection->send_size - connection->send_pos,
+		                    MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return update_events(epoll_fd, connection, EPOLLIN | EPOLLOUT);
+			return ERROR_NETWORK;
+		}
+		connection->send_pos += sent;
+	}
+
+	return update_events(epoll_fd, connection, EPOLLIN);
+}
+
+static int request_quest(const LOADGEN *loadgen, int epoll_fd, LOADGEN_CONNECTION *connection) {
+	MENU_SELECT_PACKET select;
+	memset(&select, 0, sizeof(select));
+	select.header.pkt_id = PACKET_ID_MENU_SELECT;
+	select.header.pkt_size = sizeof(select);
+	select.item_id = loadgen->quest_number;
+
+	qst_reassembler_init(&connection->reassembler);
+
+	int returncode = session_encrypt_packet(&connection->session, &select, sizeof(select), connection->send_buffer);
+	if (returncode)
+		return returncode;
+
+	connection->send_pos = 0;
+	connection->send_size = sizeof(select);
+	connection->request_start = stats_get_time();
+	return flush_send(epoll_fd, connection);
+}
+
+static void consume_recv_buffer(LOADGEN_CONNECTION *connection, size_t size) {
+	connection->recv_size -= size;
+	if (connection->recv_size)
+		memmove(connection->recv_buffer, connection->recv_buffer + size, connection->recv_size);
+}
+
+// handles all of the complete packets currently sitting in the connection's receive buffer
+static int process_received(const LOADGEN *loadgen, int epoll_fd, LOADGEN_CONNECTION *connection, int *num_active) {
+	for (;;) {
+		if (connection->recv_size < sizeof(PACKET_HEADER))
+			return SUCCESS;
+
+		PACKET_HEADER *header = (PACKET_HEADER*)connection->recv_buffer;
+
+		if (connection->state == STATE_WELCOME) {
+			// the "Welcome" packet is never encrypted
+			if (!session_is_welcome_packet(header) || header->pkt_size > RECV_BUFFER_SIZE)
+				return ERROR_BAD_DATA;
+			if (connection->recv_size < header->pkt_size)
+				return SUCCESS;
+
+			session_init_client(connection->fd, (const WELCOME_PACKET*)connection->recv_buffer, &connection->session);
+			consume_recv_buffer(connection, header->pkt_size);
+			connection->state = STATE_DOWNLOADING;
+
+			int returncode = request_quest(loadgen, epoll_fd, connection);
+			if (returncode)
+				return returncode;
+			continue;
+		}
+
+		if (!connection->header_decrypted) {
+			session_decrypt_data(&connection->session, connection->recv_buffer, sizeof(PACKET_HEADER));
+			connection->header_decrypted = true;
+			if (header->pkt_size < sizeof(PACKET_HEADER) || header->pkt_size > RECV_BUFFER_SIZE || (header->pkt_size % 4) != 0)
+				return ERROR_BAD_DATA;
+		}
+
+		size_t size = header->pkt_size;
+		if (connection->recv_size < size)
+			return SUCCESS;
+
+		session_decrypt_data(&connection->session, connection->recv_buffer + sizeof(PACKET_HEADER), size - sizeof(PACKET_HEADER));
+		int returncode = qst_reassembler_add_packet(&connection->reassembler, connection->recv_buffer, size);
+		if (returncode)
+			return returncode;
+		consume_recv_buffer(connection, size);
+		connection->header_decrypted = false;
+
+		if (qst_reassembler_is_complete(&connection->reassembler)) {
+			connection->latencies[connection->num_downloads++] = stats_get_time() - connection->request_start;
+			qst_reassembler_free(&connection->reassembler);
+
+			if (connection->num_downloads == loadgen->downloads_per_connection) {
+				finish_connection(connection, num_active);
+				return SUCCESS;
+			}
+
+			returncode = request_quest(loadgen, epoll_fd, connection);
+			if (returncode)
+				return returncode;
+		}
+	}
+}
+
+static int handle_readable(const LOADGEN *loadgen, int epoll_fd, LOADGEN_CONNECTION *connection, int *num_active) {
+	for (;;) {
+		size_t space = RECV_BUFFER_SIZE - connection->recv_size;
+		ssize_t received = recv(connection->fd, connection->recv_buffer + connection->recv_size, space, 0);
+		if (received < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return SUCCESS;
+			return ERROR_NETWORK;
+		}
+		if (received == 0)
+			return ERROR_NETWORK;    // server closed the connection
+
+		connection->recv_size += received;
+		connection->bytes_received += received;
+
+		int returncode = process_received(loadgen, epoll_fd, connection, num_active);
+		if (returncode || connection->state == STATE_DONE)
+			return returncode;
+	}
+}
+
+static int handle_connected(int epoll_fd, LOADGEN_CONNECTION *connection) {
+	int error = 0;
+	socklen_t length = sizeof(error);
+	if (getsockopt(connection->fd, SOL_SOCKET, SO_ERROR, &error, &length) || error)
+		return ERROR_NETWORK;
+
+	int nodelay = 1;
+	setsockopt(connection->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+	connection->state = STATE_WELCOME;
+	return update_events(epoll_fd, connection, EPOLLIN);
+}
+
+static int start_connection(const LOADGEN *loadgen, int epoll_fd, LOADGEN_CONNECTION *connection) {
+	const struct addrinfo *address = loadgen->address;
+
+	connection->fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK, address->ai_protocol);
+	if (connection->fd < 0)
+		return ERROR_NETWORK;
+
+	if (connect(connection->fd, address->ai_addr, address->ai_addrlen) && errno != EINPROGRESS) {
+		close(connection->fd);
+		connection->fd = -1;
+		return ERROR_NETWORK;
+	}
+
+	connection->state = STATE_CONNECTING;
+
+	struct epoll_event event;
+	event.events = EPOLLOUT;
+	event.data.ptr = connection;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection->fd, &event)) {
+		close(connection->fd);
+		connection->fd = -1;
+		return ERROR_NETWORK;
+	}
+
+	return SUCCESS;
+}
+
+// runs the event loop for every n-th connection, where n is the number of worker threads
+void run_worker(int job_index, int worker_index, void *context) {
+	(void)worker_index;
+	const LOADGEN *loadgen = (const LOADGEN*)context;
+	struct epoll_event events[MAX_EVENTS];
+	int num_active = 0;
+
+	int epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0) {
+		printf("Error creating epoll instance: %s\n", strerror(errno));
+		return;
+	}
+
+	for (int i = job_index; i < loadgen->num_connections; i += loadgen->num_workers) {
+		LOADGEN_CONNECTION *connection = &loadgen->connections[i];
+		connection->latencies = &loadgen->latencies[(size_t)i * loadgen->downloads_per_connection];
+		qst_reassembler_init(&connection->reassembler);
+
+		int returncode = start_connection(loadgen, epoll_fd, connection);
+		if (returncode) {
+			connection->state = STATE_FAILED;
+			connection->result = returncode;
+		} else {
+			++num_active;
+		}
+	}
+
+	while (num_active > 0) {
+		int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+		if (num_events < 0) {
+			if (errno == EINTR)
+				continue;
+			printf("Error waiting for events: %s\n", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < num_events; ++i) {
+			LOADGEN_CONNECTION *connection = (LOADGEN_CONNECTION*)events[i].data.ptr;
+			int returncode = SUCCESS;
+
+			// a connection can be finished off by an earlier event in this same batch
+			if (connection->state == STATE_DONE || connection->state == STATE_FAILED)
+				continue;
+
+			if (connection->state == STATE_CONNECTING) {
+				returncode = handle_connected(epoll_fd, connection);
+			} else {
+				if (events[i].events & EPOLLOUT)
+					returncode = flush_send(epoll_fd, connection);
+				if (!returncode && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+					returncode = handle_readable(loadgen, epoll_fd, connection, &num_active);
+			}
+
+			if (returncode)
+				fail_connection(connection, returncode, &num_active);
+		}
+	}
+
+	// anything left over if the event loop bailed out early
+	for (int i = job_index; i < loadgen->num_connections; i += loadgen->num_workers)
+		fail_connection(&loadgen->connections[i], ERROR_NETWORK, &num_active);
+
+	close(epoll_fd);
+}
+
+static int compare_latencies(const void *a, const void *b) {
+	uint64_t latency_a = *(const uint64_t*)a;
+	uint64_t latency_b = *(const uint64_t*)b;
+	return (latency_a < latency_b) ? -1 : ((latency_a > latency_b) ? 1 : 0);
+}
+
+// nearest-rank percentile of an already sorted list
+static uint64_t get_percentile(const uint64_t *sorted, size_t count, double percentile) {
+	size_t rank = (size_t)((percentile / 100.0) * count + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	if (rank > count)
+		rank = count;
+	return sorted[rank - 1];
+}
+
+int main(int argc, char *argv[]) {
+	int returncode;
+	LOADGEN loadgen;
+	struct addrinfo hints, *addresses = NULL;
+	uint64_t *completed = NULL;
+
+	memset(&loadgen, 0, sizeof(loadgen));
+	loadgen.num_connections = 100;
+	loadgen.downloads_per_connection = 10;
+	loadgen.num_workers = 1;
+
+	stats_parse_args(&argc, argv);
+
+	int argi = 1;
+	while (argi < argc && argv[argi][0] == '-') {
+		if (!strcmp(argv[argi], "-c") && (argi + 1) < argc) {
+			loadgen.num_connections = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-n") && (argi + 1) < argc) {
+			loadgen.downloads_per_connection = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-q") && (argi + 1) < argc) {
+			loadgen.quest_number = (uint32_t)strtoul(argv[argi + 1], NULL, 10);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-j") && (argi + 1) < argc) {
+			loadgen.num_workers = atoi(argv[argi + 1]);
+			argi += 2;
+		} else {
+			break;
+		}
+	}
+
+	if ((argc - argi) != 2 || loadgen.num_connections < 1 || loadgen.downloads_per_connection < 1 || loadgen.num_workers < 1) {
+		printf("Usage: quest_loadgen [--stats] [-c connections] [-n downloads-per-connection] [-q quest-number] [-j num-threads] host port\n");
+		return 1;
+	}
+
+	const char *host = argv[argi];
+	const char *port = argv[argi + 1];
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addresses) || !addresses) {
+		printf("Unable to resolve address: %s port %s\n", host, port);
+		goto error;
+	}
+	loadgen.address = addresses;
+
+	int fd_limit = session_raise_open_file_limit();
+	if (fd_limit > 0 && loadgen.num_connections > (fd_limit - 16))
+		printf("WARNING: Open file limit is %d, which is probably too low for %d connections.\n", fd_limit, loadgen.num_connections);
+
+	if (loadgen.num_workers > loadgen.num_connections)
+		loadgen.num_workers = loadgen.num_connections;
+
+	size_t max_downloads = (size_t)loadgen.num_connections * loadgen.downloads_per_connection;
+	loadgen.connections = calloc(loadgen.num_connections, sizeof(LOADGEN_CONNECTION));
+	loadgen.latencies = calloc(max_downloads, sizeof(uint64_t));
+	completed = malloc(max_downloads * sizeof(uint64_t));
+	if (!loadgen.connections || !loadgen.latencies || !completed) {
+		printf("Not enough memory for %d connections.\n", loadgen.num_connections);
+		goto error;
+	}
+
+	printf("Running %d connection(s) with %d thread(s), each downloading quest %u %d time(s) ...\n",
+	       loadgen.num_connections, loadgen.num_workers, loadgen.quest_number, loadgen.downloads_per_connection);
+
+	uint64_t start = stats_get_time();
+	returncode = batch_run(loadgen.num_workers, loadgen.num_workers, run_worker, &loadgen);
+	uint64_t elapsed = stats_get_time() - start;
+	if (returncode) {
+		printf("Error code %d (%s) running connections.\n", returncode, get_error_message(returncode));
+		goto error;
+	}
+
+	int num_failed = 0, first_error = SUCCESS;
+	size_t num_completed = 0;
+	uint64_t bytes_received = 0;
+	for (int i = 0; i < loadgen.num_connections; ++i) {
+		LOADGEN_CONNECTION *connection = &loadgen.connections[i];
+		if (connection->state != STATE_DONE) {
+			if (!num_failed)
+				first_error = connection->result;
+			++num_failed;
+		}
+		bytes_received += connection->bytes_received;
+		for (int j = 0; j < connection->num_downloads; ++j)
+			completed[num_completed++] = connection->latencies[j];
+	}
+
+	double seconds = elapsed / 1000000000.0;
+	printf("%d connection(s), %d failed. %zu download(s) in %.3f seconds.\n", loadgen.num_connections, num_failed, num_completed, seconds);
+	if (num_failed)
+		printf("First failure: error code %d (%s)\n", first_error, get_error_message(first_error));
+	printf("Throughput: %.1f downloads/s, %.2f MB/s\n", num_completed / seconds, (bytes_received / (1024.0 * 1024.0)) / seconds);
+
+	if (num_completed) {
+		qsort(completed, num_completed, sizeof(uint64_t), compare_latencies);
+		printf("Completion latency: p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n",
+		       get_percentile(completed, num_completed, 50.0) / 1000000.0,
+		       get_percentile(completed, num_completed, 99.0) / 1000000.0,
+		       get_percentile(completed, num_completed, 99.9) / 1000000.0,
+		       completed[num_completed - 1] / 1000000.0);
+	}
+
+	returncode = num_failed ? 1 : 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	if (addresses)
+		freeaddrinfo(addresses);
+	free(loadgen.connections);
+	free(loadgen.latencies);
+	free(completed);
+	return returncode;
+}
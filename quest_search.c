@@ -0,0 +1,192 @@
+/*
+ * PSO EP1&2 (Gamecube) Quest Search Tool
+ *
+ * Builds a full-text search index over the names and descriptions of any number of quests, and searches it.
+ *
+ * Quests can be given as any of the following types of files (same as quest_info):
+ *
+ * - Compressed .bin + .dat file combo
+ * - Online-play, unencrypted (0x44 / 0x13) .qst file
+ * - Download/Offline-play, encrypted (0xA6 / 0xA7) .qst file
+ *
+ * The index is a single file that is mmap'd when searching, so no loading or parsing is required before a search
+ * can be performed.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+
+#include "retvals.h"
+#include "utils.h"
+#include "stats.h"
+#include "quests.h"
+#include "decode_cache.h"
+#include "quest_index.h"
+
+#define MAX_DISPLAYED_RESULTS          1000
+
+int load_quest_bin_header(const char *filename, const char *dat_filename, QUEST_BIN_HEADER *out_bin_header) {
+	int returncode;
+	int32_t result;
+	uint8_t *bin_data = NULL;
+	uint8_t *dat_data = NULL;
+	uint8_t *decompressed_bin_data = NULL;
+	size_t bin_data_size, dat_data_size;
+	int qst_type = QST_TYPE_NONE;
+
+	if (dat_filename) {
+		returncode = load_quest_from_bindat(filename, dat_filename, &bin_data, &bin_data_size, &dat_data, &dat_data_size);
+		if (returncode)
+			goto error;
+	} else {
+		returncode = load_quest_from_qst(filename, &bin_data, &bin_data_size, &dat_data, &dat_data_size, &qst_type);
+		if (returncode)
+			goto error;
+		if (qst_type == QST_TYPE_DOWNLOAD) {
+			returncode = decrypt_qst_bindat(bin_data, &bin_data_size, dat_data, &dat_data_size);
+			if (returncode)
+				goto error;
+		}
+	}
+
+	result = decode_cache_decompress_buf(bin_data, &decompressed_bin_data, bin_data_size);
+	if (result < (int32_t)sizeof(QUEST_BIN_HEADER)) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+
+	memcpy(out_bin_header, decompressed_bin_data, sizeof(QUEST_BIN_HEADER));
+	returncode = SUCCESS;
+
+error:
+	free(bin_data);
+	free(dat_data);
+	free(decompressed_bin_data);
+	return returncode;
+}
+
+int build_index(const char *index_filename, int num_files, char *files[]) {
+	int returncode;
+	QUEST_INDEX_BUILDER builder;
+	QUEST_BIN_HEADER bin_header;
+	int num_failed = 0;
+
+	quest_index_builder_init(&builder);
+
+	for (int i = 0; i < num_files; ++i) {
+		const char *filename = files[i];
+		const char *dat_filename = NULL;
+
+		if (string_ends_with(filename, ".bin")) {
+			if ((i + 1) >= num_files || !string_ends_with(files[i + 1], ".dat")) {
+				printf("Skipping %s, as it is not followed by a .dat file\n", filename);
+				++num_failed;
+				continue;
+			}
+			dat_filename = files[++i];
+		}
+
+		returncode = load_quest_bin_header(filename, dat_filename, &bin_header);
+		if (returncode) {
+			printf("Error code %d (%s) loading quest: %s. Skipping it.\n", returncode, get_error_message(returncode), filename);
+			++num_failed;
+			continue;
+		}
+
+		returncode = quest_index_builder_add(&builder, filename, &bin_header);
+		if (returncode) {
+			printf("Error code %d (%s) indexing quest: %s\n", returncode, get_error_message(returncode), filename);
+			goto error;
+		}
+	}
+
+	printf("Writing index of %d quests (%d postings) to %s ...\n", builder.num_quests, builder.num_postings, index_filename);
+	returncode = quest_index_builder_write(&builder, index_filename);
+	if (returncode) {
+		printf("Error code %d (%s) writing index file: %s\n", returncode, get_error_message(returncode), index_filename);
+		goto error;
+	}
+
+	if (num_failed)
+		printf("%d quest(s) could not be indexed.\n", num_failed);
+
+	returncode = 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	quest_index_builder_free(&builder);
+	return returncode;
+}
+
+int search_index(const char *index_filename, int num_terms, char *terms[]) {
+	int returncode;
+	QUEST_INDEX index;
+	uint32_t results[MAX_DISPLAYED_RESULTS];
+	uint32_t count;
+	struct timespec start, end;
+
+	returncode = quest_index_open(index_filename, &index);
+	if (returncode) {
+		printf("Error code %d (%s) opening index file: %s\n", returncode, get_error_message(returncode), index_filename);
+		return 1;
+	}
+
+	// all of the search terms are treated as one query, so it doesn't matter if they were quoted or not
+	size_t query_length = 1;
+	for (int i = 0; i < num_terms; ++i)
+		query_length += strlen(terms[i]) + 1;
+	char *query = malloc(query_length);
+	query[0] = '\0';
+	for (int i = 0; i < num_terms; ++i) {
+		strcat(query, terms[i]);
+		strcat(query, " ");
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	returncode = quest_index_search(&index, query, results, MAX_DISPLAYED_RESULTS, &count);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (returncode) {
+		printf("Error code %d (%s) searching for: %s\n", returncode, get_error_message(returncode), query);
+		goto error;
+	}
+
+	for (uint32_t i = 0; i < count && i < MAX_DISPLAYED_RESULTS; ++i) {
+		const QUEST_INDEX_QUEST *quest = &index.quests[results[i]];
+		printf("id=%d (0x%04x), episode=%d, name=\"%s\", file=%s\n",
+		       quest->quest_number_word & 0xff,
+		       quest->quest_number_word,
+		       quest->episode + 1,
+		       quest_index_get_name(&index, results[i]),
+		       quest_index_get_path(&index, results[i]));
+	}
+
+	double elapsed_us = ((end.tv_sec - start.tv_sec) * 1000000.0) + ((end.tv_nsec - start.tv_nsec) / 1000.0);
+	printf("%d matching quest(s) out of %d (search took %.1f us)\n", count, index.header->num_quests, elapsed_us);
+
+	returncode = 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	free(query);
+	quest_index_close(&index);
+	return returncode;
+}
+
+int main(int argc, char *argv[]) {
+	stats_parse_args(&argc, argv);
+
+	if (argc >= 4 && strcmp(argv[1], "index") == 0) {
+		return build_index(argv[2], argc - 3, &argv[3]);
+	} else if (argc >= 4 && strcmp(argv[1], "search") == 0) {
+		return search_index(argv[2], argc - 3, &argv[3]);
+	} else {
+		printf("Usage: quest_search [--stats] index output.idx quest.bin quest.dat [quest.qst ...]\n");
+		printf("       quest_search [--stats] search index.idx search terms ...\n");
+		return 1;
+	}
+}
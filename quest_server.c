@@ -0,0 +1,399 @@
+/*
+ * PSO EP1&2 (Gamecube) Local Quest Download Server
+ *
+ * A stand-in for a real PSO server, serving download/offline .qst files to any number of concurrent clients. This
+ * only implements the parts of the protocol needed to download a quest (the "Welcome" key exchange, a quest being
+ * picked from a menu, and the 0xA6 / 0xA7 quest packets being sent back). It is intended to be used together with
+ * quest_client / quest_loadgen for measuring quest download throughput and latency locally, not to be used with a real
+ * Gamecube.
+ *
+ * All client connections are handled by a single thread, using the event-driven sender in qst_sender.c, which shares
+ * the available bandwidth fairly between all of the downloads in progress.
+ *
+ * The quests are loaded once into a shared quest catalogue (see quest_catalogue.h). With "-w", that many worker
+ * processes are forked which all map the same catalogue read-only and accept connections on the same listening
+ * socket. A worker that dies is replaced straight away, without anything having to be loaded again.
+ *
+ * Alternatively, with "-d", all of the quests in a directory are served, and the directory is watched for quests
+ * being added, changed or removed while the server is running (see live_catalogue.h).
+ *
+ * Or, with "-m", only the quests currently being downloaded (and the most recently used ones, up to the given memory
+ * budget) are kept in memory (see lazy_catalogue.h).
+ *
+ * With "-D", identical .dat tables in the shared quest catalogue are only stored once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "session.h"
+#include "qst_sender.h"
+#include "quest_catalogue.h"
+#include "live_catalogue.h"
+#include "lazy_catalogue.h"
+#include "utils.h"
+#include "stats.h"
+
+#define DEFAULT_PORT                   "9100"
+
+#define MAX_WORKERS                    256
+
+static QUEST_CATALOGUE catalogue;
+static LIVE_CATALOGUE live_catalogue;
+static LAZY_CATALOGUE lazy_catalogue;
+static volatile sig_atomic_t stopping = 0;
+
+int lookup_quest(uint32_t item_id, const uint8_t **out_qst_data, size_t *out_qst_size, void **out_handle, void *context) {
+	(void)context;
+	if (item_id >= catalogue.header->num_quests) {
+		printf("Client requested quest %u, but there are only %u quest(s). Disconnecting it.\n", item_id, catalogue.header->num_quests);
+		return ERROR_INVALID_PARAMS;
+	}
+
+	const QUEST_CATALOGUE_ENTRY *entry = &catalogue.entries[item_id];
+	*out_qst_data = catalogue.base + entry->qst_offset;
+	*out_qst_size = entry->qst_size;
+	*out_handle = NULL;
+	return SUCCESS;
+}
+
+int lookup_live_quest(uint32_t item_id, const uint8_t **out_qst_data, size_t *out_qst_size, void **out_handle, void *context) {
+	int reader = *(int*)context;
+	LIVE_CATALOGUE_ENTRY *entry;
+
+	if (live_catalogue_acquire(&live_catalogue, reader, item_id, &entry)) {
+		printf("Client requested quest %u, which is not in the quest catalogue. Disconnecting it.\n", item_id);
+		return ERROR_INVALID_PARAMS;
+	}
+
+	*out_qst_data = entry->quest.qst_data;
+	*out_qst_size = entry->quest.qst_size;
+	*out_handle = entry;
+	return SUCCESS;
+}
+
+void release_live_quest(void *handle, void *context) {
+	(void)context;
+	live_catalogue_release((LIVE_CATALOGUE_ENTRY*)handle);
+}
+
+int lookup_lazy_quest(uint32_t item_id, const uint8_t **out_qst_data, size_t *out_qst_size, void **out_handle, void *context) {
+	(void)context;
+	LAZY_CATALOGUE_ENTRY *entry;
+
+	int returncode = lazy_catalogue_acquire(&lazy_catalogue, item_id, &entry);
+	if (returncode) {
+		printf("Client requested quest %u, which could not be loaded. Disconnecting it.\n", item_id);
+		return returncode;
+	}
+
+	*out_qst_data = entry->body.qst_data;
+	*out_qst_size = entry->body.qst_size;
+	*out_handle = entry;
+	return SUCCESS;
+}
+
+void release_lazy_quest(void *handle, void *context) {
+	(void)context;
+	lazy_catalogue_release(&lazy_catalogue, (LAZY_CATALOGUE_ENTRY*)handle);
+}
+
+void* watch_quest_directory(void *context) {
+	(void)context;
+	int returncode = live_catalogue_watch(&live_catalogue, &stopping);
+	if (returncode)
+		printf("Error code %d (%s) watching quest directory. Quests will no longer be reloaded.\n", returncode, get_error_message(returncode));
+	return NULL;
+}
+
+void handle_stop_signal(int signal) {
+	(void)signal;
+	stopping = 1;
+}
+
+// serves quests on the listening socket until stopped. worker is -1 when not running as a worker
+int serve_quests(int listen_fd, int window, int worker, QST_SENDER_LOOKUP_FUNC lookup, QST_SENDER_RELEASE_FUNC release, void *context) {
+	QST_SENDER sender;
+	int returncode;
+
+	returncode = qst_sender_init(&sender, listen_fd, window, lookup, release, context);
+	if (returncode) {
+		printf("Error code %d (%s) setting up sender.\n", returncode, get_error_message(returncode));
+		return returncode;
+	}
+
+	returncode = qst_sender_run(&sender, &stopping);
+	if (returncode) {
+		printf("Error code %d (%s) serving quests.\n", returncode, get_error_message(returncode));
+	} else {
+		if (worker >= 0)
+			printf("Worker %d stopping. ", worker);
+		else
+			printf("\nStopping. ");
+		printf("%llu connection(s), %llu quest(s) sent, %llu bytes sent.\n",
+		       (unsigned long long)sender.num_connections,
+		       (unsigned long long)sender.num_quests_sent,
+		       (unsigned long long)sender.num_bytes_sent);
+	}
+
+	qst_sender_destroy(&sender);
+	return returncode;
+}
+
+// forks a worker process, which inherits the read-only catalogue mapping and the listening socket. returns the
+// worker's pid in the parent process (or -1 if it could not be started), and never returns in the worker process
+pid_t start_worker(int worker, int listen_fd, int window) {
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid != 0)
+		return pid;
+
+	int returncode = serve_quests(listen_fd, window, worker, lookup_quest, NULL, NULL);
+	fflush(stdout);
+	exit(returncode ? 1 : 0);
+}
+
+// starts the worker processes and replaces any that exit before the server is stopped. once stopped, the workers
+// are told to stop too and waited for
+int run_workers(int num_workers, int listen_fd, int window) {
+	pid_t workers[MAX_WORKERS];
+	time_t started[MAX_WORKERS];
+	int returncode = SUCCESS;
+
+	for (int i = 0; i < num_workers; ++i) {
+		workers[i] = start_worker(i, listen_fd, window);
+		started[i] = time(NULL);
+		if (workers[i] < 0) {
+			printf("Error starting worker %d: %s\n", i, strerror(errno));
+			returncode = ERROR_IO;
+			stopping = 1;
+			break;
+		}
+	}
+
+	while (!stopping) {
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (int i = 0; i < num_workers; ++i) {
+			if (workers[i] != pid)
+				continue;
+
+			workers[i] = -1;
+			if (stopping)
+				break;
+
+			if (WIFSIGNALED(status))
+				printf("Worker %d (pid %d) was killed by signal %d. Restarting it.\n", i, (int)pid, WTERMSIG(status));
+			else
+				printf("Worker %d (pid %d) exited with status %d. Restarting it.\n", i, (int)pid, WEXITSTATUS(status));
+
+			// don't spin if a worker keeps dying as soon as it has started
+			if (time(NULL) - started[i] < 1)
+				sleep(1);
+
+			workers[i] = start_worker(i, listen_fd, window);
+			started[i] = time(NULL);
+			if (workers[i] < 0)
+				printf("Error restarting worker %d: %s\n", i, strerror(errno));
+			break;
+		}
+	}
+
+	for (int i = 0; i < num_workers; ++i) {
+		if (workers[i] > 0)
+			kill(workers[i], SIGTERM);
+	}
+	for (int i = 0; i < num_workers; ++i) {
+		if (workers[i] > 0) {
+			while (waitpid(workers[i], NULL, 0) < 0 && errno == EINTR)
+				;
+		}
+	}
+
+	return returncode;
+}
+
+int main(int argc, char *argv[]) {
+	int returncode;
+	int listen_fd = -1;
+	int catalogue_fd = -1;
+	int window = QST_SENDER_DEFAULT_WINDOW;
+	int num_workers = 0;
+	int reader = -1;
+	bool live = false;
+	bool lazy = false;
+	int catalogue_flags = 0;
+	long long budget_kb = -1;
+	pthread_t watcher;
+	bool watcher_started = false;
+	const char *directory = NULL;
+	const char *host = NULL;
+	const char *port = DEFAULT_PORT;
+
+	stats_parse_args(&argc, argv);
+
+	int argi = 1;
+	while (argi < argc && argv[argi][0] == '-') {
+		if (!strcmp(argv[argi], "-p") && (argi + 1) < argc) {
+			port = argv[argi + 1];
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-b") && (argi + 1) < argc) {
+			host = argv[argi + 1];
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-W") && (argi + 1) < argc) {
+			window = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-w") && (argi + 1) < argc) {
+			num_workers = atoi(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-d") && (argi + 1) < argc) {
+			directory = argv[argi + 1];
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-m") && (argi + 1) < argc) {
+			budget_kb = atoll(argv[argi + 1]);
+			argi += 2;
+		} else if (!strcmp(argv[argi], "-D")) {
+			catalogue_flags |= QUEST_CATALOGUE_DEDUP_DAT_TABLES;
+			argi += 1;
+		} else {
+			break;
+		}
+	}
+
+	// reloadable and memory-budgeted catalogues live in the one process. they can't be shared by worker processes
+	bool valid_quests = directory ? (argi == argc && num_workers == 0 && budget_kb < 0) : (argi < argc);
+	if (budget_kb >= 0 && num_workers != 0)
+		valid_quests = false;
+	// only the shared catalogue can store .dat tables de-duplicated
+	if (catalogue_flags && (budget_kb >= 0 || directory))
+		valid_quests = false;
+	if (!valid_quests || window < 1 || window > QST_SENDER_MAX_WINDOW || num_workers < 0 || num_workers > MAX_WORKERS) {
+		printf("Usage: quest_server [--stats] [-b bind-address] [-p port] [-W window-packets] [-w num-workers] [-D] quest1.qst [quest2.qst ...]\n");
+		printf("       quest_server [--stats] [-b bind-address] [-p port] [-W window-packets] -m memory-budget-kb quest1.qst [quest2.qst ...]\n");
+		printf("       quest_server [--stats] [-b bind-address] [-p port] [-W window-packets] -d quest-directory\n");
+		return 1;
+	}
+
+	if (budget_kb >= 0) {
+		returncode = lazy_catalogue_init(&lazy_catalogue, (const char**)&argv[argi], argc - argi, (size_t)budget_kb * 1024);
+		if (returncode) {
+			printf("Error code %d (%s) building quest catalogue.\n", returncode, get_error_message(returncode));
+			goto error;
+		}
+		lazy = true;
+
+		for (int i = 0; i < lazy_catalogue.num_entries; ++i)
+			printf("Quest %d: %s\n", i, lazy_catalogue.entries[i].filename);
+		printf("Keeping up to %lld KB of quests in memory.\n", budget_kb);
+	} else if (directory) {
+		returncode = live_catalogue_init(&live_catalogue, directory);
+		if (returncode) {
+			printf("Error code %d (%s) loading quests from %s\n", returncode, get_error_message(returncode), directory);
+			goto error;
+		}
+		live = true;
+		live_catalogue_print(&live_catalogue);
+		reader = live_catalogue_add_reader(&live_catalogue);
+	} else {
+		returncode = quest_catalogue_build_ex((const char**)&argv[argi], argc - argi, catalogue_flags, &catalogue_fd);
+		if (returncode) {
+			printf("Error code %d (%s) building quest catalogue.\n", returncode, get_error_message(returncode));
+			goto error;
+		}
+
+		returncode = quest_catalogue_map(catalogue_fd, &catalogue);
+		if (returncode) {
+			printf("Error code %d (%s) mapping quest catalogue.\n", returncode, get_error_message(returncode));
+			goto error;
+		}
+
+		for (uint32_t i = 0; i < catalogue.header->num_quests; ++i)
+			printf("Quest %u: %s\n", i, argv[argi + i]);
+		printf("Quest catalogue is %zu bytes.\n", catalogue.size);
+	}
+
+	session_raise_open_file_limit();
+	listen_fd = session_listen(host, port);
+	if (listen_fd < 0) {
+		printf("Error listening on port %s: %s\n", port, strerror(errno));
+		goto error;
+	}
+
+	// no SA_RESTART, so epoll_wait() is interrupted and the server can shut down cleanly (and display --stats)
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	if (live) {
+		// the watcher thread must not be the one to get SIGINT / SIGTERM, as that wouldn't interrupt epoll_wait()
+		sigset_t signals, old_signals;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+		watcher_started = (pthread_create(&watcher, NULL, watch_quest_directory, NULL) == 0);
+		pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+		if (!watcher_started) {
+			printf("Error starting quest directory watcher thread.\n");
+			goto error;
+		}
+
+		printf("Serving quests from %s on port %s. Press Ctrl-C to stop.\n", directory, port);
+		returncode = serve_quests(listen_fd, window, -1, lookup_live_quest, release_live_quest, &reader);
+	} else if (lazy) {
+		printf("Serving %d quest(s) on port %s. Press Ctrl-C to stop.\n", lazy_catalogue.num_entries, port);
+		returncode = serve_quests(listen_fd, window, -1, lookup_lazy_quest, release_lazy_quest, NULL);
+		if (!returncode)
+			lazy_catalogue_print_stats(&lazy_catalogue);
+	} else if (num_workers > 0) {
+		printf("Serving %u quest(s) on port %s with %d worker(s). Press Ctrl-C to stop.\n", catalogue.header->num_quests, port, num_workers);
+		returncode = run_workers(num_workers, listen_fd, window);
+		if (!returncode)
+			printf("\nStopped.\n");
+	} else {
+		printf("Serving %u quest(s) on port %s. Press Ctrl-C to stop.\n", catalogue.header->num_quests, port);
+		returncode = serve_quests(listen_fd, window, -1, lookup_quest, NULL, NULL);
+	}
+	if (returncode)
+		goto error;
+
+	returncode = 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	if (watcher_started) {
+		stopping = 1;
+		pthread_join(watcher, NULL);
+	}
+	if (live)
+		live_catalogue_destroy(&live_catalogue);
+	if (lazy)
+		lazy_catalogue_destroy(&lazy_catalogue);
+	if (listen_fd >= 0)
+		close(listen_fd);
+	quest_catalogue_unmap(&catalogue);
+	if (catalogue_fd >= 0)
+		close(catalogue_fd);
+	return returncode;
+}
@@ -0,0 +1,428 @@
+/*
+ * PSO EP1&2 (Gamecube) Quest Store Tool
+ *
+ * Manages a content-addressed store of quest .bin/.dat data. The same quest often exists in several different
+ * containers (.bin/.dat files, online .qst, download .qst, .gci files) which are all byte-identical once the quest
+ * data has been extracted and decompressed. The store keeps a single copy of each distinct decompressed .bin and .dat
+ * and simply records which of those each added container refers to.
+ *
+ * Quests can be added from any of the following types of files (in any combination):
+ *
+ * - Compressed .bin + .dat file combo
+ * - Online-play, unencrypted (0x44 / 0x13) .qst file
+ * - Download/Offline-play, encrypted (0xA6 / 0xA7) .qst file
+ * - Pre-decrypted .gci download quest files (see gci_extract)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "fuzziqer_prs.h"
+
+#include "retvals.h"
+#include "utils.h"
+#include "stats.h"
+#include "hash.h"
+#include "quests.h"
+#include "decode_cache.h"
+#include "gci.h"
+#include "content_store.h"
+
+typedef struct {
+	int num_containers;
+	int num_already_stored;
+	int num_objects_added;
+	int num_objects_reused;
+	int num_decompressed;
+	size_t bytes_added;
+	size_t bytes_reused;
+} ADD_STATS;
+
+typedef struct {
+	uint64_t hash;
+	size_t size;
+} STORED_OBJECT;
+
+static int compare_stored_objects(const void *a, const void *b) {
+	const STORED_OBJECT *object_a = (const STORED_OBJECT*)a;
+	const STORED_OBJECT *object_b = (const STORED_OBJECT*)b;
+	if (object_a->hash != object_b->hash)
+		return (object_a->hash < object_b->hash) ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Adds one piece of PRS-compressed quest data (a .bin or .dat) to the store. If this exact compressed data has been
+ * added before, the existing object is re-used without needing to decompress anything.
+ */
+int add_compressed_data(const CONTENT_STORE *store, const uint8_t *data, size_t size, uint64_t *out_hash, ADD_STATS *stats) {
+	int returncode;
+	int32_t result;
+	uint8_t *decompressed_data = NULL;
+	uint64_t compressed_hash = xxh64(data, size, 0);
+	size_t object_size;
+	bool added;
+
+	if (!content_store_get_alias(store, compressed_hash, out_hash) && content_store_has(store, *out_hash, &object_size)) {
+		++stats->num_objects_reused;
+		stats->bytes_reused += object_size;
+		return SUCCESS;
+	}
+
+	result = decode_cache_decompress_buf(data, &decompressed_data, size);
+	if (result < 0) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+	++stats->num_decompressed;
+
+	returncode = content_store_put(store, decompressed_data, result, out_hash, &added);
+	if (returncode)
+		goto error;
+
+	if (added) {
+		++stats->num_objects_added;
+		stats->bytes_added += result;
+	} else {
+		++stats->num_objects_reused;
+		stats->bytes_reused += result;
+	}
+
+	returncode = content_store_put_alias(store, compressed_hash, *out_hash);
+
+error:
+	free(decompressed_data);
+	return returncode;
+}
+
+/*
+ * Adds the quest data from one container to the store, and a ref to it, unless the store already has an identical ref
+ * (the same data added from the same file before). out_ref is filled in with the ref, and is added to refs_index.
+ */
+int add_container(const CONTENT_STORE *store, const char *filename, const char *second_filename, CONTENT_STORE_REF_INDEX *refs_index, CONTENT_STORE_REF *out_ref, ADD_STATS *stats) {
+	int returncode;
+	uint8_t *bin_data = NULL;
+	uint8_t *dat_data = NULL;
+	size_t bin_data_size, dat_data_size;
+	uint64_t bin_hash, dat_hash;
+	const char *container_type;
+
+	if (string_ends_with(filename, ".gci")) {
+		GCI_DECRYPTED_DLQUEST_HEADER gci_header;
+		uint32_t size;
+
+		container_type = CONTAINER_TYPE_GCI;
+		returncode = get_quest_data(filename, &bin_data, &size, &gci_header);
+		if (returncode)
+			goto error;
+		bin_data_size = size;
+		returncode = get_quest_data(second_filename, &dat_data, &size, &gci_header);
+		if (returncode)
+			goto error;
+		dat_data_size = size;
+
+	} else if (second_filename) {
+		container_type = CONTAINER_TYPE_BINDAT;
+		returncode = load_quest_from_bindat(filename, second_filename, &bin_data, &bin_data_size, &dat_data, &dat_data_size);
+		if (returncode)
+			goto error;
+
+	} else {
+		int qst_type;
+		returncode = load_quest_from_qst(filename, &bin_data, &bin_data_size, &dat_data, &dat_data_size, &qst_type);
+		if (returncode)
+			goto error;
+
+		if (qst_type == QST_TYPE_DOWNLOAD) {
+			container_type = CONTAINER_TYPE_QST_DOWNLOAD;
+			returncode = decrypt_qst_bindat(bin_data, &bin_data_size, dat_data, &dat_data_size);
+			if (returncode)
+				goto error;
+		} else {
+			container_type = CONTAINER_TYPE_QST_ONLINE;
+		}
+	}
+
+	returncode = add_compressed_data(store, bin_data, bin_data_size, &bin_hash, stats);
+	if (returncode)
+		goto error;
+	returncode = add_compressed_data(store, dat_data, dat_data_size, &dat_hash, stats);
+	if (returncode)
+		goto error;
+
+	out_ref->bin_hash = bin_hash;
+	out_ref->dat_hash = dat_hash;
+	strncpy(out_ref->container_type, container_type, sizeof(out_ref->container_type) - 1);
+	out_ref->container_path = strdup(filename);
+	if (!out_ref->container_path) {
+		returncode = ERROR_IO;
+		goto error;
+	}
+
+	if (content_store_ref_index_add(refs_index, out_ref)) {
+		returncode = content_store_add_ref(store, filename, container_type, bin_hash, dat_hash);
+		if (returncode)
+			goto error;
+		++stats->num_containers;
+	} else {
+		++stats->num_already_stored;
+	}
+
+error:
+	free(bin_data);
+	free(dat_data);
+	return returncode;
+}
+
+int add_files(const char *store_path, int num_files, char *files[]) {
+	int returncode;
+	CONTENT_STORE store;
+	CONTENT_STORE_REF *refs = NULL, *new_refs = NULL;
+	CONTENT_STORE_REF_INDEX refs_index = { NULL, 0, 0 };
+	size_t num_refs = 0;
+	ADD_STATS stats;
+	int num_failed = 0;
+
+	memset(&stats, 0, sizeof(stats));
+
+	returncode = content_store_open(store_path, &store);
+	if (returncode) {
+		printf("Error code %d (%s) opening store: %s\n", returncode, get_error_message(returncode), store_path);
+		return 1;
+	}
+
+	// the refs already in the store, so that adding the same container again doesn't add another ref for it
+	returncode = content_store_read_refs(&store, &refs, &num_refs);
+	if (returncode) {
+		printf("Error code %d (%s) reading store refs: %s\n", returncode, get_error_message(returncode), store_path);
+		goto error;
+	}
+	new_refs = calloc(num_files, sizeof(CONTENT_STORE_REF));
+	if (!new_refs || content_store_ref_index_init(&refs_index, num_refs + num_files)) {
+		printf("Not enough memory for the store refs.\n");
+		goto error;
+	}
+	for (size_t i = 0; i < num_refs; ++i)
+		content_store_ref_index_add(&refs_index, &refs[i]);
+
+	for (int i = 0; i < num_files; ++i) {
+		const char *filename = files[i];
+		const char *second_filename = NULL;
+		CONTENT_STORE_REF *new_ref = &new_refs[i];
+
+		// .bin/.dat and .gci quests are made up of two files which must be given one right after the other
+		if (string_ends_with(filename, ".bin") || string_ends_with(filename, ".gci")) {
+			const char *expected_extension = string_ends_with(filename, ".bin") ? ".dat" : ".gci";
+			if ((i + 1) >= num_files || !string_ends_with(files[i + 1], expected_extension)) {
+				printf("Skipping %s, as it is not followed by a %s file\n", filename, expected_extension);
+				++num_failed;
+				continue;
+			}
+			second_filename = files[++i];
+		}
+
+		returncode = add_container(&store, filename, second_filename, &refs_index, new_ref, &stats);
+		if (returncode) {
+			printf("Error code %d (%s) adding quest: %s. Skipping it.\n", returncode, get_error_message(returncode), filename);
+			++num_failed;
+			continue;
+		}
+	}
+
+	printf("Added %d quest(s).\n", stats.num_containers);
+	if (stats.num_already_stored)
+		printf("Already in the store: %d quest(s)\n", stats.num_already_stored);
+	printf("New objects stored: %d (%zu bytes)\n", stats.num_objects_added, stats.bytes_added);
+	printf("Existing objects re-used: %d (%zu bytes)\n", stats.num_objects_reused, stats.bytes_reused);
+	printf("PRS decompressions performed: %d\n", stats.num_decompressed);
+	if (num_failed)
+		printf("%d quest(s) could not be added.\n", num_failed);
+
+	returncode = num_failed ? 1 : 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	content_store_ref_index_free(&refs_index);
+	if (new_refs)
+		content_store_free_refs(new_refs, num_files);
+	content_store_free_refs(refs, num_refs);
+	content_store_close(&store);
+	return returncode;
+}
+
+int list_store(const char *store_path) {
+	int returncode;
+	CONTENT_STORE store;
+	CONTENT_STORE_REF *refs = NULL;
+	CONTENT_STORE_REF_INDEX refs_index = { NULL, 0, 0 };
+	STORED_OBJECT *objects = NULL;
+	size_t num_refs = 0;
+	char bin_hash_string[HASH_STRING_LENGTH + 1];
+	char dat_hash_string[HASH_STRING_LENGTH + 1];
+
+	returncode = content_store_open(store_path, &store);
+	if (returncode) {
+		printf("Error code %d (%s) opening store: %s\n", returncode, get_error_message(returncode), store_path);
+		return 1;
+	}
+
+	returncode = content_store_read_refs(&store, &refs, &num_refs);
+	if (returncode) {
+		printf("Error code %d (%s) reading store refs: %s\n", returncode, get_error_message(returncode), store_path);
+		goto error;
+	}
+
+	objects = malloc(sizeof(STORED_OBJECT) * (num_refs ? num_refs * 2 : 1));
+	if (!objects || content_store_ref_index_init(&refs_index, num_refs)) {
+		printf("Not enough memory for the store refs.\n");
+		goto error;
+	}
+
+	size_t referenced_bytes = 0, stored_bytes = 0, num_objects = 0, num_containers = 0, num_referenced = 0;
+	for (size_t i = 0; i < num_refs; ++i) {
+		const CONTENT_STORE_REF *ref = &refs[i];
+
+		// stores written before duplicate refs were skipped can have the same ref more than once
+		if (!content_store_ref_index_add(&refs_index, ref))
+			continue;
+		++num_containers;
+
+		size_t bin_size = 0, dat_size = 0;
+		content_store_has(&store, ref->bin_hash, &bin_size);
+		content_store_has(&store, ref->dat_hash, &dat_size);
+		referenced_bytes += bin_size + dat_size;
+
+		hash_to_string(ref->bin_hash, bin_hash_string);
+		hash_to_string(ref->dat_hash, dat_hash_string);
+		printf("bin=%s dat=%s type=%-12s %s\n", bin_hash_string, dat_hash_string, ref->container_type, ref->container_path);
+
+		objects[num_referenced].hash = ref->bin_hash;
+		objects[num_referenced++].size = bin_size;
+		objects[num_referenced].hash = ref->dat_hash;
+		objects[num_referenced++].size = dat_size;
+	}
+
+	// each distinct object is only stored once, and identical hashes end up next to each other
+	qsort(objects, num_referenced, sizeof(STORED_OBJECT), compare_stored_objects);
+	for (size_t i = 0; i < num_referenced; ++i) {
+		if (i && objects[i].hash == objects[i - 1].hash)
+			continue;
+		++num_objects;
+		stored_bytes += objects[i].size;
+	}
+
+	printf("%zu quest container(s) referencing %zu distinct object(s)\n", num_containers, num_objects);
+	printf("Decompressed data referenced: %zu bytes, stored: %zu bytes (%zu bytes saved by de-duplication)\n",
+	       referenced_bytes, stored_bytes, referenced_bytes - stored_bytes);
+
+	returncode = 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	content_store_ref_index_free(&refs_index);
+	free(objects);
+	content_store_free_refs(refs, num_refs);
+	content_store_close(&store);
+	return returncode;
+}
+
+int extract_object(const CONTENT_STORE *store, uint64_t hash, const char *out_filename) {
+	int returncode;
+	int32_t result;
+	uint8_t *data = NULL;
+	uint8_t *compressed_data = NULL;
+	size_t size;
+
+	returncode = content_store_get(store, hash, &data, &size);
+	if (returncode)
+		goto error;
+
+	// note: see header comment in fuzziqer_prs.c for explanation on why this is used instead of prs_compress()
+	result = fuzziqer_prs_compress(data, &compressed_data, size);
+	if (result < 0) {
+		returncode = ERROR_BAD_DATA;
+		goto error;
+	}
+
+	returncode = write_file(out_filename, compressed_data, result);
+
+error:
+	free(data);
+	free(compressed_data);
+	return returncode;
+}
+
+int extract_quest(const char *store_path, const char *container_path, const char *out_bin_filename, const char *out_dat_filename) {
+	int returncode;
+	CONTENT_STORE store;
+	CONTENT_STORE_REF *refs = NULL;
+	const CONTENT_STORE_REF *ref = NULL;
+	size_t num_refs;
+
+	returncode = content_store_open(store_path, &store);
+	if (returncode) {
+		printf("Error code %d (%s) opening store: %s\n", returncode, get_error_message(returncode), store_path);
+		return 1;
+	}
+
+	returncode = content_store_read_refs(&store, &refs, &num_refs);
+	if (returncode) {
+		printf("Error code %d (%s) reading store refs: %s\n", returncode, get_error_message(returncode), store_path);
+		goto error;
+	}
+
+	// if the same container was added more than once, the most recently added one wins
+	for (size_t i = 0; i < num_refs; ++i) {
+		if (!strcmp(refs[i].container_path, container_path))
+			ref = &refs[i];
+	}
+	if (!ref) {
+		printf("No quest was added to the store from: %s\n", container_path);
+		goto error;
+	}
+
+	printf("Writing compressed quest .bin data to %s ...\n", out_bin_filename);
+	returncode = extract_object(&store, ref->bin_hash, out_bin_filename);
+	if (returncode) {
+		printf("Error code %d (%s) extracting .bin data to: %s\n", returncode, get_error_message(returncode), out_bin_filename);
+		goto error;
+	}
+
+	printf("Writing compressed quest .dat data to %s ...\n", out_dat_filename);
+	returncode = extract_object(&store, ref->dat_hash, out_dat_filename);
+	if (returncode) {
+		printf("Error code %d (%s) extracting .dat data to: %s\n", returncode, get_error_message(returncode), out_dat_filename);
+		goto error;
+	}
+
+	returncode = 0;
+	goto quit;
+error:
+	returncode = 1;
+quit:
+	content_store_free_refs(refs, num_refs);
+	content_store_close(&store);
+	return returncode;
+}
+
+int main(int argc, char *argv[]) {
+	stats_parse_args(&argc, argv);
+
+	if (argc >= 4 && strcmp(argv[1], "add") == 0) {
+		return add_files(argv[2], argc - 3, &argv[3]);
+	} else if (argc == 3 && strcmp(argv[1], "list") == 0) {
+		return list_store(argv[2]);
+	} else if (argc == 6 && strcmp(argv[1], "extract") == 0) {
+		return extract_quest(argv[2], argv[3], argv[4], argv[5]);
+	} else {
+		printf("Usage: quest_store [--stats] add store-dir quest.bin quest.dat [quest.qst] [quest-bin.gci quest-dat.gci] ...\n");
+		printf("       quest_store [--stats] list store-dir\n");
+		printf("       quest_store [--stats] extract store-dir original-quest-file output.bin output.dat\n");
+		return 1;
+	}
+}
@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "arena.h"
+#include "quest_synth.h"
+
+#define MAX_AREAS                      18
+#define MAX_SECTIONS                   10
+#define SLACK_SIZE                     16
+#define SEARCH_WINDOW_SIZE             0x2000   // a little more than the PRS compressor searches back
+
+typedef struct {
+	uint64_t rng;
+	int entropy;
+	ARENA *arena;
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	bool failed;
+} SYNTH;
+
+typedef struct {
+	uint8_t opcode[2];
+	int opcode_size;
+	const char *args;              // r = register, i = 32-bit value, l = label, w = 16-bit value, b = byte, s = text
+	int weight;
+} SYNTH_INSTRUCTION;
+
+// a rough mix of the instruction shapes (opcode and argument sizes) that make up most quest scripts
+static const SYNTH_INSTRUCTION instructions[] = {
+	{ { 0x09 }, 1, "ri", 20 },     // load immediate into register
+	{ { 0x08 }, 1, "rr", 10 },     // copy register
+	{ { 0x18 }, 1, "rr", 8 },      // register arithmetic
+	{ { 0x19 }, 1, "ri", 8 },
+	{ { 0x28 }, 1, "l", 10 },      // jump
+	{ { 0x29 }, 1, "l", 12 },      // call
+	{ { 0x2c }, 1, "rrl", 8 },     // conditional jumps
+	{ { 0x2d }, 1, "ril", 8 },
+	{ { 0x43 }, 1, "i", 14 },      // argument pushes
+	{ { 0x42 }, 1, "r", 10 },
+	{ { 0x44 }, 1, "b", 8 },
+	{ { 0x45 }, 1, "w", 6 },
+	{ { 0x47 }, 1, "s", 6 },
+	{ { 0x50 }, 1, "", 6 },        // instructions taking pushed arguments
+	{ { 0x51 }, 1, "", 4 },
+	{ { 0x0c }, 1, "r", 3 },       // set / clear flag register
+	{ { 0x0d }, 1, "r", 3 },
+	{ { 0xf8, 0x08 }, 2, "", 8 },  // two-byte opcodes
+	{ { 0xf8, 0x1c }, 2, "r", 6 },
+	{ { 0xf9, 0x40 }, 2, "rr", 4 },
+};
+static const int num_instructions = sizeof(instructions) / sizeof(instructions[0]);
+
+static const char *words[] = {
+	"the", "of", "to", "and", "a", "in", "you", "is", "Hunter", "Ragol", "Pioneer", "please", "help", "we", "must",
+	"find", "forest", "caves", "mines", "ruins", "lab", "Principal", "report", "Guild", "client", "reward", "Meseta",
+	"monsters", "signal", "strange", "data", "lost", "team", "hurry", "thank", "your", "mission", "area", "door",
+	"switch", "boss", "Dragon", "De Rol Le", "Vol Opt", "Dark Falz", "Rappy", "Booma", "Sinow", "Delsaber", "Dimenian",
+	"Hildebear", "Gillchic", "Canadine", "Episode", "quest", "complete", "failed", "item", "weapon", "armor", "unit",
+};
+static const int num_words = sizeof(words) / sizeof(words[0]);
+
+// object and NPC types, in order from most to least common. only used through random_skewed
+static const uint16_t object_skins[] = {
+	0x0000, 0x0002, 0x0088, 0x0092, 0x0003, 0x00c1, 0x0008, 0x0019, 0x0001, 0x00c0, 0x0040, 0x0045, 0x0024, 0x0090,
+	0x0091, 0x0004, 0x0005, 0x0006, 0x000a, 0x000b, 0x0012, 0x0013, 0x0015, 0x001b, 0x0023, 0x0050, 0x0051, 0x00c2,
+};
+static const int num_object_skins = sizeof(object_skins) / sizeof(object_skins[0]);
+
+static const uint16_t npc_skins[] = {
+	0x0040, 0x0041, 0x0044, 0x0061, 0x0062, 0x0080, 0x0081, 0x0082, 0x0063, 0x0064, 0x0065, 0x0043, 0x0047, 0x0048,
+	0x0060, 0x0083, 0x0084, 0x0085, 0x0099, 0x00a0, 0x00a1, 0x00a2, 0x00a3, 0x00a4, 0x00a5, 0x00c0, 0x00c1, 0x00c2,
+	0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007, 0x0008, 0x0009, 0x000a, 0x0019, 0x001a,
+};
+static const int num_npc_skins = sizeof(npc_skins) / sizeof(npc_skins[0]);
+
+static uint64_t next_u64(uint64_t *state) {
+	// splitmix64
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+uint64_t quest_synth_seed(uint64_t seed, uint32_t quest_index) {
+	uint64_t state = seed ^ ((uint64_t)quest_index * 0xd1b54a32d192ed03ULL);
+	return next_u64(&state);
+}
+
+uint32_t quest_synth_random(uint64_t *state) {
+	return (uint32_t)(next_u64(state) >> 32);
+}
+
+static uint32_t random_below(SYNTH *s, uint32_t n) {
+	return (uint32_t)(((next_u64(&s->rng) >> 32) * n) >> 32);
+}
+
+static double random_unit(SYNTH *s) {
+	return (next_u64(&s->rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// mostly small indexes, with a long tail of larger ones up to n - 1
+static uint32_t random_skewed(SYNTH *s, uint32_t n) {
+	double u = random_unit(s);
+	return (uint32_t)(n * u * u * u);
+}
+
+// a random value between half and one and a half times the given one
+static uint32_t random_vary(SYNTH *s, uint32_t value) {
+	return (uint32_t)(value * (0.5 + random_unit(s)));
+}
+
+static bool noisy(SYNTH *s) {
+	return s->entropy > 0 && random_below(s, 100) < (uint32_t)s->entropy;
+}
+
+static uint32_t noise_u32(SYNTH *s, uint32_t value) {
+	return noisy(s) ? (uint32_t)next_u64(&s->rng) : value;
+}
+
+static uint16_t noise_u16(SYNTH *s, uint16_t value) {
+	return noisy(s) ? (uint16_t)next_u64(&s->rng) : value;
+}
+
+static uint8_t noise_u8(SYNTH *s, uint8_t value) {
+	return noisy(s) ? (uint8_t)next_u64(&s->rng) : value;
+}
+
+static float noise_float(SYNTH *s, float value) {
+	if (noisy(s)) {
+		uint32_t bits = (uint32_t)next_u64(&s->rng);
+		memcpy(&value, &bits, sizeof(value));
+	}
+	return value;
+}
+
+static uint8_t* reserve(SYNTH *s, size_t size) {
+	if (s->failed)
+		return NULL;
+
+	// the PRS compressor can read a couple of bytes past the end of its input, so some slack is always kept after the
+	// data (see finish_buffer). otherwise whatever the arena held before could change the compressed output
+	if (s->size + size + SLACK_SIZE > s->capacity) {
+		size_t capacity = s->capacity ? s->capacity : 4096;
+		while (s->size + size + SLACK_SIZE > capacity)
+			capacity *= 2;
+		uint8_t *data = arena_realloc(s->arena, s->data, s->capacity, capacity);
+		if (!data) {
+			s->failed = true;
+			return NULL;
+		}
+		memset(data + s->capacity, 0, capacity - s->capacity);
+		s->data = data;
+		s->capacity = capacity;
+	}
+
+	uint8_t *p = s->data + s->size;
+	s->size += size;
+	return p;
+}
+
+static void append(SYNTH *s, const void *data, size_t size) {
+	uint8_t *p = reserve(s, size);
+	if (p)
+		memcpy(p, data, size);
+}
+
+static void append_u8(SYNTH *s, uint8_t value) {
+	append(s, &value, sizeof(value));
+}
+
+static void append_u16(SYNTH *s, uint16_t value) {
+	append(s, &value, sizeof(value));
+}
+
+static void append_u32(SYNTH *s, uint32_t value) {
+	append(s, &value, sizeof(value));
+}
+
+// writes a line of random words (up to max_length - 1 characters) into dst, always null terminated
+static void random_text(SYNTH *s, char *dst, size_t max_length, int min_words, int max_words) {
+	int num_words_wanted = min_words + random_below(s, max_words - min_words + 1);
+	size_t length = 0;
+
+	dst[0] = '\0';
+	for (int i = 0; i < num_words_wanted; ++i) {
+		const char *word = words[random_skewed(s, num_words)];
+		size_t word_length = strlen(word);
+		if (length + word_length + 2 > max_length)
+			break;
+		if (i > 0)
+			dst[length++] = (random_below(s, 12) == 0) ? '\n' : ' ';
+		memcpy(dst + length, word, word_length);
+		length += word_length;
+	}
+	dst[length] = '\0';
+}
+
+/*
+ * The PRS compressor will take a 3 byte match at the very end of its input even when it runs past the end, which makes
+ * the data decompress to 1 or 2 bytes more than it should. A match like that needs the last two bytes followed by the
+ * first slack byte, or the last byte followed by the first two slack bytes, to appear somewhere within the compressor's
+ * search window (the last 8K or so of the data). So the first two slack bytes are picked so that neither does.
+ */
+static void finish_buffer(SYNTH *s) {
+	uint8_t after_last_two[256 / 8];
+	uint8_t after_last[(256 * 256) / 8];
+
+	if (s->failed || s->size < 2)
+		return;
+
+	memset(after_last_two, 0, sizeof(after_last_two));
+	memset(after_last, 0, sizeof(after_last));
+
+	uint8_t last2 = s->data[s->size - 2];
+	uint8_t last = s->data[s->size - 1];
+	size_t start = (s->size > SEARCH_WINDOW_SIZE) ? (s->size - SEARCH_WINDOW_SIZE) : 0;
+	for (size_t i = start; i + 2 < s->size; ++i) {
+		if (s->data[i] == last2 && s->data[i + 1] == last)
+			after_last_two[s->data[i + 2] / 8] |= (1 << (s->data[i + 2] % 8));
+		if (s->data[i] == last) {
+			uint32_t pair = (s->data[i + 1] << 8) | s->data[i + 2];
+			after_last[pair / 8] |= (1 << (pair % 8));
+		}
+	}
+
+	for (int first = 0; first < 256; ++first) {
+		if (after_last_two[first / 8] & (1 << (first % 8)))
+			continue;
+
+		for (int second = 0; second < 256; ++second) {
+			uint32_t pair = (first << 8) | second;
+			if (!(after_last[pair / 8] & (1 << (pair % 8)))) {
+				s->data[s->size] = (uint8_t)first;
+				s->data[s->size + 1] = (uint8_t)second;
+				return;
+			}
+		}
+	}
+}
+
+/** .bin generation **/
+
+static void generate_instruction(SYNTH *s, uint32_t num_functions) {
+	int total_weight = 0;
+	for (int i = 0; i < num_instructions; ++i)
+		total_weight += instructions[i].weight;
+
+	int pick = (int)random_below(s, total_weight);
+	const SYNTH_INSTRUCTION *instruction = &instructions[0];
+	for (int i = 0; i < num_instructions; ++i) {
+		if (pick < instructions[i].weight) {
+			instruction = &instructions[i];
+			break;
+		}
+		pick -= instructions[i].weight;
+	}
+
+	for (int i = 0; i < instruction->opcode_size; ++i)
+		append_u8(s, noise_u8(s, instruction->opcode[i]));
+
+	for (const char *arg = instruction->args; *arg; ++arg) {
+		switch (*arg) {
+			case 'r':
+				append_u8(s, noise_u8(s, (uint8_t)random_skewed(s, 80)));
+				break;
+			case 'i':
+				append_u32(s, noise_u32(s, random_skewed(s, 1000)));
+				break;
+			case 'l':
+				append_u16(s, noise_u16(s, (uint16_t)random_below(s, num_functions)));
+				break;
+			case 'w':
+				append_u16(s, noise_u16(s, (uint16_t)random_skewed(s, 500)));
+				break;
+			case 'b':
+				append_u8(s, noise_u8(s, (uint8_t)random_skewed(s, 32)));
+				break;
+			case 's': {
+				char text[256];
+				random_text(s, text, sizeof(text), 3, 30);
+				size_t length = strlen(text);
+				for (size_t j = 0; j < length; ++j) {
+					uint8_t c = noise_u8(s, (uint8_t)text[j]);
+					append_u8(s, c ? c : ' ');
+				}
+				append_u8(s, 0);
+				break;
+			}
+		}
+	}
+}
+
+static int generate_bin(SYNTH *s, const QUEST_SYNTH_PARAMS *params, uint32_t quest_index) {
+	uint32_t target = random_vary(s, params->bin_size);
+	if (target < QUEST_SYNTH_MIN_BIN_SIZE)
+		target = QUEST_SYNTH_MIN_BIN_SIZE;
+
+	uint32_t code_budget = target - sizeof(QUEST_BIN_HEADER);
+	uint32_t num_functions = code_budget / 64;
+	if (num_functions < 4)
+		num_functions = 4;
+	uint32_t code_target = code_budget - (num_functions * sizeof(uint32_t));
+
+	uint32_t *function_offsets = arena_alloc(s->arena, num_functions * sizeof(uint32_t));
+	if (!function_offsets)
+		return ERROR_IO;
+
+	// the header is filled in last, once the sizes are known
+	reserve(s, sizeof(QUEST_BIN_HEADER));
+
+	// some labels are left undefined, as they often are in real quests
+	for (uint32_t i = 0; i < num_functions; ++i) {
+		uint32_t code_size = s->size - sizeof(QUEST_BIN_HEADER);
+		if (code_size >= code_target || (i > 0 && random_below(s, 100) < 8)) {
+			function_offsets[i] = 0xffffffff;
+			continue;
+		}
+
+		function_offsets[i] = code_size;
+		uint32_t function_size = random_vary(s, (code_target - code_size) / (num_functions - i));
+		while ((s->size - sizeof(QUEST_BIN_HEADER)) - code_size < function_size && !s->failed)
+			generate_instruction(s, num_functions);
+		append_u8(s, 0x01);  // return
+	}
+
+	uint32_t function_offset_table_offset = s->size;
+	for (uint32_t i = 0; i < num_functions; ++i)
+		append_u32(s, noise_u32(s, function_offsets[i]));
+	arena_free(s->arena, function_offsets);
+
+	if (s->failed)
+		return ERROR_IO;
+
+	QUEST_BIN_HEADER *header = (QUEST_BIN_HEADER*)s->data;
+	memset(header, 0, sizeof(QUEST_BIN_HEADER));
+	header->object_code_offset = sizeof(QUEST_BIN_HEADER);
+	header->function_offset_table_offset = function_offset_table_offset;
+	header->bin_size = s->size;
+	header->xffffffff = 0xffffffff;
+	header->download = 0;
+	header->quest_number_byte = (uint8_t)((quest_index % 255) + 1);
+	header->episode = (uint8_t)random_below(s, 2);
+	snprintf(header->name, sizeof(header->name), "Synthetic %u", quest_index);
+	random_text(s, header->short_description, sizeof(header->short_description), 4, 16);
+	random_text(s, header->long_description, sizeof(header->long_description), 10, 50);
+
+	finish_buffer(s);
+	return SUCCESS;
+}
+
+/** .dat generation **/
+
+typedef struct {
+	float x, z;
+} SYNTH_SECTION;
+
+// a position near one of the area's map sections. mostly round numbers, as placed by hand in a quest editor
+static void random_position(SYNTH *s, const SYNTH_SECTION *section, float *out_position) {
+	out_position[0] = noise_float(s, section->x + ((int)random_below(s, 400) - 200) * 0.5f);
+	out_position[1] = noise_float(s, random_below(s, 8) == 0 ? (float)random_below(s, 40) : 0.0f);
+	out_position[2] = noise_float(s, section->z + ((int)random_below(s, 400) - 200) * 0.5f);
+}
+
+static uint32_t begin_table(SYNTH *s, uint32_t type, uint32_t area) {
+	QUEST_DAT_TABLE_HEADER header;
+	memset(&header, 0, sizeof(header));
+	header.type = type;
+	header.area = area;
+
+	uint32_t offset = s->size;
+	append(s, &header, sizeof(header));
+	return offset;
+}
+
+static void end_table(SYNTH *s, uint32_t offset) {
+	if (s->failed)
+		return;
+
+	QUEST_DAT_TABLE_HEADER *header = (QUEST_DAT_TABLE_HEADER*)(s->data + offset);
+	header->table_body_size = s->size - offset - sizeof(QUEST_DAT_TABLE_HEADER);
+	header->table_size = header->table_body_size + sizeof(QUEST_DAT_TABLE_HEADER);
+}
+
+static void generate_objects(SYNTH *s, uint32_t area, const SYNTH_SECTION *sections, int num_sections, uint32_t count) {
+	uint32_t offset = begin_table(s, QUEST_DAT_TABLE_OBJECTS, area);
+
+	for (uint32_t i = 0; i < count; ++i) {
+		QUEST_DAT_OBJECT object;
+		float position[3];
+		memset(&object, 0, sizeof(object));
+
+		int section = random_below(s, num_sections);
+		object.skin = noise_u16(s, object_skins[random_skewed(s, num_object_skins)]);
+		object.unknown1 = noise_u16(s, 0);
+		object.unknown2 = noise_u32(s, 0);
+		object.id = noise_u16(s, (uint16_t)i);
+		object.group = noise_u16(s, (uint16_t)random_skewed(s, 4));
+		object.section = noise_u16(s, (uint16_t)section);
+		object.unknown3 = noise_u16(s, 0);
+		random_position(s, &sections[section], position);
+		object.x = position[0];
+		object.y = position[1];
+		object.z = position[2];
+		object.rotation_x = noise_u32(s, 0);
+		object.rotation_y = noise_u32(s, random_below(s, 16) * 0x1000);
+		object.rotation_z = noise_u32(s, 0);
+		object.param1 = noise_float(s, (float)random_skewed(s, 100));
+		object.param2 = noise_float(s, (float)random_skewed(s, 10));
+		object.param3 = noise_float(s, (float)random_skewed(s, 10));
+		object.param4 = noise_u32(s, random_skewed(s, 200));
+		object.param5 = noise_u32(s, random_skewed(s, 20));
+		object.param6 = noise_u32(s, random_skewed(s, 20));
+		object.unknown4 = noise_u32(s, 0);
+
+		append(s, &object, sizeof(object));
+	}
+
+	end_table(s, offset);
+}
+
+static void generate_npcs(SYNTH *s, uint32_t area, const SYNTH_SECTION *sections, int num_sections, uint32_t count, uint32_t num_waves, uint16_t *wave_sections) {
+	uint32_t offset = begin_table(s, QUEST_DAT_TABLE_NPCS, area);
+
+	for (uint32_t i = 0; i < count; ++i) {
+		QUEST_DAT_NPC npc;
+		float position[3];
+		memset(&npc, 0, sizeof(npc));
+
+		// NPCs are handed out to waves in order, and each wave stays within one map section
+		uint32_t wave = (uint32_t)(((uint64_t)i * num_waves) / count);
+		int section = wave_sections[wave] % num_sections;
+
+		npc.skin = noise_u16(s, npc_skins[random_skewed(s, num_npc_skins)]);
+		npc.unknown1 = noise_u16(s, 0);
+		npc.unknown2 = noise_u32(s, 0);
+		npc.num_children = noise_u16(s, (uint16_t)random_skewed(s, 6));
+		npc.floor = noise_u16(s, (uint16_t)area);
+		npc.entity_id = noise_u32(s, i);
+		npc.section = noise_u16(s, (uint16_t)section);
+		npc.wave_number = noise_u16(s, (uint16_t)(wave + 1));
+		npc.wave_number2 = noise_u32(s, wave + 1);
+		random_position(s, &sections[section], position);
+		npc.x = position[0];
+		npc.y = position[1];
+		npc.z = position[2];
+		npc.rotation_x = noise_u32(s, 0);
+		npc.rotation_y = noise_u32(s, random_below(s, 16) * 0x1000);
+		npc.rotation_z = noise_u32(s, 0);
+		npc.param1 = noise_float(s, (float)random_skewed(s, 50));
+		npc.param2 = noise_float(s, 0.0f);
+		npc.param3 = noise_float(s, (float)random_skewed(s, 4));
+		npc.param4 = noise_float(s, 0.0f);
+		npc.param5 = noise_u32(s, random_skewed(s, 4));
+		npc.param6 = noise_u32(s, 0);
+
+		append(s, &npc, sizeof(npc));
+	}
+
+	end_table(s, offset);
+}
+
+// one event per wave, each triggering the next wave's event once its wave is cleared
+static void generate_events(SYNTH *s, uint32_t area, uint32_t num_waves, const uint16_t *wave_sections) {
+	uint32_t offset = begin_table(s, QUEST_DAT_TABLE_EVENTS, area);
+	uint32_t body_offset = s->size;
+
+	QUEST_DAT_EVENTS_HEADER events_header;
+	memset(&events_header, 0, sizeof(events_header));
+	events_header.action_stream_offset = sizeof(QUEST_DAT_EVENTS_HEADER) + (num_waves * sizeof(QUEST_DAT_EVENT));
+	events_header.entries_offset = sizeof(QUEST_DAT_EVENTS_HEADER);
+	events_header.entry_count = num_waves;
+	append(s, &events_header, sizeof(events_header));
+
+	uint32_t events_offset = s->size;
+	reserve(s, num_waves * sizeof(QUEST_DAT_EVENT));
+
+	uint32_t action_stream_start = s->size;
+	for (uint32_t i = 0; i < num_waves; ++i) {
+		QUEST_DAT_EVENT event;
+		memset(&event, 0, sizeof(event));
+		event.event_id = noise_u32(s, (area * 100) + i + 1);
+		event.flags = noise_u16(s, 0);
+		event.unknown1 = noise_u16(s, 0);
+		event.section = noise_u16(s, wave_sections[i]);
+		event.wave_number = noise_u16(s, (uint16_t)(i + 1));
+		event.delay = noise_u32(s, random_below(s, 3) == 0 ? 30 * random_below(s, 5) : 0);
+		event.action_offset = noise_u32(s, s->size - action_stream_start);
+
+		// unlock the doors this wave kept shut, then start the next wave
+		int num_doors = random_skewed(s, 4);
+		for (int j = 0; j < num_doors; ++j) {
+			append_u8(s, noise_u8(s, 0x0a));
+			append_u16(s, noise_u16(s, (uint16_t)(random_below(s, 64) + (area * 100))));
+		}
+		if (i + 1 < num_waves) {
+			append_u8(s, noise_u8(s, 0x0c));
+			append_u32(s, noise_u32(s, (area * 100) + i + 2));
+		}
+		append_u8(s, 0x01);
+
+		if (!s->failed)
+			memcpy(s->data + events_offset + (i * sizeof(QUEST_DAT_EVENT)), &event, sizeof(event));
+	}
+
+	// the action stream is padded out to a multiple of 4 bytes
+	while ((s->size - body_offset) % 4)
+		append_u8(s, 0);
+
+	end_table(s, offset);
+}
+
+static int generate_dat(SYNTH *s, const QUEST_SYNTH_PARAMS *params) {
+	uint32_t target = random_vary(s, params->dat_size);
+	if (target < QUEST_SYNTH_MIN_DAT_SIZE)
+		target = QUEST_SYNTH_MIN_DAT_SIZE;
+
+	uint32_t num_areas = 2 + random_below(s, 1 + (target / 16384));
+	if (num_areas > MAX_AREAS)
+		num_areas = MAX_AREAS;
+
+	// the first area (Pioneer 2) is always used, the rest are picked in order from the remaining ones
+	uint32_t areas[MAX_AREAS];
+	areas[0] = 0;
+	uint32_t areas_picked = 1;
+	for (uint32_t area = 1; area < MAX_AREAS && areas_picked < num_areas; ++area) {
+		if (random_below(s, MAX_AREAS - area) < (num_areas - areas_picked))
+			areas[areas_picked++] = area;
+	}
+
+	for (uint32_t i = 0; i < num_areas; ++i) {
+		uint32_t area = areas[i];
+		uint32_t remaining = (s->size < target) ? (target - s->size) : 0;
+		uint32_t area_budget = random_vary(s, remaining / (num_areas - i));
+		if (area == 0)
+			area_budget /= 8;  // just a few townspeople and objects in Pioneer 2
+
+		SYNTH_SECTION sections[MAX_SECTIONS];
+		int num_sections = 2 + random_below(s, MAX_SECTIONS - 1);
+		for (int j = 0; j < num_sections; ++j) {
+			sections[j].x = ((int)random_below(s, 400) - 200) * 10.0f;
+			sections[j].z = ((int)random_below(s, 400) - 200) * 10.0f;
+		}
+
+		uint32_t num_objects = 1 + ((area_budget * 35) / 100) / sizeof(QUEST_DAT_OBJECT);
+		uint32_t num_npcs = 1 + ((area_budget * 55) / 100) / sizeof(QUEST_DAT_NPC);
+		uint32_t num_waves = 1 + (num_npcs / (4 + random_below(s, 5)));
+
+		uint16_t *wave_sections = arena_alloc(s->arena, num_waves * sizeof(uint16_t));
+		if (!wave_sections)
+			return ERROR_IO;
+		for (uint32_t j = 0; j < num_waves; ++j)
+			wave_sections[j] = (uint16_t)random_below(s, num_sections);
+
+		generate_objects(s, area, sections, num_sections, num_objects);
+		generate_npcs(s, area, sections, num_sections, num_npcs, num_waves, wave_sections);
+		generate_events(s, area, num_waves, wave_sections);
+
+		arena_free(s->arena, wave_sections);
+	}
+
+	// empty table marking the end of the file
+	QUEST_DAT_TABLE_HEADER eof;
+	memset(&eof, 0, sizeof(eof));
+	append(s, &eof, sizeof(eof));
+
+	finish_buffer(s);
+	return s->failed ? ERROR_IO : SUCCESS;
+}
+
+void quest_synth_default_params(QUEST_SYNTH_PARAMS *params) {
+	params->bin_size = QUEST_SYNTH_DEFAULT_BIN_SIZE;
+	params->dat_size = QUEST_SYNTH_DEFAULT_DAT_SIZE;
+	params->entropy = QUEST_SYNTH_DEFAULT_ENTROPY;
+}
+
+/*
+ * Generates the decompressed .bin and .dat data for one quest. The output buffers are allocated from the given arena,
+ * or with malloc if arena is NULL (see arena.h).
+ */
+int quest_synth_generate(const QUEST_SYNTH_PARAMS *params,
+                         uint64_t seed,
+                         uint32_t quest_index,
+                         uint8_t **out_bin,
+                         size_t *out_bin_size,
+                         uint8_t **out_dat,
+                         size_t *out_dat_size,
+                         ARENA *arena) {
+	int returncode;
+	SYNTH bin, dat;
+
+	if (!params || !out_bin || !out_bin_size || !out_dat || !out_dat_size || params->entropy < 0 || params->entropy > 100)
+		return ERROR_INVALID_PARAMS;
+
+	memset(&bin, 0, sizeof(bin));
+	bin.rng = quest_synth_seed(seed, quest_index);
+	bin.entropy = params->entropy;
+	bin.arena = arena;
+
+	returncode = generate_bin(&bin, params, quest_index);
+	if (returncode)
+		goto error;
+
+	// the .dat data gets its own random number stream, so changing the .bin size doesn't change the .dat data
+	memset(&dat, 0, sizeof(dat));
+	dat.rng = quest_synth_seed(~seed, quest_index);
+	dat.entropy = params->entropy;
+	dat.arena = arena;
+
+	returncode = generate_dat(&dat, params);
+	if (returncode) {
+		arena_free(arena, dat.data);
+		goto error;
+	}
+
+	*out_bin = bin.data;
+	*out_bin_size = bin.size;
+	*out_dat = dat.data;
+	*out_dat_size = dat.size;
+	return SUCCESS;
+
+error:
+	arena_free(arena, bin.data);
+	return returncode;
+}
@@ -0,0 +1,55 @@
+#ifndef QUEST_SYNTH_H_INCLUDED
+#define QUEST_SYNTH_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "quests.h"
+#include "arena.h"
+
+/*
+ * Generates synthetic (decompressed) quest .bin and .dat data, for benchmarking the tools without needing real quests.
+ *
+ * The .bin data has a normal QUEST_BIN_HEADER, followed by object code made up of a rough mix of script instructions
+ * (register loads, jumps and calls between functions, argument pushes and message text) and then the function offset
+ * table pointing into it. The code is shaped like real quest scripts but is not meant to actually run.
+ *
+ * The .dat data is made up of an object table, an NPC table and a wave/event table for each of a number of areas,
+ * followed by the empty table marking the end of the file. As in real quests, a few object and NPC types are very
+ * common and the rest are rare, entities are clustered into map sections, NPCs are grouped into waves and each wave's
+ * event triggers the next.
+ *
+ * Everything is generated from a 64-bit seed and the quest's index, so the same quest always comes out identical,
+ * no matter how many other quests are generated or in what order.
+ *
+ * The sizes are targets. Each quest's actual sizes vary randomly between half and one and a half times the target.
+ * Entropy (0-100) is the chance, in percent, of each generated value being replaced with random bits. 0 gives data
+ * that compresses about as well as real quests, 100 gives data that barely compresses at all.
+ */
+
+#define QUEST_SYNTH_DEFAULT_BIN_SIZE   (24 * 1024)
+#define QUEST_SYNTH_DEFAULT_DAT_SIZE   (48 * 1024)
+#define QUEST_SYNTH_DEFAULT_ENTROPY    5
+
+#define QUEST_SYNTH_MIN_BIN_SIZE       1024
+#define QUEST_SYNTH_MIN_DAT_SIZE       1024
+
+typedef struct {
+	uint32_t bin_size;
+	uint32_t dat_size;
+	int entropy;
+} QUEST_SYNTH_PARAMS;
+
+void quest_synth_default_params(QUEST_SYNTH_PARAMS *params);
+uint64_t quest_synth_seed(uint64_t seed, uint32_t quest_index);
+uint32_t quest_synth_random(uint64_t *state);
+int quest_synth_generate(const QUEST_SYNTH_PARAMS *params,
+                         uint64_t seed,
+                         uint32_t quest_index,
+                         uint8_t **out_bin,
+                         size_t *out_bin_size,
+                         uint8_t **out_dat,
+                         size_t *out_dat_size,
+                         ARENA *arena);
+
+#endif
@@ -3,16 +3,26 @@
 #include <string.h>
 #include <malloc.h>
 
+#include <sylverant/encryption.h>
+
 #include "retvals.h"
+#include "utils.h"
 #include "quests.h"
+#include "textconv.h"
+#include "stats.h"
 
 int generate_qst_header(const char *src_file, size_t src_file_size, const QUEST_BIN_HEADER *bin_header, QST_HEADER *out_header) {
+	return generate_qst_header_ex(src_file, src_file_size, bin_header, QST_TYPE_DOWNLOAD, out_header);
+}
+
+// same as generate_qst_header, but qst_type picks between the online (0x44) and download (0xA6) packet id
+int generate_qst_header_ex(const char *src_file, size_t src_file_size, const QUEST_BIN_HEADER *bin_header, int qst_type, QST_HEADER *out_header) {
 	if (!src_file || !bin_header || !out_header)
 		return ERROR_INVALID_PARAMS;
 
 	memset(out_header, 0, sizeof(QST_HEADER));
 
-	out_header->pkt_id = PACKET_ID_QUEST_INFO_DOWNLOAD;
+	out_header->pkt_id = (qst_type == QST_TYPE_ONLINE) ? PACKET_ID_QUEST_INFO_ONLINE : PACKET_ID_QUEST_INFO_DOWNLOAD;
 	out_header->pkt_size = sizeof(QST_HEADER);
 	out_header->pkt_flags = 0;
 	out_header->flags = 0;
@@ -25,12 +35,17 @@ int generate_qst_header(const char *src_file, size_t src_file_size, const QUEST_
 }
 
 int generate_qst_data_chunk(const char *base_filename, uint8_t counter, const uint8_t *src, uint32_t size, QST_DATA_CHUNK *out_chunk) {
+	return generate_qst_data_chunk_ex(base_filename, counter, src, size, QST_TYPE_DOWNLOAD, out_chunk);
+}
+
+// same as generate_qst_data_chunk, but qst_type picks between the online (0x13) and download (0xA7) packet id
+int generate_qst_data_chunk_ex(const char *base_filename, uint8_t counter, const uint8_t *src, uint32_t size, int qst_type, QST_DATA_CHUNK *out_chunk) {
 	if (!base_filename || !src || !out_chunk)
 		return ERROR_INVALID_PARAMS;
 
 	memset(out_chunk, 0, sizeof(QST_DATA_CHUNK));
 
-	out_chunk->pkt_id = PACKET_ID_QUEST_CHUNK_DOWNLOAD;
+	out_chunk->pkt_id = (qst_type == QST_TYPE_ONLINE) ? PACKET_ID_QUEST_CHUNK_ONLINE : PACKET_ID_QUEST_CHUNK_DOWNLOAD;
 	out_chunk->pkt_flags = counter;
 	out_chunk->pkt_size = sizeof(QST_DATA_CHUNK);
 	strncpy(out_chunk->filename, base_filename, sizeof(out_chunk->filename));
@@ -40,8 +55,87 @@ int generate_qst_data_chunk(const char *base_filename, uint8_t counter, const ui
 	return SUCCESS;
 }
 
+/*
+ * Writes out a .qst file containing the given .bin and .dat data, as interleaved data chunk packets containing 1024
+ * bytes each. For QST_TYPE_DOWNLOAD the data should already be compressed, encrypted and prefixed with the download
+ * quest chunks header (see gcdl.h), and 0xA6 / 0xA7 packets are written. For QST_TYPE_ONLINE the data is just the
+ * PRS-compressed .bin and .dat data, and 0x44 / 0x13 packets are written.
+ */
+int write_qst_file(const char *filename,
+                   const char *bin_base_filename,
+                   const char *dat_base_filename,
+                   const QUEST_BIN_HEADER *bin_header,
+                   const uint8_t *bin_data,
+                   size_t bin_size,
+                   const uint8_t *dat_data,
+                   size_t dat_size,
+                   int qst_type) {
+	if (!filename || !bin_base_filename || !dat_base_filename || !bin_header || !bin_data || !dat_data)
+		return ERROR_INVALID_PARAMS;
+
+	/** generate .qst file header for both the .bin and .dat file data, using the .bin header data **/
+
+	QST_HEADER qst_bin_header, qst_dat_header;
+
+	generate_qst_header_ex(bin_base_filename, bin_size, bin_header, qst_type, &qst_bin_header);
+	generate_qst_header_ex(dat_base_filename, dat_size, bin_header, qst_type, &qst_dat_header);
+
+	uint64_t start = stats_start();
+	FILE *fp = fopen(filename, "wb");
+	if (!fp)
+		return ERROR_CREATING_FILE;
+
+	fwrite(&qst_bin_header, sizeof(qst_bin_header), 1, fp);
+	fwrite(&qst_dat_header, sizeof(qst_dat_header), 1, fp);
+
+	uint32_t bin_pos = 0, bin_done = 0;
+	uint32_t dat_pos = 0, dat_done = 0;
+	uint8_t bin_counter = 0, dat_counter = 0;
+	QST_DATA_CHUNK chunk;
+
+	// note: .qst files actually do NOT need to be interleaved like this to work with the gamecube pso client. the
+	// khyller server did not do this. it is possible that some .qst file tools (qedit?) expect it though? so, meh,
+	// we'll just do it here because it's easy enough. also worth mentioning that khyller also put the .dat file data
+	// first. so the order seems unimportant too ... ?
+
+	while (!bin_done || !dat_done) {
+		if (!bin_done) {
+			uint32_t size = (bin_size - bin_pos >= 1024) ? 1024 : (bin_size - bin_pos);
+
+			generate_qst_data_chunk_ex(bin_base_filename, bin_counter, bin_data + bin_pos, size, qst_type, &chunk);
+			fwrite(&chunk, sizeof(QST_DATA_CHUNK), 1, fp);
+
+			bin_pos += size;
+			++bin_counter;
+			if (bin_pos >= bin_size)
+				bin_done = 1;
+		}
+
+		if (!dat_done) {
+			uint32_t size = (dat_size - dat_pos >= 1024) ? 1024 : (dat_size - dat_pos);
+
+			generate_qst_data_chunk_ex(dat_base_filename, dat_counter, dat_data + dat_pos, size, qst_type, &chunk);
+			fwrite(&chunk, sizeof(QST_DATA_CHUNK), 1, fp);
+
+			dat_pos += size;
+			++dat_counter;
+			if (dat_pos >= dat_size)
+				dat_done = 1;
+		}
+	}
+
+	int error = ferror(fp);
+	fclose(fp);
+	if (error)
+		return ERROR_IO;
+
+	stats_end(STATS_WRITE, start, (2 * sizeof(QST_HEADER)) + ((bin_counter + dat_counter) * sizeof(QST_DATA_CHUNK)));
+	return SUCCESS;
+}
+
 int validate_quest_bin(const QUEST_BIN_HEADER *header, uint32_t length, bool print_errors) {
 	int result = 0;
+	uint64_t start = stats_start();
 
 	// TODO: validations might need tweaking ...
 	if (header->object_code_offset != 468) {
@@ -69,12 +163,14 @@ int validate_quest_bin(const QUEST_BIN_HEADER *header, uint32_t length, bool pri
 		result |= QUESTBIN_ERROR_EPISODE;
 	}
 
+	stats_end(STATS_VALIDATE, start, length);
 	return result;
 }
 
 int validate_quest_dat(const uint8_t *data, uint32_t length, bool print_errors) {
 	int result = 0;
 	int table_index = 0;
+	uint64_t start = stats_start();
 
 	// TODO: validations might need tweaking ...
 	uint32_t offset = 0;
@@ -113,17 +209,27 @@ int validate_quest_dat(const uint8_t *data, uint32_t length, bool print_errors)
 		++table_index;
 	}
 
+	stats_end(STATS_VALIDATE, start, length);
 	return result;
 }
 
 // HACK: this function applies some arguably shitty hack-fixes under certain circumstances.
 int handle_quest_bin_validation_issues(int bin_validation_result, QUEST_BIN_HEADER *bin_header, uint8_t **decompressed_bin_data, size_t *decompressed_bin_length) {
+	return handle_quest_bin_validation_issues_ex(bin_validation_result, bin_header, decompressed_bin_data, decompressed_bin_length, true, NULL);
+}
+
+// the 1-byte fix-up below can move *decompressed_bin_data, so callers should re-fetch any header pointer into it after.
+// print_warnings can be false to apply the same fix-ups without displaying anything. the batch tools pass false from
+// their worker threads, as the output from all of them would be mixed together. quest_info or bindat_to_gcdl can be
+// used on any quests, to see the issues
+int handle_quest_bin_validation_issues_ex(int bin_validation_result, QUEST_BIN_HEADER *bin_header, uint8_t **decompressed_bin_data, size_t *decompressed_bin_length, bool print_warnings, ARENA *arena) {
 	// this hacky fix _probably_ isn't so bad. in these cases, the extra data sitting in the decompressed memory seems
 	// to just be repeated subsets of the previous "good" data. almost as if the PRS decompression was stuck in a loop
 	// that it eventually worked itself out of. just a wild guess though ...
 	if (bin_validation_result & QUESTBIN_ERROR_SMALLER_BIN_SIZE) {
 		bin_validation_result &= ~QUESTBIN_ERROR_SMALLER_BIN_SIZE;
-		printf("WARNING: Decompressed .bin data is larger than expected. Proceeding using the smaller .bin header bin_size value ...\n");
+		if (print_warnings)
+			printf("WARNING: Decompressed .bin data is larger than expected. Proceeding using the smaller .bin header bin_size value ...\n");
 		*decompressed_bin_length = bin_header->bin_size;
 	}
 
@@ -135,10 +241,13 @@ int handle_quest_bin_validation_issues(int bin_validation_result, QUEST_BIN_HEAD
 	if (bin_validation_result & QUESTBIN_ERROR_LARGER_BIN_SIZE) {
 		bin_validation_result &= ~QUESTBIN_ERROR_LARGER_BIN_SIZE;
 		if ((*decompressed_bin_length + 1) == bin_header->bin_size) {
-			printf("WARNING: Decompressed .bin data is 1 byte smaller than the .bin header bin_size specifies. Correcting by adding a null byte ...\n");
+			if (print_warnings)
+				printf("WARNING: Decompressed .bin data is 1 byte smaller than the .bin header bin_size specifies. Correcting by adding a null byte ...\n");
 			size_t length = *decompressed_bin_length + 1;
 			uint8_t *new_bin_data;
-			new_bin_data = realloc(*decompressed_bin_data, length);
+			new_bin_data = arena_realloc(arena, *decompressed_bin_data, *decompressed_bin_length, length);
+			if (!new_bin_data)
+				return bin_validation_result | QUESTBIN_ERROR_LARGER_BIN_SIZE;
 			new_bin_data[length - 1] = 0;
 			*decompressed_bin_data = new_bin_data;
 			*decompressed_bin_length = length;
@@ -146,13 +255,19 @@ int handle_quest_bin_validation_issues(int bin_validation_result, QUEST_BIN_HEAD
 	}
 	if (bin_validation_result & QUESTBIN_ERROR_EPISODE) {
 		bin_validation_result &= ~QUESTBIN_ERROR_EPISODE;
-		printf("WARNING: .bin header episode value should be ignored due to apparent 16-bit quest_number value\n");
+		if (print_warnings)
+			printf("WARNING: .bin header episode value should be ignored due to apparent 16-bit quest_number value\n");
 	}
 
 	return bin_validation_result;
 }
 
 int handle_quest_dat_validation_issues(int dat_validation_result, uint8_t **decompressed_dat_data, size_t *decompressed_dat_length) {
+	return handle_quest_dat_validation_issues_ex(dat_validation_result, decompressed_dat_data, decompressed_dat_length, true);
+}
+
+// print_warnings works the same as for handle_quest_bin_validation_issues_ex
+int handle_quest_dat_validation_issues_ex(int dat_validation_result, uint8_t **decompressed_dat_data, size_t *decompressed_dat_length, bool print_warnings) {
 	// this one is a bit more annoying. the quest .dat format does not have any explicit value anywhere that tells you
 	// how large the entire data should be. so we have to guess. from what i can piece together, .dat files normally
 	// have a table with all zeros located at the end of the file (therefore, the last 16 bytes of an uncompressed .dat
@@ -161,13 +276,73 @@ int handle_quest_dat_validation_issues(int dat_validation_result, uint8_t **deco
 	// values. so i am guessing that this is also a result of PRS compression/decompression issues ...
 	if (dat_validation_result & QUESTDAT_ERROR_PREMATURE_EOF) {
 		dat_validation_result &= ~QUESTDAT_ERROR_PREMATURE_EOF;
-		printf("WARNING: .dat file appeared to end early (found zero-length table before end of file was reached). Decompressed .dat data might be too large? Ignoring.\n");
+		if (print_warnings)
+			printf("WARNING: .dat file appeared to end early (found zero-length table before end of file was reached). Decompressed .dat data might be too large? Ignoring.\n");
 	}
 
 	return dat_validation_result;
 }
 
+int get_quest_bin_header_text(const QUEST_BIN_HEADER *header, QUEST_BIN_HEADER_TEXT *out_text) {
+	if (!header || !out_text)
+		return ERROR_INVALID_PARAMS;
+
+	sjis_to_utf8(header->name, sizeof(header->name), out_text->name, sizeof(out_text->name), NULL);
+	sjis_to_utf8(header->short_description, sizeof(header->short_description), out_text->short_description, sizeof(out_text->short_description), NULL);
+	sjis_to_utf8(header->long_description, sizeof(header->long_description), out_text->long_description, sizeof(out_text->long_description), NULL);
+
+	return SUCCESS;
+}
+
+static int set_sjis_field(char *field, size_t field_size, const char *utf8_text) {
+	if (!utf8_text)
+		return SUCCESS;
+
+	// the game's fixed-size text fields are not required to be null terminated, so the whole field can be used
+	char sjis[field_size + 1];
+	size_t length;
+	int result = utf8_to_sjis(utf8_text, strlen(utf8_text), sjis, sizeof(sjis), &length);
+
+	memset(field, 0, field_size);
+	memcpy(field, sjis, length);
+
+	return result;
+}
+
+// sets any of the header's text fields from UTF-8 strings, converting them to Shift-JIS. NULL strings are skipped.
+// text which does not fit is truncated and ERROR_TRUNCATED is returned (after all the fields have been set).
+int set_quest_bin_header_text(QUEST_BIN_HEADER *header, const char *name, const char *short_description, const char *long_description) {
+	if (!header)
+		return ERROR_INVALID_PARAMS;
+
+	int result = SUCCESS;
+	int field_result;
+
+	field_result = set_sjis_field(header->name, sizeof(header->name), name);
+	if (field_result)
+		result = field_result;
+	field_result = set_sjis_field(header->short_description, sizeof(header->short_description), short_description);
+	if (field_result)
+		result = field_result;
+	field_result = set_sjis_field(header->long_description, sizeof(header->long_description), long_description);
+	if (field_result)
+		result = field_result;
+
+	return result;
+}
+
+// sets the quest name in a .qst header from a UTF-8 string, converting it to Shift-JIS
+int set_qst_header_name(QST_HEADER *header, const char *name) {
+	if (!header || !name)
+		return ERROR_INVALID_PARAMS;
+
+	return set_sjis_field(header->name, sizeof(header->name), name);
+}
+
 void print_quick_quest_info(QUEST_BIN_HEADER *bin_header, size_t compressed_bin_size, size_t compressed_dat_size) {
+	QUEST_BIN_HEADER_TEXT text;
+	get_quest_bin_header_text(bin_header, &text);
+
 	printf("Quest: id=%d (%d, 0x%04x), episode=%d (0x%02x), download=%d, unknown=0x%02x, name=\"%s\"\n",
 	       bin_header->quest_number_byte,
 	       bin_header->quest_number_word,
@@ -176,6 +351,295 @@ void print_quick_quest_info(QUEST_BIN_HEADER *bin_header, size_t compressed_bin_
 	       bin_header->episode,
 	       bin_header->download,
 	       bin_header->unknown,
-	       bin_header->name);
+	       text.name);
 	printf("       compressed_bin_size=%ld, compressed_dat_size=%ld\n", compressed_bin_size, compressed_dat_size);
 }
+
+int read_next_qst_packet(FILE *fp, QST_HEADER *out_header_packet, QST_DATA_CHUNK *out_data_packet) {
+	size_t bytes_read;
+	PACKET_HEADER packet_header;
+
+	bytes_read = fread(&packet_header, 1, sizeof(PACKET_HEADER), fp);
+	if (bytes_read == 0 && feof(fp))
+		return PACKET_TYPE_EOF;
+	if (bytes_read != sizeof(PACKET_HEADER))
+		return PACKET_TYPE_ERROR;
+
+	if (packet_header.pkt_size == sizeof(QST_HEADER) &&
+	    (packet_header.pkt_id == PACKET_ID_QUEST_INFO_ONLINE ||
+	     packet_header.pkt_id == PACKET_ID_QUEST_INFO_DOWNLOAD)) {
+		memcpy(out_header_packet, &packet_header, sizeof(PACKET_HEADER));
+		size_t remaining_bytes = sizeof(QST_HEADER) - sizeof(PACKET_HEADER);
+		bytes_read = fread((uint8_t*)out_header_packet + sizeof(PACKET_HEADER), 1, remaining_bytes, fp);
+		if (bytes_read != remaining_bytes)
+			return PACKET_TYPE_ERROR;
+		else
+			return PACKET_TYPE_HEADER;
+
+	} else if (packet_header.pkt_size == sizeof(QST_DATA_CHUNK) &&
+	           (packet_header.pkt_id == PACKET_ID_QUEST_CHUNK_ONLINE ||
+	            packet_header.pkt_id == PACKET_ID_QUEST_CHUNK_DOWNLOAD)) {
+		memcpy(out_data_packet, &packet_header, sizeof(PACKET_HEADER));
+		size_t remaining_bytes = sizeof(QST_DATA_CHUNK) - sizeof(PACKET_HEADER);
+		bytes_read = fread((uint8_t*)out_data_packet + sizeof(PACKET_HEADER), 1, remaining_bytes, fp);
+		if (bytes_read != remaining_bytes)
+			return PACKET_TYPE_ERROR;
+		else
+			return PACKET_TYPE_DATA;
+
+	} else
+		return PACKET_TYPE_ERROR;
+}
+
+void qst_reassembler_init(QST_REASSEMBLER *reassembler) {
+	memset(reassembler, 0, sizeof(QST_REASSEMBLER));
+	reassembler->qst_type = QST_TYPE_NONE;
+}
+
+void qst_reassembler_free(QST_REASSEMBLER *reassembler) {
+	free(reassembler->bin_data);
+	free(reassembler->dat_data);
+	qst_reassembler_init(reassembler);
+}
+
+int qst_reassembler_add_header(QST_REASSEMBLER *reassembler, const QST_HEADER *header) {
+	uint8_t **data;
+	if (string_ends_with(header->filename, ".bin")) {
+		strncpy(reassembler->bin_filename, header->filename, QUEST_FILENAME_MAX_LENGTH);
+		reassembler->bin_length = header->size;
+		reassembler->bin_pos = 0;
+		data = &reassembler->bin_data;
+	} else if (string_ends_with(header->filename, ".dat")) {
+		strncpy(reassembler->dat_filename, header->filename, QUEST_FILENAME_MAX_LENGTH);
+		reassembler->dat_length = header->size;
+		reassembler->dat_pos = 0;
+		data = &reassembler->dat_data;
+	} else {
+		return ERROR_BAD_DATA;
+	}
+
+	free(*data);
+	*data = malloc(header->size ? header->size : 1);
+	if (!*data)
+		return ERROR_IO;
+
+	if (header->pkt_id == PACKET_ID_QUEST_INFO_ONLINE)
+		reassembler->qst_type = QST_TYPE_ONLINE;
+	else
+		reassembler->qst_type = QST_TYPE_DOWNLOAD;
+
+	return SUCCESS;
+}
+
+int qst_reassembler_add_chunk(QST_REASSEMBLER *reassembler, const QST_DATA_CHUNK *chunk) {
+	if (chunk->size > sizeof(chunk->data))
+		return ERROR_BAD_DATA;
+
+	if (reassembler->bin_data && strncmp(chunk->filename, reassembler->bin_filename, QUEST_FILENAME_MAX_LENGTH) == 0) {
+		if ((reassembler->bin_pos + chunk->size) > reassembler->bin_length)
+			return ERROR_BAD_DATA;
+		memcpy(reassembler->bin_data + reassembler->bin_pos, chunk->data, chunk->size);
+		reassembler->bin_pos += chunk->size;
+
+	} else if (reassembler->dat_data && strncmp(chunk->filename, reassembler->dat_filename, QUEST_FILENAME_MAX_LENGTH) == 0) {
+		if ((reassembler->dat_pos + chunk->size) > reassembler->dat_length)
+			return ERROR_BAD_DATA;
+		memcpy(reassembler->dat_data + reassembler->dat_pos, chunk->data, chunk->size);
+		reassembler->dat_pos += chunk->size;
+
+	} else {
+		return ERROR_BAD_DATA;
+	}
+
+	return SUCCESS;
+}
+
+// adds a single, complete, header or data chunk packet, of either the online or download variety
+int qst_reassembler_add_packet(QST_REASSEMBLER *reassembler, const uint8_t *packet, size_t size) {
+	if (size < sizeof(PACKET_HEADER))
+		return ERROR_BAD_DATA;
+
+	const PACKET_HEADER *header = (const PACKET_HEADER*)packet;
+	if (header->pkt_size != size)
+		return ERROR_BAD_DATA;
+
+	if (size == sizeof(QST_HEADER) &&
+	    (header->pkt_id == PACKET_ID_QUEST_INFO_ONLINE || header->pkt_id == PACKET_ID_QUEST_INFO_DOWNLOAD))
+		return qst_reassembler_add_header(reassembler, (const QST_HEADER*)packet);
+	else if (size == sizeof(QST_DATA_CHUNK) &&
+	         (header->pkt_id == PACKET_ID_QUEST_CHUNK_ONLINE || header->pkt_id == PACKET_ID_QUEST_CHUNK_DOWNLOAD))
+		return qst_reassembler_add_chunk(reassembler, (const QST_DATA_CHUNK*)packet);
+	else
+		return ERROR_BAD_DATA;
+}
+
+bool qst_reassembler_is_complete(const QST_REASSEMBLER *reassembler) {
+	return reassembler->bin_data &&
+	       reassembler->dat_data &&
+	       reassembler->bin_pos == reassembler->bin_length &&
+	       reassembler->dat_pos == reassembler->dat_length;
+}
+
+int load_quest_from_qst(const char *filename, uint8_t **out_bin_data, size_t *out_bin_length, uint8_t **out_dat_data, size_t *out_dat_length, int *out_qst_type) {
+	return load_quest_from_qst_ex(filename, out_bin_data, out_bin_length, out_dat_data, out_dat_length, out_qst_type, NULL, NULL);
+}
+
+/*
+ * The same as load_quest_from_qst, but also returns the .bin and .dat filenames given in the .qst file's headers, if
+ * out_bin_filename and out_dat_filename are not NULL. They must be at least QUEST_FILENAME_MAX_LENGTH+1 chars long.
+ */
+int load_quest_from_qst_ex(const char *filename,
+                           uint8_t **out_bin_data,
+                           size_t *out_bin_length,
+                           uint8_t **out_dat_data,
+                           size_t *out_dat_length,
+                           int *out_qst_type,
+                           char *out_bin_filename,
+                           char *out_dat_filename) {
+	int returncode;
+	FILE *fp = NULL;
+	QST_REASSEMBLER reassembler;
+	uint64_t start = stats_start();
+
+	qst_reassembler_init(&reassembler);
+
+	fp = fopen(filename, "rb");
+	if (!fp)
+		return ERROR_FILE_NOT_FOUND;
+
+	while (!feof(fp)) {
+		QST_HEADER header;
+		QST_DATA_CHUNK data;
+		int type = read_next_qst_packet(fp, &header, &data);
+
+		if (type == PACKET_TYPE_EOF && reassembler.bin_data && reassembler.dat_data)
+			break;
+
+		if (type == PACKET_TYPE_ERROR) {
+			returncode = ERROR_BAD_DATA;
+			goto error;
+
+		} else if (type == PACKET_TYPE_HEADER) {
+			returncode = qst_reassembler_add_header(&reassembler, &header);
+			if (returncode)
+				goto error;
+
+		} else if (type == PACKET_TYPE_DATA) {
+			returncode = qst_reassembler_add_chunk(&reassembler, &data);
+			if (returncode)
+				goto error;
+		}
+	}
+
+	fclose(fp);
+	stats_end(STATS_READ, start, reassembler.bin_length + reassembler.dat_length);
+
+	*out_bin_length = reassembler.bin_length;
+	*out_dat_length = reassembler.dat_length;
+	*out_bin_data = reassembler.bin_data;
+	*out_dat_data = reassembler.dat_data;
+	*out_qst_type = reassembler.qst_type;
+	if (out_bin_filename) {
+		memcpy(out_bin_filename, reassembler.bin_filename, QUEST_FILENAME_MAX_LENGTH);
+		out_bin_filename[QUEST_FILENAME_MAX_LENGTH] = '\0';
+	}
+	if (out_dat_filename) {
+		memcpy(out_dat_filename, reassembler.dat_filename, QUEST_FILENAME_MAX_LENGTH);
+		out_dat_filename[QUEST_FILENAME_MAX_LENGTH] = '\0';
+	}
+
+	return SUCCESS;
+
+error:
+	fclose(fp);
+	qst_reassembler_free(&reassembler);
+	return returncode;
+}
+
+int decrypt_qst_bindat(uint8_t *bin_data, size_t *bin_length, uint8_t *dat_data, size_t *dat_length) {
+	DOWNLOAD_QUEST_CHUNKS_HEADER *bin_dl_header = (DOWNLOAD_QUEST_CHUNKS_HEADER*)bin_data;
+	DOWNLOAD_QUEST_CHUNKS_HEADER *dat_dl_header = (DOWNLOAD_QUEST_CHUNKS_HEADER*)dat_data;
+
+	uint64_t start = stats_start();
+	CRYPT_SETUP bin_cs, dat_cs;
+	CRYPT_CreateKeys(&bin_cs, &bin_dl_header->crypt_key, CRYPT_PC);
+	CRYPT_CreateKeys(&dat_cs, &dat_dl_header->crypt_key, CRYPT_PC);
+
+	uint8_t *actual_bin_data = bin_data + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
+	uint8_t *actual_dat_data = dat_data + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
+	size_t decrypted_bin_length = *bin_length - sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
+	size_t decrypted_dat_length = *dat_length - sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER);
+	CRYPT_CryptData(&bin_cs, bin_data + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER), decrypted_bin_length, 0);
+	CRYPT_CryptData(&dat_cs, dat_data + sizeof(DOWNLOAD_QUEST_CHUNKS_HEADER), decrypted_dat_length, 0);
+	stats_end(STATS_DECRYPT, start, decrypted_bin_length + decrypted_dat_length);
+
+	memmove(bin_data, actual_bin_data, decrypted_bin_length);
+	memmove(dat_data, actual_dat_data, decrypted_dat_length);
+
+	*bin_length = decrypted_bin_length;
+	*dat_length = decrypted_dat_length;
+
+	return SUCCESS;
+}
+
+/*
+ * Only download .qst files say how large the decompressed .bin and .dat data really is. Otherwise, the real size has to
+ * be worked out from the data itself, to drop any junk that decompressing left on the end. These return the real size
+ * of the given decompressed data, which is the same as length unless there was some junk.
+ */
+
+// the .bin header has the real size in it
+size_t trim_decompressed_bin_junk(const uint8_t *data, size_t length) {
+	if (length < sizeof(QUEST_BIN_HEADER))
+		return length;
+
+	const QUEST_BIN_HEADER *header = (const QUEST_BIN_HEADER*)data;
+	if (header->bin_size < length && (length - header->bin_size) <= MAX_DECOMPRESSED_JUNK)
+		return header->bin_size;
+	return length;
+}
+
+// the .dat data always ends with an EOF marker table, so a few bytes that aren't a table right after one are never
+// part of the quest
+size_t trim_decompressed_dat_junk(const uint8_t *data, size_t length) {
+	size_t offset = 0;
+	while ((length - offset) >= sizeof(QUEST_DAT_TABLE_HEADER)) {
+		const QUEST_DAT_TABLE_HEADER *table_header = (const QUEST_DAT_TABLE_HEADER*)(data + offset);
+		offset += sizeof(QUEST_DAT_TABLE_HEADER);
+
+		if (table_header->type == 0 && table_header->table_body_size == 0)
+			return ((length - offset) <= MAX_DECOMPRESSED_JUNK) ? offset : length;
+		if (table_header->table_body_size > (length - offset))
+			break;
+		offset += table_header->table_body_size;
+	}
+
+	return length;
+}
+
+int load_quest_from_bindat(const char *bin_filename, const char *dat_filename, uint8_t **out_bin_data, size_t *out_bin_length, uint8_t **out_dat_data, size_t *out_dat_length) {
+	int returncode;
+	uint8_t *bin_data = NULL;
+	uint8_t *dat_data = NULL;
+	uint32_t bin_data_length, dat_data_length;
+
+	returncode = read_file(bin_filename, &bin_data, &bin_data_length);
+	if (returncode)
+		goto error;
+
+	returncode = read_file(dat_filename, &dat_data, &dat_data_length);
+	if (returncode)
+		goto error;
+
+	*out_bin_length = bin_data_length;
+	*out_dat_length = dat_data_length;
+	*out_bin_data = bin_data;
+	*out_dat_data = dat_data;
+
+	return SUCCESS;
+
+error:
+	free(bin_data);
+	free(dat_data);
+	return returncode;
+}
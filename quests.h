@@ -6,6 +6,8 @@
 #include <stdbool.h>
 
 #include "defs.h"
+#include "textconv.h"
+#include "arena.h"
 
 #define QUESTBIN_ERROR_OBJECT_CODE_OFFSET  1
 #define QUESTBIN_ERROR_LARGER_BIN_SIZE     2
@@ -24,6 +26,24 @@
 
 #define QUEST_FILENAME_MAX_LENGTH      16
 
+#define PACKET_TYPE_ERROR  0
+#define PACKET_TYPE_HEADER 1
+#define PACKET_TYPE_DATA   2
+#define PACKET_TYPE_EOF    4   // not really a packet type, lol
+
+#define QST_TYPE_NONE     0
+#define QST_TYPE_ONLINE   1
+#define QST_TYPE_DOWNLOAD 2
+
+// PRS decompression can leave up to this many bytes of junk after the end of the real data (see fuzziqer_prs.c)
+#define MAX_DECOMPRESSED_JUNK          2
+
+typedef struct _PACKED_ {
+	uint8_t pkt_id;
+	uint8_t pkt_flags;
+	uint16_t pkt_size;
+} PACKET_HEADER;
+
 // decompressed quest .bin file header
 typedef struct _PACKED_ {
 	uint32_t object_code_offset;
@@ -59,6 +79,13 @@ typedef struct _PACKED_ {
 	char long_description[288];
 } QUEST_BIN_HEADER;
 
+// UTF-8 converted copies of the Shift-JIS text fields from a QUEST_BIN_HEADER
+typedef struct {
+	char name[SJIS_TO_UTF8_MAX_SIZE(32)];
+	char short_description[SJIS_TO_UTF8_MAX_SIZE(128)];
+	char long_description[SJIS_TO_UTF8_MAX_SIZE(288)];
+} QUEST_BIN_HEADER_TEXT;
+
 // decompressed quest .dat file table header
 typedef struct _PACKED_ {
 	uint32_t type;
@@ -67,6 +94,61 @@ typedef struct _PACKED_ {
 	uint32_t table_body_size;
 } QUEST_DAT_TABLE_HEADER;
 
+#define QUEST_DAT_TABLE_OBJECTS        1
+#define QUEST_DAT_TABLE_NPCS           2
+#define QUEST_DAT_TABLE_EVENTS         3
+
+// .dat object table entry. the meaning of most of the params depends on the object type (skin)
+typedef struct _PACKED_ {
+	uint16_t skin;
+	uint16_t unknown1;
+	uint32_t unknown2;
+	uint16_t id;
+	uint16_t group;
+	uint16_t section;
+	uint16_t unknown3;
+	float x, y, z;
+	uint32_t rotation_x, rotation_y, rotation_z;
+	float param1, param2, param3;
+	uint32_t param4, param5, param6;
+	uint32_t unknown4;
+} QUEST_DAT_OBJECT;
+
+// .dat NPC (monsters and townspeople) table entry
+typedef struct _PACKED_ {
+	uint16_t skin;
+	uint16_t unknown1;
+	uint32_t unknown2;
+	uint16_t num_children;
+	uint16_t floor;
+	uint32_t entity_id;
+	uint16_t section;
+	uint16_t wave_number;
+	uint32_t wave_number2;
+	float x, y, z;
+	uint32_t rotation_x, rotation_y, rotation_z;
+	float param1, param2, param3, param4;
+	uint32_t param5, param6;
+} QUEST_DAT_NPC;
+
+// .dat wave/event table body: this header, then entry_count QUEST_DAT_EVENTs, then the action stream they refer to
+typedef struct _PACKED_ {
+	uint32_t action_stream_offset;
+	uint32_t entries_offset;
+	uint32_t entry_count;
+	uint32_t format;
+} QUEST_DAT_EVENTS_HEADER;
+
+typedef struct _PACKED_ {
+	uint32_t event_id;
+	uint16_t flags;
+	uint16_t unknown1;
+	uint16_t section;
+	uint16_t wave_number;
+	uint32_t delay;
+	uint32_t action_offset;        // relative to the start of the action stream
+} QUEST_DAT_EVENT;
+
 // .qst file header, for either the embedded bin or dat quest data (there should be two of these per .qst file).
 typedef struct _PACKED_ {
 	// 0xA6 = download to memcard, 0x44 = download for online play
@@ -111,12 +193,61 @@ typedef struct _PACKED_ {
 	uint32_t crypt_key;
 } DOWNLOAD_QUEST_CHUNKS_HEADER;
 
+// collects the .bin and .dat file data back out of a sequence of .qst header and data chunk packets, whether they
+// are being read from a .qst file or received over the network
+typedef struct {
+	char bin_filename[QUEST_FILENAME_MAX_LENGTH];
+	char dat_filename[QUEST_FILENAME_MAX_LENGTH];
+	uint8_t *bin_data;
+	uint8_t *dat_data;
+	size_t bin_length, dat_length;
+	size_t bin_pos, dat_pos;
+	int qst_type;
+} QST_REASSEMBLER;
+
 int generate_qst_header(const char *src_file, size_t src_file_size, const QUEST_BIN_HEADER *bin_header, QST_HEADER *out_header);
+int generate_qst_header_ex(const char *src_file, size_t src_file_size, const QUEST_BIN_HEADER *bin_header, int qst_type, QST_HEADER *out_header);
 int generate_qst_data_chunk(const char *base_filename, uint8_t counter, const uint8_t *src, uint32_t size, QST_DATA_CHUNK *out_chunk);
+int generate_qst_data_chunk_ex(const char *base_filename, uint8_t counter, const uint8_t *src, uint32_t size, int qst_type, QST_DATA_CHUNK *out_chunk);
+int write_qst_file(const char *filename,
+                   const char *bin_base_filename,
+                   const char *dat_base_filename,
+                   const QUEST_BIN_HEADER *bin_header,
+                   const uint8_t *bin_data,
+                   size_t bin_size,
+                   const uint8_t *dat_data,
+                   size_t dat_size,
+                   int qst_type);
 int validate_quest_bin(const QUEST_BIN_HEADER *header, uint32_t length, bool print_errors);
 int validate_quest_dat(const uint8_t *data, uint32_t length, bool print_errors);
 int handle_quest_bin_validation_issues(int bin_validation_result, QUEST_BIN_HEADER *bin_header, uint8_t **decompressed_bin_data, size_t *decompressed_bin_length);
+int handle_quest_bin_validation_issues_ex(int bin_validation_result, QUEST_BIN_HEADER *bin_header, uint8_t **decompressed_bin_data, size_t *decompressed_bin_length, bool print_warnings, ARENA *arena);
 int handle_quest_dat_validation_issues(int dat_validation_result, uint8_t **decompressed_dat_data, size_t *decompressed_dat_length);
+int handle_quest_dat_validation_issues_ex(int dat_validation_result, uint8_t **decompressed_dat_data, size_t *decompressed_dat_length, bool print_warnings);
+int get_quest_bin_header_text(const QUEST_BIN_HEADER *header, QUEST_BIN_HEADER_TEXT *out_text);
+int set_quest_bin_header_text(QUEST_BIN_HEADER *header, const char *name, const char *short_description, const char *long_description);
+int set_qst_header_name(QST_HEADER *header, const char *name);
 void print_quick_quest_info(QUEST_BIN_HEADER *bin_header, size_t compressed_bin_size, size_t compressed_dat_size);
 
+int read_next_qst_packet(FILE *fp, QST_HEADER *out_header_packet, QST_DATA_CHUNK *out_data_packet);
+void qst_reassembler_init(QST_REASSEMBLER *reassembler);
+void qst_reassembler_free(QST_REASSEMBLER *reassembler);
+int qst_reassembler_add_header(QST_REASSEMBLER *reassembler, const QST_HEADER *header);
+int qst_reassembler_add_chunk(QST_REASSEMBLER *reassembler, const QST_DATA_CHUNK *chunk);
+int qst_reassembler_add_packet(QST_REASSEMBLER *reassembler, const uint8_t *packet, size_t size);
+bool qst_reassembler_is_complete(const QST_REASSEMBLER *reassembler);
+int load_quest_from_qst(const char *filename, uint8_t **out_bin_data, size_t *out_bin_length, uint8_t **out_dat_data, size_t *out_dat_length, int *out_qst_type);
+int load_quest_from_qst_ex(const char *filename,
+                           uint8_t **out_bin_data,
+                           size_t *out_bin_length,
+                           uint8_t **out_dat_data,
+                           size_t *out_dat_length,
+                           int *out_qst_type,
+                           char *out_bin_filename,
+                           char *out_dat_filename);
+int decrypt_qst_bindat(uint8_t *bin_data, size_t *bin_length, uint8_t *dat_data, size_t *dat_length);
+size_t trim_decompressed_bin_junk(const uint8_t *data, size_t length);
+size_t trim_decompressed_dat_junk(const uint8_t *data, size_t length);
+int load_quest_from_bindat(const char *bin_filename, const char *dat_filename, uint8_t **out_bin_data, size_t *out_bin_length, uint8_t **out_dat_data, size_t *out_dat_length);
+
 #endif
@@ -7,5 +7,9 @@
 #define ERROR_CREATING_FILE            3
 #define ERROR_BAD_DATA                 4
 #define ERROR_IO                       5
+#define ERROR_TRUNCATED                6
+#define ERROR_NETWORK                  7
+#define ERROR_NOT_FOUND                8
+#define ERROR_NO_SPACE                 9
 
 #endif
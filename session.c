@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <sylverant/encryption.h>
+
+#include "retvals.h"
+#include "quests.h"
+#include "stats.h"
+#include "session.h"
+
+static int send_all(int fd, const void *data, size_t size) {
+	const uint8_t *p = (const uint8_t*)data;
+	while (size > 0) {
+		ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return ERROR_NETWORK;
+		}
+		p += sent;
+		size -= sent;
+	}
+	return SUCCESS;
+}
+
+static int recv_all(int fd, void *data, size_t size) {
+	uint8_t *p = (uint8_t*)data;
+	while (size > 0) {
+		ssize_t received = recv(fd, p, size, 0);
+		if (received < 0) {
+			if (errno == EINTR)
+				continue;
+			return ERROR_NETWORK;
+		}
+		if (received == 0)
+			return ERROR_NETWORK;    // connection closed
+		p += received;
+		size -= received;
+	}
+	return SUCCESS;
+}
+
+// packets are small and sent one at a time, so don't let them sit around waiting to be combined with the next one
+static void set_nodelay(int fd) {
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+}
+
+/*
+ * Sends the unencrypted "Welcome" packet with the given keys to a newly connected client and sets up the session's
+ * crypt state to match.
+ */
+int session_accept(int fd, uint32_t server_key, uint32_t client_key, SESSION *out_session) {
+	if (fd < 0 || !out_session)
+		return ERROR_INVALID_PARAMS;
+
+	set_nodelay(fd);
+
+	WELCOME_PACKET welcome;
+	memset(&welcome, 0, sizeof(welcome));
+	welcome.header.pkt_id = PACKET_ID_WELCOME_PATCH;
+	welcome.header.pkt_size = sizeof(WELCOME_PACKET);
+	strncpy(welcome.message, SESSION_WELCOME_MESSAGE, sizeof(welcome.message));
+	welcome.server_key = server_key;
+	welcome.client_key = client_key;
+
+	int returncode = send_all(fd, &welcome, sizeof(welcome));
+	if (returncode)
+		return returncode;
+
+	memset(out_session, 0, sizeof(SESSION));
+	out_session->fd = fd;
+	out_session->bytes_sent = sizeof(welcome);
+	CRYPT_CreateKeys(&out_session->send_cs, &server_key, CRYPT_GAMECUBE);
+	CRYPT_CreateKeys(&out_session->recv_cs, &client_key, CRYPT_GAMECUBE);
+	return SUCCESS;
+}
+
+/*
+ * Reads the "Welcome" packet that the server sends right after connecting, and sets up the session's crypt state
+ * using the keys in it.
+ */
+int session_connect(int fd, SESSION *out_session) {
+	if (fd < 0 || !out_session)
+		return ERROR_INVALID_PARAMS;
+
+	uint8_t buffer[SESSION_MAX_PACKET_SIZE];
+	WELCOME_PACKET *welcome = (WELCOME_PACKET*)buffer;
+
+	set_nodelay(fd);
+
+	int returncode = recv_all(fd, &welcome->header, sizeof(PACKET_HEADER));
+	if (returncode)
+		return returncode;
+	if (!session_is_welcome_packet(&welcome->header))
+		return ERROR_BAD_DATA;
+
+	// any extra text after the keys is read and ignored
+	returncode = recv_all(fd, buffer + sizeof(PACKET_HEADER), welcome->header.pkt_size - sizeof(PACKET_HEADER));
+	if (returncode)
+		return returncode;
+
+	session_init_client(fd, welcome, out_session);
+	return SUCCESS;
+}
+
+/*
+ * Sets up a client session's crypt state from an already received "Welcome" packet.
+ */
+void session_init_client(int fd, const WELCOME_PACKET *welcome, SESSION *out_session) {
+	uint32_t server_key = welcome->server_key;
+	uint32_t client_key = welcome->client_key;
+
+	memset(out_session, 0, sizeof(SESSION));
+	out_session->fd = fd;
+	out_session->bytes_received = welcome->header.pkt_size;
+	CRYPT_CreateKeys(&out_session->send_cs, &client_key, CRYPT_GAMECUBE);
+	CRYPT_CreateKeys(&out_session->recv_cs, &server_key, CRYPT_GAMECUBE);
+}
+
+bool session_is_welcome_packet(const PACKET_HEADER *header) {
+	return (header->pkt_id == PACKET_ID_WELCOME || header->pkt_id == PACKET_ID_WELCOME_PATCH) &&
+	       header->pkt_size >= sizeof(WELCOME_PACKET);
+}
+
+void session_close(SESSION *session) {
+	if (!session || session->fd < 0)
+		return;
+
+	close(session->fd);
+	session->fd = -1;
+}
+
+/*
+ * Encrypts a copy of a single packet into out (which must be at least size bytes), advancing the session's send crypt
+ * state. Gamecube encryption works on 4 bytes at a time, so the packet size must be a multiple of 4.
+ */
+int session_encrypt_packet(SESSION *session, const void *packet, size_t size, uint8_t *out) {
+	if (!session || !packet || !out || size < sizeof(PACKET_HEADER) || size > SESSION_MAX_PACKET_SIZE || (size % 4) != 0)
+		return ERROR_INVALID_PARAMS;
+
+	memcpy(out, packet, size);
+
+	uint64_t start = stats_start();
+	CRYPT_CryptData(&session->send_cs, out, size, 1);
+	stats_end(STATS_ENCRYPT, start, size);
+
+	return SUCCESS;
+}
+
+/*
+ * Decrypts received data in-place, advancing the session's receive crypt state. The header of each packet can be
+ * decrypted on its own first (to find out how much more there is to read), and then the rest of the packet. The
+ * crypt state just carries on from one call to the next, so this is the same as decrypting it all at once.
+ */
+void session_decrypt_data(SESSION *session, uint8_t *data, size_t size) {
+	uint64_t start = stats_start();
+	CRYPT_CryptData(&session->recv_cs, data, size, 0);
+	stats_end(STATS_DECRYPT, start, size);
+}
+
+/*
+ * Encrypts and sends a single packet. The given packet data is left as-is (a copy of it is encrypted).
+ */
+int session_send_packet(SESSION *session, const void *packet, size_t size) {
+	if (!session || !packet || size < sizeof(PACKET_HEADER) || size > SESSION_MAX_PACKET_SIZE)
+		return ERROR_INVALID_PARAMS;
+
+	uint8_t buffer[size];
+	int returncode = session_encrypt_packet(session, packet, size, buffer);
+	if (returncode)
+		return returncode;
+
+	returncode = send_all(session->fd, buffer, size);
+	if (returncode)
+		return returncode;
+
+	session->bytes_sent += size;
+	return SUCCESS;
+}
+
+/*
+ * Receives and decrypts a single packet into the given buffer, which must be large enough to hold it.
+ */
+int session_recv_packet(SESSION *session, uint8_t *buffer, size_t buffer_size, size_t *out_size) {
+	if (!session || !buffer || buffer_size < sizeof(PACKET_HEADER) || !out_size)
+		return ERROR_INVALID_PARAMS;
+
+	int returncode = recv_all(session->fd, buffer, sizeof(PACKET_HEADER));
+	if (returncode)
+		return returncode;
+
+	session_decrypt_data(session, buffer, sizeof(PACKET_HEADER));
+
+	PACKET_HEADER *header = (PACKET_HEADER*)buffer;
+	size_t size = header->pkt_size;
+	if (size < sizeof(PACKET_HEADER) || size > buffer_size || (size % 4) != 0)
+		return ERROR_BAD_DATA;
+
+	size_t remaining = size - sizeof(PACKET_HEADER);
+	if (remaining) {
+		returncode = recv_all(session->fd, buffer + sizeof(PACKET_HEADER), remaining);
+		if (returncode)
+			return returncode;
+
+		session_decrypt_data(session, buffer + sizeof(PACKET_HEADER), remaining);
+	}
+
+	session->bytes_received += size;
+	*out_size = size;
+	return SUCCESS;
+}
+
+/*
+ * Sends every packet from the given .qst file data, in the same order they are in the file. A .qst file is really
+ * nothing more than the packets a server sends to a client for that quest.
+ */
+int session_send_qst(SESSION *session, const uint8_t *qst_data, size_t qst_size) {
+	if (!session || !qst_data)
+		return ERROR_INVALID_PARAMS;
+
+	size_t pos = 0;
+	while (pos < qst_size) {
+		if ((qst_size - pos) < sizeof(PACKET_HEADER))
+			return ERROR_BAD_DATA;
+
+		const PACKET_HEADER *header = (const PACKET_HEADER*)(qst_data + pos);
+		if (header->pkt_size < sizeof(PACKET_HEADER) || header->pkt_size > (qst_size - pos))
+			return ERROR_BAD_DATA;
+
+		int returncode = session_send_packet(session, header, header->pkt_size);
+		if (returncode)
+			return returncode;
+
+		pos += header->pkt_size;
+	}
+
+	return SUCCESS;
+}
+
+/*
+ * Receives .qst header and data chunk packets until both the .bin and .dat file data has been completely received.
+ */
+int session_recv_qst(SESSION *session, QST_REASSEMBLER *reassembler) {
+	if (!session || !reassembler)
+		return ERROR_INVALID_PARAMS;
+
+	uint8_t buffer[sizeof(QST_DATA_CHUNK)];
+	size_t size;
+
+	while (!qst_reassembler_is_complete(reassembler)) {
+		int returncode = session_recv_packet(session, buffer, sizeof(buffer), &size);
+		if (returncode)
+			return returncode;
+
+		returncode = qst_reassembler_add_packet(reassembler, buffer, size);
+		if (returncode)
+			return returncode;
+	}
+
+	return SUCCESS;
+}
+
+/*
+ * Returns a socket listening on the given host (or all interfaces, if NULL) and port, or -1 on error.
+ */
+int session_listen(const char *host, const char *port) {
+	struct addrinfo hints, *addresses, *address;
+	int fd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(host, port, &hints, &addresses))
+		return -1;
+
+	for (address = addresses; address; address = address->ai_next) {
+		fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		int reuse = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if (!bind(fd, address->ai_addr, address->ai_addrlen) && !listen(fd, SOMAXCONN))
+			break;
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(addresses);
+	return fd;
+}
+
+/*
+ * Returns a socket connected to the given host and port, or -1 on error.
+ */
+int session_dial(const char *host, const char *port) {
+	struct addrinfo hints, *addresses, *address;
+	int fd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &addresses))
+		return -1;
+
+	for (address = addresses; address; address = address->ai_next) {
+		fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		if (!connect(fd, address->ai_addr, address->ai_addrlen))
+			break;
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(addresses);
+	return fd;
+}
+
+/*
+ * Raises the limit on the number of open files (and so, sockets) to the maximum allowed, for servers and clients that
+ * have many connections open at once. Returns the new limit.
+ */
+int session_raise_open_file_limit(void) {
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit))
+		return -1;
+
+	if (limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+		getrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	return (limit.rlim_cur > INT32_MAX) ? INT32_MAX : (int)limit.rlim_cur;
+}
@@ -0,0 +1,71 @@
+#ifndef SESSION_H_INCLUDED
+#define SESSION_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sylverant/encryption.h>
+
+#include "defs.h"
+#include "quests.h"
+
+/*
+ * A minimal Gamecube PSO client/server session over a TCP socket. Just enough of the protocol to hand out quests:
+ *
+ * 1. Upon connecting, the server sends an unencrypted "Welcome" packet containing the server and client crypt keys.
+ * 2. Every packet after that is encrypted using the Gamecube crypt method. Server->client packets use the server
+ *    key, and client->server packets use the client key.
+ *
+ * Note that the crypt state carries on from one packet to the next, so every packet sent or received on a session
+ * must go through session_send_packet() / session_recv_packet() in order.
+ */
+
+#define PACKET_ID_WELCOME              0x02
+#define PACKET_ID_WELCOME_PATCH        0x17
+#define PACKET_ID_MENU_SELECT          0x10
+
+#define SESSION_MAX_PACKET_SIZE        0xffff
+#define SESSION_WELCOME_MESSAGE        "DreamCast Port Map. Copyright SEGA Enterprises. 1999"
+
+typedef struct _PACKED_ {
+	PACKET_HEADER header;
+	char message[64];
+	uint32_t server_key;
+	uint32_t client_key;
+	// note: there may be more data. if so, it is likely just more text which can be ignored. check header.pkt_size
+} WELCOME_PACKET;
+
+// sent by the client when picking an item from a menu (e.g. a quest from the quest list)
+typedef struct _PACKED_ {
+	PACKET_HEADER header;
+	uint32_t menu_id;
+	uint32_t item_id;
+} MENU_SELECT_PACKET;
+
+typedef struct {
+	int fd;
+	CRYPT_SETUP send_cs;
+	CRYPT_SETUP recv_cs;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+} SESSION;
+
+int session_accept(int fd, uint32_t server_key, uint32_t client_key, SESSION *out_session);
+int session_connect(int fd, SESSION *out_session);
+void session_init_client(int fd, const WELCOME_PACKET *welcome, SESSION *out_session);
+bool session_is_welcome_packet(const PACKET_HEADER *header);
+void session_close(SESSION *session);
+
+int session_encrypt_packet(SESSION *session, const void *packet, size_t size, uint8_t *out);
+void session_decrypt_data(SESSION *session, uint8_t *data, size_t size);
+int session_send_packet(SESSION *session, const void *packet, size_t size);
+int session_recv_packet(SESSION *session, uint8_t *buffer, size_t buffer_size, size_t *out_size);
+
+int session_send_qst(SESSION *session, const uint8_t *qst_data, size_t qst_size);
+int session_recv_qst(SESSION *session, QST_REASSEMBLER *reassembler);
+
+int session_listen(const char *host, const char *port);
+int session_dial(const char *host, const char *port);
+int session_raise_open_file_limit(void);
+
+#endif
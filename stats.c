@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+static const char *stage_names[] = {
+		"read",                        // STATS_READ
+		"prs_decode",                  // STATS_PRS_DECODE
+		"prs_decode (cached)",         // STATS_PRS_DECODE_CACHED
+		"prs_encode",                  // STATS_PRS_ENCODE
+		"decrypt",                     // STATS_DECRYPT
+		"encrypt",                     // STATS_ENCRYPT
+		"validate",                    // STATS_VALIDATE
+		"write",                       // STATS_WRITE
+		NULL
+};
+
+static bool enabled = false;
+static uint64_t enabled_time = 0;
+static STATS_COUNTER counters[STATS_NUM_STAGES];
+static STATS_SPAN_CALLBACK span_callback = NULL;
+
+/*
+ * Looks for (and removes) the "--stats" argument from the given command line arguments, enabling stats collection
+ * if it was found. Stats are then displayed automatically when the program exits.
+ */
+bool stats_parse_args(int *argc, char *argv[]) {
+	bool found = false;
+
+	for (int i = 1; i < *argc; ) {
+		if (!strcmp(argv[i], STATS_ARG)) {
+			found = true;
+			memmove(&argv[i], &argv[i + 1], (*argc - i) * sizeof(char*));
+			--(*argc);
+		} else {
+			++i;
+		}
+	}
+
+	if (found) {
+		stats_enable();
+		atexit(stats_print);
+	}
+
+	return found;
+}
+
+void stats_enable(void) {
+	enabled = true;
+	enabled_time = stats_get_time();
+}
+
+bool stats_is_enabled(void) {
+	return enabled;
+}
+
+uint64_t stats_get_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t stats_start(void) {
+	if (!enabled && !span_callback)
+		return 0;
+
+	return stats_get_time();
+}
+
+void stats_end(int stage, uint64_t start, uint64_t bytes) {
+	if ((!enabled && !span_callback) || stage < 0 || stage >= STATS_NUM_STAGES)
+		return;
+
+	uint64_t end = stats_get_time();
+	if (span_callback && start)
+		span_callback(stage, start, end, bytes);
+	if (!enabled)
+		return;
+
+	uint64_t elapsed = end - start;
+	STATS_COUNTER *counter = &counters[stage];
+	__atomic_fetch_add(&counter->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counter->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&counter->nanoseconds, elapsed, __ATOMIC_RELAXED);
+}
+
+void stats_get_counter(int stage, STATS_COUNTER *out_counter) {
+	if (stage < 0 || stage >= STATS_NUM_STAGES || !out_counter)
+		return;
+
+	out_counter->calls = __atomic_load_n(&counters[stage].calls, __ATOMIC_RELAXED);
+	out_counter->bytes = __atomic_load_n(&counters[stage].bytes, __ATOMIC_RELAXED);
+	out_counter->nanoseconds = __atomic_load_n(&counters[stage].nanoseconds, __ATOMIC_RELAXED);
+}
+
+const char* stats_get_stage_name(int stage) {
+	if (stage < 0 || stage >= STATS_NUM_STAGES)
+		return "unknown";
+
+	return stage_names[stage];
+}
+
+void stats_print(void) {
+	if (!enabled)
+		return;
+
+	double total_ms = (stats_get_time() - enabled_time) / 1000000.0;
+
+	printf("\n");
+	printf("STAGE                       CALLS          BYTES      TIME (ms)    MB/s    %% WALL\n");
+	printf("==================================================================================\n");
+	for (int i = 0; i < STATS_NUM_STAGES; ++i) {
+		STATS_COUNTER counter;
+		stats_get_counter(i, &counter);
+		if (!counter.calls)
+			continue;
+
+		double ms = counter.nanoseconds / 1000000.0;
+		double mb_per_sec = counter.nanoseconds ? ((counter.bytes / (1024.0 * 1024.0)) / (counter.nanoseconds / 1000000000.0)) : 0.0;
+		printf("%-20s %12llu %14llu %14.3f %7.1f %8.1f%%\n",
+		       stage_names[i],
+		       (unsigned long long)counter.calls,
+		       (unsigned long long)counter.bytes,
+		       ms,
+		       mb_per_sec,
+		       total_ms > 0.0 ? (ms / total_ms) * 100.0 : 0.0);
+	}
+	printf("----------------------------------------------------------------------------------\n");
+	printf("%-20s %12s %14s %14.3f\n", "total (wall clock)", "", "", total_ms);
+	printf("(stage times are summed over all threads, so can add up to more than the wall clock time)\n");
+}
+
+// note: this should be set before any worker threads are started
+void stats_set_span_callback(STATS_SPAN_CALLBACK callback) {
+	span_callback = callback;
+}
@@ -0,0 +1,55 @@
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Lightweight per-stage timing and counters, enabled in any tool by passing "--stats". When enabled, the number of
+ * calls, bytes processed and total time spent in each stage is displayed when the tool exits.
+ *
+ * Usage around any instrumented operation is simply:
+ *
+ *     uint64_t start = stats_start();
+ *     ... do the work ...
+ *     stats_end(STATS_PRS_DECODE, start, number_of_bytes);
+ *
+ * Both calls are very cheap when stats are not enabled. Counters are updated atomically so they can be used from
+ * multiple threads.
+ *
+ * A span callback can also be set, which gets called at the end of every instrumented operation regardless of
+ * whether stats are enabled (this is how the trace output gets per-stage spans, see trace.h).
+ */
+
+#define STATS_READ                     0
+#define STATS_PRS_DECODE               1
+#define STATS_PRS_DECODE_CACHED        2
+#define STATS_PRS_ENCODE               3
+#define STATS_DECRYPT                  4
+#define STATS_ENCRYPT                  5
+#define STATS_VALIDATE                 6
+#define STATS_WRITE                    7
+#define STATS_NUM_STAGES               8
+
+#define STATS_ARG                      "--stats"
+
+typedef void (*STATS_SPAN_CALLBACK)(int stage, uint64_t start, uint64_t end, uint64_t bytes);
+
+typedef struct {
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t nanoseconds;
+} STATS_COUNTER;
+
+bool stats_parse_args(int *argc, char *argv[]);
+void stats_enable(void);
+bool stats_is_enabled(void);
+uint64_t stats_get_time(void);
+uint64_t stats_start(void);
+void stats_end(int stage, uint64_t start, uint64_t bytes);
+void stats_get_counter(int stage, STATS_COUNTER *out_counter);
+const char* stats_get_stage_name(int stage);
+void stats_print(void);
+void stats_set_span_callback(STATS_SPAN_CALLBACK callback);
+
+#endif
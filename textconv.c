@@ -1,32 +1,282 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
-#include <malloc.h>
 
-#include <iconv.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "textconv.h"
 #include "retvals.h"
+#include "sjis_tables.h"
 
-int sjis_to_utf8(char *s, size_t length) {
-	if (!s)
+// substituted for any Shift-JIS character which cannot be mapped to unicode
+#define INVALID_CHAR_REPLACEMENT       '?'
+
+static inline int is_sjis_lead_byte(uint8_t c) {
+	return (c >= 0x81 && c <= 0x9f) || (c >= 0xe0 && c <= 0xfc);
+}
+
+// returns the unicode code point for the given double-byte Shift-JIS character, or 0 if there is no mapping for it
+static uint16_t sjis_double_byte_to_unicode(uint8_t lead, uint8_t trail) {
+	if (trail < 0x40 || trail == 0x7f || trail > 0xfc)
+		return 0;
+
+	// every Shift-JIS lead byte covers two consecutive JIS X 0208 rows, the trail byte selects which one
+	int lead_index = (lead <= 0x9f) ? (lead - 0x81) : (lead - 0xc1);
+	int row, cell;
+	if (trail >= 0x9f) {
+		row = (lead_index * 2) + 1;
+		cell = trail - 0x9f;
+	} else {
+		row = lead_index * 2;
+		cell = trail - ((trail >= 0x80) ? 0x41 : 0x40);
+	}
+
+	// lead bytes 0xf0-0xfc are the "user defined" area, which is outside of JIS X 0208 entirely
+	if (row >= JIS0208_ROW_COUNT)
+		return 0;
+
+	uint8_t index = jis0208_row_index[row];
+	if (index == JIS0208_UNASSIGNED_ROW)
+		return 0;
+
+	return jis0208_to_unicode[index][cell];
+}
+
+/*
+ * Copies the run of 7-bit ASCII characters (which are the same in both Shift-JIS and UTF-8) found at the start of src
+ * to dst, stopping at the first non-ASCII byte, the first null byte, or when either buffer runs out. Quest text is
+ * mostly plain ASCII, so when SSE2 is available this copies 16 bytes at a time. Returns the number of bytes copied.
+ */
+static size_t copy_ascii_run(const uint8_t *src, size_t src_length, char *dst, size_t dst_length) {
+	size_t length = (src_length < dst_length) ? src_length : dst_length;
+	size_t pos = 0;
+
+#if defined(__SSE2__)
+	while ((length - pos) >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)(src + pos));
+		int stop_mask = _mm_movemask_epi8(chunk) | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_setzero_si128()));
+		if (stop_mask) {
+			int ascii_length = __builtin_ctz(stop_mask);
+			memcpy(dst + pos, src + pos, ascii_length);
+			return pos + ascii_length;
+		}
+
+		_mm_storeu_si128((__m128i*)(dst + pos), chunk);
+		pos += 16;
+	}
+#endif
+
+	while (pos < length && src[pos] != 0 && src[pos] < 0x80) {
+		dst[pos] = (char)src[pos];
+		++pos;
+	}
+
+	return pos;
+}
+
+static size_t encode_utf8(uint16_t codepoint, char *out) {
+	if (codepoint < 0x80) {
+		out[0] = (char)codepoint;
+		return 1;
+	} else if (codepoint < 0x800) {
+		out[0] = (char)(0xc0 | (codepoint >> 6));
+		out[1] = (char)(0x80 | (codepoint & 0x3f));
+		return 2;
+	} else {
+		out[0] = (char)(0xe0 | (codepoint >> 12));
+		out[1] = (char)(0x80 | ((codepoint >> 6) & 0x3f));
+		out[2] = (char)(0x80 | (codepoint & 0x3f));
+		return 3;
+	}
+}
+
+/*
+ * Converts a Shift-JIS string to UTF-8 without allocating any memory. Conversion stops at the first null byte or once
+ * src_length bytes have been read, whichever comes first (so fixed-size fields like those in QUEST_BIN_HEADER can be
+ * passed in directly with their field size as src_length). The output is always null terminated. If dst_size is too
+ * small, the output is truncated on a character boundary and ERROR_TRUNCATED is returned. Use SJIS_TO_UTF8_MAX_SIZE to
+ * size dst to avoid that.
+ *
+ * Any characters that cannot be mapped are replaced with '?'.
+ */
+int sjis_to_utf8(const char *src, size_t src_length, char *dst, size_t dst_size, size_t *out_length) {
+	if (!src || !dst || dst_size == 0)
+		return ERROR_INVALID_PARAMS;
+
+	const uint8_t *in = (const uint8_t*)src;
+	size_t in_pos = 0;
+	size_t out_pos = 0;
+	size_t out_max = dst_size - 1;  // leave room for the null terminator
+	int result = SUCCESS;
+
+	while (in_pos < src_length) {
+		size_t ascii_run = copy_ascii_run(in + in_pos, src_length - in_pos, dst + out_pos, out_max - out_pos);
+		in_pos += ascii_run;
+		out_pos += ascii_run;
+		if (in_pos >= src_length)
+			break;
+
+		uint8_t c = in[in_pos];
+		if (c == 0)
+			break;
+
+		char encoded[3];
+		size_t encoded_length;
+
+		if (c < 0x80) {
+			encoded[0] = (char)c;
+			encoded_length = 1;
+			in_pos += 1;
+		} else if (c >= 0xa1 && c <= 0xdf) {
+			// half-width katakana map directly onto U+FF61 - U+FF9F
+			encoded_length = encode_utf8(0xff61 + (c - 0xa1), encoded);
+			in_pos += 1;
+		} else if (is_sjis_lead_byte(c) && (in_pos + 1) < src_length && in[in_pos + 1] != 0) {
+			uint16_t codepoint = sjis_double_byte_to_unicode(c, in[in_pos + 1]);
+			if (codepoint) {
+				encoded_length = encode_utf8(codepoint, encoded);
+			} else {
+				encoded[0] = INVALID_CHAR_REPLACEMENT;
+				encoded_length = 1;
+			}
+			in_pos += 2;
+		} else {
+			// stray trail byte, truncated double-byte character at the end of the string, or an unused byte value
+			encoded[0] = INVALID_CHAR_REPLACEMENT;
+			encoded_length = 1;
+			in_pos += 1;
+		}
+
+		if ((out_max - out_pos) < encoded_length) {
+			result = ERROR_TRUNCATED;
+			break;
+		}
+
+		memcpy(dst + out_pos, encoded, encoded_length);
+		out_pos += encoded_length;
+	}
+
+	dst[out_pos] = '\0';
+	if (out_length)
+		*out_length = out_pos;
+
+	return result;
+}
+
+// decodes one UTF-8 sequence. returns the number of bytes consumed (always at least 1) and sets out_codepoint to the
+// decoded code point, or to 0 for malformed sequences (overlong forms, surrogates and truncated sequences included)
+static size_t decode_utf8(const uint8_t *src, size_t src_length, uint32_t *out_codepoint) {
+	uint8_t c = src[0];
+	size_t length;
+	uint32_t codepoint, min_codepoint;
+
+	if (c < 0x80) {
+		*out_codepoint = c;
+		return 1;
+	} else if ((c & 0xe0) == 0xc0) {
+		length = 2;
+		codepoint = c & 0x1f;
+		min_codepoint = 0x80;
+	} else if ((c & 0xf0) == 0xe0) {
+		length = 3;
+		codepoint = c & 0x0f;
+		min_codepoint = 0x800;
+	} else if ((c & 0xf8) == 0xf0) {
+		length = 4;
+		codepoint = c & 0x07;
+		min_codepoint = 0x10000;
+	} else {
+		*out_codepoint = 0;
+		return 1;
+	}
+
+	if (length > src_length) {
+		*out_codepoint = 0;
+		return 1;
+	}
+	for (size_t i = 1; i < length; ++i) {
+		if ((src[i] & 0xc0) != 0x80) {
+			*out_codepoint = 0;
+			return i;
+		}
+		codepoint = (codepoint << 6) | (src[i] & 0x3f);
+	}
+
+	if (codepoint < min_codepoint || codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint <= 0xdfff))
+		*out_codepoint = 0;
+	else
+		*out_codepoint = codepoint;
+
+	return length;
+}
+
+// returns the Shift-JIS encoding of the given code point (1 or 2 bytes, a value > 0xff means 2 bytes), or 0 if there
+// is no mapping for it
+static uint16_t unicode_to_sjis_char(uint32_t codepoint) {
+	if (codepoint < 0x80)
+		return (uint16_t)codepoint;
+	if (codepoint >= 0xff61 && codepoint <= 0xff9f)
+		return (uint16_t)(0xa1 + (codepoint - 0xff61));
+	if (codepoint > 0xffff)
+		return 0;
+
+	uint8_t page = unicode_page_index[codepoint >> 8];
+	if (!page)
+		return 0;
+
+	return unicode_to_sjis[page - 1][codepoint & 0xff];
+}
+
+/*
+ * Converts a UTF-8 string to Shift-JIS without allocating any memory. Same semantics as sjis_to_utf8 with regards to
+ * src_length, null termination and truncation. The Shift-JIS output is never longer than the UTF-8 input, so a dst
+ * buffer of (src_length + 1) bytes is always large enough.
+ *
+ * Any characters that cannot be mapped (or malformed UTF-8 sequences) are replaced with '?'.
+ */
+int utf8_to_sjis(const char *src, size_t src_length, char *dst, size_t dst_size, size_t *out_length) {
+	if (!src || !dst || dst_size == 0)
 		return ERROR_INVALID_PARAMS;
 
-	iconv_t conv;
-	size_t in_size, out_size;
+	const uint8_t *in = (const uint8_t*)src;
+	size_t in_pos = 0;
+	size_t out_pos = 0;
+	size_t out_max = dst_size - 1;  // leave room for the null terminator
+	int result = SUCCESS;
+
+	while (in_pos < src_length) {
+		size_t ascii_run = copy_ascii_run(in + in_pos, src_length - in_pos, dst + out_pos, out_max - out_pos);
+		in_pos += ascii_run;
+		out_pos += ascii_run;
+		if (in_pos >= src_length)
+			break;
+
+		if (in[in_pos] == 0)
+			break;
+
+		uint32_t codepoint;
+		size_t consumed = decode_utf8(in + in_pos, src_length - in_pos, &codepoint);
+		uint16_t sjis = codepoint ? unicode_to_sjis_char(codepoint) : 0;
+		if (!sjis)
+			sjis = INVALID_CHAR_REPLACEMENT;
 
-	char *outbuf = malloc(length);
+		size_t encoded_length = (sjis > 0xff) ? 2 : 1;
+		if ((out_max - out_pos) < encoded_length) {
+			result = ERROR_TRUNCATED;
+			break;
+		}
 
-	in_size = length;
-	out_size = length;
-	char *in = s;
-	char *out = outbuf;
-	conv = iconv_open("SHIFT_JIS", "UTF-8");
-	iconv(conv, &in, &in_size, &out, &out_size);
-	iconv_close(conv);
+		if (encoded_length == 2)
+			dst[out_pos++] = (char)(sjis >> 8);
+		dst[out_pos++] = (char)(sjis & 0xff);
+		in_pos += consumed;
+	}
 
-	memset(s, 0, length);
-	memcpy(s, outbuf, length);
-	free(outbuf);
+	dst[out_pos] = '\0';
+	if (out_length)
+		*out_length = out_pos;
 
-	return SUCCESS;
+	return result;
 }
@@ -2,10 +2,15 @@
 #define TEXTCONV_H_INCLUDED
 
 #include <stdio.h>
-#include <iconv.h>
 
 #include "retvals.h"
 
-int sjis_to_utf8(char *s, size_t length);
+// worst-case size of a buffer needed to hold the UTF-8 conversion of a Shift-JIS string of the given length (including
+// the null terminator). double-byte Shift-JIS characters become 3 bytes of UTF-8, but so do single-byte half-width
+// katakana characters, so 3 bytes per source byte is the upper bound.
+#define SJIS_TO_UTF8_MAX_SIZE(sjis_length)  (((sjis_length) * 3) + 1)
+
+int sjis_to_utf8(const char *src, size_t src_length, char *dst, size_t dst_size, size_t *out_length);
+int utf8_to_sjis(const char *src, size_t src_length, char *dst, size_t dst_size, size_t *out_length);
 
 #endif
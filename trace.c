@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "retvals.h"
+#include "stats.h"
+#include "trace.h"
+
+typedef struct TRACE_BUFFER {
+	TRACE_EVENT events[TRACE_RING_SIZE];
+	uint64_t head;                 // total number of events ever recorded into this buffer
+	int tid;
+	char thread_name[TRACE_THREAD_NAME_LENGTH];
+	struct TRACE_BUFFER *next;
+} TRACE_BUFFER;
+
+static bool enabled = false;
+static char *trace_filename = NULL;
+static uint64_t trace_start_time = 0;
+static int next_tid = 1;
+static TRACE_BUFFER *buffers = NULL;
+static __thread TRACE_BUFFER *thread_buffer = NULL;
+
+static TRACE_BUFFER* get_thread_buffer(void) {
+	if (thread_buffer)
+		return thread_buffer;
+
+	TRACE_BUFFER *buffer = calloc(1, sizeof(TRACE_BUFFER));
+	if (!buffer)
+		return NULL;
+
+	buffer->tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+	snprintf(buffer->thread_name, sizeof(buffer->thread_name), "thread %d", buffer->tid);
+
+	// push onto the list of all buffers so trace_finish() can find it later
+	buffer->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&buffers, &buffer->next, buffer, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	thread_buffer = buffer;
+	return buffer;
+}
+
+static void record_event(const char *name, const char *category, const char *arg, uint64_t start, uint64_t end) {
+	TRACE_BUFFER *buffer = get_thread_buffer();
+	if (!buffer)
+		return;
+
+	TRACE_EVENT *event = &buffer->events[buffer->head % TRACE_RING_SIZE];
+	event->name = name;
+	event->category = category;
+	event->arg = arg;
+	event->start = start;
+	event->end = end;
+	__atomic_store_n(&buffer->head, buffer->head + 1, __ATOMIC_RELEASE);
+}
+
+static void stats_span(int stage, uint64_t start, uint64_t end, uint64_t bytes) {
+	(void)bytes;
+	record_event(stats_get_stage_name(stage), "stage", NULL, start, end);
+}
+
+static void write_json_string(FILE *fp, const char *s) {
+	fputc('"', fp);
+	for (; *s; ++s) {
+		unsigned char c = (unsigned char)*s;
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+int trace_start(const char *filename) {
+	if (!filename)
+		return ERROR_INVALID_PARAMS;
+
+	// make sure the file can be written to now, instead of finding out only after everything else is done
+	FILE *fp = fopen(filename, "w");
+	if (!fp)
+		return ERROR_CREATING_FILE;
+	fclose(fp);
+
+	trace_filename = strdup(filename);
+	trace_start_time = stats_get_time();
+	enabled = true;
+	stats_set_span_callback(stats_span);
+
+	return SUCCESS;
+}
+
+bool trace_is_enabled(void) {
+	return enabled;
+}
+
+void trace_set_thread_name(const char *name) {
+	if (!enabled || !name)
+		return;
+
+	TRACE_BUFFER *buffer = get_thread_buffer();
+	if (buffer)
+		snprintf(buffer->thread_name, sizeof(buffer->thread_name), "%s", name);
+}
+
+uint64_t trace_begin(void) {
+	if (!enabled)
+		return 0;
+
+	return stats_get_time();
+}
+
+void trace_end(const char *name, const char *category, const char *arg, uint64_t start) {
+	if (!enabled)
+		return;
+
+	record_event(name, category, arg, start, stats_get_time());
+}
+
+int trace_finish(void) {
+	if (!enabled)
+		return SUCCESS;
+
+	enabled = false;
+	stats_set_span_callback(NULL);
+
+	FILE *fp = fopen(trace_filename, "w");
+	if (!fp)
+		return ERROR_CREATING_FILE;
+
+	int pid = (int)getpid();
+	bool first = true;
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	TRACE_BUFFER *buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE);
+	while (buffer) {
+		uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+		uint64_t first_event = (head > TRACE_RING_SIZE) ? (head - TRACE_RING_SIZE) : 0;
+
+		fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+		        first ? "" : ",\n", pid, buffer->tid);
+		write_json_string(fp, buffer->thread_name);
+		fprintf(fp, "}}");
+		first = false;
+
+		if (first_event)
+			fprintf(fp, ",\n{\"name\":\"dropped_events\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":0,\"args\":{\"count\":%llu}}",
+			        pid, buffer->tid, (unsigned long long)first_event);
+
+		for (uint64_t i = first_event; i < head; ++i) {
+			const TRACE_EVENT *event = &buffer->events[i % TRACE_RING_SIZE];
+			fprintf(fp, ",\n{\"name\":");
+			write_json_string(fp, event->name);
+			fprintf(fp, ",\"cat\":");
+			write_json_string(fp, event->category);
+			fprintf(fp, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+			        pid,
+			        buffer->tid,
+			        (event->start - trace_start_time) / 1000.0,
+			        (event->end - event->start) / 1000.0);
+			if (event->arg) {
+				fprintf(fp, ",\"args\":{\"file\":");
+				write_json_string(fp, event->arg);
+				fprintf(fp, "}");
+			}
+			fprintf(fp, "}");
+		}
+
+		buffer = buffer->next;
+	}
+
+	fprintf(fp, "\n]}\n");
+	int error = ferror(fp);
+	fclose(fp);
+
+	buffer = buffers;
+	while (buffer) {
+		TRACE_BUFFER *next = buffer->next;
+		free(buffer);
+		buffer = next;
+	}
+	buffers = NULL;
+	thread_buffer = NULL;
+	free(trace_filename);
+	trace_filename = NULL;
+
+	return error ? ERROR_IO : SUCCESS;
+}
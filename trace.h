@@ -0,0 +1,37 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Records timed spans from any number of threads and writes them out as a Chrome trace-event format JSON file, which
+ * can be loaded into chrome://tracing or https://ui.perfetto.dev to see what every thread was doing over time.
+ *
+ * Each thread records into its own fixed-size ring buffer, so recording a span never takes a lock or waits on another
+ * thread. If a thread records more than TRACE_RING_SIZE spans, its oldest spans are overwritten. All of the buffers
+ * are written out at the end by trace_finish(), which must only be called once all other threads have stopped.
+ *
+ * While tracing is enabled, every stage instrumented for stats (see stats.h) is also recorded as a span.
+ */
+
+#define TRACE_ARG                      "--trace"
+#define TRACE_RING_SIZE                16384
+#define TRACE_THREAD_NAME_LENGTH       32
+
+typedef struct {
+	const char *name;
+	const char *category;
+	const char *arg;               // optional, may be NULL. the string must stay valid until trace_finish()
+	uint64_t start;
+	uint64_t end;
+} TRACE_EVENT;
+
+int trace_start(const char *filename);
+bool trace_is_enabled(void);
+void trace_set_thread_name(const char *name);
+uint64_t trace_begin(void);
+void trace_end(const char *name, const char *category, const char *arg, uint64_t start);
+int trace_finish(void);
+
+#endif
@@ -3,9 +3,12 @@
 #include <stdint.h>
 #include <string.h>
 #include <malloc.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include "utils.h"
 #include "retvals.h"
+#include "stats.h"
 
 // from error codes defined in retvals.h
 static const char *error_messages[] = {
@@ -15,13 +18,23 @@ static const char *error_messages[] = {
 		"Cannot create file",          // ERROR_CREATING_FILE
 		"Bad data",                    // ERROR_BAD_DATA
 		"I/O error",                   // ERROR_IO
+		"Output truncated",            // ERROR_TRUNCATED
+		"Network error",               // ERROR_NETWORK
+		"Not found",                   // ERROR_NOT_FOUND
+		"Not enough space",            // ERROR_NO_SPACE
 		NULL
 };
 
 int read_file(const char *filename, uint8_t** out_file_data, uint32_t *out_file_size) {
+	return read_file_ex(filename, out_file_data, out_file_size, NULL);
+}
+
+int read_file_ex(const char *filename, uint8_t** out_file_data, uint32_t *out_file_size, ARENA *arena) {
 	if (!filename || !out_file_size || !out_file_data)
 		return ERROR_INVALID_PARAMS;
 
+	uint64_t start = stats_start();
+
 	FILE *fp = fopen(filename, "rb");
 	if (!fp)
 		return ERROR_FILE_NOT_FOUND;
@@ -30,7 +43,11 @@ int read_file(const char *filename, uint8_t** out_file_data, uint32_t *out_file_
 	*out_file_size = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
 
-	uint8_t *result = malloc(*out_file_size);
+	uint8_t *result = arena_alloc(arena, *out_file_size);
+	if (!result) {
+		fclose(fp);
+		return ERROR_IO;
+	}
 
 	uint32_t read, next;
 	uint8_t buffer[1024];
@@ -45,6 +62,9 @@ int read_file(const char *filename, uint8_t** out_file_data, uint32_t *out_file_
 		}
 	} while (read);
 
+	fclose(fp);
+	stats_end(STATS_READ, start, next);
+
 	*out_file_data = result;
 	return SUCCESS;
 }
@@ -53,6 +73,8 @@ int write_file(const char *filename, const void *data, size_t size) {
 	if (!filename || !data || size == 0)
 		return ERROR_INVALID_PARAMS;
 
+	uint64_t start = stats_start();
+
 	FILE *fp = fopen(filename, "wb");
 	if (!fp)
 		return ERROR_CREATING_FILE;
@@ -64,6 +86,7 @@ int write_file(const char *filename, const void *data, size_t size) {
 	}
 
 	fclose(fp);
+	stats_end(STATS_WRITE, start, size);
 	return SUCCESS;
 }
 
@@ -82,6 +105,17 @@ int get_filesize(const char *filename, size_t *out_size) {
 	return SUCCESS;
 }
 
+// creates the given directory (but not any missing parent directories). it already existing is not an error
+int create_directory(const char *path) {
+	if (!path)
+		return ERROR_INVALID_PARAMS;
+
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return ERROR_CREATING_FILE;
+
+	return SUCCESS;
+}
+
 const char* path_to_filename(const char *path) {
 	const char *pos = strrchr(path, '/');
 	if (pos) {
@@ -5,10 +5,13 @@
 #include <stdbool.h>
 
 #include "retvals.h"
+#include "arena.h"
 
 int read_file(const char *filename, uint8_t** out_file_data, uint32_t *out_file_size);
+int read_file_ex(const char *filename, uint8_t** out_file_data, uint32_t *out_file_size, ARENA *arena);
 int write_file(const char *filename, const void *data, size_t size);
 int get_filesize(const char *filename, size_t *out_size);
+int create_directory(const char *path);
 const char* path_to_filename(const char *path);
 char* append_string(const char *a, const char *b);
 bool string_ends_with(const char *s, const char *suffix);